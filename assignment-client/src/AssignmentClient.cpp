@@ -9,6 +9,7 @@
 //  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
 //
 
+#include <QtCore/QDataStream>
 #include <QtCore/QProcess>
 #include <QtCore/QThread>
 #include <QtCore/QTimer>
@@ -20,6 +21,7 @@
 #include <PacketHeaders.h>
 #include <SharedUtil.h>
 
+#include "AssignmentClientMonitor.h"
 #include "AssignmentFactory.h"
 #include "AssignmentThread.h"
 
@@ -32,7 +34,10 @@ int hifiSockAddrMeta = qRegisterMetaType<HifiSockAddr>("HifiSockAddr");
 
 AssignmentClient::AssignmentClient(int &argc, char **argv) :
     QCoreApplication(argc, argv),
-    _currentAssignment()
+    _currentAssignment(),
+    _isStandby(false),
+    _monitorSocket(NULL),
+    _monitorChildID(0)
 {
     setOrganizationName("High Fidelity");
     setOrganizationDomain("highfidelity.io");
@@ -93,8 +98,27 @@ AssignmentClient::AssignmentClient(int &argc, char **argv) :
         nodeList->setAssignmentServerSocket(customAssignmentSocket);
     }
     
+    // if we were forked by a monitor, connect back to it so that it can tell us when to take over for a dead sibling
+    const char* monitorServerName = getCmdOption(argc, (const char**) argv, MONITOR_SERVER_PARAMETER);
+    const char* monitorChildIDString = getCmdOption(argc, (const char**) argv, MONITOR_CHILD_ID_PARAMETER);
+    
+    if (monitorServerName && monitorChildIDString) {
+        _isStandby = cmdOptionExists(argc, (const char**) argv, STANDBY_PARAMETER);
+        _monitorChildID = atoi(monitorChildIDString);
+        
+        _monitorSocket = new QLocalSocket(this);
+        connect(_monitorSocket, &QLocalSocket::connected, this, &AssignmentClient::sendReadyToMonitor);
+        connect(_monitorSocket, &QLocalSocket::readyRead, this, &AssignmentClient::readMonitorMessages);
+        connect(_monitorSocket, &QLocalSocket::disconnected, this, &AssignmentClient::monitorDisconnected);
+        _monitorSocket->connectToServer(monitorServerName);
+    }
+    
     // call a timer function every ASSIGNMENT_REQUEST_INTERVAL_MSECS to ask for assignment, if required
-    qDebug() << "Waiting for assignment -" << _requestAssignment;
+    if (_isStandby) {
+        qDebug() << "Standing by until activated, then waiting for assignment -" << _requestAssignment;
+    } else {
+        qDebug() << "Waiting for assignment -" << _requestAssignment;
+    }
     
     QTimer* timer = new QTimer(this);
     connect(timer, SIGNAL(timeout()), SLOT(sendAssignmentRequest()));
@@ -109,7 +133,7 @@ AssignmentClient::AssignmentClient(int &argc, char **argv) :
 }
 
 void AssignmentClient::sendAssignmentRequest() {
-    if (!_currentAssignment) {
+    if (!_currentAssignment && !_isStandby) {
         NodeList::getInstance()->sendAssignment(_requestAssignment);
     }
 }
@@ -133,6 +157,14 @@ void AssignmentClient::readPendingDatagrams() {
                 if (_currentAssignment) {
                     qDebug() << "Received an assignment -" << *_currentAssignment;
                     
+                    if (_monitorSocket) {
+                        // let the monitor know, it measures how long it took to replace a dead sibling
+                        QByteArray startedMessage;
+                        QDataStream startedStream(&startedMessage, QIODevice::WriteOnly);
+                        startedStream << MonitorMessageType::AssignmentStarted << (quint8) _currentAssignment->getType();
+                        sendMessageToMonitor(startedMessage);
+                    }
+                    
                     // switch our nodelist domain IP and port to whoever sent us the assignment
                     
                     nodeList->getDomainInfo().setSockAddr(senderSockAddr);
@@ -196,6 +228,48 @@ void AssignmentClient::handleAuthenticationRequest() {
     }
 }
 
+void AssignmentClient::sendMessageToMonitor(const QByteArray& message) {
+    if (_monitorSocket->state() == QLocalSocket::ConnectedState) {
+        _monitorSocket->write(frameMonitorMessage(message));
+        _monitorSocket->flush();
+    }
+}
+
+void AssignmentClient::sendReadyToMonitor() {
+    QByteArray readyMessage;
+    QDataStream readyStream(&readyMessage, QIODevice::WriteOnly);
+    readyStream << MonitorMessageType::ChildReady << _monitorChildID;
+    sendMessageToMonitor(readyMessage);
+}
+
+void AssignmentClient::readMonitorMessages() {
+    _monitorMessageBuffer.append(_monitorSocket->readAll());
+    
+    // a message may arrive in pieces, so only handle the ones that are there in full
+    QByteArray message;
+    while (takeMonitorMessage(_monitorMessageBuffer, message)) {
+        QDataStream messageStream(message);
+        MonitorMessageType_t messageType;
+        messageStream >> messageType;
+        
+        if (messageType == MonitorMessageType::Activate && _isStandby) {
+            qDebug() << "Activated by the monitor - waiting for assignment -" << _requestAssignment;
+            _isStandby = false;
+            
+            // we're replacing a sibling, don't wait for the request timer
+            sendAssignmentRequest();
+        }
+    }
+}
+
+void AssignmentClient::monitorDisconnected() {
+    if (_isStandby) {
+        // nobody is left to activate us
+        qDebug("Lost the connection to the monitor while standing by - quitting.");
+        quit();
+    }
+}
+
 void AssignmentClient::assignmentCompleted() {
     // reset the logging target to the the CHILD_TARGET_NAME
     Logging::setTargetName(ASSIGNMENT_CLIENT_TARGET_NAME);
@@ -13,6 +13,7 @@
 #define hifi_AssignmentClient_h
 
 #include <QtCore/QCoreApplication>
+#include <QtNetwork/QLocalSocket>
 
 #include "ThreadedAssignment.h"
 
@@ -25,9 +26,21 @@ private slots:
     void readPendingDatagrams();
     void assignmentCompleted();
     void handleAuthenticationRequest();
+    
+    void sendReadyToMonitor();
+    void readMonitorMessages();
+    void monitorDisconnected();
 private:
+    void sendMessageToMonitor(const QByteArray& message);
+    
     Assignment _requestAssignment;
     SharedAssignmentPointer _currentAssignment;
+    
+    /// a standby client is fully started but doesn't ask for an assignment until its monitor activates it
+    bool _isStandby;
+    QLocalSocket* _monitorSocket;
+    QByteArray _monitorMessageBuffer;
+    quint32 _monitorChildID;
 };
 
 #endif // hifi_AssignmentClient_h
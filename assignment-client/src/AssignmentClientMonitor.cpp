@@ -9,16 +9,57 @@
 //  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
 //
 
+#include <QtCore/QDataStream>
+
 #include <Logging.h>
+#include <SharedUtil.h>
 
 #include "AssignmentClientMonitor.h"
 
 const char* NUM_FORKS_PARAMETER = "-n";
+const char* NUM_STANDBY_FORKS_PARAMETER = "--standbyForks";
+
+const char* MONITOR_SERVER_PARAMETER = "--monitor";
+const char* MONITOR_CHILD_ID_PARAMETER = "--childID";
+const char* STANDBY_PARAMETER = "--standby";
 
 const QString ASSIGNMENT_CLIENT_MONITOR_TARGET_NAME = "assignment-client-monitor";
 
+const int DEFAULT_NUM_STANDBY_FORKS = 1;
+
+const char CHILD_ID_PROPERTY[] = "childID";
+
+QByteArray frameMonitorMessage(const QByteArray& message) {
+    QByteArray framedMessage;
+    QDataStream framedStream(&framedMessage, QIODevice::WriteOnly);
+    framedStream << (quint16)message.size();
+    framedMessage.append(message);
+    return framedMessage;
+}
+
+bool takeMonitorMessage(QByteArray& buffer, QByteArray& message) {
+    const int LENGTH_BYTES = sizeof(quint16);
+    if (buffer.size() < LENGTH_BYTES) {
+        return false;
+    }
+    quint16 length;
+    QDataStream lengthStream(buffer);
+    lengthStream >> length;
+    if (buffer.size() < LENGTH_BYTES + length) {
+        return false;
+    }
+    message = buffer.mid(LENGTH_BYTES, length);
+    buffer.remove(0, LENGTH_BYTES + length);
+    return true;
+}
+
 AssignmentClientMonitor::AssignmentClientMonitor(int &argc, char **argv, int numAssignmentClientForks) :
-    QCoreApplication(argc, argv)
+    QCoreApplication(argc, argv),
+    _childServer(this),
+    _children(),
+    _nextChildID(0),
+    _numStandbyChildren(DEFAULT_NUM_STANDBY_FORKS),
+    _pendingReplacements()
 {
     // start the Logging class with the parent's target name
     Logging::setTargetName(ASSIGNMENT_CLIENT_MONITOR_TARGET_NAME);
@@ -32,28 +73,180 @@ AssignmentClientMonitor::AssignmentClientMonitor(int &argc, char **argv, int num
     _childArguments.removeAt(forksParameterIndex);
     _childArguments.removeAt(forksParameterIndex);
     
+    // same for the number of warm standby children to keep
+    int standbyForksParameterIndex = _childArguments.indexOf(NUM_STANDBY_FORKS_PARAMETER);
+    if (standbyForksParameterIndex != -1) {
+        _numStandbyChildren = _childArguments.value(standbyForksParameterIndex + 1).toInt();
+        
+        _childArguments.removeAt(standbyForksParameterIndex);
+        _childArguments.removeAt(standbyForksParameterIndex);
+    }
+    
+    // our children connect back to us so that we can tell standby children when to take over
+    QString serverName = QString("%1-%2").arg(ASSIGNMENT_CLIENT_MONITOR_TARGET_NAME).arg(applicationPid());
+    QLocalServer::removeServer(serverName);
+    
+    if (_childServer.listen(serverName)) {
+        connect(&_childServer, &QLocalServer::newConnection, this, &AssignmentClientMonitor::childConnected);
+    } else {
+        qDebug() << "Could not listen for child assignment clients -" << _childServer.errorString()
+            << "- dead children will be replaced from a cold start.";
+        _numStandbyChildren = 0;
+    }
+    
     // use QProcess to fork off a process for each of the child assignment clients
     for (int i = 0; i < numAssignmentClientForks; i++) {
-        spawnChildClient();
+        spawnChildClient(false);
+    }
+    
+    for (int i = 0; i < _numStandbyChildren; i++) {
+        spawnChildClient(true);
     }
 }
 
-void AssignmentClientMonitor::spawnChildClient() {
+quint32 AssignmentClientMonitor::spawnChildClient(bool isStandby, quint64 replacingSince) {
+    quint32 childID = _nextChildID++;
+    
+    QStringList arguments = _childArguments;
+    if (_childServer.isListening()) {
+        arguments << MONITOR_SERVER_PARAMETER << _childServer.serverName()
+            << MONITOR_CHILD_ID_PARAMETER << QString::number(childID);
+    }
+    if (isStandby) {
+        arguments << STANDBY_PARAMETER;
+    }
+    
     QProcess *assignmentClient = new QProcess(this);
+    assignmentClient->setProperty(CHILD_ID_PROPERTY, childID);
     
     // make sure that the output from the child process appears in our output
     assignmentClient->setProcessChannelMode(QProcess::ForwardedChannels);
     
-    assignmentClient->start(applicationFilePath(), _childArguments);
+    assignmentClient->start(applicationFilePath(), arguments);
     
     // link the child processes' finished slot to our childProcessFinished slot
     connect(assignmentClient, SIGNAL(finished(int, QProcess::ExitStatus)), this,
             SLOT(childProcessFinished(int, QProcess::ExitStatus)));
     
-    qDebug() << "Spawned a child client with PID" << assignmentClient->pid();
+    MonitoredChild& child = _children[childID];
+    child.process = assignmentClient;
+    child.isStandby = isStandby;
+    child.replacingSince = replacingSince;
+    child.activatedAt = replacingSince;
+    
+    qDebug() << "Spawned" << (isStandby ? "a standby" : "a") << "child client with PID" << assignmentClient->pid();
+    
+    return childID;
 }
 
 void AssignmentClientMonitor::childProcessFinished(int exitCode, QProcess::ExitStatus exitStatus) {
-    qDebug("Replacing dead child assignment client with a new one");
-    spawnChildClient();
+    quint64 now = usecTimestampNow();
+    
+    QProcess* finishedProcess = static_cast<QProcess*>(sender());
+    MonitoredChild deadChild = _children.take(finishedProcess->property(CHILD_ID_PROPERTY).toUInt());
+    finishedProcess->deleteLater();
+    
+    if (deadChild.socket) {
+        _childMessageBuffers.remove(deadChild.socket);
+        deadChild.socket->deleteLater();
+    }
+    
+    if (deadChild.isStandby) {
+        qDebug("Replacing dead standby child assignment client with a new one");
+        spawnChildClient(true);
+        return;
+    }
+    
+    if (_numStandbyChildren == 0) {
+        qDebug("Replacing dead child assignment client with a new one");
+        spawnChildClient(false, now);
+        return;
+    }
+    
+    if (!activateStandbyChild(now)) {
+        // the standby children are still starting up, the first one to connect back will take over
+        qDebug("No warm standby child is ready yet - the next one to start up will take over");
+        _pendingReplacements.enqueue(now);
+    }
+    
+    // keep the pool of standby children topped up
+    spawnChildClient(true);
+}
+
+bool AssignmentClientMonitor::activateStandbyChild(quint64 replacingSince) {
+    for (QHash<quint32, MonitoredChild>::iterator it = _children.begin(); it != _children.end(); it++) {
+        if (it.value().isStandby && it.value().socket) {
+            sendActivation(it.key(), it.value(), replacingSince);
+            return true;
+        }
+    }
+    return false;
+}
+
+void AssignmentClientMonitor::sendActivation(quint32 childID, MonitoredChild& child, quint64 replacingSince) {
+    child.isStandby = false;
+    child.replacingSince = replacingSince;
+    child.activatedAt = usecTimestampNow();
+    
+    QByteArray message;
+    QDataStream messageStream(&message, QIODevice::WriteOnly);
+    messageStream << MonitorMessageType::Activate;
+    child.socket->write(frameMonitorMessage(message));
+    child.socket->flush();
+    
+    qDebug() << "Activated warm standby child" << childID << "with PID" << child.process->pid() << "-"
+        << (child.activatedAt - replacingSince) / USECS_PER_MSEC << "ms after its predecessor died";
+}
+
+void AssignmentClientMonitor::childConnected() {
+    while (_childServer.hasPendingConnections()) {
+        QLocalSocket* childSocket = _childServer.nextPendingConnection();
+        connect(childSocket, &QLocalSocket::readyRead, this, &AssignmentClientMonitor::readChildMessages);
+    }
+}
+
+void AssignmentClientMonitor::readChildMessages() {
+    QLocalSocket* childSocket = static_cast<QLocalSocket*>(sender());
+    QByteArray& buffer = _childMessageBuffers[childSocket];
+    buffer.append(childSocket->readAll());
+    
+    // a message may arrive in pieces, so only handle the ones that are there in full
+    QByteArray message;
+    while (takeMonitorMessage(buffer, message)) {
+        QDataStream messageStream(message);
+        MonitorMessageType_t messageType;
+        messageStream >> messageType;
+        
+        if (messageType == MonitorMessageType::ChildReady) {
+            quint32 childID;
+            messageStream >> childID;
+            
+            QHash<quint32, MonitoredChild>::iterator it = _children.find(childID);
+            if (it == _children.end()) {
+                continue;
+            }
+            childSocket->setProperty(CHILD_ID_PROPERTY, childID);
+            it.value().socket = childSocket;
+            
+            if (it.value().isStandby && !_pendingReplacements.isEmpty()) {
+                sendActivation(childID, it.value(), _pendingReplacements.dequeue());
+            }
+        } else if (messageType == MonitorMessageType::AssignmentStarted) {
+            quint8 assignmentType;
+            messageStream >> assignmentType;
+            
+            quint32 childID = childSocket->property(CHILD_ID_PROPERTY).toUInt();
+            QHash<quint32, MonitoredChild>::iterator it = _children.find(childID);
+            if (it == _children.end() || it.value().replacingSince == 0) {
+                continue;
+            }
+            
+            quint64 now = usecTimestampNow();
+            qDebug() << "Child" << childID << "took over with assignment type" << assignmentType << "- time to recover"
+                << (now - it.value().replacingSince) / USECS_PER_MSEC << "ms,"
+                << (now - it.value().activatedAt) / USECS_PER_MSEC << "ms of which after activation";
+            
+            it.value().replacingSince = 0;
+        }
+    }
 }
@@ -13,22 +13,79 @@
 #define hifi_AssignmentClientMonitor_h
 
 #include <QtCore/QCoreApplication>
+#include <QtCore/QHash>
 #include <QtCore/QProcess>
+#include <QtCore/QQueue>
+#include <QtNetwork/QLocalServer>
+#include <QtNetwork/QLocalSocket>
 
 #include <Assignment.h>
 
 extern const char* NUM_FORKS_PARAMETER;
+extern const char* NUM_STANDBY_FORKS_PARAMETER;
 
+/// passed to the children the monitor forks, followed by the name of the monitor's local server and the child's ID
+extern const char* MONITOR_SERVER_PARAMETER;
+extern const char* MONITOR_CHILD_ID_PARAMETER;
+/// passed to the children that should initialize and then wait to be activated
+extern const char* STANDBY_PARAMETER;
+
+/// Messages exchanged between the monitor and its children over the monitor's local server
+typedef quint8 MonitorMessageType_t;
+namespace MonitorMessageType {
+    const MonitorMessageType_t ChildReady = 0; // child to monitor, followed by the quint32 child ID
+    const MonitorMessageType_t Activate = 1; // monitor to a standby child, start requesting assignments
+    const MonitorMessageType_t AssignmentStarted = 2; // child to monitor, followed by the quint8 assignment type
+}
+
+/// Prefixes a message with its length so that the reader can tell where it ends, however the socket splits it up.
+QByteArray frameMonitorMessage(const QByteArray& message);
+
+/// Takes the next whole message off the front of the bytes read so far.
+/// eturn false if the rest of the message hasn't arrived yet
+bool takeMonitorMessage(QByteArray& buffer, QByteArray& message);
+
+class MonitoredChild {
+public:
+    MonitoredChild() : process(NULL), socket(NULL), isStandby(false), replacingSince(0), activatedAt(0) { }
+    
+    QProcess* process;
+    QLocalSocket* socket;
+    bool isStandby;
+    
+    /// when the child this one took over for died, zero if it isn't a replacement
+    quint64 replacingSince;
+    quint64 activatedAt;
+};
+
+/// Forks and watches a set of assignment clients. It also keeps warm standby children that have already started up
+/// and only need to be told to request an assignment when one of the active children dies.
 class AssignmentClientMonitor : public QCoreApplication {
     Q_OBJECT
 public:
     AssignmentClientMonitor(int &argc, char **argv, int numAssignmentClientForks);
 private slots:
     void childProcessFinished(int exitCode, QProcess::ExitStatus exitStatus);
+    void childConnected();
+    void readChildMessages();
 private:
-    void spawnChildClient();
+    quint32 spawnChildClient(bool isStandby, quint64 replacingSince = 0);
+    
+    /// Hands an assignment slot to a ready standby child.
+    /// \return false if no standby child has connected back yet
+    bool activateStandbyChild(quint64 replacingSince);
+    void sendActivation(quint32 childID, MonitoredChild& child, quint64 replacingSince);
     
     QStringList _childArguments;
+    QLocalServer _childServer;
+    
+    QHash<quint32, MonitoredChild> _children;
+    QHash<QLocalSocket*, QByteArray> _childMessageBuffers;
+    quint32 _nextChildID;
+    int _numStandbyChildren;
+    
+    /// times at which active children died while there was no ready standby to replace them
+    QQueue<quint64> _pendingReplacements;
 };
 
 #endif // hifi_AssignmentClientMonitor_h
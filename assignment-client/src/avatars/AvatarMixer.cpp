@@ -33,6 +33,7 @@ AvatarMixer::AvatarMixer(const QByteArray& packet) :
     ThreadedAssignment(packet),
     _broadcastThread(),
     _lastFrameTimestamp(QDateTime::currentMSecsSinceEpoch()),
+    _broadcastFrame(0),
     _trailingSleepRatio(1.0f),
     _performanceThrottlingRatio(0.0f),
     _sumListeners(0),
@@ -113,14 +114,23 @@ void AvatarMixer::broadcastAvatarData() {
         ++framesSinceCutoffEvent;
     }
     
-    static QByteArray mixedAvatarByteArray;
+    NodeList* nodeList = NodeList::getInstance();
     
-    int numPacketHeaderBytes = populatePacketHeader(mixedAvatarByteArray, PacketTypeBulkAvatarData);
+    // serialize each avatar once for the frame, so that the recipient loop only copies
+    ++_broadcastFrame;
+    foreach (const SharedNodePointer& node, nodeList->getNodeHash()) {
+        AvatarMixerClientData* nodeData = reinterpret_cast<AvatarMixerClientData*>(node->getLinkedData());
+        if (nodeData && nodeData->getMutex().tryLock()) {
+            nodeData->prepareBroadcast(node->getUUID(), _broadcastFrame);
+            nodeData->getMutex().unlock();
+        }
+    }
     
-    NodeList* nodeList = NodeList::getInstance();
+    QByteArray mixedAvatarByteArray = nodeList->getPacketBufferPool().acquire();
+    
+    int numPacketHeaderBytes = populatePacketHeader(mixedAvatarByteArray, PacketTypeBulkAvatarData);
     
     AvatarMixerClientData* nodeData = NULL;
-    AvatarMixerClientData* otherNodeData = NULL;
     
     foreach (const SharedNodePointer& node, nodeList->getNodeHash()) {
         if (node->getLinkedData() && node->getType() == NodeType::Agent && node->getActiveSocket()
@@ -130,20 +140,18 @@ void AvatarMixer::broadcastAvatarData() {
             // reset packet pointers for this node
             mixedAvatarByteArray.resize(numPacketHeaderBytes);
             
-            AvatarData& avatar = nodeData->getAvatar();
-            glm::vec3 myPosition = avatar.getPosition();
+            glm::vec3 myPosition = nodeData->getAvatar().getPosition();
             
             // this is an AGENT we have received head data from
             // send back a packet with other active node data to this node
             foreach (const SharedNodePointer& otherNode, nodeList->getNodeHash()) {
-                if (otherNode->getLinkedData() && otherNode->getUUID() != node->getUUID()
-                    && (otherNodeData = reinterpret_cast<AvatarMixerClientData*>(otherNode->getLinkedData()))->getMutex().tryLock()) {
+                AvatarMixerClientData* otherNodeData = reinterpret_cast<AvatarMixerClientData*>(otherNode->getLinkedData());
+                
+                // only the avatars serialized for this frame are sent; their broadcast state is ours to read
+                if (otherNodeData && otherNode->getUUID() != node->getUUID()
+                    && otherNodeData->getBroadcastFrame() == _broadcastFrame) {
                     
-                    AvatarMixerClientData* otherNodeData = reinterpret_cast<AvatarMixerClientData*>(otherNode->getLinkedData());
-                    AvatarData& otherAvatar = otherNodeData->getAvatar();
-                    glm::vec3 otherPosition = otherAvatar.getPosition();
-            
-                    float distanceToAvatar = glm::length(myPosition - otherPosition);
+                    float distanceToAvatar = glm::length(myPosition - otherNodeData->getBroadcastPosition());
                     //  The full rate distance is the distance at which EVERY update will be sent for this avatar
                     //  at a distance of twice the full rate distance, there will be a 50% chance of sending this avatar's update
                     const float FULL_RATE_DISTANCE = 2.f;
@@ -151,12 +159,10 @@ void AvatarMixer::broadcastAvatarData() {
                     //  Decide whether to send this avatar's data based on it's distance from us
                     if ((_performanceThrottlingRatio == 0 || randFloat() < (1.0f - _performanceThrottlingRatio))
                         && (distanceToAvatar == 0.f || randFloat() < FULL_RATE_DISTANCE / distanceToAvatar)) {
-                        QByteArray avatarByteArray;
-                        avatarByteArray.append(otherNode->getUUID().toRfc4122());
-                        avatarByteArray.append(otherAvatar.toByteArray());
+                        const QByteArray& avatarByteArray = otherNodeData->getBroadcastData();
                         
                         if (avatarByteArray.size() + mixedAvatarByteArray.size() > MAX_PACKET_SIZE) {
-                            nodeList->writeDatagram(mixedAvatarByteArray, node);
+                            nodeList->queueDatagram(mixedAvatarByteArray, node);
                             
                             // reset the packet
                             mixedAvatarByteArray.resize(numPacketHeaderBytes);
@@ -172,45 +178,38 @@ void AvatarMixer::broadcastAvatarData() {
                         // we will also force a send of billboard or identity packet
                         // if either has changed in the last frame
                         
-                        if (otherNodeData->getBillboardChangeTimestamp() > 0
+                        if (otherNodeData->getBroadcastBillboardTimestamp() > 0
                             && (forceSend
-                                || otherNodeData->getBillboardChangeTimestamp() > _lastFrameTimestamp
+                                || otherNodeData->getBroadcastBillboardTimestamp() > _lastFrameTimestamp
                                 || randFloat() < BILLBOARD_AND_IDENTITY_SEND_PROBABILITY)) {
-                            QByteArray billboardPacket = byteArrayWithPopulatedHeader(PacketTypeAvatarBillboard);
-                            billboardPacket.append(otherNode->getUUID().toRfc4122());
-                            billboardPacket.append(otherNodeData->getAvatar().getBillboard());
-                            nodeList->writeDatagram(billboardPacket, node);
+                            nodeList->queueDatagram(otherNodeData->getBillboardPacket(), node);
                             
                             ++_sumBillboardPackets;
                         }
                         
-                        if (otherNodeData->getIdentityChangeTimestamp() > 0
+                        if (otherNodeData->getBroadcastIdentityTimestamp() > 0
                             && (forceSend
-                                || otherNodeData->getIdentityChangeTimestamp() > _lastFrameTimestamp
+                                || otherNodeData->getBroadcastIdentityTimestamp() > _lastFrameTimestamp
                                 || randFloat() < BILLBOARD_AND_IDENTITY_SEND_PROBABILITY)) {
-                                
-                            QByteArray identityPacket = byteArrayWithPopulatedHeader(PacketTypeAvatarIdentity);
-                            
-                            QByteArray individualData = otherNodeData->getAvatar().identityByteArray();
-                            individualData.replace(0, NUM_BYTES_RFC4122_UUID, otherNode->getUUID().toRfc4122());
-                            identityPacket.append(individualData);
-                            
-                            nodeList->writeDatagram(identityPacket, node);
+                            nodeList->queueDatagram(otherNodeData->getIdentityPacket(), node);
                                 
                             ++_sumIdentityPackets;
                         }
                     }
-                
-                    otherNodeData->getMutex().unlock();
                 }
             }
             
-            nodeList->writeDatagram(mixedAvatarByteArray, node);
+            nodeList->queueDatagram(mixedAvatarByteArray, node);
             
             nodeData->getMutex().unlock();
         }
     }
     
+    nodeList->getPacketBufferPool().release(mixedAvatarByteArray);
+    
+    // send this frame's avatar data out together
+    nodeList->flushQueuedDatagrams();
+    
     _lastFrameTimestamp = QDateTime::currentMSecsSinceEpoch();
 }
 
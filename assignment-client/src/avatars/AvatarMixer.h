@@ -39,6 +39,7 @@ private:
     QThread _broadcastThread;
     
     quint64 _lastFrameTimestamp;
+    int _broadcastFrame;
     
     float _trailingSleepRatio;
     float _performanceThrottlingRatio;
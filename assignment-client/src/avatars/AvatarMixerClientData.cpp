@@ -9,13 +9,24 @@
 //  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
 //
 
+#include <PacketHeaders.h>
+#include <SharedUtil.h>
+#include <UUID.h>
+
 #include "AvatarMixerClientData.h"
 
 AvatarMixerClientData::AvatarMixerClientData() :
     NodeData(),
     _hasReceivedFirstPackets(false),
     _billboardChangeTimestamp(0),
-    _identityChangeTimestamp(0)
+    _identityChangeTimestamp(0),
+    _broadcastFrame(-1),
+    _broadcastPosition(),
+    _broadcastData(),
+    _billboardPacketTimestamp(0),
+    _billboardPacket(),
+    _identityPacketTimestamp(0),
+    _identityPacket()
 {
     
 }
@@ -31,3 +42,32 @@ bool AvatarMixerClientData::checkAndSetHasReceivedFirstPackets() {
     _hasReceivedFirstPackets = true;
     return oldValue;
 }
+
+void AvatarMixerClientData::prepareBroadcast(const QUuid& nodeUUID, int frame) {
+    _broadcastFrame = frame;
+    _broadcastPosition = _avatar.getPosition();
+    
+    // with the capacity reserved, resizing within it never reallocates
+    _broadcastData.reserve(MAX_PACKET_SIZE);
+    _broadcastData.resize(MAX_PACKET_SIZE);
+    char* broadcastBuffer = _broadcastData.data();
+    int numUUIDBytes = packRfc4122UUID(nodeUUID, broadcastBuffer);
+    _broadcastData.resize(numUUIDBytes + _avatar.toBuffer(reinterpret_cast<unsigned char*>(broadcastBuffer + numUUIDBytes)));
+    
+    // the billboard and identity only change once in a while, so their packets are rebuilt only when they do
+    if (_billboardChangeTimestamp != _billboardPacketTimestamp) {
+        _billboardPacketTimestamp = _billboardChangeTimestamp;
+        _billboardPacket = byteArrayWithPopulatedHeader(PacketTypeAvatarBillboard);
+        _billboardPacket.append(nodeUUID.toRfc4122());
+        _billboardPacket.append(_avatar.getBillboard());
+    }
+    
+    if (_identityChangeTimestamp != _identityPacketTimestamp) {
+        _identityPacketTimestamp = _identityChangeTimestamp;
+        _identityPacket = byteArrayWithPopulatedHeader(PacketTypeAvatarIdentity);
+        
+        QByteArray individualData = _avatar.identityByteArray();
+        individualData.replace(0, NUM_BYTES_RFC4122_UUID, nodeUUID.toRfc4122());
+        _identityPacket.append(individualData);
+    }
+}
@@ -13,6 +13,7 @@
 #define hifi_AvatarMixerClientData_h
 
 #include <QtCore/QUrl>
+#include <QtCore/QUuid>
 
 #include <AvatarData.h>
 #include <NodeData.h>
@@ -33,11 +34,34 @@ public:
     quint64 getIdentityChangeTimestamp() const { return _identityChangeTimestamp; }
     void setIdentityChangeTimestamp(quint64 identityChangeTimestamp) { _identityChangeTimestamp = identityChangeTimestamp; }
     
+    /// Serializes the avatar (prefixed with its node's UUID) for a frame of the mixer's broadcast, and rebuilds the billboard
+    /// and identity packets if they've changed since they were last built. The buffers are kept from frame to frame, so
+    /// this doesn't allocate in the steady state. Call with the mutex held; the broadcast getters can then be read without it.
+    void prepareBroadcast(const QUuid& nodeUUID, int frame);
+    
+    int getBroadcastFrame() const { return _broadcastFrame; }
+    const glm::vec3& getBroadcastPosition() const { return _broadcastPosition; }
+    const QByteArray& getBroadcastData() const { return _broadcastData; }
+    
+    quint64 getBroadcastBillboardTimestamp() const { return _billboardPacketTimestamp; }
+    const QByteArray& getBillboardPacket() const { return _billboardPacket; }
+    
+    quint64 getBroadcastIdentityTimestamp() const { return _identityPacketTimestamp; }
+    const QByteArray& getIdentityPacket() const { return _identityPacket; }
+    
 private:
     AvatarData _avatar;
     bool _hasReceivedFirstPackets;
     quint64 _billboardChangeTimestamp;
     quint64 _identityChangeTimestamp;
+    
+    int _broadcastFrame;
+    glm::vec3 _broadcastPosition;
+    QByteArray _broadcastData;
+    quint64 _billboardPacketTimestamp;
+    QByteArray _billboardPacket;
+    quint64 _identityPacketTimestamp;
+    QByteArray _identityPacket;
 };
 
 #endif // hifi_AvatarMixerClientData_h
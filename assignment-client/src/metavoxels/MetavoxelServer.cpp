@@ -10,25 +10,64 @@
 //
 
 #include <QDateTime>
+#include <QJsonObject>
+#include <QRunnable>
 
 #include <PacketHeaders.h>
+#include <SharedUtil.h>
 
 #include <MetavoxelMessages.h>
+#include <MetavoxelPersister.h>
 #include <MetavoxelUtil.h>
 
 #include "MetavoxelServer.h"
 
 const int SEND_INTERVAL = 50;
 
+// if the sequencer can't take this many bytes, we hold back the delta
+const int MIN_DELTA_BUDGET = 256;
+
+// each step of coarsening multiplies the client's level of detail threshold by this much
+const float LOD_COARSENING_STEP = 2.0f;
+const int MAX_LOD_COARSENING = 4;
+
+const int SNAPSHOT_INTERVAL = 60 * 1000;
+
 MetavoxelServer::MetavoxelServer(const QByteArray& packet) :
-    ThreadedAssignment(packet) {
+    ThreadedAssignment(packet),
+    _persister(NULL),
+    _statTicks(0),
+    _statSessionsEncoded(0),
+    _statTotalEncodeUsecs(0),
+    _statMaxEncodeUsecs(0),
+    _statTotalTickEncodeUsecs(0),
+    _statCacheHits(0),
+    _statCacheMisses(0),
+    _statDeltasHeld(0),
+    _statTotalLODCoarsening(0) {
     
     _sendTimer.setSingleShot(true);
     connect(&_sendTimer, SIGNAL(timeout()), SLOT(sendDeltas()));
+    
+    connect(&_snapshotTimer, SIGNAL(timeout()), SLOT(maybeSnapshot()));
 }
 
 void MetavoxelServer::applyEdit(const MetavoxelEditMessage& edit) {
-    edit.apply(_data, SharedObject::getWeakHash());
+    if (edit.visitsSpanners()) {
+        // a snapshot may be writing spanners that the edit touches; if so, the wait is part of the snapshot's pause
+        quint64 start = usecTimestampNow();
+        QMutexLocker locker(&Spanner::getVisitMutex());
+        if (_persister && _persister->isSnapshotPending()) {
+            _persister->addSnapshotPause(usecTimestampNow() - start);
+        }
+        edit.apply(_data, SharedObject::getWeakHash());
+        
+    } else {
+        edit.apply(_data, SharedObject::getWeakHash());
+    }
+    if (_persister) {
+        _persister->logEdit(edit);
+    }
 }
 
 const QString METAVOXEL_SERVER_LOGGING_NAME = "metavoxel-server";
@@ -41,6 +80,25 @@ void MetavoxelServer::run() {
     
     connect(nodeList, SIGNAL(nodeAdded(SharedNodePointer)), SLOT(maybeAttachSession(const SharedNodePointer&)));
     
+    // by default we persist; pass --NoPersist to disable, or --persistDirectory to choose where
+    QStringList arguments = QString(getPayload()).split(" ", QString::SkipEmptyParts);
+    if (!arguments.contains("--NoPersist")) {
+        QString directory = "resources/metavoxels";
+        int directoryIndex = arguments.indexOf("--persistDirectory");
+        if (directoryIndex != -1 && directoryIndex + 1 < arguments.size()) {
+            directory = arguments.at(directoryIndex + 1);
+        }
+        qDebug() << "Persisting metavoxels to" << directory;
+        
+        _persister = new MetavoxelPersister(directory, this);
+        if (_persister->load(_data)) {
+            qDebug() << "Loaded metavoxels in" << _persister->getLoadUsecs() / USECS_PER_MSEC << "ms";
+        }
+        // loaded spanners have new IDs, so start a log that refers to them by those
+        _persister->snapshot(_data);
+        _snapshotTimer.start(SNAPSHOT_INTERVAL);
+    }
+    
     _lastSend = QDateTime::currentMSecsSinceEpoch();
     _sendTimer.start(SEND_INTERVAL);
 }
@@ -73,13 +131,107 @@ void MetavoxelServer::maybeAttachSession(const SharedNodePointer& node) {
     }
 }
 
+void MetavoxelServer::sendStatsPacket() {
+    QJsonObject statsObject;
+    statsObject["sessions_encoded_per_tick"] = _statTicks == 0 ? 0.0f : (float)_statSessionsEncoded / _statTicks;
+    statsObject["average_session_encode_usecs"] = _statSessionsEncoded == 0 ? 0.0f :
+        (float)_statTotalEncodeUsecs / _statSessionsEncoded;
+    statsObject["max_session_encode_usecs"] = (float)_statMaxEncodeUsecs;
+    statsObject["average_tick_encode_usecs"] = _statTicks == 0 ? 0.0f : (float)_statTotalTickEncodeUsecs / _statTicks;
+    int cacheLookups = _statCacheHits + _statCacheMisses;
+    statsObject["delta_cache_hit_percentage"] = cacheLookups == 0 ? 0.0f : _statCacheHits * 100.0f / cacheLookups;
+    statsObject["held_delta_percentage"] = _statSessionsEncoded == 0 ? 0.0f :
+        _statDeltasHeld * 100.0f / _statSessionsEncoded;
+    statsObject["average_lod_coarsening"] = _statSessionsEncoded == 0 ? 0.0f :
+        (float)_statTotalLODCoarsening / _statSessionsEncoded;
+    if (_persister) {
+        statsObject["persist_load_usecs"] = (float)_persister->getLoadUsecs();
+        statsObject["last_snapshot_pause_usecs"] = (float)_persister->getLastSnapshotPauseUsecs();
+        statsObject["last_snapshot_write_usecs"] = (float)_persister->getLastSnapshotWriteUsecs();
+    }
+    
+    ThreadedAssignment::addPacketStatsAndSendStatsPacket(statsObject);
+    
+    _statTicks = 0;
+    _statSessionsEncoded = 0;
+    _statTotalEncodeUsecs = 0;
+    _statMaxEncodeUsecs = 0;
+    _statTotalTickEncodeUsecs = 0;
+    _statCacheHits = 0;
+    _statCacheMisses = 0;
+    _statDeltasHeld = 0;
+    _statTotalLODCoarsening = 0;
+}
+
+void MetavoxelServer::aboutToFinish() {
+    if (!_persister) {
+        return;
+    }
+    // write out whatever has changed since the last snapshot, so that we needn't replay it on the next start
+    _snapshotTimer.stop();
+    _persister->waitForSnapshot();
+    if (_persister->getEditsSinceSnapshot() > 0) {
+        _persister->snapshot(_data);
+        _persister->waitForSnapshot();
+    }
+}
+
+/// Encodes a single session's delta on the server's encoding pool.
+class DeltaEncoder : public QRunnable {
+public:
+    
+    DeltaEncoder(MetavoxelSession* session, MetavoxelDeltaCache& cache) : _session(session), _cache(cache) { }
+    
+    virtual void run() { _session->encodeDelta(_cache); }
+
+private:
+    
+    MetavoxelSession* _session;
+    MetavoxelDeltaCache& _cache;
+};
+
 void MetavoxelServer::sendDeltas() {
-    // send deltas for all sessions
+    quint64 tickStart = usecTimestampNow();
+    
+    // encode deltas for all sessions on the pool, leaving those that can't be encoded in parallel for afterwards
+    QList<MetavoxelSession*> sessions;
+    QList<MetavoxelSession*> serialSessions;
     foreach (const SharedNodePointer& node, NodeList::getInstance()->getNodeHash()) {
         if (node->getType() == NodeType::Agent) {
-            static_cast<MetavoxelSession*>(node->getLinkedData())->sendDelta();
+            MetavoxelSession* session = static_cast<MetavoxelSession*>(node->getLinkedData());
+            if (!session->isReadyToSend()) {
+                continue;
+            }
+            sessions.append(session);
+            if (session->canEncodeInParallel()) {
+                _encodingPool.start(new DeltaEncoder(session, _deltaCache));
+            } else {
+                serialSessions.append(session);
+            }
         }
     }
+    _encodingPool.waitForDone();
+    foreach (MetavoxelSession* session, serialSessions) {
+        session->encodeDelta(_deltaCache);
+    }
+    
+    // the packets are sent from this thread; once they're all out, the encodings are of no further use
+    foreach (MetavoxelSession* session, sessions) {
+        session->sendEncodedDelta();
+        
+        quint64 encodeUsecs = session->getEncodeUsecs();
+        _statTotalEncodeUsecs += encodeUsecs;
+        _statMaxEncodeUsecs = qMax(_statMaxEncodeUsecs, encodeUsecs);
+        _statDeltasHeld += session->isDeltaHeld() ? 1 : 0;
+        _statTotalLODCoarsening += session->getLODCoarsening();
+    }
+    _statSessionsEncoded += sessions.size();
+    _statCacheHits += _deltaCache.getHits();
+    _statCacheMisses += _deltaCache.getMisses();
+    _deltaCache.clear();
+    
+    _statTicks++;
+    _statTotalTickEncodeUsecs += usecTimestampNow() - tickStart;
     
     // restart the send timer
     qint64 now = QDateTime::currentMSecsSinceEpoch();
@@ -89,10 +241,21 @@ void MetavoxelServer::sendDeltas() {
     _sendTimer.start(qMax(0, 2 * SEND_INTERVAL - elapsed));
 }
 
+void MetavoxelServer::maybeSnapshot() {
+    // if the last one's still being written, we'll try again next time
+    if (_persister->getEditsSinceSnapshot() > 0) {
+        _persister->snapshot(_data);
+    }
+}
+
 MetavoxelSession::MetavoxelSession(MetavoxelServer* server, const SharedNodePointer& node) :
     _server(server),
     _sequencer(byteArrayWithPopulatedHeader(PacketTypeMetavoxelData)),
-    _node(node) {
+    _node(node),
+    _encodeUsecs(0),
+    _sendBudget(0),
+    _deltaHeld(false),
+    _lodCoarsening(0) {
     
     connect(&_sequencer, SIGNAL(readyToWrite(const QByteArray&)), SLOT(sendData(const QByteArray&)));
     connect(&_sequencer, SIGNAL(readyToRead(Bitstream&)), SLOT(readPacket(Bitstream&)));
@@ -115,19 +278,49 @@ int MetavoxelSession::parseData(const QByteArray& packet) {
     return packet.size();
 }
 
-void MetavoxelSession::sendDelta() {
-    // wait until we have a valid lod
-    if (!_lod.isValid()) {
-        return;
-    }
+bool MetavoxelSession::canEncodeInParallel() const {
+    return _server->getData().getSize() == _sendRecords.first().data.getSize();
+}
+
+void MetavoxelSession::encodeDelta(MetavoxelDeltaCache& cache) {
+    quint64 start = usecTimestampNow();
+    
+    // if the link can't take anything more, hold back the new changes and send again what we last sent, so that the
+    // client neither gets ahead nor falls back to the acknowledged reference (losing what it has since received);
+    // otherwise, stop subdividing early by coarsening the level of detail as far as the last deltas have shown we need to
+    const SendRecord& reference = _sendRecords.first();
+    const SendRecord& latest = _sendRecords.last();
+    _sendBudget = _sequencer.getSendBudget();
+    _deltaHeld = (_sendBudget < MIN_DELTA_BUDGET);
+    _deltaLOD = _deltaHeld ? latest.lod : MetavoxelLOD(_lod.position,
+        _lod.threshold * glm::pow(LOD_COARSENING_STEP, (float)_lodCoarsening));
+    
     Bitstream& out = _sequencer.startPacket();
-    out << QVariant::fromValue(MetavoxelDeltaMessage());
-    _server->getData().writeDelta(_sendRecords.first().data, _sendRecords.first().lod, out, _lod);
+    MetavoxelDeltaMessage message = { _deltaLOD };
+    out << QVariant::fromValue(message);
+    (_deltaHeld ? latest.data : _server->getData()).writeDelta(reference.data, reference.lod, out, _deltaLOD, &cache);
+    
+    _encodeUsecs = usecTimestampNow() - start;
+}
+
+void MetavoxelSession::sendEncodedDelta() {
     _sequencer.endPacket();
     
     // record the send
-    SendRecord record = { _sequencer.getOutgoingPacketNumber(), _server->getData(), _lod };
+    SendRecord record = { _sequencer.getOutgoingPacketNumber(), _deltaHeld ? _sendRecords.last().data :
+        _server->getData(), _deltaLOD };
     _sendRecords.append(record);
+    
+    // coarsen further if we overran the budget; refine again once the deltas fit easily
+    if (!_deltaHeld) {
+        int packetSize = _sequencer.getLastPacketSize();
+        if (packetSize > _sendBudget) {
+            _lodCoarsening = qMin(_lodCoarsening + 1, MAX_LOD_COARSENING);
+        
+        } else if (packetSize < _sendBudget / 2) {
+            _lodCoarsening = qMax(_lodCoarsening - 1, 0);
+        }
+    }
 }
 
 void MetavoxelSession::sendData(const QByteArray& data) {
@@ -13,6 +13,7 @@
 #define hifi_MetavoxelServer_h
 
 #include <QList>
+#include <QThreadPool>
 #include <QTimer>
 
 #include <ThreadedAssignment.h>
@@ -21,6 +22,7 @@
 #include <MetavoxelData.h>
 
 class MetavoxelEditMessage;
+class MetavoxelPersister;
 class MetavoxelSession;
 
 /// Maintains a shared metavoxel system, accepting change requests and broadcasting updates.
@@ -39,10 +41,15 @@ public:
     
     virtual void readPendingDatagrams();
     
+    virtual void sendStatsPacket();
+    
+    virtual void aboutToFinish();
+    
 private slots:
 
     void maybeAttachSession(const SharedNodePointer& node);
     void sendDeltas();    
+    void maybeSnapshot();
     
 private:
     
@@ -50,6 +57,22 @@ private:
     qint64 _lastSend;
     
     MetavoxelData _data;
+    
+    MetavoxelPersister* _persister;
+    QTimer _snapshotTimer;
+    
+    QThreadPool _encodingPool;
+    MetavoxelDeltaCache _deltaCache;
+    
+    int _statTicks;
+    int _statSessionsEncoded;
+    quint64 _statTotalEncodeUsecs;
+    quint64 _statMaxEncodeUsecs;
+    quint64 _statTotalTickEncodeUsecs;
+    int _statCacheHits;
+    int _statCacheMisses;
+    int _statDeltasHeld;
+    int _statTotalLODCoarsening;
 };
 
 /// Contains the state of a single client session.
@@ -63,7 +86,32 @@ public:
 
     virtual int parseData(const QByteArray& packet);
 
-    void sendDelta();
+    /// Checks whether we have a level of detail to send deltas for.
+    bool isReadyToSend() const { return _lod.isValid(); }
+
+    /// Checks whether the delta may be encoded off the server thread.  It can't be when the data has grown since our
+    /// reference, as expanding the reference copies nodes whose reference counts are shared with other sessions.
+    bool canEncodeInParallel() const;
+
+    /// Writes this tick's delta into a new packet, sharing encoded roots with the other sessions through the cache.  The
+    /// delta is fitted to the sequencer's send budget by coarsening the level of detail, or held back entirely if the
+    /// link can take nothing more, in which case the packet brings the client to the state we last sent rather than the
+    /// current one.
+    /// \thread any thread, so long as the server thread is waiting on the encoding
+    void encodeDelta(MetavoxelDeltaCache& cache);
+
+    /// Sends the packet written by encodeDelta, records the send, and adjusts the coarsening for the next delta according
+    /// to how well this one fit.
+    void sendEncodedDelta();
+
+    /// Returns the time taken by the last call to encodeDelta.
+    quint64 getEncodeUsecs() const { return _encodeUsecs; }
+    
+    /// Checks whether the last delta was held back for want of budget.
+    bool isDeltaHeld() const { return _deltaHeld; }
+    
+    /// Returns the number of steps by which we're coarsening the client's level of detail.
+    int getLODCoarsening() const { return _lodCoarsening; }
 
 private slots:
 
@@ -93,6 +141,13 @@ private:
     MetavoxelLOD _lod;
     
     QList<SendRecord> _sendRecords;
+    
+    quint64 _encodeUsecs;
+    
+    int _sendBudget;
+    bool _deltaHeld;
+    MetavoxelLOD _deltaLOD;
+    int _lodCoarsening;
 };
 
 #endif // hifi_MetavoxelServer_h
@@ -37,6 +37,7 @@ void OctreeInboundPacketProcessor::resetStats() {
     _totalPackets = 0;
 
     _singleSenderStats.clear();
+    resetQueueHistograms();
 }
 
 
@@ -260,6 +260,9 @@ OctreeServer::~OctreeServer() {
 
     if (_persistThread) {
         _persistThread->terminate();
+        
+        // save whatever changed since the last interval so the server that takes over from us starts with it
+        _persistThread->persist();
         _persistThread->deleteLater();
     }
 
@@ -626,6 +629,12 @@ bool OctreeServer::handleHTTPRequest(HTTPConnection* connection, const QUrl& url
             .arg(locale.toString((uint)averageProcessTimePerElement).rightJustified(COLUMN_WIDTH, ' '));
         statsString += QString("  Average Wait Lock Time/Element: %1 usecs\r\n")
             .arg(locale.toString((uint)averageLockWaitTimePerElement).rightJustified(COLUMN_WIDTH, ' '));
+        statsString += QString("         Inbound Queue Depth: %1\r\n")
+            .arg(_octreeInboundPacketProcessor->getQueueDepthHistogram().toString());
+        statsString += QString("   Inbound Queue Wait (usecs): %1\r\n")
+            .arg(_octreeInboundPacketProcessor->getQueueWaitTimeHistogram().toString());
+        statsString += QString("         Inbound Queue Drops: %1 packets\r\n")
+            .arg(locale.toString(_octreeInboundPacketProcessor->getDroppedPacketCount()).rightJustified(COLUMN_WIDTH, ' '));
 
 
         int senderNumber = 0;
@@ -669,6 +678,13 @@ bool OctreeServer::handleHTTPRequest(HTTPConnection* connection, const QUrl& url
 
         statsString += "\r\n\r\n";
 
+        // display the stats specific to our type of server
+        QString myServerStats = getMyServerStats();
+        if (!myServerStats.isEmpty()) {
+            statsString += myServerStats;
+            statsString += "\r\n\r\n";
+        }
+
         // display memory usage stats
         statsString += "<b>Current Memory Usage Statistics</b>\r\n";
         statsString += QString().sprintf("\r\nOctreeElement size... %ld bytes\r\n", sizeof(OctreeElement));
@@ -1234,6 +1250,16 @@ void OctreeServer::sendStatsPacket() {
         (double)_octreeInboundPacketProcessor->getAverageProcessTimePerElement();
     statsObject3[baseName + QString(".3.inbound.timing.5.avgLockWaitTimePerElement")] = 
         (double)_octreeInboundPacketProcessor->getAverageLockWaitTimePerElement();
+    statsObject3[baseName + QString(".3.inbound.queue.1.depthP50")] = 
+        (double)_octreeInboundPacketProcessor->getQueueDepthHistogram().getPercentile(50.0f);
+    statsObject3[baseName + QString(".3.inbound.queue.2.depthP99")] = 
+        (double)_octreeInboundPacketProcessor->getQueueDepthHistogram().getPercentile(99.0f);
+    statsObject3[baseName + QString(".3.inbound.queue.3.waitTimeP50")] = 
+        (double)_octreeInboundPacketProcessor->getQueueWaitTimeHistogram().getPercentile(50.0f);
+    statsObject3[baseName + QString(".3.inbound.queue.4.waitTimeP99")] = 
+        (double)_octreeInboundPacketProcessor->getQueueWaitTimeHistogram().getPercentile(99.0f);
+    statsObject3[baseName + QString(".3.inbound.queue.5.dropped")] = 
+        (double)_octreeInboundPacketProcessor->getDroppedPacketCount();
 
     NodeList::getInstance()->sendStatsToDomainServer(statsObject3);
 }
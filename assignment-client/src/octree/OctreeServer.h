@@ -73,6 +73,9 @@ public:
     virtual void beforeRun() { };
     virtual bool hasSpecialPacketToSend(const SharedNodePointer& node) { return false; }
     virtual int sendSpecialPacket(const SharedNodePointer& node) { return 0; }
+    
+    /// \return a section of statistics specific to this type of server, for the stats page
+    virtual QString getMyServerStats() { return QString(); }
 
     static void attachQueryNodeToNode(Node* newNode);
     
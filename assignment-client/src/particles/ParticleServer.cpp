@@ -115,6 +115,35 @@ int ParticleServer::sendSpecialPacket(const SharedNodePointer& node) {
     return packetLength;
 }
 
+QString ParticleServer::getMyServerStats() {
+    ParticleTree* tree = static_cast<ParticleTree*>(_tree);
+    QString statsString("<b>Particle Edit Statistics...</b>\r\n");
+    statsString += QString("           Particle Edits: %1 (%2 stale)\r\n").arg(tree->getParticleEditCount())
+        .arg(tree->getStaleParticleEditCount());
+    statsString += QString().sprintf("           Average Bytes per Edit: %5.2f\r\n", tree->getAverageBytesPerParticleEdit());
+    statsString += QString().sprintf("                 Edits per Second: %5.2f\r\n", tree->getParticleEditsPerSecond());
+    statsString += "\r\n";
+
+    statsString += "<b>Particle Script Statistics...</b>\r\n";
+
+    const ParticleScriptRuntime* scriptRuntime = tree->getExistingScriptRuntime();
+    if (!scriptRuntime) {
+        statsString += "           No particle scripts have run yet\r\n";
+        return statsString;
+    }
+
+    const float AS_PERCENT = 100.0f;
+    statsString += QString("               Scripted Particles: %1\r\n").arg(scriptRuntime->getScriptedParticleCount());
+    statsString += QString("                 Compiled Scripts: %1\r\n").arg(scriptRuntime->getCompiledScriptCount());
+    statsString += QString().sprintf("           Compile Cache Hit Rate: %5.2f%% (%llu hits, %llu misses)\r\n",
+        scriptRuntime->getCompileCacheHitRate() * AS_PERCENT, scriptRuntime->getCompileCacheHits(),
+        scriptRuntime->getCompileCacheMisses());
+    statsString += QString("           Last Tick Script Time: %1 usecs\r\n").arg(scriptRuntime->getLastTickScriptTime());
+    statsString += QString("        Average Tick Script Time: %1 usecs\r\n").arg(scriptRuntime->getAverageTickScriptTime());
+
+    return statsString;
+}
+
 void ParticleServer::pruneDeletedParticles() {
     ParticleTree* tree = static_cast<ParticleTree*>(_tree);
     if (tree->hasAnyDeletedParticles()) {
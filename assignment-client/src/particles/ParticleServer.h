@@ -38,6 +38,7 @@ public:
     virtual void beforeRun();
     virtual bool hasSpecialPacketToSend(const SharedNodePointer& node);
     virtual int sendSpecialPacket(const SharedNodePointer& node);
+    virtual QString getMyServerStats();
 
     virtual void particleCreated(const Particle& newParticle, const SharedNodePointer& senderNode);
 
@@ -9,6 +9,7 @@
 //  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
 //
 
+#include <limits>
 #include <signal.h>
 
 #include <QtCore/QDir>
@@ -16,8 +17,11 @@
 #include <QtCore/QJsonObject>
 #include <QtCore/QJsonArray>
 #include <QtCore/QProcess>
+#include <QtCore/QRunnable>
 #include <QtCore/QStandardPaths>
+#include <QtCore/QThread>
 #include <QtCore/QTimer>
+#include <QtCore/QtEndian>
 
 #include <AccountManager.h>
 #include <HTTPConnection.h>
@@ -37,7 +41,14 @@ DomainServer::DomainServer(int argc, char* argv[]) :
     _staticAssignmentHash(),
     _assignmentQueue(),
     _nodeAuthenticationURL(),
-    _redeemedTokenResponses()
+    _redeemedTokenResponses(),
+    _domainListVersion(0),
+    _oldestDeltaBaseVersion(0),
+    _domainListChanges(),
+    _roundPackets(),
+    _roundSenderSockAddrs(),
+    _roundCheckIns(),
+    _checkInParsingPool()
 {
     setOrganizationName("High Fidelity");
     setOrganizationDomain("highfidelity.io");
@@ -418,7 +429,15 @@ NodeSet DomainServer::nodeInterestListFromPacket(const QByteArray& packet, int n
 }
 
 void DomainServer::sendDomainListToNode(const SharedNodePointer& node, const HifiSockAddr &senderSockAddr,
-                                        const NodeSet& nodeInterestList) {
+                                        const NodeSet& nodeInterestList, quint32 knownListVersion) {
+    DomainServerNodeData* nodeData = reinterpret_cast<DomainServerNodeData*>(node->getLinkedData());
+    
+    // a node that just connected, has fallen behind what we still have logged or changed what it is interested in
+    // gets the full list, everyone else gets what has changed since the last list they received in full
+    bool sendFullList = knownListVersion == 0 || knownListVersion < _oldestDeltaBaseVersion
+        || knownListVersion > _domainListVersion || nodeInterestList != nodeData->getNodeInterestList();
+    
+    nodeData->setNodeInterestList(nodeInterestList);
     
     QByteArray broadcastPacket = byteArrayWithPopulatedHeader(PacketTypeDomainList);
     
@@ -426,81 +445,249 @@ void DomainServer::sendDomainListToNode(const SharedNodePointer& node, const Hif
     QDataStream broadcastDataStream(&broadcastPacket, QIODevice::Append);
     broadcastDataStream << node->getUUID();
     
+    DomainListType_t listType = sendFullList ? DomainListType::Full : DomainListType::Delta;
+    broadcastDataStream << listType << (sendFullList ? 0 : knownListVersion) << _domainListVersion;
+    
+    // the index of each packet and the number of packets in this list are filled in once we know how many there are
+    int packetIndexOffset = broadcastDataStream.device()->pos();
+    broadcastDataStream << (quint16) 0 << (quint16) 0;
+    
     int numBroadcastPacketLeadBytes = broadcastDataStream.device()->pos();
     
-    DomainServerNodeData* nodeData = reinterpret_cast<DomainServerNodeData*>(node->getLinkedData());
+    QVector<QByteArray> listPackets;
+    listPackets.append(broadcastPacket);
     
     NodeList* nodeList = NodeList::getInstance();
     
-    
     if (nodeInterestList.size() > 0) {
-        // if the node has any interest types, send back those nodes as well
-        foreach (const SharedNodePointer& otherNode, nodeList->getNodeHash()) {
-            
-            // reset our nodeByteArray and nodeDataStream
-            QByteArray nodeByteArray;
-            QDataStream nodeDataStream(&nodeByteArray, QIODevice::Append);
+        if (sendFullList) {
+            // if the node has any interest types, send back those nodes as well
+            foreach (const SharedNodePointer& otherNode, nodeList->getNodeHash()) {
+                if (otherNode->getUUID() != node->getUUID() && nodeInterestList.contains(otherNode->getType())) {
+                    appendDomainListRecord(listPackets, numBroadcastPacketLeadBytes,
+                                           domainListRecordForNode(node, otherNode));
+                }
+            }
+        } else {
+            // only the latest change to each node matters, find it so earlier ones can be skipped
+            int firstChangeIndex = _domainListChanges.size() - (int)(_domainListVersion - knownListVersion);
+            QHash<QUuid, int> latestChangeIndexes;
+            for (int i = firstChangeIndex; i < _domainListChanges.size(); i++) {
+                latestChangeIndexes.insert(_domainListChanges.at(i).nodeUUID, i);
+            }
             
-            if (otherNode->getUUID() != node->getUUID() && nodeInterestList.contains(otherNode->getType())) {
-                
-                // don't send avatar nodes to other avatars, that will come from avatar mixer
-                nodeDataStream << *otherNode.data();
-                
-                // pack the secret that these two nodes will use to communicate with each other
-                QUuid secretUUID = nodeData->getSessionSecretHash().value(otherNode->getUUID());
-                if (secretUUID.isNull()) {
-                    // generate a new secret UUID these two nodes can use
-                    secretUUID = QUuid::createUuid();
-                    
-                    // set that on the current Node's sessionSecretHash
-                    nodeData->getSessionSecretHash().insert(otherNode->getUUID(), secretUUID);
-                    
-                    // set it on the other Node's sessionSecretHash
-                    reinterpret_cast<DomainServerNodeData*>(otherNode->getLinkedData())
-                        ->getSessionSecretHash().insert(node->getUUID(), secretUUID);
-                    
+            for (int i = firstChangeIndex; i < _domainListChanges.size(); i++) {
+                const DomainListChange& change = _domainListChanges.at(i);
+                if (latestChangeIndexes.value(change.nodeUUID) != i || change.nodeUUID == node->getUUID()
+                    || !nodeInterestList.contains(change.nodeType)) {
+                    continue;
                 }
                 
-                nodeDataStream << secretUUID;
-                
-                if (broadcastPacket.size() +  nodeByteArray.size() > MAX_PACKET_SIZE) {
-                    // we need to break here and start a new packet
-                    // so send the current one
+                if (change.isRemoval) {
+                    QByteArray removalRecord;
+                    QDataStream removalStream(&removalRecord, QIODevice::Append);
+                    removalStream << DomainListRecordType::Removal << change.nodeUUID;
                     
-                    nodeList->writeDatagram(broadcastPacket, node, senderSockAddr);
-                    
-                    // reset the broadcastPacket structure
-                    broadcastPacket.resize(numBroadcastPacketLeadBytes);
-                    broadcastDataStream.device()->seek(numBroadcastPacketLeadBytes);
+                    appendDomainListRecord(listPackets, numBroadcastPacketLeadBytes, removalRecord);
+                } else {
+                    SharedNodePointer otherNode = nodeList->nodeWithUUID(change.nodeUUID);
+                    if (otherNode) {
+                        appendDomainListRecord(listPackets, numBroadcastPacketLeadBytes,
+                                               domainListRecordForNode(node, otherNode));
+                    }
                 }
-                
-                // append the nodeByteArray to the current state of broadcastDataStream
-                broadcastPacket.append(nodeByteArray);
             }
         }
     }
     
-    // always write the last broadcastPacket
-    nodeList->writeDatagram(broadcastPacket, node, senderSockAddr);
+    if (listPackets.size() > std::numeric_limits<quint16>::max()) {
+        qDebug() << "DomainList for" << uuidStringWithoutCurlyBraces(node->getUUID()) << "needs" << listPackets.size()
+            << "packets, more than can be numbered. It will not be sent.";
+        return;
+    }
+    
+    for (int i = 0; i < listPackets.size(); i++) {
+        uchar* packetIndexData = reinterpret_cast<uchar*>(listPackets[i].data() + packetIndexOffset);
+        qToBigEndian<quint16>(i, packetIndexData);
+        qToBigEndian<quint16>(listPackets.size(), packetIndexData + sizeof(quint16));
+        
+        nodeList->queueDatagram(listPackets[i], node, senderSockAddr);
+    }
+}
+
+void DomainServer::appendDomainListRecord(QVector<QByteArray>& listPackets, int numLeadBytes, const QByteArray& record) {
+    if (listPackets.last().size() + record.size() > MAX_PACKET_SIZE) {
+        // we need to break here and start a new packet with the same lead bytes
+        listPackets.append(listPackets.last().left(numLeadBytes));
+    }
+    
+    listPackets.last().append(record);
+}
+
+QByteArray DomainServer::domainListRecordForNode(const SharedNodePointer& node, const SharedNodePointer& otherNode) {
+    QByteArray nodeByteArray;
+    QDataStream nodeDataStream(&nodeByteArray, QIODevice::Append);
+    
+    nodeDataStream << DomainListRecordType::Node << *otherNode.data();
+    
+    // pack the secret that these two nodes will use to communicate with each other
+    DomainServerNodeData* nodeData = reinterpret_cast<DomainServerNodeData*>(node->getLinkedData());
+    QUuid secretUUID = nodeData->getSessionSecretHash().value(otherNode->getUUID());
+    if (secretUUID.isNull()) {
+        // generate a new secret UUID these two nodes can use
+        secretUUID = QUuid::createUuid();
+        
+        // set that on the current Node's sessionSecretHash
+        nodeData->getSessionSecretHash().insert(otherNode->getUUID(), secretUUID);
+        
+        // set it on the other Node's sessionSecretHash
+        reinterpret_cast<DomainServerNodeData*>(otherNode->getLinkedData())
+            ->getSessionSecretHash().insert(node->getUUID(), secretUUID);
+    }
+    
+    nodeDataStream << secretUUID;
+    
+    return nodeByteArray;
+}
+
+void DomainServer::recordDomainListChange(const SharedNodePointer& node, bool isRemoval) {
+    DomainListChange change;
+    change.version = ++_domainListVersion;
+    change.nodeUUID = node->getUUID();
+    change.nodeType = node->getType();
+    change.isRemoval = isRemoval;
+    
+    _domainListChanges.append(change);
+    
+    const int MAX_LOGGED_DOMAIN_LIST_CHANGES = 4096;
+    if (_domainListChanges.size() > MAX_LOGGED_DOMAIN_LIST_CHANGES) {
+        // drop the oldest half of the log, nodes that last received a list from before that get a full list
+        int numDroppedChanges = _domainListChanges.size() / 2;
+        _oldestDeltaBaseVersion = _domainListChanges.at(numDroppedChanges - 1).version;
+        _domainListChanges.remove(0, numDroppedChanges);
+    }
+}
+
+/// Parses one shard of a round's check-ins on a thread from the check-in parsing pool
+class CheckInParser : public QRunnable {
+public:
+    CheckInParser(DomainServer* domainServer, int shard, int numShards) :
+        _domainServer(domainServer),
+        _shard(shard),
+        _numShards(numShards) { }
+    
+    void run() { _domainServer->parseCheckInShard(_shard, _numShards); }
+    
+private:
+    DomainServer* _domainServer;
+    int _shard;
+    int _numShards;
+};
+
+void DomainServer::parseCheckInShard(int shard, int numShards) {
+    NodeList* nodeList = NodeList::getInstance();
+    
+    for (int i = shard; i < _roundPackets.size(); i += numShards) {
+        const QByteArray& packet = _roundPackets.at(i);
+        
+        // version mismatches are left for the main thread, which is where NodeList reports them from
+        if (packetTypeForPacket(packet) != PacketTypeDomainListRequest
+            || packet[1] != versionForPacketType(PacketTypeDomainListRequest)
+            || !nodeList->packetVersionAndHashMatch(packet)) {
+            continue;
+        }
+        
+        ParsedCheckIn& checkIn = _roundCheckIns[i];
+        checkIn.nodeUUID = uuidFromPacketHeader(packet);
+        
+        int numNodeInfoBytes = parseNodeDataFromByteArray(checkIn.nodeType, checkIn.publicSockAddr, checkIn.localSockAddr,
+                                                          packet, _roundSenderSockAddrs.at(i));
+        checkIn.nodeInterestList = nodeInterestListFromPacket(packet, numNodeInfoBytes);
+        
+        // the list version the node last received in full follows its interest list
+        QDataStream packetStream(packet);
+        packetStream.skipRawData(numNodeInfoBytes);
+        
+        quint8 numInterestTypes = 0;
+        packetStream >> numInterestTypes;
+        packetStream.skipRawData(numInterestTypes * sizeof(NodeType_t));
+        
+        if (!packetStream.atEnd()) {
+            packetStream >> checkIn.knownListVersion;
+        }
+        
+        checkIn.isValid = true;
+    }
+}
+
+void DomainServer::processCheckIn(const ParsedCheckIn& checkIn, const HifiSockAddr& senderSockAddr) {
+    SharedNodePointer checkInNode = NodeList::getInstance()->nodeWithUUID(checkIn.nodeUUID);
+    if (!checkInNode) {
+        return;
+    }
+    
+    if (checkIn.publicSockAddr != checkInNode->getPublicSocket() || checkIn.localSockAddr != checkInNode->getLocalSocket()) {
+        NodeList::getInstance()->updateSocketsForNode(checkIn.nodeUUID, checkIn.publicSockAddr, checkIn.localSockAddr);
+        
+        // the nodes that know about this one need to hear about its new sockets
+        recordDomainListChange(checkInNode, false);
+    }
+    
+    // update last receive to now
+    checkInNode->setLastHeardMicrostamp(usecTimestampNow());
+    
+    sendDomainListToNode(checkInNode, senderSockAddr, checkIn.nodeInterestList, checkIn.knownListVersion);
 }
 
 void DomainServer::readAvailableDatagrams() {
     NodeList* nodeList = NodeList::getInstance();
     AccountManager& accountManager = AccountManager::getInstance();
 
-    HifiSockAddr senderSockAddr;
-    
     static QByteArray assignmentPacket = byteArrayWithPopulatedHeader(PacketTypeCreateAssignment);
     static int numAssignmentPacketHeaderBytes = assignmentPacket.size();
     
-    QByteArray receivedPacket;
-
-    while (nodeList->getNodeSocket().hasPendingDatagrams()) {
-        receivedPacket.resize(nodeList->getNodeSocket().pendingDatagramSize());
-        nodeList->getNodeSocket().readDatagram(receivedPacket.data(), receivedPacket.size(),
-                                               senderSockAddr.getAddressPointer(), senderSockAddr.getPortPointer());
+    QByteArray datagram;
+    HifiSockAddr datagramSenderSockAddr;
+    int numCheckIns = 0;
+    
+    // pull everything waiting on the socket first, so the check-ins in this round can be parsed in parallel
+    while (nodeList->readDatagram(datagram, datagramSenderSockAddr)) {
+        if (packetTypeForPacket(datagram) == PacketTypeDomainListRequest) {
+            numCheckIns++;
+        }
+        
+        _roundPackets.append(datagram);
+        _roundSenderSockAddrs.append(datagramSenderSockAddr);
+    }
+    
+    _roundCheckIns.fill(ParsedCheckIn(), _roundPackets.size());
+    
+    // verifying the hash on each check-in dominates its cost, only spread it out when there are enough to go around
+    const int MIN_CHECK_INS_PER_SHARD = 32;
+    int numShards = qMin(QThread::idealThreadCount(), numCheckIns / MIN_CHECK_INS_PER_SHARD);
+    
+    if (numShards > 1) {
+        for (int i = 0; i < numShards; i++) {
+            _checkInParsingPool.start(new CheckInParser(this, i, numShards));
+        }
+        _checkInParsingPool.waitForDone();
+    } else if (numCheckIns > 0) {
+        parseCheckInShard(0, 1);
+    }
+    
+    // everything that changes state happens back here, in the order the datagrams arrived
+    for (int i = 0; i < _roundPackets.size(); i++) {
+        const QByteArray& receivedPacket = _roundPackets.at(i);
+        const HifiSockAddr& senderSockAddr = _roundSenderSockAddrs.at(i);
         
-        if (nodeList->packetVersionAndHashMatch(receivedPacket)) {
+        if (packetTypeForPacket(receivedPacket) == PacketTypeDomainListRequest) {
+            if (_roundCheckIns.at(i).isValid) {
+                processCheckIn(_roundCheckIns.at(i), senderSockAddr);
+            } else if (receivedPacket[1] != versionForPacketType(PacketTypeDomainListRequest)) {
+                // let NodeList report the version mismatch
+                nodeList->packetVersionAndHashMatch(receivedPacket);
+            }
+        } else if (nodeList->packetVersionAndHashMatch(receivedPacket)) {
             PacketType requestType = packetTypeForPacket(receivedPacket);
             
             if (requestType == PacketTypeDomainConnectRequest) {
@@ -548,23 +735,6 @@ void DomainServer::readAvailableDatagrams() {
                     addNodeToNodeListAndConfirmConnection(receivedPacket, senderSockAddr);
                 }
                 
-            } else if (requestType == PacketTypeDomainListRequest) {
-                QUuid nodeUUID = uuidFromPacketHeader(receivedPacket);
-                NodeType_t throwawayNodeType;
-                HifiSockAddr nodePublicAddress, nodeLocalAddress;
-                
-                int numNodeInfoBytes = parseNodeDataFromByteArray(throwawayNodeType, nodePublicAddress, nodeLocalAddress,
-                                                                  receivedPacket, senderSockAddr);
-                
-                SharedNodePointer checkInNode = nodeList->updateSocketsForNode(nodeUUID, nodePublicAddress, nodeLocalAddress);
-            
-                // update last receive to now
-                quint64 timeNow = usecTimestampNow();
-                checkInNode->setLastHeardMicrostamp(timeNow);
-                
-                
-                sendDomainListToNode(checkInNode, senderSockAddr, nodeInterestListFromPacket(receivedPacket, numNodeInfoBytes));
-                
             } else if (requestType == PacketTypeRequestAssignment) {
                 
                 // construct the requested assignment from the packet data
@@ -614,6 +784,17 @@ void DomainServer::readAvailableDatagrams() {
             }
         }
     }
+    
+    // hand this round's buffers back for the next one
+    for (int i = 0; i < _roundPackets.size(); i++) {
+        nodeList->getPacketBufferPool().release(_roundPackets[i]);
+    }
+    _roundPackets.resize(0);
+    _roundSenderSockAddrs.resize(0);
+    _roundCheckIns.resize(0);
+    
+    // send out the domain lists queued while answering this round of check-ins
+    nodeList->flushQueuedDatagrams();
 }
 
 QJsonObject DomainServer::jsonForSocket(const HifiSockAddr& socket) {
@@ -870,9 +1051,12 @@ void DomainServer::refreshStaticAssignmentAndAddToQueue(SharedAssignmentPointer&
 void DomainServer::nodeAdded(SharedNodePointer node) {
     // we don't use updateNodeWithData, so add the DomainServerNodeData to the node here
     node->setLinkedData(new DomainServerNodeData());
+    
+    recordDomainListChange(node, false);
 }
 
 void DomainServer::nodeKilled(SharedNodePointer node) {
+    recordDomainListChange(node, true);
     
     DomainServerNodeData* nodeData = reinterpret_cast<DomainServerNodeData*>(node->getLinkedData());
     if (nodeData) {
@@ -18,7 +18,9 @@
 #include <QtCore/QQueue>
 #include <QtCore/QSharedPointer>
 #include <QtCore/QStringList>
+#include <QtCore/QThreadPool>
 #include <QtCore/QUrl>
+#include <QtCore/QVector>
 
 #include <Assignment.h>
 #include <HTTPManager.h>
@@ -26,6 +28,29 @@
 
 typedef QSharedPointer<Assignment> SharedAssignmentPointer;
 
+/// A node joining, leaving or moving, logged so that check-ins can be answered with just what changed
+class DomainListChange {
+public:
+    quint32 version;
+    QUuid nodeUUID;
+    NodeType_t nodeType;
+    bool isRemoval;
+};
+
+/// A PacketTypeDomainListRequest that has been verified and parsed, possibly on a worker thread
+class ParsedCheckIn {
+public:
+    ParsedCheckIn() : isValid(false), nodeType(NodeType::Unassigned), knownListVersion(0) { }
+    
+    bool isValid;
+    QUuid nodeUUID;
+    NodeType_t nodeType;
+    HifiSockAddr publicSockAddr;
+    HifiSockAddr localSockAddr;
+    NodeSet nodeInterestList;
+    quint32 knownListVersion;
+};
+
 class DomainServer : public QCoreApplication, public HTTPRequestHandler {
     Q_OBJECT
 public:
@@ -37,6 +62,10 @@ public:
     
     void exit(int retCode = 0);
     
+    /// Verifies and parses every numShards-th check-in of the current round of datagrams, starting at shard.
+    /// \thread any - touches only the round's packets, its own slots in the parsed results and the node hash
+    void parseCheckInShard(int shard, int numShards);
+    
 public slots:
     /// Called by NodeList to inform us a node has been added
     void nodeAdded(SharedNodePointer node);
@@ -52,8 +81,12 @@ private:
     int parseNodeDataFromByteArray(NodeType_t& nodeType, HifiSockAddr& publicSockAddr,
                                     HifiSockAddr& localSockAddr, const QByteArray& packet, const HifiSockAddr& senderSockAddr);
     NodeSet nodeInterestListFromPacket(const QByteArray& packet, int numPreceedingBytes);
+    void processCheckIn(const ParsedCheckIn& checkIn, const HifiSockAddr& senderSockAddr);
     void sendDomainListToNode(const SharedNodePointer& node, const HifiSockAddr& senderSockAddr,
-                              const NodeSet& nodeInterestList);
+                              const NodeSet& nodeInterestList, quint32 knownListVersion = 0);
+    void appendDomainListRecord(QVector<QByteArray>& listPackets, int numLeadBytes, const QByteArray& record);
+    QByteArray domainListRecordForNode(const SharedNodePointer& node, const SharedNodePointer& otherNode);
+    void recordDomainListChange(const SharedNodePointer& node, bool isRemoval);
     
     void parseCommandLineTypeConfigs(const QStringList& argumentList, QSet<Assignment::Type>& excludedTypes);
     void readConfigFile(const QString& path, QSet<Assignment::Type>& excludedTypes);
@@ -81,6 +114,15 @@ private:
     QStringList _argumentList;
     
     QHash<QString, QJsonObject> _redeemedTokenResponses;
+    
+    quint32 _domainListVersion;
+    quint32 _oldestDeltaBaseVersion;
+    QVector<DomainListChange> _domainListChanges;
+    
+    QVector<QByteArray> _roundPackets;
+    QVector<HifiSockAddr> _roundSenderSockAddrs;
+    QVector<ParsedCheckIn> _roundCheckIns;
+    QThreadPool _checkInParsingPool;
 private slots:
     void requestCreationFromDataServer();
     void processCreateResponseFromDataServer(const QJsonObject& jsonObject);
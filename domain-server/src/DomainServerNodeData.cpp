@@ -20,6 +20,7 @@
 DomainServerNodeData::DomainServerNodeData() :
     _sessionSecretHash(),
     _staticAssignmentUUID(),
+    _nodeInterestList(),
     _statsJSONObject()
 {
     
@@ -16,6 +16,7 @@
 #include <QtCore/QUuid>
 
 #include <NodeData.h>
+#include <NodeList.h>
 
 class DomainServerNodeData : public NodeData {
 public:
@@ -30,11 +31,16 @@ public:
     const QUuid& getStaticAssignmentUUID() const { return _staticAssignmentUUID; }
     
     QHash<QUuid, QUuid>& getSessionSecretHash() { return _sessionSecretHash; }
+    
+    /// The node types this node last told us it is interested in, a change means it needs a full DomainList
+    void setNodeInterestList(const NodeSet& nodeInterestList) { _nodeInterestList = nodeInterestList; }
+    const NodeSet& getNodeInterestList() const { return _nodeInterestList; }
 private:
     QJsonObject mergeJSONStatsFromNewObject(const QJsonObject& newObject, QJsonObject destinationObject);
     
     QHash<QUuid, QUuid> _sessionSecretHash;
     QUuid _staticAssignmentUUID;
+    NodeSet _nodeInterestList;
     QJsonObject _statsJSONObject;
 };
 
@@ -39,7 +39,6 @@
 #include <QMouseEvent>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
-#include <QNetworkDiskCache>
 #include <QOpenGLFramebufferObject>
 #include <QObject>
 #include <QWheelEvent>
@@ -64,6 +63,7 @@
 #include <ParticlesScriptingInterface.h>
 #include <PerfStat.h>
 #include <ResourceCache.h>
+#include <ResourceDiskCache.h>
 #include <UUID.h>
 #include <OctreeSceneStats.h>
 #include <LocalVoxelsList.h>
@@ -288,8 +288,8 @@ Application::Application(int& argc, char** argv, timeval &startup_time) :
     QString cachePath = QStandardPaths::writableLocation(QStandardPaths::DataLocation);
 
     _networkAccessManager = new QNetworkAccessManager(this);
-    QNetworkDiskCache* cache = new QNetworkDiskCache(_networkAccessManager);
-    cache->setCacheDirectory(!cachePath.isEmpty() ? cachePath : "interfaceCache");
+    ResourceDiskCache* cache = new ResourceDiskCache((!cachePath.isEmpty() ? cachePath : "interfaceCache") + "/resources",
+        DEFAULT_RESOURCE_DISK_CACHE_SIZE, _networkAccessManager);
     _networkAccessManager->setCache(cache);
 
     ResourceCache::setNetworkAccessManager(_networkAccessManager);
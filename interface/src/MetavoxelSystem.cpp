@@ -30,7 +30,8 @@ ProgramObject MetavoxelSystem::_program;
 int MetavoxelSystem::_pointScaleLocation;
 
 MetavoxelSystem::MetavoxelSystem() :
-    _simulateVisitor(_points),
+    _pointCount(0),
+    _pointClientCount(0),
     _buffer(QOpenGLBuffer::VertexBuffer) {
 }
 
@@ -85,10 +86,11 @@ void MetavoxelSystem::applyEdit(const MetavoxelEditMessage& edit, bool reliable)
 }
 
 void MetavoxelSystem::simulate(float deltaTime) {
-    // simulate the clients
-    _points.clear();
+    // simulate the clients and bring their points up to date
     _simulateVisitor.setDeltaTime(deltaTime);
-    _simulateVisitor.setOrder(-Application::getInstance()->getViewFrustum()->getDirection());
+    _pointVisitor.setOrder(-Application::getInstance()->getViewFrustum()->getDirection());
+    bool pointsChanged = false;
+    QList<QVector<Point> > clientPoints;
     foreach (const SharedNodePointer& node, NodeList::getInstance()->getNodeHash()) {
         if (node->getType() == NodeType::MetavoxelServer) {
             QMutexLocker locker(&node->getMutex());
@@ -96,16 +98,35 @@ void MetavoxelSystem::simulate(float deltaTime) {
             if (client) {
                 client->simulate(deltaTime);
                 client->guide(_simulateVisitor);
+                if (client->updatePoints(_pointVisitor)) {
+                    pointsChanged = true;
+                }
+                clientPoints.append(client->getPoints());
             }
         }
     }
+    if (!pointsChanged && clientPoints.size() == _pointClientCount) {
+        return;
+    }
+    _pointClientCount = clientPoints.size();
+    
+    // the usual case is a single client, whose points we can upload as they are
+    QVector<Point> points;
+    if (clientPoints.size() == 1) {
+        points = clientPoints.first();
+    } else {
+        foreach (const QVector<Point>& client, clientPoints) {
+            points += client;
+        }
+    }
+    _pointCount = points.size();
     
     _buffer.bind();
-    int bytes = _points.size() * sizeof(Point);
+    int bytes = _pointCount * sizeof(Point);
     if (_buffer.size() < bytes) {
-        _buffer.allocate(_points.constData(), bytes);
+        _buffer.allocate(points.constData(), bytes);
     } else {
-        _buffer.write(0, _points.constData(), bytes);
+        _buffer.write(0, points.constData(), bytes);
     }
     _buffer.release();
 }
@@ -138,7 +159,7 @@ void MetavoxelSystem::render() {
 
     glEnable(GL_VERTEX_PROGRAM_POINT_SIZE_ARB);
 
-    glDrawArrays(GL_POINTS, 0, _points.size());
+    glDrawArrays(GL_POINTS, 0, _pointCount);
     
     glDisable(GL_VERTEX_PROGRAM_POINT_SIZE_ARB);
     
@@ -168,13 +189,8 @@ void MetavoxelSystem::maybeAttachClient(const SharedNodePointer& node) {
     }
 }
 
-MetavoxelSystem::SimulateVisitor::SimulateVisitor(QVector<Point>& points) :
-    SpannerVisitor(QVector<AttributePointer>() << AttributeRegistry::getInstance()->getSpannersAttribute(),
-        QVector<AttributePointer>(), QVector<AttributePointer>() << AttributeRegistry::getInstance()->getColorAttribute() <<
-            AttributeRegistry::getInstance()->getNormalAttribute() <<
-            AttributeRegistry::getInstance()->getSpannerColorAttribute() <<
-            AttributeRegistry::getInstance()->getSpannerNormalAttribute()),
-    _points(points) {
+MetavoxelSystem::SimulateVisitor::SimulateVisitor() :
+    SpannerVisitor(QVector<AttributePointer>() << AttributeRegistry::getInstance()->getSpannersAttribute()) {
 }
 
 bool MetavoxelSystem::SimulateVisitor::visit(Spanner* spanner, const glm::vec3& clipMinimum, float clipSize) {
@@ -182,12 +198,42 @@ bool MetavoxelSystem::SimulateVisitor::visit(Spanner* spanner, const glm::vec3&
     return true;
 }
 
-int MetavoxelSystem::SimulateVisitor::visit(MetavoxelInfo& info) {
-    SpannerVisitor::visit(info);
+MetavoxelVisitor* MetavoxelSystem::SimulateVisitor::clone() const {
+    return new SimulateVisitor(*this);
+}
 
+MetavoxelSystem::PointVisitor::PointVisitor() :
+    MetavoxelVisitor(QVector<AttributePointer>() << AttributeRegistry::getInstance()->getColorAttribute() <<
+        AttributeRegistry::getInstance()->getNormalAttribute() <<
+        AttributeRegistry::getInstance()->getSpannerColorAttribute() <<
+        AttributeRegistry::getInstance()->getSpannerNormalAttribute()),
+    _points(NULL),
+    _order(DEFAULT_ORDER),
+    _foundTranslucent(false) {
+}
+
+MetavoxelVisitor* MetavoxelSystem::PointVisitor::clone() const {
+    PointVisitor* visitor = new PointVisitor(*this);
+    visitor->_points = &visitor->_clonePoints;
+    visitor->_foundTranslucent = false;
+    return visitor;
+}
+
+bool MetavoxelSystem::PointVisitor::merge(MetavoxelVisitor& clone) {
+    PointVisitor& pointClone = static_cast<PointVisitor&>(clone);
+    *_points += pointClone._clonePoints;
+    _foundTranslucent |= pointClone._foundTranslucent;
+    return true;
+}
+
+int MetavoxelSystem::PointVisitor::visit(MetavoxelInfo& info) {
+    if (!(_regions.isEmpty() || MetavoxelData::overlapsRegions(info.getCenter(), info.size, _regions))) {
+        return STOP_RECURSION;
+    }
     if (!info.isLeaf) {
         return _order;
     }
+    int previousSize = _points->size();
     QRgb color = info.inputValues.at(0).getInlineValue<QRgb>();
     QRgb normal = info.inputValues.at(1).getInlineValue<QRgb>();
     quint8 alpha = qAlpha(color);
@@ -196,7 +242,7 @@ int MetavoxelSystem::SimulateVisitor::visit(MetavoxelInfo& info) {
             Point point = { glm::vec4(info.minimum + glm::vec3(info.size, info.size, info.size) * 0.5f, info.size),
                 { quint8(qRed(color)), quint8(qGreen(color)), quint8(qBlue(color)), alpha }, 
                 { quint8(qRed(normal)), quint8(qGreen(normal)), quint8(qBlue(normal)) } };
-            _points.append(point);
+            _points->append(point);
         }
     } else {
         QRgb spannerColor = info.inputValues.at(2).getInlineValue<QRgb>();
@@ -207,21 +253,25 @@ int MetavoxelSystem::SimulateVisitor::visit(MetavoxelInfo& info) {
                 Point point = { glm::vec4(info.minimum + glm::vec3(info.size, info.size, info.size) * 0.5f, info.size),
                     { quint8(qRed(spannerColor)), quint8(qGreen(spannerColor)), quint8(qBlue(spannerColor)), spannerAlpha }, 
                     { quint8(qRed(spannerNormal)), quint8(qGreen(spannerNormal)), quint8(qBlue(spannerNormal)) } };
-                _points.append(point);
+                _points->append(point);
                 
             } else {
                 Point point = { glm::vec4(info.minimum + glm::vec3(info.size, info.size, info.size) * 0.5f, info.size),
                     { quint8(qRed(spannerColor)), quint8(qGreen(spannerColor)), quint8(qBlue(spannerColor)), spannerAlpha }, 
                     { quint8(qRed(spannerNormal)), quint8(qGreen(spannerNormal)), quint8(qBlue(spannerNormal)) } };
-                _points.append(point);
+                _points->append(point);
             }
         } else if (alpha > 0) {
             Point point = { glm::vec4(info.minimum + glm::vec3(info.size, info.size, info.size) * 0.5f, info.size),
                 { quint8(qRed(color)), quint8(qGreen(color)), quint8(qBlue(color)), alpha }, 
                 { quint8(qRed(normal)), quint8(qGreen(normal)), quint8(qBlue(normal)) } };
-            _points.append(point);
+            _points->append(point);
         }
     }
+    const quint8 OPAQUE_ALPHA = 255;
+    if (_points->size() > previousSize && _points->last().color[3] < OPAQUE_ALPHA) {
+        _foundTranslucent = true;
+    }
     return STOP_RECURSION;
 }
 
@@ -235,19 +285,21 @@ bool MetavoxelSystem::RenderVisitor::visit(Spanner* spanner, const glm::vec3& cl
     return true;
 }
 
+MetavoxelVisitor* MetavoxelSystem::RenderVisitor::clone() const {
+    return new RenderVisitor(*this);
+}
+
 MetavoxelClient::MetavoxelClient(const SharedNodePointer& node) :
     _node(node),
-    _sequencer(byteArrayWithPopulatedHeader(PacketTypeMetavoxelData)) {
+    _sequencer(byteArrayWithPopulatedHeader(PacketTypeMetavoxelData)),
+    _pointsValid(false),
+    _pointsOrder(MetavoxelVisitor::DEFAULT_ORDER),
+    _pointsTranslucent(false) {
     
     connect(&_sequencer, SIGNAL(readyToWrite(const QByteArray&)), SLOT(sendData(const QByteArray&)));
     connect(&_sequencer, SIGNAL(readyToRead(Bitstream&)), SLOT(readPacket(Bitstream&)));
-    connect(&_sequencer, SIGNAL(sendAcknowledged(int)), SLOT(clearSendRecordsBefore(int)));
     connect(&_sequencer, SIGNAL(receiveAcknowledged(int)), SLOT(clearReceiveRecordsBefore(int)));
     
-    // insert the baseline send record
-    SendRecord sendRecord = { 0 };
-    _sendRecords.append(sendRecord);
-    
     // insert the baseline receive record
     ReceiveRecord receiveRecord = { 0, _data };
     _receiveRecords.append(receiveRecord);
@@ -262,7 +314,13 @@ MetavoxelClient::~MetavoxelClient() {
 
 static MetavoxelLOD getLOD() {
     const float FIXED_LOD_THRESHOLD = 0.01f;
-    return MetavoxelLOD(Application::getInstance()->getCamera()->getPosition(), FIXED_LOD_THRESHOLD);
+    
+    // snap the position to a grid so that clients standing together ask for the same level of detail, which lets the
+    // server share its encoding of their updates
+    const float LOD_POSITION_GRANULARITY = 0.25f;
+    glm::vec3 position = glm::floor(Application::getInstance()->getCamera()->getPosition() / LOD_POSITION_GRANULARITY +
+        glm::vec3(0.5f, 0.5f, 0.5f)) * LOD_POSITION_GRANULARITY;
+    return MetavoxelLOD(position, FIXED_LOD_THRESHOLD);
 }
 
 void MetavoxelClient::guide(MetavoxelVisitor& visitor) {
@@ -276,7 +334,9 @@ void MetavoxelClient::applyEdit(const MetavoxelEditMessage& edit, bool reliable)
     
     } else {
         // apply immediately to local tree
+        MetavoxelData previousData = _data;
         edit.apply(_data, _sequencer.getWeakSharedObjectHash());
+        _data.getChangedRegions(previousData, _changedRegions);
 
         // start sending it out
         _sequencer.sendHighPriorityMessage(QVariant::fromValue(edit));
@@ -289,10 +349,56 @@ void MetavoxelClient::simulate(float deltaTime) {
     ClientStateMessage state = { getLOD() };
     out << QVariant::fromValue(state);
     _sequencer.endPacket();
+}
+
+bool MetavoxelClient::updatePoints(MetavoxelSystem::PointVisitor& visitor) {
+    MetavoxelLOD lod = getLOD();
     
-    // record the send
-    SendRecord record = { _sequencer.getOutgoingPacketNumber(), state.lod };
-    _sendRecords.append(record);
+    // past a point, it's cheaper to start from scratch than to check every point against every region; translucent
+    // points must stay in visitation order (back to front), which replacing points at the end would break
+    const int MAX_CHANGED_REGIONS = 64;
+    bool rebuild = !_pointsValid || lod != _pointsLOD || visitor.getOrder() != _pointsOrder ||
+        _changedRegions.size() > MAX_CHANGED_REGIONS || (_pointsTranslucent && !_changedRegions.isEmpty());
+    if (rebuild) {
+        _points.clear();
+        visitor.setRegions(QVector<Box>());
+        _pointsValid = true;
+        _pointsLOD = lod;
+        _pointsOrder = visitor.getOrder();
+        
+    } else if (_changedRegions.isEmpty()) {
+        return false;
+        
+    } else {
+        // remove the points in the changed regions, keeping the rest where they are; their replacements go on the end
+        MetavoxelSystem::Point* points = _points.data();
+        int pointCount = 0;
+        for (int i = 0; i < _points.size(); i++) {
+            if (!MetavoxelData::overlapsRegions(glm::vec3(points[i].vertex), points[i].vertex.w, _changedRegions)) {
+                points[pointCount++] = points[i];
+            }
+        }
+        _points.resize(pointCount);
+        visitor.setRegions(_changedRegions);
+    }
+    _changedRegions.clear();
+    
+    visitor.setPoints(_points);
+    visitor.setLOD(lod);
+    _data.guide(visitor);
+    
+    if (rebuild) {
+        _pointsTranslucent = visitor.foundTranslucent();
+    
+    } else if (visitor.foundTranslucent()) {
+        // the changed regions brought in translucent points, which went on the end; start over to put them in order
+        _points.clear();
+        visitor.setRegions(QVector<Box>());
+        visitor.setPoints(_points);
+        _data.guide(visitor);
+        _pointsTranslucent = true;
+    }
+    return true;
 }
 
 int MetavoxelClient::parseData(const QByteArray& packet) {
@@ -308,12 +414,13 @@ void MetavoxelClient::sendData(const QByteArray& data) {
 }
 
 void MetavoxelClient::readPacket(Bitstream& in) {
+    MetavoxelData previousData = _data;
     QVariant message;
     in >> message;
     handleMessage(message, in);
     
     // record the receipt
-    ReceiveRecord record = { _sequencer.getIncomingPacketNumber(), _data, _sendRecords.first().lod };
+    ReceiveRecord record = { _sequencer.getIncomingPacketNumber(), _data, _dataLOD };
     _receiveRecords.append(record);
     
     // reapply local edits
@@ -322,10 +429,7 @@ void MetavoxelClient::readPacket(Bitstream& in) {
             message.data.value<MetavoxelEditMessage>().apply(_data, _sequencer.getWeakSharedObjectHash());
         }
     }
-}
-
-void MetavoxelClient::clearSendRecordsBefore(int index) {
-    _sendRecords.erase(_sendRecords.begin(), _sendRecords.begin() + index + 1);
+    _data.getChangedRegions(previousData, _changedRegions);
 }
 
 void MetavoxelClient::clearReceiveRecordsBefore(int index) {
@@ -335,7 +439,9 @@ void MetavoxelClient::clearReceiveRecordsBefore(int index) {
 void MetavoxelClient::handleMessage(const QVariant& message, Bitstream& in) {
     int userType = message.userType();
     if (userType == MetavoxelDeltaMessage::Type) {
-        _data.readDelta(_receiveRecords.first().data, _receiveRecords.first().lod, in, _sendRecords.first().lod);
+        // the server tells us the level of detail it wrote at, which may be coarser than the one we asked for
+        _dataLOD = message.value<MetavoxelDeltaMessage>().lod;
+        _data.readDelta(_receiveRecords.first().data, _receiveRecords.first().lod, in, _dataLOD);
         
     } else if (userType == QMetaType::QVariantList) {
         foreach (const QVariant& element, message.toList()) {
@@ -34,6 +34,39 @@ class MetavoxelSystem : public QObject {
 
 public:
 
+    class Point {
+    public:
+        glm::vec4 vertex;
+        quint8 color[4];
+        quint8 normal[3];
+    };
+    
+    /// Generates the points for the voxels, optionally only those within a set of regions.
+    class PointVisitor : public MetavoxelVisitor {
+    public:
+        PointVisitor();
+        void setPoints(QVector<Point>& points) { _points = &points; _foundTranslucent = false; }
+        void setOrder(const glm::vec3& direction) { _order = encodeOrder(direction); }
+        int getOrder() const { return _order; }
+        
+        /// Checks whether any of the points generated since setPoints was called are translucent.
+        bool foundTranslucent() const { return _foundTranslucent; }
+        
+        /// Limits the visit to the voxels overlapping the specified regions, or, if empty, lifts the limit.
+        void setRegions(const QVector<Box>& regions) { _regions = regions; }
+        
+        virtual int visit(MetavoxelInfo& info);
+        virtual MetavoxelVisitor* clone() const;
+        virtual bool merge(MetavoxelVisitor& clone);
+    
+    private:
+        QVector<Point>* _points;
+        QVector<Point> _clonePoints; ///< where clones put their points until they're merged
+        int _order;
+        QVector<Box> _regions;
+        bool _foundTranslucent;
+    };
+    
     MetavoxelSystem();
 
     void init();
@@ -52,38 +85,33 @@ private slots:
 
 private:
     
-    class Point {
-    public:
-        glm::vec4 vertex;
-        quint8 color[4];
-        quint8 normal[3];
-    };
-    
+    /// Simulates the spanners' renderers.
     class SimulateVisitor : public SpannerVisitor {
     public:
-        SimulateVisitor(QVector<Point>& points);
+        SimulateVisitor();
         void setDeltaTime(float deltaTime) { _deltaTime = deltaTime; }
-        void setOrder(const glm::vec3& direction) { _order = encodeOrder(direction); }
         virtual bool visit(Spanner* spanner, const glm::vec3& clipMinimum, float clipSize);
-        virtual int visit(MetavoxelInfo& info);
+        virtual MetavoxelVisitor* clone() const;
     
     private:
-        QVector<Point>& _points;
         float _deltaTime;
-        int _order;
     };
     
+    /// Renders on the calling thread; clones only gather the spanners to render.
     class RenderVisitor : public SpannerVisitor {
     public:
         RenderVisitor();
         virtual bool visit(Spanner* spanner, const glm::vec3& clipMinimum, float clipSize);
+        virtual MetavoxelVisitor* clone() const;
     };
     
     static ProgramObject _program;
     static int _pointScaleLocation;
     
-    QVector<Point> _points;
+    int _pointCount;
+    int _pointClientCount;
     SimulateVisitor _simulateVisitor;
+    PointVisitor _pointVisitor;
     RenderVisitor _renderVisitor;
     QOpenGLBuffer _buffer;
 };
@@ -105,6 +133,14 @@ public:
 
     void simulate(float deltaTime);
 
+    /// Brings our points up to date with our data.  Only the points in the regions that have changed since the last update
+    /// are regenerated, unless the level of detail or the visitation order has changed as well, or translucent points are
+    /// involved: the replacements go on the end rather than in visitation order, which only opaque points can afford.
+    /// \return true if the points changed
+    bool updatePoints(MetavoxelSystem::PointVisitor& visitor);
+    
+    const QVector<MetavoxelSystem::Point>& getPoints() const { return _points; }
+
     virtual int parseData(const QByteArray& packet);
 
 private slots:
@@ -113,20 +149,12 @@ private slots:
 
     void readPacket(Bitstream& in);
     
-    void clearSendRecordsBefore(int index);
-    
     void clearReceiveRecordsBefore(int index);
     
 private:
     
     void handleMessage(const QVariant& message, Bitstream& in);
     
-    class SendRecord {
-    public:
-        int packetNumber;
-        MetavoxelLOD lod;
-    };
-    
     class ReceiveRecord {
     public:
         int packetNumber;
@@ -139,9 +167,18 @@ private:
     DatagramSequencer _sequencer;
     
     MetavoxelData _data;
+    MetavoxelLOD _dataLOD;
     
-    QList<SendRecord> _sendRecords;
     QList<ReceiveRecord> _receiveRecords;
+    
+    QVector<MetavoxelSystem::Point> _points;
+    bool _pointsValid;
+    MetavoxelLOD _pointsLOD;
+    int _pointsOrder;
+    bool _pointsTranslucent;
+    
+    /// the bounds of the nodes that changed since the points were last updated
+    QVector<Box> _changedRegions;
 };
 
 /// Base class for spanner renderers; provides clipping.
@@ -97,6 +97,18 @@ float Avatar::getLODDistance() const {
         glm::distance(Application::getInstance()->getCamera()->getPosition(), _position) / _scale;
 }
 
+Model* Avatar::prepareSkeletonForSimulation() {
+    if (!_hasNewJointRotations || _shouldRenderBillboard || !_skeletonModel.isActive() || !isInViewFrustum()) {
+        return NULL;
+    }
+    for (int i = 0; i < _jointData.size(); i++) {
+        const JointData& data = _jointData.at(i);
+        _skeletonModel.setJointState(i, data.valid, data.rotation);
+    }
+    _skeletonModel.setTransformFromOwningAvatar();
+    return &_skeletonModel;
+}
+
 void Avatar::simulate(float deltaTime) {
     if (_scale != _targetScale) {
         setScale(_targetScale);
@@ -112,21 +124,15 @@ void Avatar::simulate(float deltaTime) {
         _shouldRenderBillboard = true;
     }
 
-    // simple frustum check
-    float boundingRadius = getBillboardSize();
-    bool inViewFrustum = Application::getInstance()->getViewFrustum()->sphereInFrustum(_position, boundingRadius) !=
-        ViewFrustum::OUTSIDE;
-
     getHand()->simulate(deltaTime, false);
     _skeletonModel.setLODDistance(getLODDistance());
     
-    if (!_shouldRenderBillboard && inViewFrustum) {
+    if (!_shouldRenderBillboard && isInViewFrustum()) {
         if (_hasNewJointRotations) {
             for (int i = 0; i < _jointData.size(); i++) {
                 const JointData& data = _jointData.at(i);
                 _skeletonModel.setJointState(i, data.valid, data.rotation);
             }
-            _skeletonModel.simulate(deltaTime);
         }
         _skeletonModel.simulate(deltaTime, _hasNewJointRotations);
         _hasNewJointRotations = false;
@@ -402,6 +408,12 @@ void Avatar::renderBillboard() {
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+bool Avatar::isInViewFrustum() const {
+    // simple frustum check
+    return Application::getInstance()->getViewFrustum()->sphereInFrustum(_position, getBillboardSize()) !=
+        ViewFrustum::OUTSIDE;
+}
+
 float Avatar::getBillboardSize() const {
     return _scale * BILLBOARD_DISTANCE * tanf(glm::radians(BILLBOARD_FIELD_OF_VIEW / 2.0f));
 }
@@ -78,6 +78,11 @@ public:
     void init();
     void simulate(float deltaTime);
     
+    /// Applies the latest joint data to the skeleton ahead of simulate().
+    /// \return the skeleton model if simulate() will compute its joint transforms this frame, so that they can be
+    /// computed ahead of time along with those of the other avatars, or NULL if it won't
+    Model* prepareSkeletonForSimulation();
+    
     enum RenderMode { NORMAL_RENDER_MODE, SHADOW_RENDER_MODE, MIRROR_RENDER_MODE };
     
     virtual void render(const glm::vec3& cameraPosition, RenderMode renderMode = NORMAL_RENDER_MODE);
@@ -201,6 +206,7 @@ private:
     void renderBillboard();
     
     float getBillboardSize() const;
+    bool isInViewFrustum() const;
 };
 
 #endif // hifi_Avatar_h
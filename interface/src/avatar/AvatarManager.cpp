@@ -11,6 +11,8 @@
 
 #include <string>
 
+#include <QtCore/QRunnable>
+
 #include <glm/gtx/string_cast.hpp>
 
 #include <PerfStat.h>
@@ -26,6 +28,24 @@
 // We add _myAvatar into the hash with all the other AvatarData, and we use the default NULL QUid as the key.
 const QUuid MY_AVATAR_KEY;  // NULL key
 
+/// fewer skeletons than this per thread and it's cheaper to update them all on the calling thread
+const int MIN_SKELETONS_PER_UPDATER = 4;
+
+class JointStateUpdater : public QRunnable {
+public:
+    JointStateUpdater(Model* const* skeletons, int count) : _skeletons(skeletons), _count(count) { }
+    
+    virtual void run() {
+        for (int i = 0; i < _count; i++) {
+            _skeletons[i]->updateJointStates();
+        }
+    }
+    
+private:
+    Model* const* _skeletons;
+    int _count;
+};
+
 AvatarManager::AvatarManager(QObject* parent) :
     _avatarFades() {
     // register a meta type for the weak pointer we'll use for the owning avatar mixer for each avatar
@@ -48,7 +68,9 @@ void AvatarManager::updateOtherAvatars(float deltaTime) {
     glm::vec3 mouseOrigin = applicationInstance->getMouseRayOrigin();
     glm::vec3 mouseDirection = applicationInstance->getMouseRayDirection();
 
-    // simulate avatars
+    // find the avatars to simulate, and the skeletons whose joints they'll need
+    _avatarsToSimulate.resize(0);
+    _skeletonsToUpdate.resize(0);
     AvatarHash::iterator avatarIterator = _avatarHash.begin();
     while (avatarIterator != _avatarHash.end()) {
         Avatar* avatar = static_cast<Avatar*>(avatarIterator.value().data());
@@ -60,8 +82,11 @@ void AvatarManager::updateOtherAvatars(float deltaTime) {
         }
         if (avatar->getOwningAvatarMixer()) {
             // this avatar's mixer is still around, go ahead and simulate it
-            avatar->simulate(deltaTime);
-            avatar->setMouseRay(mouseOrigin, mouseDirection);
+            _avatarsToSimulate.append(avatar);
+            Model* skeleton = avatar->prepareSkeletonForSimulation();
+            if (skeleton) {
+                _skeletonsToUpdate.append(skeleton);
+            }
             ++avatarIterator;
         } else {
             // the mixer that owned this avatar is gone, give it to the vector of fades and kill it
@@ -69,10 +94,37 @@ void AvatarManager::updateOtherAvatars(float deltaTime) {
         }
     }
     
+    // the joint hierarchies are walked for all avatars at once, then simulating each avatar picks up its results
+    updateSkeletonJointStates();
+    
+    foreach (Avatar* avatar, _avatarsToSimulate) {
+        avatar->simulate(deltaTime);
+        avatar->setMouseRay(mouseOrigin, mouseDirection);
+    }
+    
     // simulate avatar fades
     simulateAvatarFades(deltaTime);
 }
 
+void AvatarManager::updateSkeletonJointStates() {
+    int skeletonCount = _skeletonsToUpdate.size();
+    int updaterCount = qMin(skeletonCount / MIN_SKELETONS_PER_UPDATER, _jointUpdatePool.maxThreadCount());
+    if (updaterCount <= 1) {
+        foreach (Model* skeleton, _skeletonsToUpdate) {
+            skeleton->updateJointStates();
+        }
+        return;
+    }
+    int skeletonsPerUpdater = skeletonCount / updaterCount;
+    for (int i = 0; i < updaterCount - 1; i++) {
+        _jointUpdatePool.start(new JointStateUpdater(_skeletonsToUpdate.constData() + i * skeletonsPerUpdater,
+            skeletonsPerUpdater));
+    }
+    int lastBegin = (updaterCount - 1) * skeletonsPerUpdater;
+    JointStateUpdater(_skeletonsToUpdate.constData() + lastBegin, skeletonCount - lastBegin).run();
+    _jointUpdatePool.waitForDone();
+}
+
 void AvatarManager::renderAvatars(Avatar::RenderMode renderMode, bool selfAvatarOnly) {
     PerformanceWarning warn(Menu::getInstance()->isOptionChecked(MenuOption::PipelineWarnings),
                             "Application::renderAvatars()");
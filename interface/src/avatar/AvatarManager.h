@@ -15,6 +15,8 @@
 #include <QtCore/QHash>
 #include <QtCore/QObject>
 #include <QtCore/QSharedPointer>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVector>
 
 #include <AvatarHashMap.h>
 
@@ -49,6 +51,9 @@ private:
     void processAvatarBillboardPacket(const QByteArray& packet, const QWeakPointer<Node>& mixerWeakPointer);
     void processKillAvatar(const QByteArray& datagram);
 
+    /// Computes the joint transforms of the skeletons in _skeletonsToUpdate, spread over the worker threads.
+    void updateSkeletonJointStates();
+    
     void simulateAvatarFades(float deltaTime);
     void renderAvatarFades(const glm::vec3& cameraPosition, Avatar::RenderMode renderMode);
     
@@ -57,6 +62,12 @@ private:
     
     QVector<AvatarSharedPointer> _avatarFades;
     QSharedPointer<MyAvatar> _myAvatar;
+    
+    // kept from frame to frame so that their memory is reused
+    QVector<Avatar*> _avatarsToSimulate;
+    QVector<Model*> _skeletonsToUpdate;
+    
+    QThreadPool _jointUpdatePool;
 };
 
 #endif // hifi_AvatarManager_h
@@ -25,6 +25,9 @@ public:
     SkeletonModel(Avatar* owningAvatar);
     
     void simulate(float deltaTime, bool fullUpdate = true);
+    
+    /// Places the model at the owning avatar's position, orientation and scale.
+    void setTransformFromOwningAvatar();
 
     /// \param jointIndex index of hand joint
     /// \param shapes[out] list in which is stored pointers to hand shapes
@@ -9,6 +9,9 @@
 //
 
 #include "Application.h"
+#include "renderer/Blendshapes.h"
+#include "renderer/FBXCache.h"
+#include "renderer/TextureMips.h"
 
 #include <QDebug>
 #include <QDir>
@@ -30,6 +33,37 @@ int main(int argc, const char * argv[]) {
         qDebug("clockSkewOption=%s clockSkew=%d", clockSkewOption, clockSkew);
     }
     
+    // Times the blendshape evaluation of the given FBX file, headless, and exits
+    const char* BENCHMARK_BLENDSHAPES = "--benchmarkBlendshapes";
+    const char* benchmarkBlendshapesOption = getCmdOption(argc, argv, BENCHMARK_BLENDSHAPES);
+    if (benchmarkBlendshapesOption) {
+        benchmarkBlendshapes(benchmarkBlendshapesOption);
+        return 0;
+    }
+    
+    // Times parsing a comma-separated list of FBX files against loading them from the binary cache, and exits
+    const char* BENCHMARK_FBX_CACHE = "--benchmarkFBXCache";
+    const char* benchmarkFBXCacheOption = getCmdOption(argc, argv, BENCHMARK_FBX_CACHE);
+    if (benchmarkFBXCacheOption) {
+        benchmarkFBXCache(QString(benchmarkFBXCacheOption).split(','), QString::fromLocal8Bit(argv[0]));
+        return 0;
+    }
+    
+    // Used by the benchmark above to check that the cache key is the same in another process
+    const char* printFBXCachePathOption = getCmdOption(argc, argv, PRINT_FBX_CACHE_PATH_OPTION);
+    if (printFBXCachePathOption) {
+        printFBXCachePath(printFBXCachePathOption);
+        return 0;
+    }
+    
+    // Times decoding a comma-separated list of image files into texture mip chains, headless, and exits
+    const char* BENCHMARK_TEXTURE_DECODING = "--benchmarkTextureDecoding";
+    const char* benchmarkTextureDecodingOption = getCmdOption(argc, argv, BENCHMARK_TEXTURE_DECODING);
+    if (benchmarkTextureDecodingOption) {
+        benchmarkTextureDecoding(QString(benchmarkTextureDecodingOption).split(','));
+        return 0;
+    }
+    
     int exitCode;
     {
         QSettings::setDefaultFormat(QSettings::IniFormat);
@@ -0,0 +1,174 @@
+//
+//  Blendshapes.cpp
+//  interface/src/renderer
+//
+//  Created by Andrzej Kapolka on 5/23/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <cstring>
+#include <xmmintrin.h>
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QtDebug>
+
+#include <SharedUtil.h>
+
+#include "Blendshapes.h"
+
+const float NORMAL_COEFFICIENT_SCALE = 0.01f;
+
+/// Adds one blendshape's scaled deltas to the vertices and normals of its mesh.
+static void accumulateBlendshape(const FBXBlendshape& blendshape, float vertexCoefficient, float normalCoefficient,
+        glm::vec3* vertices, glm::vec3* normals) {
+    int count = blendshape.indices.size();
+    if (count == 0) {
+        return;
+    }
+    const int* indices = blendshape.indices.constData();
+    const float* vertexDeltas = reinterpret_cast<const float*>(blendshape.vertices.constData());
+    const float* normalDeltas = reinterpret_cast<const float*>(blendshape.normals.constData());
+    
+    // each vector is read and written as four floats, the last of which belongs to the next vector and has zero added to
+    // it; the deltas are read the same way, so the last of them is added on its own
+    __m128 vertexScale = _mm_setr_ps(vertexCoefficient, vertexCoefficient, vertexCoefficient, 0.0f);
+    __m128 normalScale = _mm_setr_ps(normalCoefficient, normalCoefficient, normalCoefficient, 0.0f);
+    int last = count - 1;
+    for (int i = 0; i < last; i++) {
+        float* vertex = reinterpret_cast<float*>(vertices + indices[i]);
+        _mm_storeu_ps(vertex, _mm_add_ps(_mm_loadu_ps(vertex), _mm_mul_ps(_mm_loadu_ps(vertexDeltas + i * 3), vertexScale)));
+        
+        float* normal = reinterpret_cast<float*>(normals + indices[i]);
+        _mm_storeu_ps(normal, _mm_add_ps(_mm_loadu_ps(normal), _mm_mul_ps(_mm_loadu_ps(normalDeltas + i * 3), normalScale)));
+    }
+    vertices[indices[last]] += blendshape.vertices.at(last) * vertexCoefficient;
+    normals[indices[last]] += blendshape.normals.at(last) * normalCoefficient;
+}
+
+void blendMeshes(const QVector<FBXMesh>& meshes, const QVector<float>& coefficients,
+        QVector<glm::vec3>& vertices, QVector<glm::vec3>& normals) {
+    int vertexCount = 0;
+    foreach (const FBXMesh& mesh, meshes) {
+        if (!mesh.blendshapes.isEmpty()) {
+            vertexCount += mesh.vertices.size();
+        }
+    }
+    // the extra element keeps the four-float writes to the last vertex in bounds
+    vertices.resize(vertexCount + 1);
+    normals.resize(vertexCount + 1);
+    
+    glm::vec3* meshVertices = vertices.data();
+    glm::vec3* meshNormals = normals.data();
+    foreach (const FBXMesh& mesh, meshes) {
+        if (mesh.blendshapes.isEmpty()) {
+            continue;
+        }
+        memcpy(meshVertices, mesh.vertices.constData(), mesh.vertices.size() * sizeof(glm::vec3));
+        memcpy(meshNormals, mesh.normals.constData(), mesh.normals.size() * sizeof(glm::vec3));
+        
+        for (int i = 0, n = qMin(coefficients.size(), mesh.blendshapes.size()); i < n; i++) {
+            float vertexCoefficient = coefficients.at(i);
+            if (vertexCoefficient < EPSILON) {
+                continue;
+            }
+            accumulateBlendshape(mesh.blendshapes.at(i), vertexCoefficient, vertexCoefficient * NORMAL_COEFFICIENT_SCALE,
+                meshVertices, meshNormals);
+        }
+        meshVertices += mesh.vertices.size();
+        meshNormals += mesh.vertices.size();
+    }
+}
+
+/// The blend as Blender used to do it, for comparison.
+static void blendMeshesScalar(const QVector<FBXMesh>& meshes, const QVector<float>& coefficients,
+        QVector<glm::vec3>& vertices, QVector<glm::vec3>& normals) {
+    vertices = QVector<glm::vec3>();
+    normals = QVector<glm::vec3>();
+    int offset = 0;
+    foreach (const FBXMesh& mesh, meshes) {
+        if (mesh.blendshapes.isEmpty()) {
+            continue;
+        }
+        vertices += mesh.vertices;
+        normals += mesh.normals;
+        glm::vec3* meshVertices = vertices.data() + offset;
+        glm::vec3* meshNormals = normals.data() + offset;
+        offset += mesh.vertices.size();
+        for (int i = 0, n = qMin(coefficients.size(), mesh.blendshapes.size()); i < n; i++) {
+            float vertexCoefficient = coefficients.at(i);
+            if (vertexCoefficient < EPSILON) {
+                continue;
+            }
+            float normalCoefficient = vertexCoefficient * NORMAL_COEFFICIENT_SCALE;
+            const FBXBlendshape& blendshape = mesh.blendshapes.at(i);
+            for (int j = 0; j < blendshape.indices.size(); j++) {
+                int index = blendshape.indices.at(j);
+                meshVertices[index] += blendshape.vertices.at(j) * vertexCoefficient;
+                meshNormals[index] += blendshape.normals.at(j) * normalCoefficient;
+            }
+        }
+    }
+}
+
+void benchmarkBlendshapes(const QString& filename) {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "Couldn't open" << filename;
+        return;
+    }
+    FBXGeometry geometry = readFBX(file.readAll(), QVariantHash());
+    int blendshapeCount = 0;
+    int vertexCount = 0;
+    foreach (const FBXMesh& mesh, geometry.meshes) {
+        if (!mesh.blendshapes.isEmpty()) {
+            blendshapeCount = qMax(blendshapeCount, mesh.blendshapes.size());
+            vertexCount += mesh.vertices.size();
+        }
+    }
+    if (blendshapeCount == 0) {
+        qDebug() << filename << "has no blendshapes.";
+        return;
+    }
+    
+    // cycle through a few expressions, each with about a third of the blendshapes in use
+    const int EXPRESSION_COUNT = 16;
+    QVector<QVector<float> > expressions(EXPRESSION_COUNT);
+    for (int i = 0; i < EXPRESSION_COUNT; i++) {
+        expressions[i].resize(blendshapeCount);
+        for (int j = 0; j < blendshapeCount; j++) {
+            expressions[i][j] = (randFloat() < 0.33f) ? randFloat() : 0.0f;
+        }
+    }
+    
+    const int BLEND_COUNT = 1000;
+    QVector<glm::vec3> scalarVertices, scalarNormals;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < BLEND_COUNT; i++) {
+        blendMeshesScalar(geometry.meshes, expressions.at(i % EXPRESSION_COUNT), scalarVertices, scalarNormals);
+    }
+    qint64 scalarNsecs = timer.nsecsElapsed();
+    
+    QVector<glm::vec3> vertices, normals;
+    timer.restart();
+    for (int i = 0; i < BLEND_COUNT; i++) {
+        blendMeshes(geometry.meshes, expressions.at(i % EXPRESSION_COUNT), vertices, normals);
+    }
+    qint64 nsecs = timer.nsecsElapsed();
+    
+    float maxDifference = 0.0f;
+    for (int i = 0; i < scalarVertices.size(); i++) {
+        maxDifference = qMax(maxDifference, glm::length(vertices.at(i) - scalarVertices.at(i)));
+        maxDifference = qMax(maxDifference, glm::length(normals.at(i) - scalarNormals.at(i)));
+    }
+    
+    const float NSECS_PER_USEC = 1000.0f;
+    qDebug() << filename << "-" << vertexCount << "blended vertices," << blendshapeCount << "blendshapes";
+    qDebug() << "    scalar:" << scalarNsecs / (BLEND_COUNT * NSECS_PER_USEC) << "usecs per blend";
+    qDebug() << "    blendMeshes:" << nsecs / (BLEND_COUNT * NSECS_PER_USEC) << "usecs per blend";
+    qDebug() << "    largest difference:" << maxDifference;
+}
@@ -0,0 +1,28 @@
+//
+//  Blendshapes.h
+//  interface/src/renderer
+//
+//  Created by Andrzej Kapolka on 5/23/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_Blendshapes_h
+#define hifi_Blendshapes_h
+
+#include <QVector>
+
+#include "FBXReader.h"
+
+/// Applies blendshape coefficients to the meshes that have blendshapes, writing their vertices and normals end to end.
+/// The outputs are resized rather than rebuilt and are left one element longer than the meshes need (the blendshapes are
+/// added four floats at a time), so handing the same vectors back in every frame reuses their memory.
+void blendMeshes(const QVector<FBXMesh>& meshes, const QVector<float>& coefficients,
+    QVector<glm::vec3>& vertices, QVector<glm::vec3>& normals);
+
+/// Loads the FBX file at the specified path and times blendMeshes() on it against a plain scalar blend.
+void benchmarkBlendshapes(const QString& filename);
+
+#endif // hifi_Blendshapes_h
@@ -0,0 +1,474 @@
+//
+//  FBXCache.cpp
+//  interface/src/renderer
+//
+//  Created by Andrzej Kapolka on 5/24/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QProcess>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QTextStream>
+#include <QtAlgorithms>
+#include <QtDebug>
+
+#include "FBXCache.h"
+
+const quint32 FBX_CACHE_MAGIC = 0x48464258; // "HFBX"
+
+/// Bump this whenever FBXGeometry or the way it's extracted changes, so that stale copies are ignored.
+const quint32 FBX_CACHE_VERSION = 1;
+
+/// The arrays are written as they lie in memory, so only copies made on the same kind of machine can be read back.
+const quint32 FBX_CACHE_LAYOUT = (sizeof(glm::vec3) << 24) | (sizeof(glm::quat) << 16) | (sizeof(glm::mat4) << 8) |
+    sizeof(int);
+
+const QString FBX_CACHE_DIRECTORY = "geometry";
+const QString FBX_CACHE_SUFFIX = ".fbxcache";
+
+/// Once the cached copies take up more than this, the least recently used are removed as new ones are written.
+const qint64 MAX_FBX_CACHE_SIZE = 256 * 1024 * 1024;
+
+template<class T> static void writeRaw(QDataStream& out, const T& value) {
+    out.writeRawData(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<class T> static void readRaw(QDataStream& in, T& value) {
+    if (in.readRawData(reinterpret_cast<char*>(&value), sizeof(T)) != (int)sizeof(T)) {
+        in.setStatus(QDataStream::ReadPastEnd);
+    }
+}
+
+template<class T> static void writeRawArray(QDataStream& out, const QVector<T>& values) {
+    out << (quint32)values.size();
+    out.writeRawData(reinterpret_cast<const char*>(values.constData()), values.size() * sizeof(T));
+}
+
+template<class T> static void readRawArray(QDataStream& in, QVector<T>& values) {
+    quint32 size;
+    in >> size;
+    qint64 bytes = (qint64)size * sizeof(T);
+    if (in.status() != QDataStream::Ok || bytes > in.device()->bytesAvailable()) {
+        in.setStatus(QDataStream::ReadCorruptData);
+        return;
+    }
+    values.resize(size);
+    in.readRawData(reinterpret_cast<char*>(values.data()), bytes);
+}
+
+/// Writes a vector of records with the function that writes each one.
+template<class T> static void writeArray(QDataStream& out, const QVector<T>& values,
+        void (*writeValue)(QDataStream&, const T&)) {
+    out << (quint32)values.size();
+    foreach (const T& value, values) {
+        writeValue(out, value);
+    }
+}
+
+template<class T> static void readArray(QDataStream& in, QVector<T>& values, void (*readValue)(QDataStream&, T&)) {
+    quint32 size;
+    in >> size;
+    if (in.status() != QDataStream::Ok || size > in.device()->bytesAvailable()) {
+        in.setStatus(QDataStream::ReadCorruptData);
+        return;
+    }
+    values.resize(size);
+    for (quint32 i = 0; i < size && in.status() == QDataStream::Ok; i++) {
+        readValue(in, values[i]);
+    }
+}
+
+static void writeJoint(QDataStream& out, const FBXJoint& joint) {
+    out << joint.isFree;
+    writeRawArray(out, joint.freeLineage);
+    out << joint.parentIndex << joint.distanceToParent << joint.boneRadius;
+    writeRaw(out, joint.translation);
+    writeRaw(out, joint.preTransform);
+    writeRaw(out, joint.preRotation);
+    writeRaw(out, joint.rotation);
+    writeRaw(out, joint.postRotation);
+    writeRaw(out, joint.postTransform);
+    writeRaw(out, joint.transform);
+    writeRaw(out, joint.rotationMin);
+    writeRaw(out, joint.rotationMax);
+    writeRaw(out, joint.inverseDefaultRotation);
+    writeRaw(out, joint.inverseBindRotation);
+    writeRaw(out, joint.bindTransform);
+    out << joint.name;
+    writeRaw(out, joint.shapePosition);
+    writeRaw(out, joint.shapeRotation);
+    out << joint.shapeType;
+}
+
+static void readJoint(QDataStream& in, FBXJoint& joint) {
+    in >> joint.isFree;
+    readRawArray(in, joint.freeLineage);
+    in >> joint.parentIndex >> joint.distanceToParent >> joint.boneRadius;
+    readRaw(in, joint.translation);
+    readRaw(in, joint.preTransform);
+    readRaw(in, joint.preRotation);
+    readRaw(in, joint.rotation);
+    readRaw(in, joint.postRotation);
+    readRaw(in, joint.postTransform);
+    readRaw(in, joint.transform);
+    readRaw(in, joint.rotationMin);
+    readRaw(in, joint.rotationMax);
+    readRaw(in, joint.inverseDefaultRotation);
+    readRaw(in, joint.inverseBindRotation);
+    readRaw(in, joint.bindTransform);
+    in >> joint.name;
+    readRaw(in, joint.shapePosition);
+    readRaw(in, joint.shapeRotation);
+    in >> joint.shapeType;
+}
+
+static void writeMeshPart(QDataStream& out, const FBXMeshPart& part) {
+    writeRawArray(out, part.quadIndices);
+    writeRawArray(out, part.triangleIndices);
+    writeRaw(out, part.diffuseColor);
+    writeRaw(out, part.specularColor);
+    out << part.shininess << part.diffuseFilename << part.normalFilename;
+}
+
+static void readMeshPart(QDataStream& in, FBXMeshPart& part) {
+    readRawArray(in, part.quadIndices);
+    readRawArray(in, part.triangleIndices);
+    readRaw(in, part.diffuseColor);
+    readRaw(in, part.specularColor);
+    in >> part.shininess >> part.diffuseFilename >> part.normalFilename;
+}
+
+static void writeCluster(QDataStream& out, const FBXCluster& cluster) {
+    out << cluster.jointIndex;
+    writeRaw(out, cluster.inverseBindMatrix);
+}
+
+static void readCluster(QDataStream& in, FBXCluster& cluster) {
+    in >> cluster.jointIndex;
+    readRaw(in, cluster.inverseBindMatrix);
+}
+
+static void writeBlendshape(QDataStream& out, const FBXBlendshape& blendshape) {
+    writeRawArray(out, blendshape.indices);
+    writeRawArray(out, blendshape.vertices);
+    writeRawArray(out, blendshape.normals);
+}
+
+static void readBlendshape(QDataStream& in, FBXBlendshape& blendshape) {
+    readRawArray(in, blendshape.indices);
+    readRawArray(in, blendshape.vertices);
+    readRawArray(in, blendshape.normals);
+}
+
+static void writeMesh(QDataStream& out, const FBXMesh& mesh) {
+    writeArray(out, mesh.parts, writeMeshPart);
+    writeRawArray(out, mesh.vertices);
+    writeRawArray(out, mesh.normals);
+    writeRawArray(out, mesh.tangents);
+    writeRawArray(out, mesh.colors);
+    writeRawArray(out, mesh.texCoords);
+    writeRawArray(out, mesh.clusterIndices);
+    writeRawArray(out, mesh.clusterWeights);
+    writeArray(out, mesh.clusters, writeCluster);
+    out << mesh.isEye;
+    writeArray(out, mesh.blendshapes, writeBlendshape);
+}
+
+static void readMesh(QDataStream& in, FBXMesh& mesh) {
+    readArray(in, mesh.parts, readMeshPart);
+    readRawArray(in, mesh.vertices);
+    readRawArray(in, mesh.normals);
+    readRawArray(in, mesh.tangents);
+    readRawArray(in, mesh.colors);
+    readRawArray(in, mesh.texCoords);
+    readRawArray(in, mesh.clusterIndices);
+    readRawArray(in, mesh.clusterWeights);
+    readArray(in, mesh.clusters, readCluster);
+    in >> mesh.isEye;
+    readArray(in, mesh.blendshapes, readBlendshape);
+}
+
+static void writeAttachment(QDataStream& out, const FBXAttachment& attachment) {
+    out << attachment.jointIndex << attachment.url;
+    writeRaw(out, attachment.translation);
+    writeRaw(out, attachment.rotation);
+    writeRaw(out, attachment.scale);
+}
+
+static void readAttachment(QDataStream& in, FBXAttachment& attachment) {
+    in >> attachment.jointIndex >> attachment.url;
+    readRaw(in, attachment.translation);
+    readRaw(in, attachment.rotation);
+    readRaw(in, attachment.scale);
+}
+
+void writeFBXBinary(QIODevice* device, const FBXGeometry& geometry) {
+    QDataStream out(device);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << FBX_CACHE_MAGIC << FBX_CACHE_VERSION << FBX_CACHE_LAYOUT;
+    
+    writeArray(out, geometry.joints, writeJoint);
+    out << geometry.jointIndices;
+    writeArray(out, geometry.meshes, writeMesh);
+    writeRaw(out, geometry.offset);
+    out << geometry.leftEyeJointIndex << geometry.rightEyeJointIndex << geometry.neckJointIndex <<
+        geometry.rootJointIndex << geometry.leanJointIndex << geometry.headJointIndex <<
+        geometry.leftHandJointIndex << geometry.rightHandJointIndex;
+    writeRawArray(out, geometry.leftFingerJointIndices);
+    writeRawArray(out, geometry.rightFingerJointIndices);
+    writeRawArray(out, geometry.leftFingertipJointIndices);
+    writeRawArray(out, geometry.rightFingertipJointIndices);
+    writeRaw(out, geometry.palmDirection);
+    writeRaw(out, geometry.neckPivot);
+    writeRaw(out, geometry.bindExtents);
+    writeRaw(out, geometry.meshExtents);
+    writeArray(out, geometry.attachments, writeAttachment);
+}
+
+bool readFBXBinary(QIODevice* device, FBXGeometry& geometry) {
+    QDataStream in(device);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic, version, layout;
+    in >> magic >> version >> layout;
+    if (magic != FBX_CACHE_MAGIC || version != FBX_CACHE_VERSION || layout != FBX_CACHE_LAYOUT) {
+        return false;
+    }
+    readArray(in, geometry.joints, readJoint);
+    in >> geometry.jointIndices;
+    readArray(in, geometry.meshes, readMesh);
+    readRaw(in, geometry.offset);
+    in >> geometry.leftEyeJointIndex >> geometry.rightEyeJointIndex >> geometry.neckJointIndex >>
+        geometry.rootJointIndex >> geometry.leanJointIndex >> geometry.headJointIndex >>
+        geometry.leftHandJointIndex >> geometry.rightHandJointIndex;
+    readRawArray(in, geometry.leftFingerJointIndices);
+    readRawArray(in, geometry.rightFingerJointIndices);
+    readRawArray(in, geometry.leftFingertipJointIndices);
+    readRawArray(in, geometry.rightFingertipJointIndices);
+    readRaw(in, geometry.palmDirection);
+    readRaw(in, geometry.neckPivot);
+    readRaw(in, geometry.bindExtents);
+    readRaw(in, geometry.meshExtents);
+    readArray(in, geometry.attachments, readAttachment);
+    return in.status() == QDataStream::Ok;
+}
+
+/// Writes a mapping value in a form that doesn't depend on the process: QHash iteration order is randomized per
+/// process, so the keys of hashes (at any depth) are written in sorted order.
+static void writeCanonicalMapping(QDataStream& out, const QVariant& value) {
+    out << (qint32)value.type();
+    if (value.type() == QVariant::Hash) {
+        QVariantHash hash = value.toHash();
+        QStringList keys = hash.uniqueKeys();
+        qSort(keys);
+        out << (quint32)keys.size();
+        foreach (const QString& key, keys) {
+            // the values of a key inserted more than once come out in the reverse order of insertion
+            QVariantList values = hash.values(key);
+            out << key << (quint32)values.size();
+            foreach (const QVariant& element, values) {
+                writeCanonicalMapping(out, element);
+            }
+        }
+    } else if (value.type() == QVariant::List) {
+        QVariantList list = value.toList();
+        out << (quint32)list.size();
+        foreach (const QVariant& element, list) {
+            writeCanonicalMapping(out, element);
+        }
+    } else {
+        out << value;
+    }
+}
+
+/// \return the path of the cached copy of the model as read with the mapping
+static QString getCachePath(const QUrl& url, const QByteArray& model, const QVariantHash& mapping) {
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(url.toEncoded());
+    
+    QByteArray mappingData;
+    QDataStream mappingStream(&mappingData, QIODevice::WriteOnly);
+    writeCanonicalMapping(mappingStream, mapping);
+    hash.addData(mappingData);
+    hash.addData(model);
+    
+    QDir directory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+    return directory.filePath(FBX_CACHE_DIRECTORY + "/" + hash.result().toHex() + FBX_CACHE_SUFFIX);
+}
+
+static bool readCachedFBX(const QString& path, FBXGeometry& geometry) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    // map the file rather than read it, so that the arrays are copied straight out of the page cache
+    bool success;
+    uchar* mapped = file.map(0, file.size());
+    if (mapped) {
+        QByteArray data = QByteArray::fromRawData(reinterpret_cast<const char*>(mapped), file.size());
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::ReadOnly);
+        success = readFBXBinary(&buffer, geometry);
+        buffer.close();
+        file.unmap(mapped);
+        
+    } else {
+        success = readFBXBinary(&file, geometry);
+    }
+    if (!success) {
+        // from an older version or damaged; it'll be replaced
+        file.remove();
+    }
+    return success;
+}
+
+static QDateTime getLastUsed(const QFileInfo& info) {
+    // the access time is only updated lazily (if at all) on most file systems, but it's the best guide we have
+    return qMax(info.lastRead(), info.lastModified());
+}
+
+static bool lessRecentlyUsed(const QFileInfo& first, const QFileInfo& second) {
+    return getLastUsed(first) < getLastUsed(second);
+}
+
+/// Removes the least recently used copies in the directory until they fit within the maximum size.  This only runs when a
+/// copy is written, which is to say after a model has been parsed, so the cost of listing the directory is lost in that.
+static void evictCachedFBX(const QDir& directory) {
+    QFileInfoList files = directory.entryInfoList(QStringList() << "*" + FBX_CACHE_SUFFIX, QDir::Files);
+    qint64 totalSize = 0;
+    foreach (const QFileInfo& file, files) {
+        totalSize += file.size();
+    }
+    if (totalSize <= MAX_FBX_CACHE_SIZE) {
+        return;
+    }
+    qSort(files.begin(), files.end(), lessRecentlyUsed);
+    for (int i = 0; i < files.size() && totalSize > MAX_FBX_CACHE_SIZE; i++) {
+        if (QFile::remove(files.at(i).filePath())) {
+            totalSize -= files.at(i).size();
+        }
+    }
+}
+
+static void writeCachedFBX(const QString& path, const FBXGeometry& geometry) {
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    
+    // QSaveFile only puts the file in place once it's complete, so readers never see part of one
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Couldn't cache geometry at" << path << "-" << file.errorString();
+        return;
+    }
+    writeFBXBinary(&file, geometry);
+    file.commit();
+}
+
+FBXGeometry readFBXWithCache(const QUrl& url, const QByteArray& model, const QVariantHash& mapping) {
+    QString path = getCachePath(url, model, mapping);
+    FBXGeometry geometry;
+    if (readCachedFBX(path, geometry)) {
+        return geometry;
+    }
+    geometry = readFBX(model, mapping);
+    writeCachedFBX(path, geometry);
+    evictCachedFBX(QFileInfo(path).absoluteDir());
+    return geometry;
+}
+
+/// Returns a mapping like those of avatars' FST files, with several entries under the same headings, so that the order in
+/// which the hashes are iterated varies between processes.
+static QVariantHash getBenchmarkMapping() {
+    return readMapping(
+        "name = benchmark\n"
+        "scale = 1.0\n"
+        "texdir = textures\n"
+        "joint = jointRoot = Hips\n"
+        "joint = jointNeck = Neck\n"
+        "joint = jointLean = Spine\n"
+        "joint = jointHead = HeadTop_End\n"
+        "joint = jointLeftHand = LeftHand\n"
+        "joint = jointRightHand = RightHand\n"
+        "bs = EyeBlink_L = Blink_Left = 1\n"
+        "bs = EyeBlink_R = Blink_Right = 1\n"
+        "bs = JawOpen = MouthOpen = 0.7\n");
+}
+
+static QString getBenchmarkCachePath(const QString& filename, const QByteArray& model) {
+    return getCachePath(QUrl::fromLocalFile(QFileInfo(filename).absoluteFilePath()), model, getBenchmarkMapping());
+}
+
+void printFBXCachePath(const QString& filename) {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    QTextStream(stdout) << getBenchmarkCachePath(filename, file.readAll()) << endl;
+}
+
+void benchmarkFBXCache(const QStringList& filenames, const QString& executable) {
+    const float NSECS_PER_MSEC = 1000000.0f;
+    foreach (const QString& filename, filenames) {
+        QFile file(filename);
+        if (!file.open(QIODevice::ReadOnly)) {
+            qDebug() << "Couldn't open" << filename;
+            continue;
+        }
+        QByteArray model = file.readAll();
+        
+        // the cached copy is only any use if another run will look for it in the same place
+        QString cachePath = getBenchmarkCachePath(filename, model);
+        QProcess otherProcess;
+        otherProcess.start(executable, QStringList() << PRINT_FBX_CACHE_PATH_OPTION << filename);
+        otherProcess.waitForFinished();
+        QString otherCachePath = QString::fromLocal8Bit(otherProcess.readAllStandardOutput()).trimmed();
+        if (otherCachePath != cachePath) {
+            qDebug() << filename << "- another process would look for the cached copy at" << otherCachePath <<
+                "rather than" << cachePath;
+            continue;
+        }
+        
+        QElapsedTimer timer;
+        timer.start();
+        FBXGeometry parsed;
+        try {
+            parsed = readFBX(model, getBenchmarkMapping());
+        } catch (const QString& error) {
+            qDebug() << "Error reading" << filename << ":" << error;
+            continue;
+        }
+        qint64 parseNsecs = timer.nsecsElapsed();
+        
+        QString path = QDir::temp().filePath(QFileInfo(filename).fileName() + FBX_CACHE_SUFFIX);
+        timer.restart();
+        writeCachedFBX(path, parsed);
+        qint64 writeNsecs = timer.nsecsElapsed();
+        
+        timer.restart();
+        FBXGeometry cached;
+        bool success = readCachedFBX(path, cached);
+        qint64 readNsecs = timer.nsecsElapsed();
+        
+        qint64 cacheSize = QFileInfo(path).size();
+        QFile::remove(path);
+        
+        if (!success || cached.joints.size() != parsed.joints.size() || cached.meshes.size() != parsed.meshes.size()) {
+            qDebug() << filename << "- the cached copy didn't match what was parsed!";
+            continue;
+        }
+        qDebug() << filename << "-" << model.size() << "bytes of FBX," << cacheSize << "bytes cached";
+        qDebug() << "    cold (parse):" << parseNsecs / NSECS_PER_MSEC << "msecs";
+        qDebug() << "    caching:" << writeNsecs / NSECS_PER_MSEC << "msecs";
+        qDebug() << "    warm (cached):" << readNsecs / NSECS_PER_MSEC << "msecs";
+    }
+}
@@ -0,0 +1,43 @@
+//
+//  FBXCache.h
+//  interface/src/renderer
+//
+//  Created by Andrzej Kapolka on 5/24/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_FBXCache_h
+#define hifi_FBXCache_h
+
+#include <QIODevice>
+#include <QStringList>
+
+#include "FBXReader.h"
+
+/// Reads FBX geometry from the supplied model and mapping data, using the binary copy cached on disk if the same model
+/// has been read with the same mapping before, and caching what it parses otherwise.  The cached copies are bounded in
+/// total size; the least recently used are removed as new ones are written.
+/// \exception QString if an error occurs in parsing
+FBXGeometry readFBXWithCache(const QUrl& url, const QByteArray& model, const QVariantHash& mapping);
+
+/// Writes geometry in the binary cache format: plain arrays of vertex data behind a versioned header.
+void writeFBXBinary(QIODevice* device, const FBXGeometry& geometry);
+
+/// Reads geometry written by writeFBXBinary.
+/// \return false if the data is from a different version or is damaged
+bool readFBXBinary(QIODevice* device, FBXGeometry& geometry);
+
+/// The option with which the benchmark has another process print the path at which it would cache a file.
+const char PRINT_FBX_CACHE_PATH_OPTION[] = "--printFBXCachePath";
+
+/// Prints the path of the cached copy of the FBX file as read with the benchmark's mapping.
+void printFBXCachePath(const QString& filename);
+
+/// Times parsing each of the FBX files (with a mapping like an avatar's) against loading them from the binary cache format,
+/// after checking that a second process (running the given executable) would find the cached copy in the same place.
+void benchmarkFBXCache(const QStringList& filenames, const QString& executable);
+
+#endif // hifi_FBXCache_h
@@ -16,6 +16,7 @@
 #include <QThreadPool>
 
 #include "Application.h"
+#include "FBXCache.h"
 #include "GeometryCache.h"
 #include "Model.h"
 #include "world.h"
@@ -474,7 +475,8 @@ void GeometryReader::run() {
     }
     try {
         QMetaObject::invokeMethod(geometry.data(), "setGeometry", Q_ARG(const FBXGeometry&,
-            _url.path().toLower().endsWith(".svo") ? readSVO(_reply->readAll()) : readFBX(_reply->readAll(), _mapping)));
+            _url.path().toLower().endsWith(".svo") ? readSVO(_reply->readAll()) :
+                readFBXWithCache(_url, _reply->readAll(), _mapping)));
         
     } catch (const QString& error) {
         qDebug() << "Error reading " << _url << ": " << error;
@@ -19,6 +19,7 @@
 #include <GeometryUtil.h>
 
 #include "Application.h"
+#include "Blendshapes.h"
 #include "Model.h"
 
 #include <SphereShape.h>
@@ -35,6 +36,7 @@ Model::Model(QObject* parent) :
     QObject(parent),
     _scale(1.0f, 1.0f, 1.0f),
     _shapesAreDirty(true),
+    _jointStatesAreCurrent(false),
     _boundingRadius(0.f),
     _boundingShape(), 
     _boundingShapeLocalOffset(0.f),
@@ -66,10 +68,25 @@ void Model::setScale(const glm::vec3& scale) {
     const float SMALLER_EPSILON = EPSILON * 0.0001f;
     if (glm::length2(deltaScale) > SMALLER_EPSILON) {
         _scale = scale;
+        _jointStatesAreCurrent = false;
         rebuildShapes();
     }
 }
 
+void Model::setRotation(const glm::quat& rotation) {
+    if (_rotation != rotation) {
+        _rotation = rotation;
+        _jointStatesAreCurrent = false;
+    }
+}
+
+void Model::setOffset(const glm::vec3& offset) {
+    if (_offset != offset) {
+        _offset = offset;
+        _jointStatesAreCurrent = false;
+    }
+}
+
 void Model::initSkinProgram(ProgramObject& program, Model::SkinLocations& locations) {
     program.bind();
     locations.clusterMatrices = program.uniformLocation("clusterMatrices");
@@ -249,6 +266,7 @@ bool Model::updateGeometry() {
         const FBXGeometry& fbxGeometry = geometry->getFBXGeometry();
         if (fbxGeometry.joints.size() > 0) {
             _jointStates = createJointStates(fbxGeometry);
+            _jointStatesAreCurrent = false;
             needToRebuild = true;
         }
     }
@@ -371,7 +389,12 @@ bool Model::getJointState(int index, glm::quat& rotation) const {
 
 void Model::setJointState(int index, bool valid, const glm::quat& rotation) {
     if (index != -1 && index < _jointStates.size()) {
-        _jointStates[index].rotation = valid ? rotation : _geometry->getFBXGeometry().joints.at(index).rotation;
+        glm::quat& jointRotation = _jointStates[index].rotation;
+        glm::quat newRotation = valid ? rotation : _geometry->getFBXGeometry().joints.at(index).rotation;
+        if (jointRotation != newRotation) {
+            jointRotation = newRotation;
+            _jointStatesAreCurrent = false;
+        }
     }
 }
 
@@ -464,6 +487,7 @@ void Model::clearShapes() {
         delete _jointShapes[i];
     }
     _jointShapes.clear();
+    _jointShapeBatch.clear();
 }
 
 void Model::rebuildShapes() {
@@ -522,6 +546,7 @@ void Model::rebuildShapes() {
             shapeExtents.addPoint(worldPosition - axis);
         }
         totalExtents.addExtents(shapeExtents);
+        _jointShapeBatch.addShape(_jointShapes.last());
     }
 
     // bounding shape
@@ -555,6 +580,7 @@ void Model::updateShapePositions() {
             }
         }
         _boundingRadius = sqrtf(_boundingRadius);
+        _jointShapeBatch.updateTransforms();
         _shapesAreDirty = false;
         _boundingShape.setPosition(rootPosition + _rotation * _boundingShapeLocalOffset);
     }
@@ -592,12 +618,8 @@ bool Model::findRayIntersection(const glm::vec3& origin, const glm::vec3& direct
 bool Model::findCollisions(const QVector<const Shape*> shapes, CollisionList& collisions) {
     bool collided = false;
     for (int i = 0; i < shapes.size(); ++i) {
-        const Shape* theirShape = shapes[i];
-        for (int j = 0; j < _jointShapes.size(); ++j) {
-            const Shape* ourShape = _jointShapes[j];
-            if (ShapeCollider::collideShapes(theirShape, ourShape, collisions)) {
-                collided = true;
-            }
+        if (ShapeCollider::collideShapeWithBatch(shapes[i], _jointShapeBatch, collisions)) {
+            collided = true;
         }
     }
     return collided;
@@ -607,6 +629,19 @@ bool Model::findSphereCollisions(const glm::vec3& sphereCenter, float sphereRadi
     CollisionList& collisions, int skipIndex) {
     bool collided = false;
     SphereShape sphere(sphereRadius, sphereCenter);
+    if (skipIndex == -1) {
+        // nothing to skip, so collide with the whole batch and tag the collisions with the joints they hit
+        int firstCollision = collisions.size();
+        QVector<int> touchedJoints;
+        collided = ShapeCollider::collideShapeWithBatch(&sphere, _jointShapeBatch, collisions, &touchedJoints);
+        for (int i = 0; i < touchedJoints.size(); i++) {
+            CollisionInfo* collision = collisions.getCollision(firstCollision + i);
+            collision->_type = MODEL_COLLISION;
+            collision->_data = (void*)(this);
+            collision->_flags = touchedJoints.at(i);
+        }
+        return collided;
+    }
     const FBXGeometry& geometry = _geometry->getFBXGeometry();
     for (int i = 0; i < _jointShapes.size(); i++) {
         const FBXJoint& joint = geometry.joints[i];
@@ -637,8 +672,9 @@ bool Model::findSphereCollisions(const glm::vec3& sphereCenter, float sphereRadi
 class Blender : public QRunnable {
 public:
 
-    Blender(Model* model, const QWeakPointer<NetworkGeometry>& geometry,
-        const QVector<FBXMesh>& meshes, const QVector<float>& blendshapeCoefficients);
+    /// Takes the vertex and normal buffers to fill, leaving the passed-in vectors empty.
+    Blender(Model* model, const QWeakPointer<NetworkGeometry>& geometry, const QVector<FBXMesh>& meshes,
+        const QVector<float>& blendshapeCoefficients, QVector<glm::vec3>& vertices, QVector<glm::vec3>& normals);
     
     virtual void run();
 
@@ -648,14 +684,20 @@ private:
     QWeakPointer<NetworkGeometry> _geometry;
     QVector<FBXMesh> _meshes;
     QVector<float> _blendshapeCoefficients;
+    QVector<glm::vec3> _vertices;
+    QVector<glm::vec3> _normals;
 };
 
-Blender::Blender(Model* model, const QWeakPointer<NetworkGeometry>& geometry,
-        const QVector<FBXMesh>& meshes, const QVector<float>& blendshapeCoefficients) :
+Blender::Blender(Model* model, const QWeakPointer<NetworkGeometry>& geometry, const QVector<FBXMesh>& meshes,
+        const QVector<float>& blendshapeCoefficients, QVector<glm::vec3>& vertices, QVector<glm::vec3>& normals) :
     _model(model),
     _geometry(geometry),
     _meshes(meshes),
     _blendshapeCoefficients(blendshapeCoefficients) {
+    
+    // taking the buffers leaves us with the only reference to them, so they can be filled in without being copied
+    _vertices.swap(vertices);
+    _normals.swap(normals);
 }
 
 void Blender::run() {
@@ -663,37 +705,12 @@ void Blender::run() {
     if (_model.isNull() || _geometry.isNull()) {
         return;
     }
-    QVector<glm::vec3> vertices, normals;
-    int offset = 0;
-    foreach (const FBXMesh& mesh, _meshes) {
-        if (mesh.blendshapes.isEmpty()) {
-            continue;
-        }
-        vertices += mesh.vertices;
-        normals += mesh.normals;
-        glm::vec3* meshVertices = vertices.data() + offset;
-        glm::vec3* meshNormals = normals.data() + offset;
-        offset += mesh.vertices.size();
-        const float NORMAL_COEFFICIENT_SCALE = 0.01f;
-        for (int i = 0, n = qMin(_blendshapeCoefficients.size(), mesh.blendshapes.size()); i < n; i++) {
-            float vertexCoefficient = _blendshapeCoefficients.at(i);
-            if (vertexCoefficient < EPSILON) {
-                continue;
-            }
-            float normalCoefficient = vertexCoefficient * NORMAL_COEFFICIENT_SCALE;
-            const FBXBlendshape& blendshape = mesh.blendshapes.at(i);
-            for (int j = 0; j < blendshape.indices.size(); j++) {
-                int index = blendshape.indices.at(j);
-                meshVertices[index] += blendshape.vertices.at(j) * vertexCoefficient;
-                meshNormals[index] += blendshape.normals.at(j) * normalCoefficient;
-            }
-        }
-    }
+    blendMeshes(_meshes, _blendshapeCoefficients, _vertices, _normals);
     
     // post the result to the geometry cache, which will dispatch to the model if still alive
     QMetaObject::invokeMethod(Application::getInstance()->getGeometryCache(), "setBlendedVertices",
         Q_ARG(const QPointer<Model>&, _model), Q_ARG(const QWeakPointer<NetworkGeometry>&, _geometry),
-        Q_ARG(const QVector<glm::vec3>&, vertices), Q_ARG(const QVector<glm::vec3>&, normals));
+        Q_ARG(const QVector<glm::vec3>&, _vertices), Q_ARG(const QVector<glm::vec3>&, _normals));
 }
 
 void Model::simulate(float deltaTime, bool fullUpdate) {
@@ -701,14 +718,25 @@ void Model::simulate(float deltaTime, bool fullUpdate) {
     if (isActive() && fullUpdate) {
         simulateInternal(deltaTime);
     }
+    _jointStatesAreCurrent = false;
 }
 
-void Model::simulateInternal(float deltaTime) {
-    // NOTE: this is a recursive call that walks all attachments, and their attachments
-    // update the world space transforms for all joints
+void Model::updateJointStates() {
     for (int i = 0; i < _jointStates.size(); i++) {
         updateJointState(i);
     }
+    _jointStatesAreCurrent = true;
+}
+
+void Model::simulateInternal(float deltaTime) {
+    // NOTE: this is a recursive call that walks all attachments, and their attachments
+    // update the world space transforms for all joints, unless updateJointStates() already has
+    if (!_jointStatesAreCurrent) {
+        for (int i = 0; i < _jointStates.size(); i++) {
+            updateJointState(i);
+        }
+    }
+    _jointStatesAreCurrent = false;
     _shapesAreDirty = true;
     
     const FBXGeometry& geometry = _geometry->getFBXGeometry();
@@ -743,7 +771,8 @@ void Model::simulateInternal(float deltaTime) {
     
     // post the blender
     if (geometry.hasBlendedMeshes()) {
-        QThreadPool::globalInstance()->start(new Blender(this, _geometry, geometry.meshes, _blendshapeCoefficients));
+        QThreadPool::globalInstance()->start(new Blender(this, _geometry, geometry.meshes, _blendshapeCoefficients,
+            _blendedVertices, _blendedNormals));
     }
 }
 
@@ -1092,6 +1121,10 @@ void Model::setBlendedVertices(const QVector<glm::vec3>& vertices, const QVector
         buffer.release();
         index += mesh.vertices.size();
     }
+    
+    // hold on to the buffers for the next blend
+    _blendedVertices = vertices;
+    _blendedNormals = normals;
 }
 
 void Model::applyNextGeometry() {
@@ -1114,6 +1147,7 @@ void Model::deleteGeometry() {
     _attachments.clear();
     _blendedVertexBuffers.clear();
     _jointStates.clear();
+    _jointStatesAreCurrent = false;
     _meshStates.clear();
     clearShapes();
     
@@ -16,6 +16,7 @@
 #include <QUrl>
 
 #include <CapsuleShape.h>
+#include <ShapeBatch.h>
 
 #include "GeometryCache.h"
 #include "InterfaceConfig.h"
@@ -36,13 +37,13 @@ public:
     void setTranslation(const glm::vec3& translation) { _translation = translation; }
     const glm::vec3& getTranslation() const { return _translation; }
     
-    void setRotation(const glm::quat& rotation) { _rotation = rotation; }
+    void setRotation(const glm::quat& rotation);
     const glm::quat& getRotation() const { return _rotation; }
     
     void setScale(const glm::vec3& scale);
     const glm::vec3& getScale() const { return _scale; }
     
-    void setOffset(const glm::vec3& offset) { _offset = offset; }
+    void setOffset(const glm::vec3& offset);
     const glm::vec3& getOffset() const { return _offset; }
     
     void setPupilDilation(float dilation) { _pupilDilation = dilation; }
@@ -61,6 +62,10 @@ public:
     void reset();
     virtual void simulate(float deltaTime, bool fullUpdate = true);
     
+    /// Computes the joint transforms ahead of the next simulate(), which then doesn't have to.  This touches nothing but
+    /// the model's own joint states, so the joints of different models can be updated on different threads at once.
+    void updateJointStates();
+    
     enum RenderMode { DEFAULT_RENDER_MODE, SHADOW_RENDER_MODE, DIFFUSE_RENDER_MODE, NORMAL_RENDER_MODE };
     
     bool render(float alpha = 1.0f, RenderMode mode = DEFAULT_RENDER_MODE);
@@ -209,8 +214,10 @@ protected:
     };
     
     bool _shapesAreDirty;
+    bool _jointStatesAreCurrent; ///< set by updateJointStates() until the next simulate() or change to the joints
     QVector<JointState> _jointStates;
     QVector<Shape*> _jointShapes;
+    ShapeBatch _jointShapeBatch; // the joint shapes again, in joint order, for colliding against all of them at once
     
     float _boundingRadius;
     CapsuleShape _boundingShape;
@@ -277,6 +284,10 @@ private:
         
     QVector<QOpenGLBuffer> _blendedVertexBuffers;
     
+    // the results of the last blend, which the next Blender fills in again
+    QVector<glm::vec3> _blendedVertices;
+    QVector<glm::vec3> _blendedNormals;
+    
     QVector<QVector<QSharedPointer<Texture> > > _dilatedTextures;
     
     QVector<Model*> _attachments;
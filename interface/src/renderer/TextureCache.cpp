@@ -12,6 +12,9 @@
 // include this before QGLWidget, which includes an earlier version of OpenGL
 #include "InterfaceConfig.h"
 
+#include <cfloat>
+#include <cmath>
+
 #include <QGLWidget>
 #include <QNetworkReply>
 #include <QOpenGLFramebufferObject>
@@ -31,8 +34,17 @@ TextureCache::TextureCache() :
     _primaryFramebufferObject(NULL),
     _secondaryFramebufferObject(NULL),
     _tertiaryFramebufferObject(NULL),
-    _shadowFramebufferObject(NULL)
+    _shadowFramebufferObject(NULL),
+    _pendingMipBudget(DEFAULT_PENDING_MIP_BUDGET),
+    _pendingMipBytes(0),
+    _mipUploadAllowance(0),
+    _lastMipUpload(usecTimestampNow())
 {
+    qRegisterMetaType<MipChain>();
+    
+    const int MIP_STREAM_INTERVAL_MSECS = 10;
+    _mipStreamTimer.setInterval(MIP_STREAM_INTERVAL_MSECS);
+    connect(&_mipStreamTimer, SIGNAL(timeout()), SLOT(streamMips()));
 }
 
 TextureCache::~TextureCache() {
@@ -116,7 +128,7 @@ QSharedPointer<NetworkTexture> TextureCache::getTexture(const QUrl& url, bool no
         texture->setCache(this);
         _dilatableNetworkTextures.insert(url, texture);
     } else {
-        _unusedResources.remove(texture->getLRUKey());
+        removeUnusedResource(texture);
     }
     return texture;
 }
@@ -218,6 +230,68 @@ QSharedPointer<Resource> TextureCache::createResource(const QUrl& url,
     return QSharedPointer<Resource>(new NetworkTexture(url, *(const bool*)extra), &Resource::allReferencesCleared);
 }
 
+void TextureCache::setPendingMipBudget(qint64 budget) {
+    _pendingMipBudget = budget;
+    evictPendingMips();
+}
+
+static bool textureViewPriorityGreaterThan(NetworkTexture* first, NetworkTexture* second) {
+    return first->getViewPriority() > second->getViewPriority();
+}
+
+void TextureCache::streamMips() {
+    QList<NetworkTexture*> textures = _streamingTextures.toList();
+    qSort(textures.begin(), textures.end(), textureViewPriorityGreaterThan);
+    foreach (NetworkTexture* texture, textures) {
+        if (!texture->streamNextLevel() && _mipUploadAllowance < 0) {
+            // out of upload allowance for this round
+            break;
+        }
+    }
+    if (_streamingTextures.isEmpty()) {
+        _mipStreamTimer.stop();
+    }
+}
+
+void TextureCache::updateStreamingTexture(NetworkTexture* texture, bool streaming, qint64 pendingBytesDelta) {
+    if (streaming) {
+        _streamingTextures.insert(texture);
+        if (!_mipStreamTimer.isActive()) {
+            _mipStreamTimer.start();
+        }
+    } else {
+        _streamingTextures.remove(texture);
+    }
+    _pendingMipBytes += pendingBytesDelta;
+}
+
+void TextureCache::evictPendingMips() {
+    if (_pendingMipBytes <= _pendingMipBudget) {
+        return;
+    }
+    // only the levels a texture no longer wants go; dropping wanted ones would just have them streamed in again
+    QList<NetworkTexture*> textures = _streamingTextures.toList();
+    qSort(textures.begin(), textures.end(), textureViewPriorityGreaterThan);
+    for (int i = textures.size() - 1; i >= 0 && _pendingMipBytes > _pendingMipBudget; i--) {
+        textures.at(i)->releaseUnwantedLevels();
+    }
+}
+
+bool TextureCache::reserveMipUpload(qint64 bytes) {
+    // a token bucket: the allowance refills at a fixed rate, up to a small burst, and may go into debt for one level
+    const qint64 MIP_UPLOAD_BYTES_PER_SECOND = 64 * 1024 * 1024;
+    const qint64 MAX_MIP_UPLOAD_BURST = MIP_UPLOAD_BYTES_PER_SECOND / 20;
+    quint64 now = usecTimestampNow();
+    _mipUploadAllowance = qMin(_mipUploadAllowance + (qint64)(now - _lastMipUpload) * MIP_UPLOAD_BYTES_PER_SECOND /
+        (qint64)USECS_PER_SECOND, MAX_MIP_UPLOAD_BURST);
+    _lastMipUpload = now;
+    if (_mipUploadAllowance < 0) {
+        return false;
+    }
+    _mipUploadAllowance -= bytes;
+    return true;
+}
+
 QOpenGLFramebufferObject* TextureCache::createFramebufferObject() {
     QOpenGLFramebufferObject* fbo = new QOpenGLFramebufferObject(Application::getInstance()->getGLWidget()->size());
     Application::getInstance()->getGLWidget()->installEventFilter(this);
@@ -240,7 +314,11 @@ Texture::~Texture() {
 
 NetworkTexture::NetworkTexture(const QUrl& url, bool normalMap) :
     Resource(url),
-    _translucent(false) {
+    _translucent(false),
+    _uploadedLevel(-1),
+    _reloading(false),
+    _reloadFailed(false),
+    _pendingMipBytes(0) {
     
     if (!url.isValid()) {
         _loaded = true;
@@ -253,6 +331,29 @@ NetworkTexture::NetworkTexture(const QUrl& url, bool normalMap) :
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+NetworkTexture::~NetworkTexture() {
+    if (_streamingCache) {
+        _streamingCache->updateStreamingTexture(this, false, -_pendingMipBytes);
+    }
+}
+
+void NetworkTexture::setLoadPriority(const QPointer<QObject>& owner, float priority) {
+    Resource::setLoadPriority(owner, priority);
+    _viewPriorities.insert(owner, priority);
+}
+
+void NetworkTexture::setLoadPriorities(const QHash<QPointer<QObject>, float>& priorities) {
+    Resource::setLoadPriorities(priorities);
+    for (QHash<QPointer<QObject>, float>::const_iterator it = priorities.constBegin(); it != priorities.constEnd(); it++) {
+        _viewPriorities.insert(it.key(), it.value());
+    }
+}
+
+void NetworkTexture::clearLoadPriority(const QPointer<QObject>& owner) {
+    Resource::clearLoadPriority(owner);
+    _viewPriorities.remove(owner);
+}
+
 class ImageReader : public QRunnable {
 public:
 
@@ -277,72 +378,184 @@ void ImageReader::run() {
         _reply->deleteLater();
         return;
     }
-    QUrl url = _reply->url();
-    QImage image = QImage::fromData(_reply->readAll());
+    bool translucent;
+    QImage image = decodeTextureImage(_reply->readAll(), _reply->url(), translucent);
     _reply->deleteLater();
     
-    // enforce a fixed maximum
-    const int MAXIMUM_SIZE = 1024;
-    if (image.width() > MAXIMUM_SIZE || image.height() > MAXIMUM_SIZE) {
-        qDebug() << "Image greater than maximum size:" << url << image.width() << image.height();
-        image = image.scaled(MAXIMUM_SIZE, MAXIMUM_SIZE, Qt::KeepAspectRatio);
+    // only the dilatable textures need the image itself once it's in the mip chain
+    MipChain mips(image);
+    if (!qobject_cast<DilatableNetworkTexture*>(texture.data())) {
+        image = QImage();
     }
-    
-    if (!image.hasAlphaChannel()) {
-        if (image.format() != QImage::Format_RGB888) {
-            image = image.convertToFormat(QImage::Format_RGB888);
+    QMetaObject::invokeMethod(texture.data(), "setImage", Q_ARG(const QImage&, image), Q_ARG(bool, translucent),
+        Q_ARG(const MipChain&, mips));
+}
+
+void NetworkTexture::downloadFinished(QNetworkReply* reply) {
+    // send the reader off to the thread pool
+    QThreadPool::globalInstance()->start(new ImageReader(_self, reply));
+}
+
+void NetworkTexture::finishedLoading(bool success) {
+    if (!success && _reloading) {
+        // the levels we fetched again didn't arrive, but what GL has is still good; just stop streaming finer ones
+        _reloading = false;
+        _reloadFailed = true;
+        return;
+    }
+    Resource::finishedLoading(success);
+}
+
+void NetworkTexture::setImage(const QImage& image, bool translucent, const MipChain& mips) {
+    _reloading = false;
+    if (_uploadedLevel != -1) {
+        if (mips.getLevelCount() == 0) {
+            // as above, keep what GL has
+            _reloadFailed = true;
+            return;
+        }
+        if (mips.getLevelCount() != _mips.getLevelCount() || mips.getWidth(0) != _mips.getWidth(0) ||
+                mips.getHeight(0) != _mips.getHeight(0) || mips.hasAlpha() != _mips.hasAlpha()) {
+            // revalidation fetched a different image, whose levels won't fit those in GL, so start over with it
+            _uploadedLevel = -1;
         }
-        QMetaObject::invokeMethod(texture.data(), "setImage", Q_ARG(const QImage&, image), Q_ARG(bool, false));
+    }
+    _translucent = translucent;
+    _mips = mips;
+    if (_mips.getLevelCount() == 0) {
+        finishedLoading(false);
         return;
     }
-    if (image.format() != QImage::Format_ARGB32) {
-        image = image.convertToFormat(QImage::Format_ARGB32);
+    if (_uploadedLevel == -1) {
+        if (!isLoaded()) {
+            finishedLoading(true);
+        }
+        imageLoaded(image);
+        
+        // start with the coarse levels, coarsest first, and stream in the rest
+        _uploadedLevel = _mips.getFirstLevelWithin(IMMEDIATE_MIP_SIZE);
+        glBindTexture(GL_TEXTURE_2D, getID());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (int level = _mips.getLevelCount() - 1; level >= _uploadedLevel; level--) {
+            uploadLevel(level);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, _uploadedLevel);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, _mips.getLevelCount() - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
     }
     
-    // check for translucency/false transparency
-    int opaquePixels = 0;
-    int translucentPixels = 0;
-    const int EIGHT_BIT_MAXIMUM = 255;
-    const int RGB_BITS = 24;
-    for (int y = 0; y < image.height(); y++) {
-        for (int x = 0; x < image.width(); x++) {
-            int alpha = image.pixel(x, y) >> RGB_BITS;
-            if (alpha == EIGHT_BIT_MAXIMUM) {
-                opaquePixels++;
-            } else if (alpha != 0) {
-                translucentPixels++;
-            }
+    // whatever GL already has, we don't need to keep, and neither do we need levels finer than those wanted
+    for (int level = _uploadedLevel; level < _mips.getLevelCount(); level++) {
+        _mips.releaseLevel(level);
+    }
+    releaseUnwantedLevels();
+    updateMipBytes();
+    if (_streamingCache) {
+        _streamingCache->evictPendingMips();
+    }
+}
+
+float NetworkTexture::getViewPriority() {
+    float highestPriority = -FLT_MAX;
+    for (QHash<QPointer<QObject>, float>::iterator it = _viewPriorities.begin(); it != _viewPriorities.end(); ) {
+        if (it.key().isNull()) {
+            it = _viewPriorities.erase(it);
+            continue;
         }
+        highestPriority = qMax(highestPriority, it.value());
+        it++;
     }
-    int imageArea = image.width() * image.height();
-    if (opaquePixels == imageArea) {
-        qDebug() << "Image with alpha channel is completely opaque:" << url;
-        image = image.convertToFormat(QImage::Format_RGB888);
+    return highestPriority;
+}
+
+int NetworkTexture::getWantedLevel() {
+    // textures without owners telling us otherwise get full resolution
+    float priority = getViewPriority();
+    const float FULL_RESOLUTION_DISTANCE = 4.0f;
+    if (priority == -FLT_MAX || -priority <= FULL_RESOLUTION_DISTANCE) {
+        return 0;
     }
-    QMetaObject::invokeMethod(texture.data(), "setImage", Q_ARG(const QImage&, image),
-        Q_ARG(bool, translucentPixels >= imageArea / 2));
+    // each doubling of the distance halves the resolution needed
+    return qMin((int)(log(-priority / FULL_RESOLUTION_DISTANCE) / log(2.0f)), _mips.getLevelCount() - 1);
 }
 
-void NetworkTexture::downloadFinished(QNetworkReply* reply) {
-    // send the reader off to the thread pool
-    QThreadPool::globalInstance()->start(new ImageReader(_self, reply));
+bool NetworkTexture::streamNextLevel() {
+    if (_uploadedLevel <= 0) {
+        return false;
+    }
+    releaseUnwantedLevels();
+    if (getWantedLevel() >= _uploadedLevel) {
+        return false;
+    }
+    int level = _uploadedLevel - 1;
+    if (!_mips.hasData(level)) {
+        // the level was dropped to save memory; fetch it again (likely from the disk cache) and carry on from there
+        if (!_reloading && !_reloadFailed) {
+            _reloading = true;
+            attemptRequest();
+        }
+        return false;
+    }
+    if (_streamingCache && !_streamingCache->reserveMipUpload(_mips.getData(level).size())) {
+        return false;
+    }
+    glBindTexture(GL_TEXTURE_2D, getID());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    uploadLevel(level);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
+    _uploadedLevel = level;
+    _mips.releaseLevel(level);
+    updateMipBytes();
+    return true;
 }
 
-void NetworkTexture::setImage(const QImage& image, bool translucent) {
-    _translucent = translucent;
+void NetworkTexture::uploadLevel(int level) {
+    if (_mips.hasAlpha()) {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, _mips.getWidth(level), _mips.getHeight(level), 0,
+            GL_BGRA, GL_UNSIGNED_BYTE, _mips.getData(level).constData());
+    } else {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGB, _mips.getWidth(level), _mips.getHeight(level), 0,
+            GL_RGB, GL_UNSIGNED_BYTE, _mips.getData(level).constData());
+    }
+}
+
+void NetworkTexture::releaseUnwantedLevels() {
+    bool released = false;
+    for (int level = qMin(getWantedLevel(), _uploadedLevel) - 1; level >= 0; level--) {
+        if (_mips.hasData(level)) {
+            _mips.releaseLevel(level);
+            released = true;
+        }
+    }
+    if (released) {
+        updateMipBytes();
+    }
+}
+
+void NetworkTexture::updateMipBytes() {
+    qint64 pendingBytes = _mips.getBytes();
+    qint64 uploadedBytes = 0;
+    int channels = _mips.hasAlpha() ? 4 : 3;
+    for (int level = qMax(_uploadedLevel, 0); level < _mips.getLevelCount(); level++) {
+        uploadedBytes += _mips.getWidth(level) * _mips.getHeight(level) * channels;
+    }
+    setBytes(uploadedBytes + pendingBytes);
     
-    finishedLoading(true);
-    imageLoaded(image);
-    glBindTexture(GL_TEXTURE_2D, getID());
-    if (image.hasAlphaChannel()) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width(), image.height(), 1,
-            GL_BGRA, GL_UNSIGNED_BYTE, image.constBits());
+    if (!_streamingCache) {
+        _streamingCache = static_cast<TextureCache*>(_cache.data());
+    }
+    if (_streamingCache) {
+        _streamingCache->updateStreamingTexture(this, _uploadedLevel > 0, pendingBytes - _pendingMipBytes);
+        _pendingMipBytes = pendingBytes;
+        
     } else {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.width(), image.height(), 1,
-            GL_RGB, GL_UNSIGNED_BYTE, image.constBits());
+        _pendingMipBytes = pendingBytes;
     }
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void NetworkTexture::imageLoaded(const QImage& image) {
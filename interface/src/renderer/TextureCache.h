@@ -14,15 +14,20 @@
 
 #include <QImage>
 #include <QMap>
+#include <QSet>
+#include <QTimer>
 
 #include <ResourceCache.h>
 
 #include "InterfaceConfig.h"
+#include "TextureMips.h"
 
 class QOpenGLFramebufferObject;
 
 class NetworkTexture;
 
+const qint64 DEFAULT_PENDING_MIP_BUDGET = 64 * 1024 * 1024;
+
 /// Stores cached textures, including render-to-texture targets.
 class TextureCache : public ResourceCache {
     Q_OBJECT
@@ -69,17 +74,47 @@ public:
     
     virtual bool eventFilter(QObject* watched, QEvent* event);
 
+    /// Sets the number of bytes of decoded mip levels waiting to be uploaded to keep around.  Past that, the waiting
+    /// levels that the least wanted textures have since stopped wanting are dropped, to be decoded again if they're wanted
+    /// later.  Levels that are still wanted are kept even past the budget, since dropping them would only reload them.
+    void setPendingMipBudget(qint64 budget);
+    qint64 getPendingMipBudget() const { return _pendingMipBudget; }
+    
+    qint64 getPendingMipBytes() const { return _pendingMipBytes; }
+
 protected:
 
     virtual QSharedPointer<Resource> createResource(const QUrl& url,
         const QSharedPointer<Resource>& fallback, bool delayLoad, const void* extra);
         
+private slots:
+    
+    /// Uploads the next finer level of the textures that want one, nearest first, as the upload rate allows.
+    void streamMips();
+    
 private:
     
+    friend class NetworkTexture;
     friend class DilatableNetworkTexture;
     
     QOpenGLFramebufferObject* createFramebufferObject();
     
+    /// Adds or removes a texture from those still streaming, and adjusts the count of bytes waiting.
+    void updateStreamingTexture(NetworkTexture* texture, bool streaming, qint64 pendingBytesDelta);
+    
+    /// Drops waiting levels that are no longer wanted, least wanted textures first, until we're within the budget.
+    void evictPendingMips();
+    
+    /// Checks whether we can upload the specified number of bytes now without exceeding the upload rate.
+    bool reserveMipUpload(qint64 bytes);
+    
+    QSet<NetworkTexture*> _streamingTextures;
+    QTimer _mipStreamTimer;
+    qint64 _pendingMipBudget;
+    qint64 _pendingMipBytes;
+    qint64 _mipUploadAllowance;
+    quint64 _lastMipUpload;
+    
     GLuint _permutationNormalTextureID;
     GLuint _whiteTextureID;
     GLuint _blueTextureID;
@@ -109,28 +144,62 @@ private:
     GLuint _id;
 };
 
-/// A texture loaded from the network.
+/// A texture loaded from the network.  The coarse mip levels are uploaded as soon as it's decoded, and the finer ones
+/// follow as the owners that set its load priority come near enough to want them.
 class NetworkTexture : public Resource, public Texture {
     Q_OBJECT
 
 public:
     
     NetworkTexture(const QUrl& url, bool normalMap);
+    virtual ~NetworkTexture();
 
     /// Checks whether it "looks like" this texture is translucent
     /// (majority of pixels neither fully opaque or fully transparent).
     bool isTranslucent() const { return _translucent; }
 
+    virtual void setLoadPriority(const QPointer<QObject>& owner, float priority);
+    virtual void setLoadPriorities(const QHash<QPointer<QObject>, float>& priorities);
+    virtual void clearLoadPriority(const QPointer<QObject>& owner);
+
 protected:
 
     virtual void downloadFinished(QNetworkReply* reply);
+    virtual void finishedLoading(bool success);
     virtual void imageLoaded(const QImage& image);      
 
-    Q_INVOKABLE void setImage(const QImage& image, bool translucent);
+    Q_INVOKABLE void setImage(const QImage& image, bool translucent, const MipChain& mips);
 
 private:
-
+    
+    friend class TextureCache;
+    
+    /// Returns the highest priority any owner has given, which for models is the negated distance to them.
+    float getViewPriority();
+    
+    /// Returns the finest mip level that's wanted, judging by how near the nearest owner is.
+    int getWantedLevel();
+    
+    /// Uploads the next finer level if it's wanted and we have it, or fetches the image again if it was dropped.
+    /// \return false if nothing more is wanted for now
+    bool streamNextLevel();
+    
+    void uploadLevel(int level);
+    
+    /// Drops the levels decoded but not yet uploaded that are finer than those wanted.
+    void releaseUnwantedLevels();
+    
+    void updateMipBytes();
+    
     bool _translucent;
+    
+    MipChain _mips;
+    int _uploadedLevel;
+    bool _reloading;
+    bool _reloadFailed;
+    qint64 _pendingMipBytes;
+    QHash<QPointer<QObject>, float> _viewPriorities;
+    QPointer<TextureCache> _streamingCache;
 };
 
 /// Caches derived, dilated textures.
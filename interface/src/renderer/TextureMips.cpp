@@ -0,0 +1,247 @@
+//
+//  TextureMips.cpp
+//  interface/src/renderer
+//
+//  Created by Andrzej Kapolka on 5/26/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <cstring>
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QRunnable>
+#include <QStringList>
+#include <QThreadPool>
+#include <QtDebug>
+
+#include "TextureMips.h"
+
+MipChain::MipChain() :
+    _hasAlpha(false) {
+}
+
+/// Averages each 2x2 block of the source level into one pixel of the destination, repeating the last row or column of
+/// sources with odd dimensions.
+static void downsample(const uchar* source, int sourceWidth, int sourceHeight, uchar* destination,
+        int width, int height, int channels) {
+    int sourceStride = sourceWidth * channels;
+    for (int y = 0; y < height; y++) {
+        const uchar* row0 = source + qMin(y * 2, sourceHeight - 1) * sourceStride;
+        const uchar* row1 = source + qMin(y * 2 + 1, sourceHeight - 1) * sourceStride;
+        for (int x = 0; x < width; x++) {
+            int offset0 = qMin(x * 2, sourceWidth - 1) * channels;
+            int offset1 = qMin(x * 2 + 1, sourceWidth - 1) * channels;
+            for (int i = 0; i < channels; i++) {
+                *destination++ = (row0[offset0 + i] + row0[offset1 + i] + row1[offset0 + i] + row1[offset1 + i] + 2) >> 2;
+            }
+        }
+    }
+}
+
+MipChain::MipChain(const QImage& image) :
+    _hasAlpha(image.hasAlphaChannel()) {
+    
+    if (image.isNull()) {
+        return;
+    }
+    int channels = _hasAlpha ? 4 : 3;
+    Level level;
+    level.width = image.width();
+    level.height = image.height();
+    
+    // QImage pads its rows to four bytes; ours are packed
+    int rowBytes = level.width * channels;
+    level.data.resize(rowBytes * level.height);
+    for (int y = 0; y < level.height; y++) {
+        memcpy(level.data.data() + y * rowBytes, image.constScanLine(y), rowBytes);
+    }
+    _levels.append(level);
+    
+    while (level.width > 1 || level.height > 1) {
+        const Level& previous = _levels.last();
+        Level next;
+        next.width = qMax(previous.width / 2, 1);
+        next.height = qMax(previous.height / 2, 1);
+        next.data.resize(next.width * next.height * channels);
+        downsample((const uchar*)previous.data.constData(), previous.width, previous.height,
+            (uchar*)next.data.data(), next.width, next.height, channels);
+        _levels.append(next);
+        level = next;
+    }
+}
+
+int MipChain::getFirstLevelWithin(int size) const {
+    for (int i = 0; i < _levels.size(); i++) {
+        if (_levels.at(i).width <= size && _levels.at(i).height <= size) {
+            return i;
+        }
+    }
+    return _levels.size() - 1;
+}
+
+qint64 MipChain::getBytes() const {
+    return getBytesFrom(0);
+}
+
+qint64 MipChain::getBytesFrom(int level) const {
+    qint64 bytes = 0;
+    for (int i = level; i < _levels.size(); i++) {
+        bytes += _levels.at(i).data.size();
+    }
+    return bytes;
+}
+
+QImage decodeTextureImage(const QByteArray& data, const QUrl& url, bool& translucent) {
+    QImage image = QImage::fromData(data);
+    translucent = false;
+    
+    // enforce a fixed maximum
+    const int MAXIMUM_SIZE = 1024;
+    if (image.width() > MAXIMUM_SIZE || image.height() > MAXIMUM_SIZE) {
+        qDebug() << "Image greater than maximum size:" << url << image.width() << image.height();
+        image = image.scaled(MAXIMUM_SIZE, MAXIMUM_SIZE, Qt::KeepAspectRatio);
+    }
+    
+    if (!image.hasAlphaChannel()) {
+        if (image.format() != QImage::Format_RGB888) {
+            image = image.convertToFormat(QImage::Format_RGB888);
+        }
+        return image;
+    }
+    if (image.format() != QImage::Format_ARGB32) {
+        image = image.convertToFormat(QImage::Format_ARGB32);
+    }
+    
+    // check for translucency/false transparency
+    int opaquePixels = 0;
+    int translucentPixels = 0;
+    const int EIGHT_BIT_MAXIMUM = 255;
+    const int RGB_BITS = 24;
+    for (int y = 0; y < image.height(); y++) {
+        for (int x = 0; x < image.width(); x++) {
+            int alpha = image.pixel(x, y) >> RGB_BITS;
+            if (alpha == EIGHT_BIT_MAXIMUM) {
+                opaquePixels++;
+            } else if (alpha != 0) {
+                translucentPixels++;
+            }
+        }
+    }
+    int imageArea = image.width() * image.height();
+    if (opaquePixels == imageArea) {
+        qDebug() << "Image with alpha channel is completely opaque:" << url;
+        image = image.convertToFormat(QImage::Format_RGB888);
+    }
+    translucent = (translucentPixels >= imageArea / 2);
+    return image;
+}
+
+/// Tracks the number of decoded bytes alive at once, and the most there have been.
+class ByteCounter {
+public:
+    
+    ByteCounter() : _current(0), _peak(0) { }
+    
+    void add(int bytes) {
+        int current = _current.fetchAndAddOrdered(bytes) + bytes;
+        int peak;
+        do {
+            peak = _peak.load();
+        } while (current > peak && !_peak.testAndSetOrdered(peak, current));
+    }
+    
+    void remove(int bytes) { _current.fetchAndAddOrdered(-bytes); }
+    
+    int getPeak() const { return _peak.load(); }
+    
+private:
+    
+    QAtomicInt _current;
+    QAtomicInt _peak;
+};
+
+/// Decodes one image the way TextureCache's readers do, and notes how many bytes it held and would keep.
+class TextureDecoder : public QRunnable {
+public:
+    
+    TextureDecoder(const QByteArray& data, bool buildMips, ByteCounter& liveBytes, QAtomicInt& keptBytes) :
+        _data(data), _buildMips(buildMips), _liveBytes(liveBytes), _keptBytes(keptBytes) { }
+    
+    virtual void run() {
+        bool translucent;
+        QImage image = decodeTextureImage(_data, QUrl(), translucent);
+        int imageBytes = image.byteCount();
+        _liveBytes.add(imageBytes);
+        if (!_buildMips) {
+            // the image is held until the main thread gets around to uploading it
+            _keptBytes.fetchAndAddOrdered(imageBytes);
+            _liveBytes.remove(imageBytes);
+            return;
+        }
+        MipChain mips(image);
+        int mipBytes = mips.getBytes();
+        _liveBytes.add(mipBytes);
+        image = QImage();
+        _liveBytes.remove(imageBytes);
+        
+        // like NetworkTexture::setImage, hand the coarse levels to GL and keep the finer ones (all wanted, as they are for
+        // a texture without owners) until they're streamed in
+        for (int level = mips.getFirstLevelWithin(IMMEDIATE_MIP_SIZE); level < mips.getLevelCount(); level++) {
+            mips.releaseLevel(level);
+        }
+        _keptBytes.fetchAndAddOrdered(mips.getBytes());
+        _liveBytes.remove(mipBytes);
+    }
+
+private:
+    
+    QByteArray _data;
+    bool _buildMips;
+    ByteCounter& _liveBytes;
+    QAtomicInt& _keptBytes;
+};
+
+void benchmarkTextureDecoding(const QStringList& filenames) {
+    QList<QByteArray> files;
+    qint64 fileBytes = 0;
+    foreach (const QString& filename, filenames) {
+        QFile file(filename);
+        if (!file.open(QIODevice::ReadOnly)) {
+            qDebug() << "Couldn't open" << filename;
+            continue;
+        }
+        files.append(file.readAll());
+        fileBytes += files.last().size();
+    }
+    if (files.isEmpty()) {
+        return;
+    }
+    const int ROUNDS = 10;
+    const float BYTES_PER_MEGABYTE = 1024.0f * 1024.0f;
+    qDebug() << files.size() << "images," << fileBytes / BYTES_PER_MEGABYTE << "MB compressed, decoding on"
+        << QThreadPool::globalInstance()->maxThreadCount() << "threads";
+    
+    for (int buildMips = 0; buildMips < 2; buildMips++) {
+        ByteCounter liveBytes;
+        QAtomicInt keptBytes;
+        QThreadPool pool;
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < ROUNDS; i++) {
+            foreach (const QByteArray& file, files) {
+                pool.start(new TextureDecoder(file, buildMips, liveBytes, keptBytes));
+            }
+            pool.waitForDone();
+        }
+        qint64 msecs = qMax(timer.elapsed(), (qint64)1);
+        qDebug() << (buildMips ? "    decode and mip chain:" : "    decode only:")
+            << files.size() * ROUNDS * 1000.0f / msecs << "images per second,"
+            << "peak decoded" << liveBytes.getPeak() / BYTES_PER_MEGABYTE << "MB,"
+            << "held at upload" << keptBytes.load() / (ROUNDS * BYTES_PER_MEGABYTE) << "MB";
+    }
+}
@@ -0,0 +1,81 @@
+//
+//  TextureMips.h
+//  interface/src/renderer
+//
+//  Created by Andrzej Kapolka on 5/26/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_TextureMips_h
+#define hifi_TextureMips_h
+
+#include <QByteArray>
+#include <QImage>
+#include <QMetaType>
+#include <QUrl>
+#include <QVector>
+
+/// The coarse mip levels, up to this size, are uploaded as soon as a texture is decoded; the finer ones follow when wanted.
+const int IMMEDIATE_MIP_SIZE = 64;
+
+/// The mip levels of a texture, from the full size down to 1x1, each packed without row padding in the byte order of
+/// the image it came from (RGB, or BGRA with alpha).  Levels can be released once they've been handed off to GL.
+class MipChain {
+public:
+    
+    MipChain();
+    
+    /// Builds the chain by box filtering an image in QImage::Format_RGB888 or QImage::Format_ARGB32.
+    MipChain(const QImage& image);
+    
+    bool hasAlpha() const { return _hasAlpha; }
+    
+    int getLevelCount() const { return _levels.size(); }
+    
+    int getWidth(int level) const { return _levels.at(level).width; }
+    int getHeight(int level) const { return _levels.at(level).height; }
+    
+    /// Returns the data for the level, which is empty once released.
+    const QByteArray& getData(int level) const { return _levels.at(level).data; }
+    bool hasData(int level) const { return !_levels.at(level).data.isEmpty(); }
+    
+    /// Returns the finest level that is no larger than the specified size in either dimension.
+    int getFirstLevelWithin(int size) const;
+    
+    /// Frees the data for the level.
+    void releaseLevel(int level) { _levels[level].data = QByteArray(); }
+    
+    /// Returns the number of bytes of data held.
+    qint64 getBytes() const;
+    
+    /// Returns the number of bytes held by the specified level and all coarser ones.
+    qint64 getBytesFrom(int level) const;
+    
+private:
+    
+    class Level {
+    public:
+        int width;
+        int height;
+        QByteArray data;
+    };
+    
+    QVector<Level> _levels;
+    bool _hasAlpha;
+};
+
+Q_DECLARE_METATYPE(MipChain)
+
+/// Decodes an image, scaling it down to the maximum texture size and converting it to RGB888, or ARGB32 if any of its
+/// pixels are other than opaque.
+/// \param translucent set to whether most of its pixels are neither fully opaque nor fully transparent
+QImage decodeTextureImage(const QByteArray& data, const QUrl& url, bool& translucent);
+
+/// Times decoding a list of image files and building their mip chains on the worker threads, and reports the bytes held
+/// for them.
+void benchmarkTextureDecoding(const QStringList& filenames);
+
+#endif // hifi_TextureMips_h
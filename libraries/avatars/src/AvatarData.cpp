@@ -71,6 +71,14 @@ void AvatarData::setHandPosition(const glm::vec3& handPosition) {
 }
 
 QByteArray AvatarData::toByteArray() {
+    QByteArray avatarDataByteArray;
+    avatarDataByteArray.resize(MAX_PACKET_SIZE);
+    
+    avatarDataByteArray.resize(toBuffer(reinterpret_cast<unsigned char*>(avatarDataByteArray.data())));
+    return avatarDataByteArray;
+}
+
+int AvatarData::toBuffer(unsigned char* destinationBuffer) {
     // TODO: DRY this up to a shared method
     // that can pack any type given the number of bytes
     // and return the number of bytes to push the pointer
@@ -80,10 +88,6 @@ QByteArray AvatarData::toByteArray() {
         _headData = new HeadData(this);
     }
     
-    QByteArray avatarDataByteArray;
-    avatarDataByteArray.resize(MAX_PACKET_SIZE);
-    
-    unsigned char* destinationBuffer = reinterpret_cast<unsigned char*>(avatarDataByteArray.data());
     unsigned char* startPosition = destinationBuffer;
     
     memcpy(destinationBuffer, &_position, sizeof(_position));
@@ -180,7 +184,7 @@ QByteArray AvatarData::toByteArray() {
         }
     }
         
-    return avatarDataByteArray.left(destinationBuffer - startPosition);
+    return destinationBuffer - startPosition;
 }
 
 bool AvatarData::shouldLogError(const quint64& now) {
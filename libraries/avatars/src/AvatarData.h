@@ -114,6 +114,10 @@ public:
 
     QByteArray toByteArray();
 
+    /// Writes the same data as toByteArray to a buffer with room for MAX_PACKET_SIZE bytes, without allocating.
+    /// \return the number of bytes written
+    int toBuffer(unsigned char* destinationBuffer);
+
     /// \return true if an error should be logged
     bool shouldLogError(const quint64& now);
 
@@ -9,6 +9,7 @@
 //  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
 //
 
+#include <QMutexLocker>
 #include <QScriptEngine>
 
 #include "AttributeRegistry.h"
@@ -522,6 +523,7 @@ void SpannerSetAttribute::readMetavoxelRoot(MetavoxelData& data, MetavoxelStream
 }
 
 void SpannerSetAttribute::writeMetavoxelRoot(const MetavoxelNode& root, MetavoxelStreamState& state) {
+    QMutexLocker locker(&Spanner::getVisitMutex());
     Spanner::incrementVisit();
     root.writeSpanners(state);
     state.stream << SharedObjectPointer();
@@ -541,6 +543,7 @@ void SpannerSetAttribute::readMetavoxelDelta(MetavoxelData& data,
 
 void SpannerSetAttribute::writeMetavoxelDelta(const MetavoxelNode& root,
         const MetavoxelNode& reference, MetavoxelStreamState& state) {
+    QMutexLocker locker(&Spanner::getVisitMutex());
     Spanner::incrementVisit();
     root.writeSpannerDelta(reference, state);
     state.stream << SharedObjectPointer();
@@ -558,6 +561,7 @@ void SpannerSetAttribute::readMetavoxelSubdivision(MetavoxelData& data, Metavoxe
 }
 
 void SpannerSetAttribute::writeMetavoxelSubdivision(const MetavoxelNode& root, MetavoxelStreamState& state) {
+    QMutexLocker locker(&Spanner::getVisitMutex());
     Spanner::incrementVisit();
     root.writeSpannerSubdivision(state);
     state.stream << SharedObjectPointer();
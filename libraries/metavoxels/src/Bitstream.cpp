@@ -11,9 +11,12 @@
 
 #include <cstring>
 
+#include <QBuffer>
 #include <QCryptographicHash>
 #include <QDataStream>
 #include <QMetaType>
+#include <QtEndian>
+#include <QReadWriteLock>
 #include <QUrl>
 #include <QtDebug>
 
@@ -42,6 +45,22 @@ static int quatStreamer = Bitstream::registerTypeStreamer(qMetaTypeId<glm::quat>
 static int metaObjectStreamer = Bitstream::registerTypeStreamer(qMetaTypeId<const QMetaObject*>(),
     new SimpleTypeStreamer<const QMetaObject*>());
 
+/// Guards the cached streaming plans, which may be built from any thread that streams.
+static QReadWriteLock& getPlanLock() {
+    static QReadWriteLock planLock;
+    return planLock;
+}
+
+static QHash<const QMetaObject*, QVector<PropertyWriter> >& getCachedPropertyWriters() {
+    static QHash<const QMetaObject*, QVector<PropertyWriter> > propertyWriters;
+    return propertyWriters;
+}
+
+static QHash<const QMetaObject*, QVector<PropertyReader> >& getCachedPropertyReaders() {
+    static QHash<const QMetaObject*, QVector<PropertyReader> > propertyReaders;
+    return propertyReaders;
+}
+
 IDStreamer::IDStreamer(Bitstream& stream) :
     _stream(stream),
     _bits(1) {
@@ -84,6 +103,11 @@ int Bitstream::registerMetaObject(const char* className, const QMetaObject* meta
 int Bitstream::registerTypeStreamer(int type, TypeStreamer* streamer) {
     streamer->setType(type);
     getTypeStreamers().insert(type, streamer);
+    
+    // plans built before now may be missing properties of this type
+    QWriteLocker locker(&getPlanLock());
+    getCachedPropertyWriters().clear();
+    getCachedPropertyReaders().clear();
     return 0;
 }
 
@@ -99,10 +123,36 @@ QList<const QMetaObject*> Bitstream::getMetaObjectSubClasses(const QMetaObject*
     return getMetaObjectSubClasses().values(metaObject);
 }
 
+QVector<PropertyWriter> Bitstream::getPropertyWriters(const QMetaObject* metaObject) {
+    {
+        QReadLocker locker(&getPlanLock());
+        QHash<const QMetaObject*, QVector<PropertyWriter> >::const_iterator it =
+            getCachedPropertyWriters().constFind(metaObject);
+        if (it != getCachedPropertyWriters().constEnd()) {
+            return it.value();
+        }
+    }
+    QVector<PropertyWriter> propertyWriters;
+    for (int i = 0; i < metaObject->propertyCount(); i++) {
+        QMetaProperty property = metaObject->property(i);
+        if (!property.isStored()) {
+            continue;
+        }
+        const TypeStreamer* typeStreamer = getTypeStreamers().value(property.userType());
+        if (typeStreamer) {
+            propertyWriters.append(PropertyWriter(property, typeStreamer));
+        }
+    }
+    QWriteLocker locker(&getPlanLock());
+    getCachedPropertyWriters().insert(metaObject, propertyWriters);
+    return propertyWriters;
+}
+
 Bitstream::Bitstream(QDataStream& underlying, MetadataType metadataType, QObject* parent) :
     QObject(parent),
     _underlying(underlying),
-    _byte(0),
+    _buffer(qobject_cast<QBuffer*>(underlying.device())),
+    _word(0),
     _position(0),
     _metadataType(metadataType),
     _metaObjectStreamer(*this),
@@ -120,20 +170,54 @@ void Bitstream::addTypeSubstitution(const QByteArray& typeName, int type) {
     _typeStreamerSubstitutions.insert(typeName, getTypeStreamers().value(type));
 }
 
-const int LAST_BIT_POSITION = BITS_IN_BYTE - 1;
+/// The most bits we move at once, so that they fit in the word with the seven that may already be there.
+const int MAX_BITS_PER_WORD = 56;
+
+static inline quint64 getLowBitMask(int bits) {
+    return (bits == 64) ? ~(quint64)0 : (((quint64)1 << bits) - 1);
+}
+
+/// Reads up to eight bytes as a little-endian word, so that the first byte holds the first bits on any host.
+static inline quint64 loadWord(const void* data, int bytes) {
+    uchar buffer[sizeof(quint64)] = { 0 };
+    memcpy(buffer, data, bytes);
+    return qFromLittleEndian<quint64>(buffer);
+}
+
+/// Writes the low bytes of a word in little-endian order.
+static inline void storeWord(quint64 word, void* data, int bytes) {
+    uchar buffer[sizeof(quint64)];
+    qToLittleEndian<quint64>(word, buffer);
+    memcpy(data, buffer, bytes);
+}
 
+// the words are converted to and from little-endian explicitly, so the wire format (bits LSB-first within each byte,
+// bytes in the order of the data they come from) is the same whatever the host's byte order
 Bitstream& Bitstream::write(const void* data, int bits, int offset) {
     const quint8* source = (const quint8*)data;
+    if (_position == 0 && offset == 0 && bits >= BITS_IN_BYTE) {
+        // we're byte aligned, so the whole bytes can go straight out
+        int bytes = bits / BITS_IN_BYTE;
+        writeBytes(source, bytes);
+        source += bytes;
+        bits -= bytes * BITS_IN_BYTE;
+    }
     while (bits > 0) {
-        int bitsToWrite = qMin(BITS_IN_BYTE - _position, qMin(BITS_IN_BYTE - offset, bits));
-        _byte |= ((*source >> offset) & ((1 << bitsToWrite) - 1)) << _position;
-        if ((_position += bitsToWrite) == BITS_IN_BYTE) {
-            flush();
-        }
-        if ((offset += bitsToWrite) == BITS_IN_BYTE) {
-            source++;
-            offset = 0;
+        int bitsToWrite = qMin(bits, MAX_BITS_PER_WORD);
+        quint64 value = loadWord(source, (offset + bitsToWrite + BITS_IN_BYTE - 1) / BITS_IN_BYTE);
+        _word |= ((value >> offset) & getLowBitMask(bitsToWrite)) << _position;
+        _position += bitsToWrite;
+        
+        int bytes = _position / BITS_IN_BYTE;
+        if (bytes > 0) {
+            uchar buffer[sizeof(quint64)];
+            storeWord(_word, buffer, bytes);
+            writeBytes(buffer, bytes);
+            _word >>= bytes * BITS_IN_BYTE;
+            _position -= bytes * BITS_IN_BYTE;
         }
+        source += (offset + bitsToWrite) / BITS_IN_BYTE;
+        offset = (offset + bitsToWrite) % BITS_IN_BYTE;
         bits -= bitsToWrite;
     }
     return *this;
@@ -141,18 +225,35 @@ Bitstream& Bitstream::write(const void* data, int bits, int offset) {
 
 Bitstream& Bitstream::read(void* data, int bits, int offset) {
     quint8* dest = (quint8*)data;
+    if (_position == 0 && offset == 0 && bits >= BITS_IN_BYTE) {
+        int bytes = bits / BITS_IN_BYTE;
+        readBytes(dest, bytes);
+        dest += bytes;
+        bits -= bytes * BITS_IN_BYTE;
+    }
     while (bits > 0) {
-        if (_position == 0) {
-            _underlying >> _byte;
-        }
-        int bitsToRead = qMin(BITS_IN_BYTE - _position, qMin(BITS_IN_BYTE - offset, bits));
-        int mask = ((1 << bitsToRead) - 1) << offset;
-        *dest = (*dest & ~mask) | (((_byte >> _position) << offset) & mask);
-        _position = (_position + bitsToRead) & LAST_BIT_POSITION;
-        if ((offset += bitsToRead) == BITS_IN_BYTE) {
-            dest++;
-            offset = 0;
+        int bitsToRead = qMin(bits, MAX_BITS_PER_WORD);
+        if (_position < bitsToRead) {
+            // fetch only the bytes we need, so that the device ends up where it would reading a byte at a time
+            int bytes = (bitsToRead - _position + BITS_IN_BYTE - 1) / BITS_IN_BYTE;
+            uchar buffer[sizeof(quint64)];
+            readBytes(buffer, bytes);
+            _word |= loadWord(buffer, bytes) << _position;
+            _position += bytes * BITS_IN_BYTE;
         }
+        quint64 value = _word & getLowBitMask(bitsToRead);
+        _word >>= bitsToRead;
+        _position -= bitsToRead;
+        
+        // leave the bits around the destination range as they were
+        int destBytes = (offset + bitsToRead + BITS_IN_BYTE - 1) / BITS_IN_BYTE;
+        quint64 destValue = loadWord(dest, destBytes);
+        quint64 mask = getLowBitMask(bitsToRead) << offset;
+        destValue = (destValue & ~mask) | (value << offset);
+        storeWord(destValue, dest, destBytes);
+        
+        dest += (offset + bitsToRead) / BITS_IN_BYTE;
+        offset = (offset + bitsToRead) % BITS_IN_BYTE;
         bits -= bitsToRead;
     }
     return *this;
@@ -160,16 +261,53 @@ Bitstream& Bitstream::read(void* data, int bits, int offset) {
 
 void Bitstream::flush() {
     if (_position != 0) {
-        _underlying << _byte;
+        quint8 byte = (quint8)_word;
+        writeBytes(&byte, 1);
         reset();
     }
 }
 
+qint64 Bitstream::getBitsWritten() const {
+    return _underlying.device()->pos() * BITS_IN_BYTE + _position;
+}
+
 void Bitstream::reset() {
-    _byte = 0;
+    _word = 0;
     _position = 0;
 }
 
+void Bitstream::writeBytes(const void* data, int bytes) {
+    if (!_buffer) {
+        _underlying.writeRawData((const char*)data, bytes);
+        return;
+    }
+    QByteArray& array = _buffer->buffer();
+    int position = _buffer->pos();
+    if (position + bytes > array.size()) {
+        array.resize(position + bytes);
+    }
+    memcpy(array.data() + position, data, bytes);
+    _buffer->seek(position + bytes);
+}
+
+void Bitstream::readBytes(void* data, int bytes) {
+    int bytesRead;
+    if (_buffer) {
+        const QByteArray& array = _buffer->data();
+        int position = _buffer->pos();
+        bytesRead = qMax(qMin(bytes, array.size() - position), 0);
+        memcpy(data, array.constData() + position, bytesRead);
+        _buffer->seek(position + bytesRead);
+        
+    } else {
+        bytesRead = qMax(_underlying.readRawData((char*)data, bytes), 0);
+    }
+    if (bytesRead < bytes) {
+        memset((char*)data + bytesRead, 0, bytes - bytesRead);
+        _underlying.setStatus(QDataStream::ReadPastEnd);
+    }
+}
+
 Bitstream::WriteMappings Bitstream::getAndResetWriteMappings() {
     WriteMappings mappings = { _metaObjectStreamer.getAndResetTransientOffsets(),
         _typeStreamerStreamer.getAndResetTransientOffsets(),
@@ -280,16 +418,11 @@ void Bitstream::writeRawDelta(const QObject* value, const QObject* reference) {
     }
     const QMetaObject* metaObject = value->metaObject();
     _metaObjectStreamer << metaObject;
-    for (int i = 0; i < metaObject->propertyCount(); i++) {
-        QMetaProperty property = metaObject->property(i);
-        if (!property.isStored(value)) {
-            continue;
-        }
-        const TypeStreamer* streamer = getTypeStreamers().value(property.userType());
-        if (streamer) {
-            streamer->writeDelta(*this, property.read(value), reference && metaObject == reference->metaObject() ?
-                property.read(reference) : QVariant());
-        }
+    if (reference && reference->metaObject() != metaObject) {
+        reference = NULL;
+    }
+    foreach (const PropertyWriter& propertyWriter, getPropertyWriters(metaObject)) {
+        propertyWriter.writeDelta(*this, value, reference);
     }
 }
 
@@ -301,7 +434,7 @@ void Bitstream::readRawDelta(QObject*& value, const QObject* reference) {
 
 Bitstream& Bitstream::operator<<(bool value) {
     if (value) {
-        _byte |= (1 << _position);
+        _word |= ((quint64)1 << _position);
     }
     if (++_position == BITS_IN_BYTE) {
         flush();
@@ -311,10 +444,14 @@ Bitstream& Bitstream::operator<<(bool value) {
 
 Bitstream& Bitstream::operator>>(bool& value) {
     if (_position == 0) {
-        _underlying >> _byte;
+        quint8 byte;
+        readBytes(&byte, 1);
+        _word = byte;
+        _position = BITS_IN_BYTE;
     }
-    value = _byte & (1 << _position);
-    _position = (_position + 1) & LAST_BIT_POSITION;
+    value = _word & 1;
+    _word >>= 1;
+    _position--;
     return *this;
 }
 
@@ -458,15 +595,8 @@ Bitstream& Bitstream::operator<<(const QObject* object) {
     }
     const QMetaObject* metaObject = object->metaObject();
     _metaObjectStreamer << metaObject;
-    for (int i = 0; i < metaObject->propertyCount(); i++) {
-        QMetaProperty property = metaObject->property(i);
-        if (!property.isStored(object)) {
-            continue;
-        }
-        const TypeStreamer* streamer = getTypeStreamers().value(property.userType());
-        if (streamer) {
-            streamer->write(*this, property.read(object));
-        }
+    foreach (const PropertyWriter& propertyWriter, getPropertyWriters(metaObject)) {
+        propertyWriter.write(*this, object);
     }
     return *this;
 }
@@ -550,25 +680,12 @@ Bitstream& Bitstream::operator<(const QMetaObject* metaObject) {
     if (_metadataType == NO_METADATA) {
         return *this;
     }
-    int storedPropertyCount = 0;
-    for (int i = 0; i < metaObject->propertyCount(); i++) {
-        QMetaProperty property = metaObject->property(i);
-        if (property.isStored() && getTypeStreamers().contains(property.userType())) {
-            storedPropertyCount++;
-        }    
-    }
-    *this << storedPropertyCount;
+    QVector<PropertyWriter> propertyWriters = getPropertyWriters(metaObject);
+    *this << propertyWriters.size();
     QCryptographicHash hash(QCryptographicHash::Md5);
-    for (int i = 0; i < metaObject->propertyCount(); i++) {
-        QMetaProperty property = metaObject->property(i);
-        if (!property.isStored()) {
-            continue;
-        }
-        const TypeStreamer* typeStreamer = getTypeStreamers().value(property.userType());
-        if (!typeStreamer) {
-            continue;
-        }
-        _typeStreamerStreamer << typeStreamer;
+    foreach (const PropertyWriter& propertyWriter, propertyWriters) {
+        _typeStreamerStreamer << propertyWriter.getStreamer();
+        const QMetaProperty& property = propertyWriter.getProperty();
         if (_metadataType == FULL_METADATA) {
             *this << QByteArray::fromRawData(property.name(), strlen(property.name()));
         } else {
@@ -622,21 +739,14 @@ Bitstream& Bitstream::operator>(ObjectReader& objectReader) {
         bool matches = true;
         if (metaObject) {
             int propertyIndex = 0;
-            for (int i = 0; i < metaObject->propertyCount(); i++) {
-                QMetaProperty property = metaObject->property(i);
-                if (!property.isStored()) {
-                    continue;
-                }
-                const TypeStreamer* typeStreamer = getTypeStreamers().value(property.userType());
-                if (!typeStreamer) {
-                    continue;
-                }
+            foreach (const PropertyWriter& propertyWriter, getPropertyWriters(metaObject)) {
                 if (propertyIndex >= properties.size() ||
-                        !properties.at(propertyIndex).getReader().matchesExactly(typeStreamer)) {
+                        !properties.at(propertyIndex).getReader().matchesExactly(propertyWriter.getStreamer())) {
                     matches = false;
                     break;
                 }
-                hash.addData(property.name(), strlen(property.name()) + 1); 
+                const char* name = propertyWriter.getProperty().name();
+                hash.addData(name, strlen(name) + 1); 
                 propertyIndex++;
             }
             if (propertyIndex != properties.size()) {
@@ -920,16 +1030,20 @@ QVector<PropertyReader> Bitstream::getPropertyReaders(const QMetaObject* metaObj
     if (!metaObject) {
         return propertyReaders;
     }
-    for (int i = 0; i < metaObject->propertyCount(); i++) {
-        QMetaProperty property = metaObject->property(i);
-        if (!property.isStored()) {
-            continue;
-        }
-        const TypeStreamer* typeStreamer = getTypeStreamers().value(property.userType());
-        if (typeStreamer) {
-            propertyReaders.append(PropertyReader(TypeReader(QByteArray(), typeStreamer), property));
+    {
+        QReadLocker locker(&getPlanLock());
+        QHash<const QMetaObject*, QVector<PropertyReader> >::const_iterator it =
+            getCachedPropertyReaders().constFind(metaObject);
+        if (it != getCachedPropertyReaders().constEnd()) {
+            return it.value();
         }
     }
+    foreach (const PropertyWriter& propertyWriter, getPropertyWriters(metaObject)) {
+        propertyReaders.append(PropertyReader(TypeReader(QByteArray(), propertyWriter.getStreamer()),
+            propertyWriter.getProperty()));
+    }
+    QWriteLocker locker(&getPlanLock());
+    getCachedPropertyReaders().insert(metaObject, propertyReaders);
     return propertyReaders;
 }
 
@@ -1152,12 +1266,24 @@ uint qHash(const ObjectReader& objectReader, uint seed) {
     return qHash(objectReader.getClassName(), seed);
 }
 
+/// Checks whether we can get and set the property through a value of its declared type rather than a QVariant.  Enums are
+/// converted to and from ints by QMetaProperty, so they always go through QVariant.
+static bool canAccessDirectly(const QMetaProperty& property, const TypeStreamer* streamer) {
+    return property.isValid() && !property.isEnumType() && streamer && streamer->getType() == property.userType();
+}
+
 PropertyReader::PropertyReader(const TypeReader& reader, const QMetaProperty& property) :
     _reader(reader),
-    _property(property) {
+    _property(property),
+    _directStreamer((reader.matchesExactly(reader.getStreamer()) && canAccessDirectly(property, reader.getStreamer())) ?
+        reader.getStreamer() : NULL) {
 }
 
 void PropertyReader::read(Bitstream& in, QObject* object) const {
+    if (_directStreamer && object) {
+        _directStreamer->readProperty(in, object, _property);
+        return;
+    }
     QVariant value = _reader.read(in);
     if (_property.isValid() && object) {
         _property.write(object, value);
@@ -1165,6 +1291,10 @@ void PropertyReader::read(Bitstream& in, QObject* object) const {
 }
 
 void PropertyReader::readDelta(Bitstream& in, QObject* object, const QObject* reference) const {
+    if (_directStreamer && object) {
+        _directStreamer->readPropertyDelta(in, object, reference, _property);
+        return;
+    }
     QVariant value;
     _reader.readDelta(in, value, (_property.isValid() && reference) ? _property.read(reference) : QVariant());
     if (_property.isValid() && object) {
@@ -1172,6 +1302,28 @@ void PropertyReader::readDelta(Bitstream& in, QObject* object, const QObject* re
     }
 }
 
+PropertyWriter::PropertyWriter(const QMetaProperty& property, const TypeStreamer* streamer) :
+    _property(property),
+    _streamer(streamer),
+    _direct(canAccessDirectly(property, streamer)) {
+}
+
+void PropertyWriter::write(Bitstream& out, const QObject* object) const {
+    if (_direct) {
+        _streamer->writeProperty(out, object, _property);
+    } else {
+        _streamer->write(out, _property.read(object));
+    }
+}
+
+void PropertyWriter::writeDelta(Bitstream& out, const QObject* object, const QObject* reference) const {
+    if (_direct) {
+        _streamer->writePropertyDelta(out, object, reference, _property);
+    } else {
+        _streamer->writeDelta(out, _property.read(object), reference ? _property.read(reference) : QVariant());
+    }
+}
+
 MetaField::MetaField(const QByteArray& name, const TypeStreamer* streamer) :
     _name(name),
     _streamer(streamer) {
@@ -1180,6 +1332,20 @@ MetaField::MetaField(const QByteArray& name, const TypeStreamer* streamer) :
 TypeStreamer::~TypeStreamer() {
 }
 
+void TypeStreamer::getPropertyValue(const QObject* object, const QMetaProperty& property, void* value) {
+    // this is what QMetaProperty::read does, minus the QVariant to hold the result
+    int status = -1;
+    void* arguments[] = { value, NULL, &status };
+    QMetaObject::metacall(const_cast<QObject*>(object), QMetaObject::ReadProperty, property.propertyIndex(), arguments);
+}
+
+void TypeStreamer::setPropertyValue(QObject* object, const QMetaProperty& property, void* value) {
+    int status = -1;
+    int flags = 0;
+    void* arguments[] = { value, NULL, &status, &flags };
+    QMetaObject::metacall(object, QMetaObject::WriteProperty, property.propertyIndex(), arguments);
+}
+
 const QVector<MetaField>& TypeStreamer::getMetaFields() const {
     static QVector<MetaField> emptyMetaFields;
     return emptyMetaFields;
@@ -1236,3 +1402,23 @@ QVariant TypeStreamer::getValue(const QVariant& object, int index) const {
 void TypeStreamer::setValue(QVariant& object, int index, const QVariant& value) const {
     // nothing by default
 }
+
+void TypeStreamer::writeProperty(Bitstream& out, const QObject* object, const QMetaProperty& property) const {
+    write(out, property.read(object));
+}
+
+void TypeStreamer::writePropertyDelta(Bitstream& out, const QObject* object, const QObject* reference,
+        const QMetaProperty& property) const {
+    writeDelta(out, property.read(object), reference ? property.read(reference) : QVariant());
+}
+
+void TypeStreamer::readProperty(Bitstream& in, QObject* object, const QMetaProperty& property) const {
+    property.write(object, read(in));
+}
+
+void TypeStreamer::readPropertyDelta(Bitstream& in, QObject* object, const QObject* reference,
+        const QMetaProperty& property) const {
+    QVariant value(getType(), (void*)NULL);
+    readDelta(in, value, reference ? property.read(reference) : QVariant());
+    property.write(object, value);
+}
@@ -28,6 +28,7 @@
 
 class QByteArray;
 class QColor;
+class QBuffer;
 class QDataStream;
 class QUrl;
 
@@ -38,6 +39,7 @@ class FieldReader;
 class ObjectReader;
 class OwnedAttributeValue;
 class PropertyReader;
+class PropertyWriter;
 class TypeReader;
 class TypeStreamer;
 
@@ -224,9 +226,15 @@ public:
     /// Returns the list of registered subclasses for the supplied meta-object.
     static QList<const QMetaObject*> getMetaObjectSubClasses(const QMetaObject* metaObject);
 
+    /// Returns the plan for streaming instances of the supplied meta-object: its stored properties that have registered
+    /// streamers, in order.  Plans are built on first use and kept until another type streamer is registered.
+    static QVector<PropertyWriter> getPropertyWriters(const QMetaObject* metaObject);
+
     enum MetadataType { NO_METADATA, HASH_METADATA, FULL_METADATA };
 
-    /// Creates a new bitstream.  Note: the stream may be used for reading or writing, but not both.
+    /// Creates a new bitstream.  Note: the stream may be used for reading or writing, but not both.  When the underlying
+    /// device is a QBuffer, the bitstream reads and writes its data directly, keeping its position where the data stream
+    /// would expect it.
     Bitstream(QDataStream& underlying, MetadataType metadataType = NO_METADATA, QObject* parent = NULL);
 
     /// Substitutes the supplied metaobject for the given class name's default mapping.
@@ -248,6 +256,9 @@ public:
     /// Flushes any unwritten bits to the underlying stream.
     void flush();
 
+    /// Returns the number of bits written so far, counting those not yet flushed.
+    qint64 getBitsWritten() const;
+
     /// Resets to the initial state.
     void reset();
 
@@ -390,8 +401,17 @@ private slots:
 
 private:
     
+    /// Writes whole bytes to the underlying buffer or stream.
+    void writeBytes(const void* data, int bytes);
+    
+    /// Reads whole bytes from the underlying buffer or stream, supplying zeros past the end.
+    void readBytes(void* data, int bytes);
+    
     QDataStream& _underlying;
-    quint8 _byte;
+    QBuffer* _buffer;
+    
+    /// When writing, the bits not yet written out; when reading, those read but not yet consumed.
+    quint64 _word;
     int _position;
 
     MetadataType _metadataType;
@@ -741,6 +761,28 @@ private:
 
     TypeReader _reader;
     QMetaProperty _property;
+    
+    /// the streamer to read the property with directly, if the stream's type matches the property's exactly
+    const TypeStreamer* _directStreamer;
+};
+
+/// Contains the information required to write an object property to the stream.
+class PropertyWriter {
+public:
+    
+    PropertyWriter(const QMetaProperty& property = QMetaProperty(), const TypeStreamer* streamer = NULL);
+    
+    const QMetaProperty& getProperty() const { return _property; }
+    const TypeStreamer* getStreamer() const { return _streamer; }
+    
+    void write(Bitstream& out, const QObject* object) const;
+    void writeDelta(Bitstream& out, const QObject* object, const QObject* reference) const;
+    
+private:
+    
+    QMetaProperty _property;
+    const TypeStreamer* _streamer;
+    bool _direct;
 };
 
 /// Describes a metatype field.
@@ -803,6 +845,29 @@ public:
     virtual QVariant getValue(const QVariant& object, int index) const;
     virtual void setValue(QVariant& object, int index, const QVariant& value) const;
 
+    /// Writes the value of an object property whose type is this streamer's.  The default implementation goes through
+    /// QVariant; streamers that know their type access the property directly.
+    virtual void writeProperty(Bitstream& out, const QObject* object, const QMetaProperty& property) const;
+    
+    /// Writes the delta between the values of an object property in the object and (if non-null) the reference.
+    virtual void writePropertyDelta(Bitstream& out, const QObject* object, const QObject* reference,
+        const QMetaProperty& property) const;
+    
+    /// Reads a value and sets the object property to it.
+    virtual void readProperty(Bitstream& in, QObject* object, const QMetaProperty& property) const;
+    
+    /// Reads a delta against the value of the property in the reference (if non-null) and sets the object property.
+    virtual void readPropertyDelta(Bitstream& in, QObject* object, const QObject* reference,
+        const QMetaProperty& property) const;
+
+protected:
+    
+    /// Reads a property into a value of the property's own type, without boxing it in a QVariant.
+    static void getPropertyValue(const QObject* object, const QMetaProperty& property, void* value);
+    
+    /// Sets a property from a value of the property's own type.
+    static void setPropertyValue(QObject* object, const QMetaProperty& property, void* value);
+
 private:
     
     int _type;
@@ -823,6 +888,20 @@ public:
         out.writeRawDelta(value.value<T>(), reference.value<T>()); }
     virtual void readRawDelta(Bitstream& in, QVariant& value, const QVariant& reference) const {
         in.readRawDelta(*static_cast<T*>(value.data()), reference.value<T>()); }
+    virtual void writeProperty(Bitstream& out, const QObject* object, const QMetaProperty& property) const {
+        T value; TypeStreamer::getPropertyValue(object, property, &value); out << value; }
+    virtual void writePropertyDelta(Bitstream& out, const QObject* object, const QObject* reference,
+            const QMetaProperty& property) const {
+        T value, referenceValue = T(); TypeStreamer::getPropertyValue(object, property, &value);
+        if (reference) { TypeStreamer::getPropertyValue(reference, property, &referenceValue); }
+        out.writeDelta(value, referenceValue); }
+    virtual void readProperty(Bitstream& in, QObject* object, const QMetaProperty& property) const {
+        T value; in >> value; TypeStreamer::setPropertyValue(object, property, &value); }
+    virtual void readPropertyDelta(Bitstream& in, QObject* object, const QObject* reference,
+            const QMetaProperty& property) const {
+        T value, referenceValue = T();
+        if (reference) { TypeStreamer::getPropertyValue(reference, property, &referenceValue); }
+        in.readDelta(value, referenceValue); TypeStreamer::setPropertyValue(object, property, &value); }
 };
 
 /// A streamer for types compiled by mtc.
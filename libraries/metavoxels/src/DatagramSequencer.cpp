@@ -23,6 +23,41 @@ const int MAX_DATAGRAM_SIZE = MAX_PACKET_SIZE;
 
 const int DEFAULT_MAX_PACKET_SIZE = 3000;
 
+// the round trip time we assume before we've measured one
+const float INITIAL_ROUND_TRIP_TIME = 100.0f * USECS_PER_MSEC;
+
+// the round trip time below which we don't pace any faster
+const float MIN_PACING_ROUND_TRIP_TIME = 1.0f * USECS_PER_MSEC;
+
+// we forget the minimum round trip time after this long, so as to notice when the route changes
+const quint64 MINIMUM_ROUND_TRIP_TIME_WINDOW = 10 * USECS_PER_SECOND;
+
+// we keep the highest bandwidth sample for this many round trips
+const int BANDWIDTH_WINDOW_ROUND_TRIPS = 10;
+
+// the congestion window limits, in multiples of the maximum packet size
+const int INITIAL_CONGESTION_WINDOW_PACKETS = 4;
+const int MIN_CONGESTION_WINDOW_PACKETS = 2;
+const int MAX_CONGESTION_WINDOW_PACKETS = 1024;
+
+// the queuing delay (beyond the minimum round trip time) that we aim for; LEDBAT allows at most 100 ms
+const float TARGET_QUEUING_DELAY = 100.0f * USECS_PER_MSEC;
+
+// the number of maximum sized packets by which the window grows each round trip when there's no queuing
+const float CONGESTION_WINDOW_GAIN = 1.0f;
+
+// the number of maximum sized packets by which the window may exceed the data actually in flight
+const int ALLOWED_WINDOW_INCREASE_PACKETS = 2;
+
+// the factor by which we shrink the window on loss
+const float LOSS_WINDOW_DECREASE = 0.5f;
+
+// we pace slightly faster than the window implies so that it's the window rather than the pacing that limits us
+const float PACING_GAIN = 1.25f;
+
+// the lower bound on the retransmission timeout
+const quint64 MIN_RETRANSMISSION_TIMEOUT = 250 * USECS_PER_MSEC;
+
 DatagramSequencer::DatagramSequencer(const QByteArray& datagramHeader, QObject* parent) :
     QObject(parent),
     _outgoingPacketStream(&_outgoingPacketData, QIODevice::WriteOnly),
@@ -37,7 +72,24 @@ DatagramSequencer::DatagramSequencer(const QByteArray& datagramHeader, QObject*
     _incomingPacketStream(&_incomingPacketData, QIODevice::ReadOnly),
     _inputStream(_incomingPacketStream),
     _receivedHighPriorityMessages(0),
-    _maxPacketSize(DEFAULT_MAX_PACKET_SIZE) {
+    _maxPacketSize(DEFAULT_MAX_PACKET_SIZE),
+    _lastPacketSize(0),
+    _smoothedRoundTripTime(INITIAL_ROUND_TRIP_TIME),
+    _roundTripTimeVariance(INITIAL_ROUND_TRIP_TIME / 2.0f),
+    _roundTripSamples(0),
+    _minimumRoundTripTime(INITIAL_ROUND_TRIP_TIME),
+    _minimumRoundTripTimeSampled(0),
+    _delivered(0),
+    _deliveredTime(0),
+    _bandwidth(0.0f),
+    _bandwidthSampled(0),
+    _congestionWindow(INITIAL_CONGESTION_WINDOW_PACKETS * DEFAULT_MAX_PACKET_SIZE),
+    _slowStart(true),
+    _recoveryStart(0),
+    _bytesInFlight(0),
+    _packetsLost(0),
+    _pacingCredit(0.0f),
+    _pacingTime(usecTimestampNow()) {
 
     _outgoingPacketStream.setByteOrder(QDataStream::LittleEndian);
     _incomingDatagramStream.setByteOrder(QDataStream::LittleEndian);
@@ -55,6 +107,19 @@ void DatagramSequencer::sendHighPriorityMessage(const QVariant& data) {
     _highPriorityMessages.append(message);
 }
 
+float DatagramSequencer::getPacingRate() const {
+    // never pace below the rate at which we've seen data delivered
+    float windowRate = _congestionWindow * USECS_PER_SECOND / qMax(_smoothedRoundTripTime, MIN_PACING_ROUND_TRIP_TIME);
+    return PACING_GAIN * qMax(windowRate, _bandwidth);
+}
+
+int DatagramSequencer::getSendBudget() const {
+    float windowBudget = _congestionWindow - _bytesInFlight;
+    float pacingBudget = qMin(_pacingCredit + getPacingRate() * (usecTimestampNow() - _pacingTime) / USECS_PER_SECOND,
+        _congestionWindow);
+    return qMax((int)qMin(windowBudget, pacingBudget), 0);
+}
+
 ReliableChannel* DatagramSequencer::getReliableOutputChannel(int index) {
     ReliableChannel*& channel = _reliableOutputChannels[index];
     if (!channel) {
@@ -91,8 +156,12 @@ Bitstream& DatagramSequencer::startPacket() {
 void DatagramSequencer::endPacket() {
     _outputStream.flush();
     
-    // if we have space remaining, send some data from our reliable channels 
-    int remaining = _maxPacketSize - _outgoingPacketStream.device()->pos();
+    // requeue the reliable data in any packets that have gone unacknowledged for too long
+    retransmitTimedOutPackets(usecTimestampNow());
+    
+    // if we have space remaining (and the congestion window allows), send some data from our reliable channels
+    int position = _outgoingPacketStream.device()->pos();
+    int remaining = qMin(_maxPacketSize - position, (int)_congestionWindow - _bytesInFlight - position);
     const int MINIMUM_RELIABLE_SIZE = sizeof(quint32) * 5; // count, channel number, segment count, offset, size
     QVector<ChannelSpan> spans;
     if (remaining > MINIMUM_RELIABLE_SIZE) {
@@ -160,6 +229,7 @@ void DatagramSequencer::receivedDatagram(const QByteArray& datagram) {
     }
     
     // read the list of acknowledged packets
+    quint64 now = usecTimestampNow();
     quint32 acknowledgementCount;
     _incomingPacketStream >> acknowledgementCount;
     for (quint32 i = 0; i < acknowledgementCount; i++) {
@@ -173,6 +243,18 @@ void DatagramSequencer::receivedDatagram(const QByteArray& datagram) {
             continue;
         }
         QList<SendRecord>::iterator it = _sendRecords.begin() + index;
+        
+        // any earlier packets still outstanding were lost, as the other party drops packets that arrive out of order
+        for (QList<SendRecord>::const_iterator lost = _sendRecords.constBegin(); lost != it; lost++) {
+            _bytesInFlight -= lost->size;
+            _packetsLost++;
+            if (!lost->retransmitted) {
+                retransmitPacket(*lost, now);
+            }
+        }
+        _bytesInFlight -= it->size;
+        updateCongestionState(*it, now);
+        
         sendRecordAcknowledged(*it);
         emit sendAcknowledged(index);
         _sendRecords.erase(_sendRecords.begin(), it + 1);
@@ -255,13 +337,88 @@ void DatagramSequencer::sendRecordAcknowledged(const SendRecord& record) {
     }
 }
 
+void DatagramSequencer::updateCongestionState(const SendRecord& record, quint64 now) {
+    // smooth the round trip time as per RFC 6298
+    float sample = now - record.sendTime;
+    if (_roundTripSamples++ == 0) {
+        _smoothedRoundTripTime = sample;
+        _roundTripTimeVariance = sample / 2.0f;
+    
+    } else {
+        const float VARIANCE_WEIGHT = 0.25f;
+        const float AVERAGE_WEIGHT = 0.125f;
+        _roundTripTimeVariance = glm::mix(_roundTripTimeVariance, qAbs(_smoothedRoundTripTime - sample), VARIANCE_WEIGHT);
+        _smoothedRoundTripTime = glm::mix(_smoothedRoundTripTime, sample, AVERAGE_WEIGHT);
+    }
+    if (sample <= _minimumRoundTripTime || now - _minimumRoundTripTimeSampled > MINIMUM_ROUND_TRIP_TIME_WINDOW) {
+        _minimumRoundTripTime = sample;
+        _minimumRoundTripTimeSampled = now;
+    }
+    
+    // the bandwidth sample is the rate at which data was delivered while this packet was in flight
+    _delivered += record.size;
+    _deliveredTime = now;
+    if (now > record.deliveredTime) {
+        float rate = (_delivered - record.delivered) * (float)USECS_PER_SECOND / (now - record.deliveredTime);
+        if (rate >= _bandwidth || now - _bandwidthSampled > BANDWIDTH_WINDOW_ROUND_TRIPS * _smoothedRoundTripTime) {
+            _bandwidth = rate;
+            _bandwidthSampled = now;
+        }
+    }
+    
+    // only grow the window if we're actually using it; otherwise, it would grow without bound while we're limited by
+    // the amount we have to send
+    float queuingDelay = sample - _minimumRoundTripTime;
+    float windowUsed = _bytesInFlight + record.size + ALLOWED_WINDOW_INCREASE_PACKETS * _maxPacketSize;
+    if (_slowStart && queuingDelay < TARGET_QUEUING_DELAY / 2.0f) {
+        // double the window each round trip until we see queuing
+        if (windowUsed >= _congestionWindow) {
+            _congestionWindow += record.size;
+        }
+    } else {
+        // grow or shrink in proportion to the distance from the target queuing delay
+        _slowStart = false;
+        float offTarget = (TARGET_QUEUING_DELAY - queuingDelay) / TARGET_QUEUING_DELAY;
+        if (offTarget < 0.0f || windowUsed >= _congestionWindow) {
+            _congestionWindow += CONGESTION_WINDOW_GAIN * offTarget * record.size * _maxPacketSize / _congestionWindow;
+        }
+    }
+    _congestionWindow = glm::clamp(_congestionWindow, (float)MIN_CONGESTION_WINDOW_PACKETS * _maxPacketSize,
+        (float)MAX_CONGESTION_WINDOW_PACKETS * _maxPacketSize);
+}
+
+void DatagramSequencer::retransmitPacket(const SendRecord& record, quint64 now) {
+    foreach (const ChannelSpan& span, record.spans) {
+        getReliableOutputChannel(span.channel)->spanLost(span);
+    }
+    
+    // back off once per window: losses of packets sent before we last backed off are part of the same event
+    if (record.sendTime >= _recoveryStart) {
+        _slowStart = false;
+        _congestionWindow = qMax(_congestionWindow * LOSS_WINDOW_DECREASE,
+            (float)MIN_CONGESTION_WINDOW_PACKETS * _maxPacketSize);
+        _recoveryStart = now;
+    }
+}
+
+void DatagramSequencer::retransmitTimedOutPackets(quint64 now) {
+    quint64 timeout = qMax((quint64)(_smoothedRoundTripTime + 4.0f * _roundTripTimeVariance), MIN_RETRANSMISSION_TIMEOUT);
+    for (QList<SendRecord>::iterator it = _sendRecords.begin(); it != _sendRecords.end() &&
+            it->sendTime + timeout < now; it++) {
+        if (!it->retransmitted) {
+            it->retransmitted = true;
+            retransmitPacket(*it, now);
+        }
+    }
+}
+
 void DatagramSequencer::appendReliableData(int bytes, QVector<ChannelSpan>& spans) {
     // gather total number of bytes to write, priority
     int totalBytes = 0;
     float totalPriority = 0.0f;
     int totalChannels = 0;
     foreach (ReliableChannel* channel, _reliableOutputChannels) {
-        int channelBytes = channel->getBytesAvailable();
+        int channelBytes = channel->getBytesToSend();
         if (channelBytes > 0) {
             totalBytes += channelBytes;
             totalPriority += channel->getPriority();
@@ -275,7 +432,7 @@ void DatagramSequencer::appendReliableData(int bytes, QVector<ChannelSpan>& span
     totalBytes = qMin(bytes, totalBytes);
     
     foreach (ReliableChannel* channel, _reliableOutputChannels) {
-        int channelBytes = channel->getBytesAvailable();
+        int channelBytes = channel->getBytesToSend();
         if (channelBytes == 0) {
             continue;
         }
@@ -293,9 +450,22 @@ void DatagramSequencer::sendPacket(const QByteArray& packet, const QVector<Chann
     // increment the packet number
     _outgoingPacketNumber++;
     
+    // spend the pacing credit accumulated since the last packet
+    quint64 now = usecTimestampNow();
+    _pacingCredit = qMin(_pacingCredit + getPacingRate() * (now - _pacingTime) / USECS_PER_SECOND, _congestionWindow) -
+        packet.size();
+    _pacingTime = now;
+    
+    // delivery rates are measured from the start of each flight, so that idle periods don't count against them
+    if (_bytesInFlight == 0) {
+        _deliveredTime = now;
+    }
+    _bytesInFlight += packet.size();
+    _lastPacketSize = packet.size();
+    
     // record the send
     SendRecord record = { _outgoingPacketNumber, _receiveRecords.isEmpty() ? 0 : _receiveRecords.last().packetNumber,
-        _outputStream.getAndResetWriteMappings(), spans };
+        _outputStream.getAndResetWriteMappings(), spans, now, packet.size(), _delivered, _deliveredTime, false };
     _sendRecords.append(record);
     
     // write the sequence number and size, which are the same between all fragments
@@ -320,6 +490,7 @@ void DatagramSequencer::sendPacket(const QByteArray& packet, const QVector<Chann
     } while(offset < packet.size());
 }
 
+// must be a power of two, as the capacity only ever doubles and we rely on that to wrap offsets with a mask
 const int INITIAL_CIRCULAR_BUFFER_CAPACITY = 16;
 
 CircularBuffer::CircularBuffer(QObject* parent) :
@@ -331,23 +502,16 @@ CircularBuffer::CircularBuffer(QObject* parent) :
 }
 
 void CircularBuffer::append(const char* data, int length) {
-    // resize to fit
     int oldSize = _size;
     resize(_size + length);
-    
-    // write our data in up to two segments: one from the position to the end, one from the beginning
-    int end = (_position + oldSize) % _data.size();
-    int firstSegment = qMin(length, _data.size() - end);
-    memcpy(_data.data() + end, data, firstSegment);
-    int secondSegment = length - firstSegment;
-    if (secondSegment > 0) {
-        memcpy(_data.data(), data + firstSegment, secondSegment);
-    }
+    copyIn(oldSize, length, data);
 }
 
 void CircularBuffer::remove(int length) {
-    _position = (_position + length) % _data.size();
     _size -= length;
+    
+    // once empty, start over at the beginning of the storage so that what follows is contiguous for longer
+    _position = (_size == 0) ? 0 : ((_position + length) & (_data.size() - 1));
 }
 
 QByteArray CircularBuffer::readBytes(int offset, int length) const {
@@ -357,36 +521,30 @@ QByteArray CircularBuffer::readBytes(int offset, int length) const {
 }
 
 void CircularBuffer::readBytes(int offset, int length, char* data) const {
-    // read in up to two segments
-    QByteArray array;
-    int start = (_position + offset) % _data.size();
-    int firstSegment = qMin(length, _data.size() - start);
-    memcpy(data, _data.constData() + start, firstSegment);
-    int secondSegment = length - firstSegment;
-    if (secondSegment > 0) {
-        memcpy(data + firstSegment, _data.constData(), secondSegment);
+    for (int copied = 0; copied < length; ) {
+        int segment = length - copied;
+        const char* source = getContiguousData(offset + copied, segment);
+        memcpy(data + copied, source, segment);
+        copied += segment;
     }
 }
 
+const char* CircularBuffer::getContiguousData(int offset, int& length) const {
+    int start = (_position + offset) & (_data.size() - 1);
+    length = qMin(length, _data.size() - start);
+    return _data.constData() + start;
+}
+
 void CircularBuffer::writeBytes(int offset, int length, const char* data) {
-    // write in up to two segments
-    int start = (_position + offset) % _data.size();
-    int firstSegment = qMin(length, _data.size() - start);
-    memcpy(_data.data() + start, data, firstSegment);
-    int secondSegment = length - firstSegment;
-    if (secondSegment > 0) {
-        memcpy(_data.data(), data + firstSegment, secondSegment);
-    }
+    copyIn(offset, length, data);
 }
 
 void CircularBuffer::writeToStream(int offset, int length, QDataStream& out) const {
-    // write in up to two segments
-    int start = (_position + offset) % _data.size();
-    int firstSegment = qMin(length, _data.size() - start);
-    out.writeRawData(_data.constData() + start, firstSegment);
-    int secondSegment = length - firstSegment;
-    if (secondSegment > 0) {
-        out.writeRawData(_data.constData(), secondSegment);
+    for (int written = 0; written < length; ) {
+        int segment = length - written;
+        const char* source = getContiguousData(offset + written, segment);
+        out.writeRawData(source, segment);
+        written += segment;
     }
 }
 
@@ -396,25 +554,20 @@ void CircularBuffer::readFromStream(int offset, int length, QDataStream& in) {
     if (requiredSize > _size) {
         resize(requiredSize);
     }
-    
-    // read in up to two segments
-    int start = (_position + offset) % _data.size();
-    int firstSegment = qMin(length, _data.size() - start);
-    in.readRawData(_data.data() + start, firstSegment);
-    int secondSegment = length - firstSegment;
-    if (secondSegment > 0) {
-        in.readRawData(_data.data(), secondSegment);
+    for (int read = 0; read < length; ) {
+        int segment = length - read;
+        char* destination = getWritableData(offset + read, segment);
+        in.readRawData(destination, segment);
+        read += segment;
     }
 }
 
 void CircularBuffer::appendToBuffer(int offset, int length, CircularBuffer& buffer) const {
-    // append in up to two segments
-    int start = (_position + offset) % _data.size();
-    int firstSegment = qMin(length, _data.size() - start);
-    buffer.append(_data.constData() + start, firstSegment);
-    int secondSegment = length - firstSegment;
-    if (secondSegment > 0) {
-        buffer.append(_data.constData(), secondSegment);
+    for (int appended = 0; appended < length; ) {
+        int segment = length - appended;
+        const char* source = getContiguousData(offset + appended, segment);
+        buffer.append(source, segment);
+        appended += segment;
     }
 }
 
@@ -427,10 +580,13 @@ qint64 CircularBuffer::bytesAvailable() const {
 }
 
 bool CircularBuffer::canReadLine() const {
-    for (int offset = _offset; offset < _size; offset++) {
-        if (_data.at((_position + offset) % _data.size()) == '\n') {
+    for (int offset = _offset; offset < _size; ) {
+        int segment = _size - offset;
+        const char* data = getContiguousData(offset, segment);
+        if (memchr(data, '\n', segment)) {
             return true;
         }
+        offset += segment;
     }
     return false;
 }
@@ -457,15 +613,7 @@ qint64 CircularBuffer::size() const {
 
 qint64 CircularBuffer::readData(char* data, qint64 length) {
     int readable = qMin((int)length, _size - _offset);
-    
-    // read in up to two segments
-    int start = (_position + _offset) % _data.size();
-    int firstSegment = qMin((int)length, _data.size() - start);
-    memcpy(data, _data.constData() + start, firstSegment);
-    int secondSegment = length - firstSegment;
-    if (secondSegment > 0) {
-        memcpy(data + firstSegment, _data.constData(), secondSegment);
-    }
+    readBytes(_offset, readable, data);
     _offset += readable;
     return readable;
 }
@@ -476,19 +624,26 @@ qint64 CircularBuffer::writeData(const char* data, qint64 length) {
     if (requiredSize > _size) {
         resize(requiredSize);
     }
-    
-    // write in up to two segments
-    int start = (_position + _offset) % _data.size();
-    int firstSegment = qMin((int)length, _data.size() - start);
-    memcpy(_data.data() + start, data, firstSegment);
-    int secondSegment = length - firstSegment;
-    if (secondSegment > 0) {
-        memcpy(_data.data(), data + firstSegment, secondSegment);
-    }
+    copyIn(_offset, length, data);
     _offset += length;
     return length;
 }
 
+char* CircularBuffer::getWritableData(int offset, int& length) {
+    int start = (_position + offset) & (_data.size() - 1);
+    length = qMin(length, _data.size() - start);
+    return _data.data() + start;
+}
+
+void CircularBuffer::copyIn(int offset, int length, const char* data) {
+    for (int copied = 0; copied < length; ) {
+        int segment = length - copied;
+        char* destination = getWritableData(offset + copied, segment);
+        memcpy(destination, data + copied, segment);
+        copied += segment;
+    }
+}
+
 void CircularBuffer::resize(int size) {
     if (size > _data.size()) {
         // double our capacity until we can fit the desired length
@@ -497,87 +652,53 @@ void CircularBuffer::resize(int size) {
             newCapacity *= 2;
         } while (size > newCapacity);
         
-        int oldCapacity = _data.size();
-        _data.resize(newCapacity);
-        
-        int trailing = _position + _size - oldCapacity;
-        if (trailing > 0) {
-            memcpy(_data.data() + oldCapacity, _data.constData(), trailing);
-        }
+        // copy only what we hold, straightening it out as we go
+        QByteArray newData;
+        newData.resize(newCapacity);
+        readBytes(0, _size, newData.data());
+        _data = newData;
+        _position = 0;
     }
     _size = size;
 }
 
-SpanList::SpanList() : _totalSet(0) {
+SpanList::SpanList() : _base(0), _totalSet(0) {
 }
 
 int SpanList::set(int offset, int length) {
-    // if we intersect the front of the list, consume beginning spans and return advancement
-    if (offset <= 0) {
-        int intersection = offset + length;
-        return (intersection > 0) ? setSpans(_spans.begin(), intersection) : 0;
-    }
-
-    // look for an intersection within the list
-    int position = 0;
-    for (QList<Span>::iterator it = _spans.begin(); it != _spans.end(); it++) {
-        // if we intersect the unset portion, contract it
-        position += it->unset;
-        if (offset <= position) {
-            int remove = position - offset;
-            it->unset -= remove;
-            
-            // if we continue into the set portion, expand it and consume following spans
-            int extra = offset + length - position;
-            if (extra >= 0) {
-                int amount = setSpans(it + 1, extra);
-                it->set += amount;
-                _totalSet += amount;
-            
-            // otherwise, insert a new span
-            } else {        
-                Span span = { it->unset, length + extra };
-                _spans.insert(it, span);
-                it->unset = -extra;
-                _totalSet += span.set;
-            }
-            return 0;
-        }
-        
-        // if we intersect the set portion, expand it and consume following spans
-        position += it->set;
-        if (offset <= position) {
-            int extra = offset + length - position;
-            int amount = setSpans(it + 1, extra);
-            it->set += amount;
-            _totalSet += amount;
-            return 0;
+    int start = qMax(_base + offset, _base);
+    int end = _base + offset + length;
+    if (end <= start) {
+        return 0;
+    }
+    
+    // merge with the span before us, if we overlap or abut it
+    QMap<int, int>::iterator it = _spans.upperBound(start);
+    if (it != _spans.begin()) {
+        QMap<int, int>::iterator previous = it - 1;
+        if (previous.value() >= start) {
+            start = previous.key();
+            end = qMax(end, previous.value());
+            _totalSet -= previous.value() - previous.key();
+            it = _spans.erase(previous);
         }
     }
-
-    // add to end of list
-    Span span = { offset - position, length };
-    _spans.append(span);
-    _totalSet += length;
-
-    return 0;
-}
-
-int SpanList::setSpans(QList<Span>::iterator it, int length) {
-    int remainingLength = length;
-    int totalRemoved = 0;
-    for (; it != _spans.end(); it = _spans.erase(it)) {
-        if (remainingLength < it->unset) {
-            it->unset -= remainingLength;
-            totalRemoved += remainingLength;
-            break;
-        }
-        int combined = it->unset + it->set;
-        remainingLength = qMax(remainingLength - combined, 0);
-        totalRemoved += combined;
-        _totalSet -= it->set;
+    
+    // and with those after that we reach
+    while (it != _spans.end() && it.key() <= end) {
+        end = qMax(end, it.value());
+        _totalSet -= it.value() - it.key();
+        it = _spans.erase(it);
     }
-    return qMax(length, totalRemoved);
+    
+    // if we've reached the beginning, we advance it rather than adding a span
+    if (start == _base) {
+        _base = end;
+        return end - start;
+    }
+    _spans.insert(it, start, end);
+    _totalSet += end - start;
+    return 0;
 }
 
 int ReliableChannel::getBytesAvailable() const {
@@ -618,7 +739,7 @@ ReliableChannel::ReliableChannel(DatagramSequencer* sequencer, int index, bool o
     _bitstream(_dataStream),
     _priority(1.0f),
     _offset(0),
-    _writePosition(0),
+    _unsentOffset(0),
     _messagesEnabled(true) {
     
     _buffer.open(output ? QIODevice::WriteOnly : QIODevice::ReadOnly);
@@ -628,69 +749,54 @@ ReliableChannel::ReliableChannel(DatagramSequencer* sequencer, int index, bool o
     connect(this, SIGNAL(receivedMessage(const QVariant&)), SLOT(handleMessage(const QVariant&)));
 }
 
+int ReliableChannel::getBytesToSend() const {
+    int bytes = _offset + _buffer.pos() - _unsentOffset;
+    foreach (const DatagramSequencer::ChannelSpan& span, _lostSpans) {
+        bytes += qMax(span.offset + span.length - qMax(span.offset, _offset), 0);
+    }
+    return bytes;
+}
+
 void ReliableChannel::writeData(QDataStream& out, int bytes, QVector<DatagramSequencer::ChannelSpan>& spans) {
-    // find out how many spans we want to write
-    int spanCount = 0;
+    // resend what we know to have been lost before anything new, skipping whatever has since been acknowledged
+    int firstSpan = spans.size();
     int remainingBytes = bytes;
-    bool first = true;
-    while (remainingBytes > 0) {
-        int position = 0;
-        foreach (const SpanList::Span& span, _acknowledged.getSpans()) {
-            if (remainingBytes <= 0) {
-                break;
-            }
-            spanCount++;
-            remainingBytes -= getBytesToWrite(first, qMin(remainingBytes, span.unset));
-            position += (span.unset + span.set);
+    while (remainingBytes > 0 && !_lostSpans.isEmpty()) {
+        DatagramSequencer::ChannelSpan& lost = _lostSpans.first();
+        int start = qMax(lost.offset, _offset);
+        int end = lost.offset + lost.length;
+        if (start >= end) {
+            _lostSpans.removeFirst();
+            continue;
         }
-        int leftover = _buffer.pos() - position;
-        if (remainingBytes > 0 && leftover > 0) {
-            spanCount++;
-            remainingBytes -= getBytesToWrite(first, qMin(remainingBytes, leftover));
+        DatagramSequencer::ChannelSpan span = { _index, start, qMin(end - start, remainingBytes) };
+        spans.append(span);
+        remainingBytes -= span.length;
+        if (start + span.length == end) {
+            _lostSpans.removeFirst();
+        
+        } else {
+            lost.offset = start + span.length;
+            lost.length = end - lost.offset;
         }
     }
     
-    // write the count and the spans
-    out << (quint32)spanCount;
-    remainingBytes = bytes;
-    first = true;
-    while (remainingBytes > 0) {
-        int position = 0;
-        foreach (const SpanList::Span& span, _acknowledged.getSpans()) {
-            if (remainingBytes <= 0) {
-                break;
-            }
-            remainingBytes -= writeSpan(out, first, position, qMin(remainingBytes, span.unset), spans);
-            position += (span.unset + span.set);
-        }
-        int leftover = _buffer.pos() - position;
-        if (remainingBytes > 0 && leftover > 0) {
-            remainingBytes -= writeSpan(out, first, position, qMin(remainingBytes, leftover), spans);
-        }
-    }
-}
-
-int ReliableChannel::getBytesToWrite(bool& first, int length) const {
-    if (first) {
-        first = false;
-        return length - (_writePosition % length);
+    // then follow with data we've never sent
+    int unsent = _offset + _buffer.pos() - _unsentOffset;
+    if (remainingBytes > 0 && unsent > 0) {
+        DatagramSequencer::ChannelSpan span = { _index, _unsentOffset, qMin(unsent, remainingBytes) };
+        spans.append(span);
+        _unsentOffset += span.length;
     }
-    return length;
-}
-
-int ReliableChannel::writeSpan(QDataStream& out, bool& first, int position, int length, QVector<DatagramSequencer::ChannelSpan>& spans) {
-    if (first) {
-        first = false;
-        position = _writePosition % length;
-        length -= position;
-        _writePosition += length;
+    
+    // write the count and the spans
+    out << (quint32)(spans.size() - firstSpan);
+    for (int i = firstSpan; i < spans.size(); i++) {
+        const DatagramSequencer::ChannelSpan& span = spans.at(i);
+        out << (quint32)span.offset;
+        out << (quint32)span.length;
+        _buffer.writeToStream(span.offset - _offset, span.length, out);
     }
-    DatagramSequencer::ChannelSpan span = { _index, _offset + position, length };
-    spans.append(span);
-    out << (quint32)span.offset;
-    out << (quint32)length;
-    _buffer.writeToStream(position, length, out);
-    return length;
 }
 
 void ReliableChannel::spanAcknowledged(const DatagramSequencer::ChannelSpan& span) {
@@ -700,10 +806,13 @@ void ReliableChannel::spanAcknowledged(const DatagramSequencer::ChannelSpan& spa
         _buffer.seek(_buffer.size());
         
         _offset += advancement;
-        _writePosition = qMax(_writePosition - advancement, 0);
     } 
 }
 
+void ReliableChannel::spanLost(const DatagramSequencer::ChannelSpan& span) {
+    _lostSpans.append(span);
+}
+
 void ReliableChannel::readData(QDataStream& in) {
     quint32 segments;
     in >> segments;
@@ -16,6 +16,7 @@
 #include <QDataStream>
 #include <QByteArray>
 #include <QList>
+#include <QMap>
 #include <QSet>
 #include <QVector>
 
@@ -23,7 +24,9 @@
 
 class ReliableChannel;
 
-/// Performs simple datagram sequencing, packet fragmentation and reassembly.
+/// Performs simple datagram sequencing, packet fragmentation and reassembly.  Estimates the round trip time and bandwidth
+/// of the link from the acknowledgements of sent packets and limits the data in flight with a delay-based (LEDBAT-style)
+/// congestion window.
 class DatagramSequencer : public QObject {
     Q_OBJECT
 
@@ -61,6 +64,36 @@ public:
     
     int getMaxPacketSize() const { return _maxPacketSize; }
     
+    /// Returns the smoothed round trip time, in microseconds.
+    float getRoundTripTime() const { return _smoothedRoundTripTime; }
+    
+    /// Returns the lowest round trip time measured recently, in microseconds, which we take to be the delay without queuing.
+    float getMinimumRoundTripTime() const { return _minimumRoundTripTime; }
+    
+    /// Returns the estimated bandwidth of the link, in bytes per second: the highest rate at which our packets have
+    /// recently been delivered.
+    float getBandwidth() const { return _bandwidth; }
+    
+    /// Returns the number of unacknowledged bytes that we allow in flight.
+    int getCongestionWindow() const { return (int)_congestionWindow; }
+    
+    /// Returns the number of bytes sent that have been neither acknowledged nor found to be lost.
+    int getBytesInFlight() const { return _bytesInFlight; }
+    
+    /// Returns the rate, in bytes per second, at which we pace the packets sent.
+    float getPacingRate() const;
+    
+    /// Returns the number of bytes that may be sent now without exceeding either the congestion window or the pacing rate.
+    /// Those generating a variable amount of data for each packet should aim to stay within it; the reliable data appended
+    /// by endPacket is limited by the window.
+    int getSendBudget() const;
+    
+    /// Returns the size of the last packet sent.
+    int getLastPacketSize() const { return _lastPacketSize; }
+    
+    /// Returns the number of sent packets found to have been lost.
+    int getPacketsLost() const { return _packetsLost; }
+    
     /// Returns the output channel at the specified index, creating it if necessary.
     ReliableChannel* getReliableOutputChannel(int index = 0);
     
@@ -118,7 +151,12 @@ private:
         int packetNumber;
         int lastReceivedPacketNumber;
         Bitstream::WriteMappings mappings;
-        QVector<ChannelSpan> spans; 
+        QVector<ChannelSpan> spans;
+        quint64 sendTime;
+        int size;
+        qint64 delivered;
+        quint64 deliveredTime;
+        bool retransmitted;
     };
     
     class ReceiveRecord {
@@ -133,6 +171,15 @@ private:
     /// Notes that the described send was acknowledged by the other party.
     void sendRecordAcknowledged(const SendRecord& record);
     
+    /// Updates the round trip time, bandwidth and congestion window estimates on the acknowledgement of a send.
+    void updateCongestionState(const SendRecord& record, quint64 now);
+    
+    /// Queues the reliable data in the described send for retransmission and backs off the congestion window.
+    void retransmitPacket(const SendRecord& record, quint64 now);
+    
+    /// Retransmits the packets that have gone unacknowledged for longer than the retransmission timeout.
+    void retransmitTimedOutPackets(quint64 now);
+    
     /// Appends some reliable data to the outgoing packet.
     void appendReliableData(int bytes, QVector<ChannelSpan>& spans);
     
@@ -167,12 +214,34 @@ private:
     int _receivedHighPriorityMessages;
     
     int _maxPacketSize;
+    int _lastPacketSize;
+    
+    float _smoothedRoundTripTime;
+    float _roundTripTimeVariance;
+    int _roundTripSamples;
+    float _minimumRoundTripTime;
+    quint64 _minimumRoundTripTimeSampled;
+    
+    qint64 _delivered;
+    quint64 _deliveredTime;
+    float _bandwidth;
+    quint64 _bandwidthSampled;
+    
+    float _congestionWindow;
+    bool _slowStart;
+    quint64 _recoveryStart;
+    int _bytesInFlight;
+    int _packetsLost;
+    
+    float _pacingCredit;
+    quint64 _pacingTime;
     
     QHash<int, ReliableChannel*> _reliableOutputChannels;
     QHash<int, ReliableChannel*> _reliableInputChannels;
 };
 
-/// A circular buffer, where one may efficiently append data to the end or remove data from the beginning.
+/// A circular buffer, where one may efficiently append data to the end or remove data from the beginning.  The capacity
+/// is always a power of two.
 class CircularBuffer : public QIODevice {
 public:
 
@@ -193,6 +262,10 @@ public:
     /// Reads part of the data from the buffer.
     void readBytes(int offset, int length, char* data) const;
 
+    /// Returns a pointer to the data at the specified offset without copying it, limiting the length to what follows
+    /// contiguously.  The pointer is valid until the buffer is next modified.
+    const char* getContiguousData(int offset, int& length) const;
+
     /// Writes to part of the data in the buffer.
     void writeBytes(int offset, int length, const char* data);
 
@@ -220,6 +293,11 @@ protected:
 
 private:
     
+    char* getWritableData(int offset, int& length);
+    
+    /// Copies data into the buffer at the specified offset, which must be within its size.
+    void copyIn(int offset, int length, const char* data);
+    
     void resize(int size);
     
     QByteArray _data;
@@ -228,36 +306,28 @@ private:
     int _offset;
 };
 
-/// A list of contiguous spans, alternating between set and unset.  Conceptually, the list is preceeded by a set
-/// span of infinite length and followed by an unset span of infinite length.  Within those bounds, it alternates
-/// between unset and set.
+/// Tracks the set regions of a stream.  Everything before the current beginning is set; beyond that, the set regions are
+/// kept as disjoint spans in a map from start to end, so that setting one takes time logarithmic in the number of spans.
 class SpanList {
 public:
 
-    class Span {
-    public:
-        int unset;
-        int set;
-    };
-    
     SpanList();
     
-    const QList<Span>& getSpans() const { return _spans; }
+    /// Returns the number of disjoint set spans beyond the beginning.
+    int getSpanCount() const { return _spans.size(); }
     
-    /// Returns the total length set.
+    /// Returns the total length set beyond the beginning.
     int getTotalSet() const { return _totalSet; }
 
     /// Sets a region of the list.
-    /// \return the advancement of the set length at the beginning of the list
+    /// \param offset the offset of the region relative to the beginning
+    /// \return the advancement of the beginning
     int set(int offset, int length);
 
 private:
     
-    /// Sets the spans starting at the specified iterator, consuming at least the given length.
-    /// \return the actual amount set, which may be greater if we ran into an existing set span
-    int setSpans(QList<Span>::iterator it, int length);
-    
-    QList<Span> _spans;
+    int _base;
+    QMap<int, int> _spans;
     int _totalSet;
 };
 
@@ -300,12 +370,16 @@ private:
     
     ReliableChannel(DatagramSequencer* sequencer, int index, bool output);
     
+    /// Returns the number of bytes waiting to be sent: those found to have been lost, followed by those never sent.
+    int getBytesToSend() const;
+    
     void writeData(QDataStream& out, int bytes, QVector<DatagramSequencer::ChannelSpan>& spans);
-    int getBytesToWrite(bool& first, int length) const;
-    int writeSpan(QDataStream& out, bool& first, int position, int length, QVector<DatagramSequencer::ChannelSpan>& spans);
     
     void spanAcknowledged(const DatagramSequencer::ChannelSpan& span);
     
+    /// Queues a sent span for retransmission.
+    void spanLost(const DatagramSequencer::ChannelSpan& span);
+    
     void readData(QDataStream& in);
     
     int _index;
@@ -316,7 +390,8 @@ private:
     float _priority;
     
     int _offset;
-    int _writePosition;
+    int _unsentOffset;
+    QList<DatagramSequencer::ChannelSpan> _lostSpans;
     SpanList _acknowledged;
     bool _messagesEnabled;
 };
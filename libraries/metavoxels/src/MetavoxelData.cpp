@@ -9,8 +9,14 @@
 //  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
 //
 
+#include <cstring>
+
 #include <QDateTime>
+#include <QMutexLocker>
+#include <QRunnable>
 #include <QScriptEngine>
+#include <QThreadPool>
+#include <QWaitCondition>
 #include <QtDebug>
 
 #include <GeometryUtil.h>
@@ -60,7 +66,8 @@ MetavoxelData::MetavoxelData() : _size(1.0f) {
 
 MetavoxelData::MetavoxelData(const MetavoxelData& other) :
     _size(other._size),
-    _roots(other._roots) {
+    _roots(other._roots),
+    _spannerIndices(other._spannerIndices) {
     
     incrementRootReferenceCounts();
 }
@@ -73,6 +80,7 @@ MetavoxelData& MetavoxelData::operator=(const MetavoxelData& other) {
     decrementRootReferenceCounts();
     _size = other._size;
     _roots = other._roots;
+    _spannerIndices = other._spannerIndices;
     incrementRootReferenceCounts();
     return *this;
 }
@@ -82,6 +90,8 @@ Box MetavoxelData::getBounds() const {
     return Box(glm::vec3(-halfSize, -halfSize, -halfSize), glm::vec3(halfSize, halfSize, halfSize));
 }
 
+static void guideInParallel(MetavoxelVisitation& visitation, MetavoxelVisitor* clone);
+
 void MetavoxelData::guide(MetavoxelVisitor& visitor) {
     // let the visitor know we're about to begin a tour
     visitor.prepare();
@@ -89,30 +99,40 @@ void MetavoxelData::guide(MetavoxelVisitor& visitor) {
     // start with the root values/defaults (plus the guide attribute)
     const QVector<AttributePointer>& inputs = visitor.getInputs();
     const QVector<AttributePointer>& outputs = visitor.getOutputs();
-    MetavoxelVisitation firstVisitation = { NULL, visitor, QVector<MetavoxelNode*>(inputs.size() + 1),
-        QVector<MetavoxelNode*>(outputs.size()), { NULL, getMinimum(), _size,
-            QVector<AttributeValue>(inputs.size() + 1), QVector<OwnedAttributeValue>(outputs.size()) } };
+    MetavoxelVisitation firstVisitation(NULL, visitor, inputs.size() + 1, outputs.size());
+    firstVisitation.info.minimum = getMinimum();
+    firstVisitation.info.size = _size;
     for (int i = 0; i < inputs.size(); i++) {
         MetavoxelNode* node = _roots.value(inputs.at(i));
         firstVisitation.inputNodes[i] = node;
         firstVisitation.info.inputValues[i] = node ? node->getAttributeValue(inputs[i]) : inputs[i];
     }
     AttributePointer guideAttribute = AttributeRegistry::getInstance()->getGuideAttribute();
-    MetavoxelNode* node = _roots.value(guideAttribute);
-    firstVisitation.inputNodes.last() = node;
-    firstVisitation.info.inputValues.last() = node ? node->getAttributeValue(guideAttribute) : guideAttribute;
+    MetavoxelNode* guideNode = _roots.value(guideAttribute);
+    firstVisitation.inputNodes.last() = guideNode;
+    firstVisitation.info.inputValues.last() = guideNode ? guideNode->getAttributeValue(guideAttribute) : guideAttribute;
     for (int i = 0; i < outputs.size(); i++) {
         MetavoxelNode* node = _roots.value(outputs.at(i));
         firstVisitation.outputNodes[i] = node;
     }
-    static_cast<MetavoxelGuide*>(firstVisitation.info.inputValues.last().getInlineValue<
-        SharedObjectPointer>().data())->guide(firstVisitation);
+    MetavoxelGuide* rootGuide = static_cast<MetavoxelGuide*>(firstVisitation.info.inputValues.last().getInlineValue<
+        SharedObjectPointer>().data());
+    
+    // we can split the tour between threads if the visitor only reads and the default guide is used throughout
+    MetavoxelVisitor* clone = (outputs.isEmpty() && rootGuide->metaObject() == &DefaultMetavoxelGuide::staticMetaObject &&
+        (!guideNode || guideNode->isLeaf())) ? visitor.createClone() : NULL;
+    if (clone) {
+        guideInParallel(firstVisitation, clone);
+    } else {
+        rootGuide->guide(firstVisitation);
+    }
     for (int i = 0; i < outputs.size(); i++) {
         OwnedAttributeValue& value = firstVisitation.info.outputValues[i];
         if (!value.getAttribute()) {
             continue;
         }
-        // replace the old node with the new
+        // replace the old node with the new; we can't tell what happened to any spanners, so the index must be rebuilt
+        _spannerIndices.remove(value.getAttribute());
         MetavoxelNode*& node = _roots[value.getAttribute()];
         if (node) {
             node->decrementReferenceCount(value.getAttribute());
@@ -191,8 +211,15 @@ void MetavoxelData::insert(const AttributePointer& attribute, const Box& bounds,
     while (!getBounds().contains(bounds)) {
         expand();
     }
+    // the tour drops the index, so we hold on to it and apply the change ourselves
+    bool indexed = _spannerIndices.contains(attribute);
+    SpannerIndex index = _spannerIndices.take(attribute);
     SpannerUpdateVisitor<insertSpanner> visitor(attribute, bounds, granularity, object);
     guide(visitor);
+    if (indexed) {
+        index.insert(object, bounds);
+        _spannerIndices.insert(attribute, index);
+    }
 }
 
 void MetavoxelData::remove(const AttributePointer& attribute, const SharedObjectPointer& object) {
@@ -202,8 +229,14 @@ void MetavoxelData::remove(const AttributePointer& attribute, const SharedObject
 
 void MetavoxelData::remove(const AttributePointer& attribute, const Box& bounds,
         float granularity, const SharedObjectPointer& object) {
+    bool indexed = _spannerIndices.contains(attribute);
+    SpannerIndex index = _spannerIndices.take(attribute);
     SpannerUpdateVisitor<removeSpanner> visitor(attribute, bounds, granularity, object);
     guide(visitor);
+    if (indexed) {
+        index.remove(object, bounds);
+        _spannerIndices.insert(attribute, index);
+    }
 }
 
 void MetavoxelData::toggle(const AttributePointer& attribute, const SharedObjectPointer& object) {
@@ -213,8 +246,14 @@ void MetavoxelData::toggle(const AttributePointer& attribute, const SharedObject
 
 void MetavoxelData::toggle(const AttributePointer& attribute, const Box& bounds,
         float granularity, const SharedObjectPointer& object) {
+    bool indexed = _spannerIndices.contains(attribute);
+    SpannerIndex index = _spannerIndices.take(attribute);
     SpannerUpdateVisitor<toggleSpanner> visitor(attribute, bounds, granularity, object);
     guide(visitor);
+    if (indexed) {
+        index.toggle(object, bounds);
+        _spannerIndices.insert(attribute, index);
+    }
 }
 
 void MetavoxelData::replace(const AttributePointer& attribute, const SharedObjectPointer& oldObject,
@@ -274,11 +313,18 @@ void MetavoxelData::replace(const AttributePointer& attribute, const Box& bounds
         insert(attribute, newSpanner->getBounds(), newSpanner->getPlacementGranularity(), newObject);
         return;
     }
+    bool indexed = _spannerIndices.contains(attribute);
+    SpannerIndex index = _spannerIndices.take(attribute);
     SpannerReplaceVisitor visitor(attribute, bounds, granularity, oldObject, newObject);
     guide(visitor);
+    if (indexed) {
+        index.replace(oldObject, newObject, bounds);
+        _spannerIndices.insert(attribute, index);
+    }
 }
 
 void MetavoxelData::clear(const AttributePointer& attribute) {
+    _spannerIndices.remove(attribute);
     MetavoxelNode* node = _roots.take(attribute);
     if (node) {
         node->decrementReferenceCount(attribute);
@@ -295,6 +341,8 @@ public:
     float getDistance() const { return _distance; }
     
     virtual bool visitSpanner(Spanner* spanner, float distance);
+    
+    virtual MetavoxelVisitor* clone() const;
 
 private:
     
@@ -315,9 +363,17 @@ bool FirstRaySpannerIntersectionVisitor::visitSpanner(Spanner* spanner, float di
     return false;
 }
 
+MetavoxelVisitor* FirstRaySpannerIntersectionVisitor::clone() const {
+    return new FirstRaySpannerIntersectionVisitor(*this);
+}
+
 SharedObjectPointer MetavoxelData::findFirstRaySpannerIntersection(
         const glm::vec3& origin, const glm::vec3& direction, const AttributePointer& attribute,
             float& distance, const MetavoxelLOD& lod) {
+    if (!lod.isValid()) {
+        return getSpannerIndex(attribute).findFirstRayIntersection(origin, direction, distance);
+    }
+    // the index doesn't know which spanners lie beyond the LOD, so limited queries must tour the sets
     FirstRaySpannerIntersectionVisitor visitor(origin, direction, attribute, lod);
     guide(visitor);
     if (!visitor.getSpanner()) {
@@ -417,6 +473,7 @@ void MetavoxelData::set(const glm::vec3& minimum, const MetavoxelData& data, boo
     // set/mix each attribute separately
     for (QHash<AttributePointer, MetavoxelNode*>::const_iterator it = data._roots.constBegin();
             it != data._roots.constEnd(); it++) {
+        _spannerIndices.remove(it.key());
         MetavoxelNode*& root = _roots[it.key()];
         setNode(it.key(), root, getMinimum(), getSize(), it.value(), minimum, data.getSize(), blend);
         if (root->isLeaf() && root->getAttributeValue(it.key()).isDefault()) {
@@ -455,12 +512,17 @@ void MetavoxelData::expand() {
         it.value() = newParent;
     }
     _size *= 2.0f;
+    
+    for (QHash<AttributePointer, SpannerIndex>::iterator it = _spannerIndices.begin(); it != _spannerIndices.end(); it++) {
+        it.value().setSize(_size);
+    }
 }
 
 void MetavoxelData::read(Bitstream& in, const MetavoxelLOD& lod) {
     // clear out any existing roots
     decrementRootReferenceCounts();
     _roots.clear();
+    _spannerIndices.clear();
 
     in >> _size;
     
@@ -537,11 +599,83 @@ void MetavoxelData::readDelta(const MetavoxelData& reference, const MetavoxelLOD
             break;
         }
         _roots.take(attribute)->decrementReferenceCount(attribute);
+        _spannerIndices.remove(attribute);
+    }
+}
+
+static void addChangedRegions(const AttributePointer& attribute, const MetavoxelNode& node,
+        const MetavoxelNode& previous, const glm::vec3& minimum, float size, QVector<Box>& regions) {
+    bool childChanged = false;
+    if (!(node.isLeaf() || previous.isLeaf())) {
+        float nextSize = size * 0.5f;
+        for (int i = 0; i < MetavoxelNode::CHILD_COUNT; i++) {
+            MetavoxelNode* child = node.getChild(i);
+            MetavoxelNode* previousChild = previous.getChild(i);
+            if (child != previousChild) {
+                addChangedRegions(attribute, *child, *previousChild, getNextMinimum(minimum, nextSize, i), nextSize, regions);
+                childChanged = true;
+            }
+        }
+    } else if (node.isLeaf() != previous.isLeaf()) {
+        regions.append(Box(minimum, minimum + glm::vec3(size, size, size)));
+        return;
+    }
+    // the value itself only matters if nothing beneath it changed; otherwise, the changed children cover it
+    if (!childChanged && !attribute->equal(node.getAttributeValue(), previous.getAttributeValue())) {
+        regions.append(Box(minimum, minimum + glm::vec3(size, size, size)));
+    }
+}
+
+void MetavoxelData::getChangedRegions(const MetavoxelData& previous, QVector<Box>& regions) const {
+    if (_size != previous._size) {
+        regions.append(getBounds());
+        return;
+    }
+    glm::vec3 minimum = getMinimum();
+    for (QHash<AttributePointer, MetavoxelNode*>::const_iterator it = _roots.constBegin(); it != _roots.constEnd(); it++) {
+        MetavoxelNode* previousRoot = previous._roots.value(it.key());
+        if (!previousRoot) {
+            regions.append(getBounds());
+            return;
+        }
+        if (previousRoot != it.value()) {
+            addChangedRegions(it.key(), *it.value(), *previousRoot, minimum, _size, regions);
+        }
+    }
+    for (QHash<AttributePointer, MetavoxelNode*>::const_iterator it = previous._roots.constBegin();
+            it != previous._roots.constEnd(); it++) {
+        if (!_roots.contains(it.key())) {
+            regions.append(getBounds());
+            return;
+        }
+    }
+}
+
+bool MetavoxelData::overlapsRegions(const glm::vec3& center, float size, const QVector<Box>& regions) {
+    foreach (const Box& region, regions) {
+        // if one contains the other, the centers are at most half the difference of the sizes apart on each axis; if they
+        // only touch, they're half the sum apart.  half the larger size splits the difference
+        float limit = qMax(size, region.getLongestSide()) * 0.5f;
+        glm::vec3 offset = glm::abs(center - region.getCenter());
+        if (offset.x < limit && offset.y < limit && offset.z < limit) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void writeRoot(const MetavoxelNode& root, const MetavoxelNode* reference, MetavoxelStreamState& state) {
+    if (!reference) {
+        state.attribute->writeMetavoxelRoot(root, state);
+    } else if (reference == &root) {
+        state.attribute->writeMetavoxelSubdivision(root, state);
+    } else {
+        state.attribute->writeMetavoxelDelta(root, *reference, state);
     }
 }
 
 void MetavoxelData::writeDelta(const MetavoxelData& reference, const MetavoxelLOD& referenceLOD,
-        Bitstream& out, const MetavoxelLOD& lod) const {
+        Bitstream& out, const MetavoxelLOD& lod, MetavoxelDeltaCache* cache) const {
     // first things first: there might be no change whatsoever
     glm::vec3 minimum = getMinimum();
     bool becameSubdivided = lod.becameSubdivided(minimum, _size, referenceLOD);
@@ -564,6 +698,9 @@ void MetavoxelData::writeDelta(const MetavoxelData& reference, const MetavoxelLO
             expanded->expand();
         }
         expandedReference = expanded;
+        
+        // the expanded nodes go away when we're done, so their encodings can't be shared
+        cache = NULL;
     }
 
     // write the added/changed/subdivided roots
@@ -573,15 +710,12 @@ void MetavoxelData::writeDelta(const MetavoxelData& reference, const MetavoxelLO
         if (it.value() != referenceRoot || becameSubdivided) {
             out << it.key();    
             if (referenceRoot) {
-                if (it.value() == referenceRoot) {
-                    out << false;
-                    it.key()->writeMetavoxelSubdivision(*it.value(), state);
-                } else {
-                    out << true;
-                    it.key()->writeMetavoxelDelta(*it.value(), *referenceRoot, state);
-                }
+                out << (it.value() != referenceRoot);
+            }
+            if (cache) {
+                cache->writeRoot(*it.value(), referenceRoot, state);
             } else {
-                it.key()->writeMetavoxelRoot(*it.value(), state);
+                writeRoot(*it.value(), referenceRoot, state);
             }
         }
     }
@@ -603,6 +737,7 @@ void MetavoxelData::writeDelta(const MetavoxelData& reference, const MetavoxelLO
 }
 
 MetavoxelNode* MetavoxelData::createRoot(const AttributePointer& attribute) {
+    _spannerIndices.remove(attribute);
     MetavoxelNode*& root = _roots[attribute];
     if (root) {
         root->decrementReferenceCount(attribute);
@@ -630,6 +765,269 @@ void MetavoxelData::decrementRootReferenceCounts() {
     }
 }
 
+/// Collects the spanners in an attribute's sets into an index.
+class SpannerIndexBuilder : public SpannerVisitor {
+public:
+    
+    SpannerIndexBuilder(const AttributePointer& attribute, SpannerIndex& index);
+    
+    virtual bool visit(Spanner* spanner, const glm::vec3& clipMinimum, float clipSize);
+
+private:
+    
+    SpannerIndex& _index;
+};
+
+SpannerIndexBuilder::SpannerIndexBuilder(const AttributePointer& attribute, SpannerIndex& index) :
+    SpannerVisitor(QVector<AttributePointer>() << attribute),
+    _index(index) {
+}
+
+bool SpannerIndexBuilder::visit(Spanner* spanner, const glm::vec3& clipMinimum, float clipSize) {
+    _index.insert(SharedObjectPointer(spanner), spanner->getBounds());
+    return true;
+}
+
+SpannerIndex& MetavoxelData::getSpannerIndex(const AttributePointer& attribute) {
+    QHash<AttributePointer, SpannerIndex>::iterator it = _spannerIndices.find(attribute);
+    if (it == _spannerIndices.end()) {
+        it = _spannerIndices.insert(attribute, SpannerIndex(_size));
+        if (_roots.contains(attribute)) {
+            SpannerIndexBuilder builder(attribute, it.value());
+            guide(builder);
+        }
+    }
+    return it.value();
+}
+
+const int MAX_SPANNER_INDEX_DEPTH = 16;
+
+SpannerIndex::SpannerIndex(float size) :
+    _size(size),
+    _spannerCount(0) {
+}
+
+static void reinsertSpanners(SpannerIndex& index, const SpannerIndexNode* node) {
+    if (!node) {
+        return;
+    }
+    foreach (const SpannerIndexNode::Entry& entry, node->entries) {
+        index.insert(entry.spanner, entry.bounds);
+    }
+    for (int i = 0; i < SpannerIndexNode::CHILD_COUNT; i++) {
+        reinsertSpanners(index, node->children[i].data());
+    }
+}
+
+void SpannerIndex::setSize(float size) {
+    QExplicitlySharedDataPointer<SpannerIndexNode> oldRoot = _root;
+    _size = size;
+    _spannerCount = 0;
+    _root.reset();
+    reinsertSpanners(*this, oldRoot.data());
+}
+
+static int findEntry(const SpannerIndexNode& node, const SharedObjectPointer& spanner) {
+    for (int i = 0; i < node.entries.size(); i++) {
+        if (node.entries.at(i).spanner == spanner) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool containsEntry(const SpannerIndexNode* node, const SharedObjectPointer& spanner) {
+    if (!node) {
+        return false;
+    }
+    if (findEntry(*node, spanner) != -1) {
+        return true;
+    }
+    for (int i = 0; i < SpannerIndexNode::CHILD_COUNT; i++) {
+        if (containsEntry(node->children[i].data(), spanner)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int getChildIndex(const glm::vec3& center, const glm::vec3& minimum, float nextSize) {
+    return (center.x >= minimum.x + nextSize ? X_MAXIMUM_FLAG : 0) | (center.y >= minimum.y + nextSize ? Y_MAXIMUM_FLAG : 0) |
+        (center.z >= minimum.z + nextSize ? Z_MAXIMUM_FLAG : 0);
+}
+
+/// Removes a spanner known to be present, descending toward the center to the given depth or, if the depth is negative,
+/// searching wherever it may be.  Nodes are copied along the way and dropped if left empty.
+static void removeEntry(QExplicitlySharedDataPointer<SpannerIndexNode>& node, const SharedObjectPointer& spanner,
+        const glm::vec3& center, const glm::vec3& minimum, float size, int depth) {
+    node.detach();
+    int entryIndex = (depth <= 0) ? findEntry(*node, spanner) : -1;
+    if (entryIndex != -1) {
+        node->entries.remove(entryIndex);
+        
+    } else {
+        float nextSize = size * 0.5f;
+        int index = 0;
+        if (depth > 0) {
+            index = getChildIndex(center, minimum, nextSize);
+        } else {
+            while (!containsEntry(node->children[index].data(), spanner)) {
+                index++;
+            }
+        }
+        removeEntry(node->children[index], spanner, center, getNextMinimum(minimum, nextSize, index), nextSize, depth - 1);
+    }
+    if (!node->entries.isEmpty()) {
+        return;
+    }
+    for (int i = 0; i < SpannerIndexNode::CHILD_COUNT; i++) {
+        if (node->children[i]) {
+            return;
+        }
+    }
+    node.reset();
+}
+
+void SpannerIndex::insert(const SharedObjectPointer& spanner, const Box& bounds) {
+    if (contains(spanner, bounds)) {
+        return;
+    }
+    glm::vec3 center = bounds.getCenter();
+    glm::vec3 minimum = glm::vec3(_size, _size, _size) * -0.5f;
+    float size = _size;
+    QExplicitlySharedDataPointer<SpannerIndexNode>* node = &_root;
+    for (int depth = getDepth(bounds);; depth--) {
+        if (*node) {
+            node->detach();
+        } else {
+            node->reset(new SpannerIndexNode());
+        }
+        if (depth == 0) {
+            break;
+        }
+        size *= 0.5f;
+        int index = getChildIndex(center, minimum, size);
+        minimum = getNextMinimum(minimum, size, index);
+        node = &(*node)->children[index];
+    }
+    SpannerIndexNode::Entry entry = { spanner, bounds };
+    (*node)->entries.append(entry);
+    _spannerCount++;
+}
+
+bool SpannerIndex::remove(const SharedObjectPointer& spanner, const Box& bounds) {
+    glm::vec3 minimum = glm::vec3(_size, _size, _size) * -0.5f;
+    if (contains(spanner, bounds)) {
+        removeEntry(_root, spanner, bounds.getCenter(), minimum, _size, getDepth(bounds));
+        
+    } else if (containsEntry(_root.data(), spanner)) {
+        removeEntry(_root, spanner, glm::vec3(), minimum, _size, -1);
+        
+    } else {
+        return false;
+    }
+    _spannerCount--;
+    return true;
+}
+
+void SpannerIndex::toggle(const SharedObjectPointer& spanner, const Box& bounds) {
+    if (contains(spanner, bounds)) {
+        remove(spanner, bounds);
+    } else {
+        insert(spanner, bounds);
+    }
+}
+
+void SpannerIndex::replace(const SharedObjectPointer& oldSpanner, const SharedObjectPointer& newSpanner, const Box& bounds) {
+    if (remove(oldSpanner, bounds)) {
+        insert(newSpanner, bounds);
+    }
+}
+
+bool SpannerIndex::contains(const SharedObjectPointer& spanner, const Box& bounds) const {
+    glm::vec3 center = bounds.getCenter();
+    glm::vec3 minimum = glm::vec3(_size, _size, _size) * -0.5f;
+    float size = _size;
+    const SpannerIndexNode* node = _root.data();
+    for (int depth = getDepth(bounds); node && depth > 0; depth--) {
+        size *= 0.5f;
+        int index = getChildIndex(center, minimum, size);
+        minimum = getNextMinimum(minimum, size, index);
+        node = node->children[index].data();
+    }
+    return node && findEntry(*node, spanner) != -1;
+}
+
+class SpannerIndexChild {
+public:
+    const SpannerIndexNode* node;
+    glm::vec3 minimum;
+    float distance;
+};
+
+bool operator<(const SpannerIndexChild& first, const SpannerIndexChild& second) {
+    return first.distance < second.distance;
+}
+
+static void findFirstRayIntersection(const SpannerIndexNode& node, const glm::vec3& minimum, float size,
+        const glm::vec3& origin, const glm::vec3& direction, SharedObjectPointer& first, float& firstDistance) {
+    foreach (const SpannerIndexNode::Entry& entry, node.entries) {
+        float distance;
+        if (static_cast<Spanner*>(entry.spanner.data())->findRayIntersection(origin, direction,
+                glm::vec3(), 0.0f, distance) && (!first || distance < firstDistance)) {
+            first = entry.spanner;
+            firstDistance = distance;
+        }
+    }
+    // visit the children whose bounds the ray enters before the closest hit so far, nearest first
+    float nextSize = size * 0.5f;
+    glm::vec3 margin(nextSize * 0.5f, nextSize * 0.5f, nextSize * 0.5f);
+    QVarLengthArray<SpannerIndexChild, SpannerIndexNode::CHILD_COUNT> children;
+    for (int i = 0; i < SpannerIndexNode::CHILD_COUNT; i++) {
+        const SpannerIndexNode* child = node.children[i].data();
+        if (!child) {
+            continue;
+        }
+        SpannerIndexChild indexChild = { child, getNextMinimum(minimum, nextSize, i) };
+        Box bounds(indexChild.minimum - margin, indexChild.minimum + glm::vec3(nextSize, nextSize, nextSize) + margin);
+        if (bounds.findRayIntersection(origin, direction, indexChild.distance) &&
+                (!first || indexChild.distance < firstDistance)) {
+            children.append(indexChild);
+        }
+    }
+    qSort(children);
+    foreach (const SpannerIndexChild& child, children) {
+        if (first && child.distance >= firstDistance) {
+            break;
+        }
+        findFirstRayIntersection(*child.node, child.minimum, nextSize, origin, direction, first, firstDistance);
+    }
+}
+
+SharedObjectPointer SpannerIndex::findFirstRayIntersection(const glm::vec3& origin,
+        const glm::vec3& direction, float& distance) const {
+    // the root also holds whatever sticks out of the volume, so we visit it regardless of its bounds
+    SharedObjectPointer first;
+    if (_root) {
+        ::findFirstRayIntersection(*_root, glm::vec3(_size, _size, _size) * -0.5f, _size, origin, direction, first, distance);
+    }
+    return first;
+}
+
+int SpannerIndex::getDepth(const Box& bounds) const {
+    float halfSize = _size * 0.5f;
+    if (!Box(glm::vec3(-halfSize, -halfSize, -halfSize), glm::vec3(halfSize, halfSize, halfSize)).contains(bounds)) {
+        return 0;
+    }
+    // descend while the children are still at least as large as the bounds; their loose bounds then contain it
+    float longestSide = bounds.getLongestSide();
+    int depth = 0;
+    for (float size = _size * 0.5f; size >= longestSide && depth < MAX_SPANNER_INDEX_DEPTH; size *= 0.5f) {
+        depth++;
+    }
+    return depth;
+}
+
 Bitstream& operator<<(Bitstream& out, const MetavoxelData& data) {
     data.write(out);
     return out;
@@ -664,34 +1062,184 @@ void MetavoxelStreamState::setMinimum(const glm::vec3& lastMinimum, int index) {
     minimum = getNextMinimum(lastMinimum, size, index);
 }
 
+MetavoxelDeltaCache::MetavoxelDeltaCache() :
+    _hits(0),
+    _misses(0) {
+}
+
+void MetavoxelDeltaCache::writeRoot(const MetavoxelNode& root, const MetavoxelNode* reference, MetavoxelStreamState& state) {
+    if (!state.attribute->isStreamIndependent()) {
+        ::writeRoot(root, reference, state);
+        return;
+    }
+    Key key = { state.attribute.data(), &root, reference, state.minimum, state.size, state.lod, state.referenceLOD };
+    QMutexLocker locker(&_mutex);
+    Encoding encoding;
+    QHash<Key, Encoding>::const_iterator it = _encodings.constFind(key);
+    if (it != _encodings.constEnd()) {
+        _hits++;
+        encoding = it.value();
+        
+    } else {
+        _misses++;
+        locker.unlock();
+        
+        // encode outside the lock so that other streams aren't held up; if another gets there first, we both insert
+        // the same thing
+        {
+            QDataStream encodingStream(&encoding.data, QIODevice::WriteOnly);
+            Bitstream encodingOut(encodingStream);
+            MetavoxelStreamState encodingState = { state.minimum, state.size, state.attribute,
+                encodingOut, state.lod, state.referenceLOD };
+            ::writeRoot(root, reference, encodingState);
+            encoding.bits = encodingOut.getBitsWritten();
+            encodingOut.flush();
+        }
+        locker.relock();
+        _encodings.insert(key, encoding);
+    }
+    locker.unlock();
+    
+    state.stream.write(encoding.data.constData(), (int)encoding.bits);
+}
+
+void MetavoxelDeltaCache::clear() {
+    QMutexLocker locker(&_mutex);
+    _encodings.clear();
+    _hits = 0;
+    _misses = 0;
+}
+
+bool MetavoxelDeltaCache::Key::operator==(const Key& other) const {
+    return attribute == other.attribute && root == other.root && reference == other.reference &&
+        minimum == other.minimum && size == other.size && lod.position == other.lod.position &&
+        lod.threshold == other.lod.threshold && referenceLOD.position == other.referenceLOD.position &&
+        referenceLOD.threshold == other.referenceLOD.threshold;
+}
+
+static uint hashVector(const glm::vec3& vector) {
+    quint32 components[3];
+    memcpy(components, &vector, sizeof(components));
+    return components[0] ^ (components[1] * 31) ^ (components[2] * 961);
+}
+
+uint qHash(const MetavoxelDeltaCache::Key& key, uint seed) {
+    // the nodes and levels of detail are what tell the keys apart in practice
+    return qHash(key.root, seed) ^ (qHash(key.reference) * 31) ^ hashVector(key.lod.position) ^
+        (hashVector(key.referenceLOD.position) * 961);
+}
+
+/// Hands out fixed-size blocks carved from larger chunks, keeping freed blocks on a list for reuse.  Chunks are never
+/// returned to the system.
+class BlockPool {
+public:
+    
+    BlockPool(size_t blockSize);
+    
+    void* allocate();
+    void free(void* block);
+    
+    int getAllocatedCount() const { return _allocatedCount; }
+    quint64 getReservedBytes() const { return _reservedBytes; }
+
+private:
+    
+    size_t _blockSize;
+    QMutex _mutex;
+    void* _freeList;
+    int _allocatedCount;
+    quint64 _reservedBytes;
+};
+
+BlockPool::BlockPool(size_t blockSize) :
+    _blockSize((qMax(blockSize, sizeof(void*)) + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*)),
+    _freeList(NULL),
+    _allocatedCount(0),
+    _reservedBytes(0) {
+}
+
+void* BlockPool::allocate() {
+    QMutexLocker locker(&_mutex);
+    if (!_freeList) {
+        // thread a new chunk onto the free list
+        const int BLOCKS_PER_CHUNK = 1024;
+        char* chunk = new char[_blockSize * BLOCKS_PER_CHUNK];
+        for (int i = BLOCKS_PER_CHUNK - 1; i >= 0; i--) {
+            void* block = chunk + i * _blockSize;
+            *static_cast<void**>(block) = _freeList;
+            _freeList = block;
+        }
+        _reservedBytes += _blockSize * BLOCKS_PER_CHUNK;
+    }
+    void* block = _freeList;
+    _freeList = *static_cast<void**>(block);
+    _allocatedCount++;
+    return block;
+}
+
+void BlockPool::free(void* block) {
+    QMutexLocker locker(&_mutex);
+    *static_cast<void**>(block) = _freeList;
+    _freeList = block;
+    _allocatedCount--;
+}
+
+static BlockPool nodePool(sizeof(MetavoxelNode));
+static BlockPool childArrayPool(sizeof(MetavoxelNode*) * MetavoxelNode::CHILD_COUNT);
+
+int MetavoxelNode::getNodeCount() {
+    return nodePool.getAllocatedCount();
+}
+
+quint64 MetavoxelNode::getMemoryUsage() {
+    return nodePool.getReservedBytes() + childArrayPool.getReservedBytes();
+}
+
+void* MetavoxelNode::operator new(size_t size) {
+    return nodePool.allocate();
+}
+
+void MetavoxelNode::operator delete(void* pointer) {
+    nodePool.free(pointer);
+}
+
 MetavoxelNode::MetavoxelNode(const AttributeValue& attributeValue, const MetavoxelNode* copyChildren) :
-        _referenceCount(1) {
+        _referenceCount(1),
+        _children(NULL) {
 
     _attributeValue = attributeValue.copy();
-    if (copyChildren) {
+    if (copyChildren && copyChildren->_children) {
+        allocateChildren();
         for (int i = 0; i < CHILD_COUNT; i++) {
-            if ((_children[i] = copyChildren->_children[i])) {
-                _children[i]->incrementReferenceCount();
-            }
-        }
-    } else {
-        for (int i = 0; i < CHILD_COUNT; i++) {
-            _children[i] = NULL;
+            (_children[i] = copyChildren->_children[i])->incrementReferenceCount();
         }
     }
 }
 
 MetavoxelNode::MetavoxelNode(const AttributePointer& attribute, const MetavoxelNode* copy) :
-        _referenceCount(1) {
+        _referenceCount(1),
+        _children(NULL) {
         
     _attributeValue = attribute->create(copy->_attributeValue);
-    for (int i = 0; i < CHILD_COUNT; i++) {
-        if ((_children[i] = copy->_children[i])) {
-            _children[i]->incrementReferenceCount();
+    if (copy->_children) {
+        allocateChildren();
+        for (int i = 0; i < CHILD_COUNT; i++) {
+            (_children[i] = copy->_children[i])->incrementReferenceCount();
         }
     }
 }
 
+MetavoxelNode::~MetavoxelNode() {
+    if (_children) {
+        childArrayPool.free(_children);
+    }
+}
+
+void MetavoxelNode::setChild(int index, MetavoxelNode* child) {
+    allocateChildren();
+    _children[index] = child;
+}
+
 void MetavoxelNode::setAttributeValue(const AttributeValue& attributeValue) {
     attributeValue.getAttribute()->destroy(_attributeValue);
     _attributeValue = attributeValue.copy();
@@ -721,15 +1269,6 @@ void MetavoxelNode::mergeChildren(const AttributePointer& attribute, bool postRe
     }
 }
 
-bool MetavoxelNode::isLeaf() const {
-    for (int i = 0; i < CHILD_COUNT; i++) {
-        if (_children[i]) {
-            return false;
-        }    
-    }
-    return true;
-}
-
 void MetavoxelNode::read(MetavoxelStreamState& state) {
     clearChildren(state.attribute);
     
@@ -743,6 +1282,7 @@ void MetavoxelNode::read(MetavoxelStreamState& state) {
     if (!leaf) {
         MetavoxelStreamState nextState = { glm::vec3(), state.size * 0.5f, state.attribute,
             state.stream, state.lod, state.referenceLOD };
+        allocateChildren();
         for (int i = 0; i < CHILD_COUNT; i++) {
             nextState.setMinimum(state.minimum, i);
             _children[i] = new MetavoxelNode(state.attribute);
@@ -783,6 +1323,7 @@ void MetavoxelNode::readDelta(const MetavoxelNode& reference, MetavoxelStreamSta
     if (!leaf) {
         MetavoxelStreamState nextState = { glm::vec3(), state.size * 0.5f, state.attribute,
             state.stream, state.lod, state.referenceLOD };
+        allocateChildren();
         if (reference.isLeaf() || !state.shouldSubdivideReference()) {
             for (int i = 0; i < CHILD_COUNT; i++) {
                 nextState.setMinimum(state.minimum, i);
@@ -859,6 +1400,7 @@ void MetavoxelNode::readSubdivision(MetavoxelStreamState& state) {
             state.stream, state.lod, state.referenceLOD };
         if (!subdivideReference) {
             clearChildren(state.attribute);
+            allocateChildren();
             for (int i = 0; i < CHILD_COUNT; i++) {
                 nextState.setMinimum(state.minimum, i);
                 _children[i] = new MetavoxelNode(state.attribute);
@@ -990,17 +1532,26 @@ void MetavoxelNode::decrementReferenceCount(const AttributePointer& attribute) {
 
 void MetavoxelNode::destroy(const AttributePointer& attribute) {
     attribute->destroy(_attributeValue);
+    clearChildren(attribute);
+}
+
+void MetavoxelNode::clearChildren(const AttributePointer& attribute) {
+    if (!_children) {
+        return;
+    }
     for (int i = 0; i < CHILD_COUNT; i++) {
         if (_children[i]) {
             _children[i]->decrementReferenceCount(attribute);
         }
     }
+    childArrayPool.free(_children);
+    _children = NULL;
 }
 
-void MetavoxelNode::clearChildren(const AttributePointer& attribute) {
-    for (int i = 0; i < CHILD_COUNT; i++) {
-        if (_children[i]) {
-            _children[i]->decrementReferenceCount(attribute);
+void MetavoxelNode::allocateChildren() {
+    if (!_children) {
+        _children = static_cast<MetavoxelNode**>(childArrayPool.allocate());
+        for (int i = 0; i < CHILD_COUNT; i++) {
             _children[i] = NULL;
         }
     }
@@ -1043,7 +1594,8 @@ MetavoxelVisitor::MetavoxelVisitor(const QVector<AttributePointer>& inputs,
     _inputs(inputs),
     _outputs(outputs),
     _lod(lod),
-    _minimumLODThresholdMultiplier(FLT_MAX) {
+    _minimumLODThresholdMultiplier(FLT_MAX),
+    _clone(false) {
     
     // find the minimum LOD threshold multiplier over all attributes
     foreach (const AttributePointer& attribute, _inputs) {
@@ -1061,6 +1613,33 @@ void MetavoxelVisitor::prepare() {
     // nothing by default
 }
 
+MetavoxelVisitor* MetavoxelVisitor::createClone() const {
+    MetavoxelVisitor* visitor = clone();
+    if (visitor) {
+        visitor->_clone = true;
+    }
+    return visitor;
+}
+
+MetavoxelVisitor* MetavoxelVisitor::clone() const {
+    return NULL;
+}
+
+bool MetavoxelVisitor::merge(MetavoxelVisitor& clone) {
+    return true;
+}
+
+bool MetavoxelVisitor::testAndSetVisited(Spanner* spanner) {
+    if (!_clone) {
+        return spanner->testAndSetVisited();
+    }
+    if (_spannersVisited.contains(spanner)) {
+        return false;
+    }
+    _spannersVisited.insert(spanner);
+    return true;
+}
+
 SpannerVisitor::SpannerVisitor(const QVector<AttributePointer>& spannerInputs, const QVector<AttributePointer>& spannerMasks,
         const QVector<AttributePointer>& inputs, const QVector<AttributePointer>& outputs, const MetavoxelLOD& lod) :
     MetavoxelVisitor(inputs + spannerInputs + spannerMasks, outputs, lod),
@@ -1076,8 +1655,8 @@ int SpannerVisitor::visit(MetavoxelInfo& info) {
     for (int end = _inputs.size() - _spannerMaskCount, i = end - _spannerInputCount, j = end; i < end; i++, j++) {
         foreach (const SharedObjectPointer& object, info.inputValues.at(i).getInlineValue<SharedObjectSet>()) {
             Spanner* spanner = static_cast<Spanner*>(object.data());
-            if (!(spanner->isMasked() && j < _inputs.size()) && spanner->testAndSetVisited() &&
-                    !visit(spanner, glm::vec3(), 0.0f)) {
+            if (!(spanner->isMasked() && j < _inputs.size()) && testAndSetVisited(spanner) &&
+                    !visitOrDefer(spanner, glm::vec3(), 0.0f)) {
                 return SHORT_CIRCUIT;
             }
         }
@@ -1093,7 +1672,7 @@ int SpannerVisitor::visit(MetavoxelInfo& info) {
                 foreach (const SharedObjectPointer& object, nextInfo->inputValues.at(
                         i - _spannerInputCount).getInlineValue<SharedObjectSet>()) {
                     Spanner* spanner = static_cast<Spanner*>(object.data());
-                    if (spanner->isMasked() && !visit(spanner, info.minimum, info.size)) {
+                    if (spanner->isMasked() && !visitOrDefer(spanner, info.minimum, info.size)) {
                         return SHORT_CIRCUIT;
                     }
                 }                
@@ -1103,6 +1682,26 @@ int SpannerVisitor::visit(MetavoxelInfo& info) {
     return STOP_RECURSION;
 }
 
+bool SpannerVisitor::merge(MetavoxelVisitor& clone) {
+    foreach (const SpannerVisit& spannerVisit, static_cast<SpannerVisitor&>(clone)._deferredVisits) {
+        // unclipped visits happen once per tour; clipped ones, once for each leaf
+        if ((spannerVisit.clipSize > 0.0f || spannerVisit.spanner->testAndSetVisited()) &&
+                !visit(spannerVisit.spanner, spannerVisit.clipMinimum, spannerVisit.clipSize)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SpannerVisitor::visitOrDefer(Spanner* spanner, const glm::vec3& clipMinimum, float clipSize) {
+    if (!_clone) {
+        return visit(spanner, clipMinimum, clipSize);
+    }
+    SpannerVisit spannerVisit = { spanner, clipMinimum, clipSize };
+    _deferredVisits.append(spannerVisit);
+    return true;
+}
+
 RayIntersectionVisitor::RayIntersectionVisitor(const glm::vec3& origin, const glm::vec3& direction,
         const QVector<AttributePointer>& inputs, const QVector<AttributePointer>& outputs, const MetavoxelLOD& lod) :
     MetavoxelVisitor(inputs, outputs, lod),
@@ -1146,7 +1745,7 @@ int RaySpannerIntersectionVisitor::visit(MetavoxelInfo& info, float distance) {
     for (int end = _inputs.size() - _spannerMaskCount, i = end - _spannerInputCount, j = end; i < end; i++, j++) {
         foreach (const SharedObjectPointer& object, info.inputValues.at(i).getInlineValue<SharedObjectSet>()) {
             Spanner* spanner = static_cast<Spanner*>(object.data());
-            if (!(spanner->isMasked() && j < _inputs.size()) && spanner->testAndSetVisited()) {
+            if (!(spanner->isMasked() && j < _inputs.size()) && testAndSetVisited(spanner)) {
                 SpannerDistance spannerDistance = { spanner };
                 if (spanner->findRayIntersection(_origin, _direction, glm::vec3(), 0.0f, spannerDistance.distance)) {
                     spannerDistances.append(spannerDistance);
@@ -1155,7 +1754,7 @@ int RaySpannerIntersectionVisitor::visit(MetavoxelInfo& info, float distance) {
         }
         qStableSort(spannerDistances);
         foreach (const SpannerDistance& spannerDistance, spannerDistances) {
-            if (!visitSpanner(spannerDistance.spanner, spannerDistance.distance)) {
+            if (!visitOrDefer(spannerDistance.spanner, spannerDistance.distance, false)) {
                 return SHORT_CIRCUIT;
             }
         }
@@ -1183,7 +1782,7 @@ int RaySpannerIntersectionVisitor::visit(MetavoxelInfo& info, float distance) {
             
             qStableSort(spannerDistances);
             foreach (const SpannerDistance& spannerDistance, spannerDistances) {
-                if (!visitSpanner(spannerDistance.spanner, spannerDistance.distance)) {
+                if (!visitOrDefer(spannerDistance.spanner, spannerDistance.distance, true)) {
                     return SHORT_CIRCUIT;
                 }
             }
@@ -1192,18 +1791,38 @@ int RaySpannerIntersectionVisitor::visit(MetavoxelInfo& info, float distance) {
     return STOP_RECURSION;
 }
 
+bool RaySpannerIntersectionVisitor::merge(MetavoxelVisitor& clone) {
+    foreach (const SpannerHit& hit, static_cast<RaySpannerIntersectionVisitor&>(clone)._deferredHits) {
+        if ((hit.clipped || hit.spanner->testAndSetVisited()) && !visitSpanner(hit.spanner, hit.distance)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RaySpannerIntersectionVisitor::visitOrDefer(Spanner* spanner, float distance, bool clipped) {
+    if (!_clone) {
+        return visitSpanner(spanner, distance);
+    }
+    SpannerHit hit = { spanner, distance, clipped };
+    _deferredHits.append(hit);
+    return true;
+}
+
 DefaultMetavoxelGuide::DefaultMetavoxelGuide() {
 }
 
-bool DefaultMetavoxelGuide::guide(MetavoxelVisitation& visitation) {
-    // save the core of the LOD calculation; we'll reuse it to determine whether to subdivide each attribute
-    float lodBase = glm::distance(visitation.visitor.getLOD().position, visitation.info.getCenter()) *
+/// Visits the node of a visitation and replaces its output nodes according to the values set.
+/// \param lodBase set to the core of the LOD calculation, which determines whether to subdivide each attribute
+/// \return the encoded order returned by the visitor
+static int visitNode(MetavoxelVisitation& visitation, float& lodBase) {
+    lodBase = glm::distance(visitation.visitor.getLOD().position, visitation.info.getCenter()) *
         visitation.visitor.getLOD().threshold;
     visitation.info.isLODLeaf = (visitation.info.size < lodBase * visitation.visitor.getMinimumLODThresholdMultiplier());
     visitation.info.isLeaf = visitation.info.isLODLeaf || visitation.allInputNodesLeaves();
     int encodedOrder = visitation.visitor.visit(visitation.info);
     if (encodedOrder == MetavoxelVisitor::SHORT_CIRCUIT) {
-        return false;
+        return encodedOrder;
     }
     for (int i = 0; i < visitation.outputNodes.size(); i++) {
         OwnedAttributeValue& value = visitation.info.outputValues[i];
@@ -1218,34 +1837,49 @@ bool DefaultMetavoxelGuide::guide(MetavoxelVisitation& visitation) {
             node = value.getAttribute()->createMetavoxelNode(value, node);
         }
     }
+    return encodedOrder;
+}
+
+const int ORDER_ELEMENT_BITS = 3;
+const int ORDER_ELEMENT_MASK = (1 << ORDER_ELEMENT_BITS) - 1;
+
+/// Sets up the visitation of one of the children of a visitation's node.
+static void prepareChild(const MetavoxelVisitation& visitation, MetavoxelVisitation& nextVisitation,
+        int index, float lodBase) {
+    for (int j = 0; j < visitation.inputNodes.size(); j++) {
+        MetavoxelNode* node = visitation.inputNodes.at(j);
+        const AttributeValue& parentValue = visitation.info.inputValues.at(j);
+        MetavoxelNode* child = (node && (visitation.info.size >= lodBase *
+            parentValue.getAttribute()->getLODThresholdMultiplier())) ? node->getChild(index) : NULL;
+        nextVisitation.info.inputValues[j] = ((nextVisitation.inputNodes[j] = child)) ?
+            child->getAttributeValue(parentValue.getAttribute()) : parentValue.getAttribute()->inherit(parentValue);
+    }
+    for (int j = 0; j < visitation.outputNodes.size(); j++) {
+        MetavoxelNode* node = visitation.outputNodes.at(j);
+        MetavoxelNode* child = (node && (visitation.info.size >= lodBase *
+            visitation.visitor.getOutputs().at(j)->getLODThresholdMultiplier())) ? node->getChild(index) : NULL;
+        nextVisitation.outputNodes[j] = child;
+    }
+    nextVisitation.info.parentInfo = &visitation.info;
+    nextVisitation.info.size = visitation.info.size * 0.5f;
+    nextVisitation.info.minimum = getNextMinimum(visitation.info.minimum, nextVisitation.info.size, index);
+}
+
+bool DefaultMetavoxelGuide::guide(MetavoxelVisitation& visitation) {
+    float lodBase;
+    int encodedOrder = visitNode(visitation, lodBase);
+    if (encodedOrder == MetavoxelVisitor::SHORT_CIRCUIT) {
+        return false;
+    }
     if (encodedOrder == MetavoxelVisitor::STOP_RECURSION) {
         return true;
     }
-    MetavoxelVisitation nextVisitation = { &visitation, visitation.visitor,
-        QVector<MetavoxelNode*>(visitation.inputNodes.size()), QVector<MetavoxelNode*>(visitation.outputNodes.size()),
-        { &visitation.info, glm::vec3(), visitation.info.size * 0.5f, QVector<AttributeValue>(visitation.inputNodes.size()),
-            QVector<OwnedAttributeValue>(visitation.outputNodes.size()) } };
+    MetavoxelVisitation& nextVisitation = visitation.getNext();
     for (int i = 0; i < MetavoxelNode::CHILD_COUNT; i++) {
         // the encoded order tells us the child indices for each iteration
-        const int ORDER_ELEMENT_BITS = 3;
-        const int ORDER_ELEMENT_MASK = (1 << ORDER_ELEMENT_BITS) - 1;
         int index = encodedOrder & ORDER_ELEMENT_MASK;
         encodedOrder >>= ORDER_ELEMENT_BITS;
-        for (int j = 0; j < visitation.inputNodes.size(); j++) {
-            MetavoxelNode* node = visitation.inputNodes.at(j);
-            const AttributeValue& parentValue = visitation.info.inputValues.at(j);
-            MetavoxelNode* child = (node && (visitation.info.size >= lodBase *
-                parentValue.getAttribute()->getLODThresholdMultiplier())) ? node->getChild(index) : NULL;
-            nextVisitation.info.inputValues[j] = ((nextVisitation.inputNodes[j] = child)) ?
-                child->getAttributeValue(parentValue.getAttribute()) : parentValue.getAttribute()->inherit(parentValue);
-        }
-        for (int j = 0; j < visitation.outputNodes.size(); j++) {
-            MetavoxelNode* node = visitation.outputNodes.at(j);
-            MetavoxelNode* child = (node && (visitation.info.size >= lodBase *
-                visitation.visitor.getOutputs().at(j)->getLODThresholdMultiplier())) ? node->getChild(index) : NULL;
-            nextVisitation.outputNodes[j] = child;
-        }
-        nextVisitation.info.minimum = getNextMinimum(visitation.info.minimum, nextVisitation.info.size, index);
+        prepareChild(visitation, nextVisitation, index, lodBase);
         if (!static_cast<MetavoxelGuide*>(nextVisitation.info.inputValues.last().getInlineValue<
                 SharedObjectPointer>().data())->guide(nextVisitation)) {
             return false;
@@ -1294,6 +1928,139 @@ bool DefaultMetavoxelGuide::guide(MetavoxelVisitation& visitation) {
     return true;
 }
 
+/// The state shared between the threads taking part in a parallel tour.  Each top-level octant is visited by whichever
+/// thread claims it first: a pool thread, or the calling thread once it reaches that octant in visitation order and finds
+/// that no pool thread has started on it.
+class ParallelTour {
+public:
+    
+    ParallelTour(MetavoxelVisitation& visitation, float lodBase);
+    ~ParallelTour();
+    
+    void addOctant(int index, MetavoxelVisitor* visitor);
+    
+    /// Visits the octant unless another thread has claimed it or the tour has been cancelled.
+    void maybeVisitOctant(int octant);
+    
+    /// Waits for whichever thread claimed the octant to finish with it.
+    void waitForOctant(int octant);
+    
+    /// Merges the octant's clone into the original visitor.
+    /// \return true to continue, false if the tour was short-circuited
+    bool mergeOctant(int octant);
+    
+    int getOctantCount() const { return _octantCount; }
+    
+    void cancel() { _cancelled.storeRelease(1); }
+    
+private:
+    
+    MetavoxelVisitation& _visitation;
+    float _lodBase;
+    QAtomicInt _cancelled;
+    
+    int _octantCount;
+    int _indices[MetavoxelNode::CHILD_COUNT];
+    MetavoxelVisitor* _visitors[MetavoxelNode::CHILD_COUNT];
+    QAtomicInt _claimed[MetavoxelNode::CHILD_COUNT];
+    bool _completed[MetavoxelNode::CHILD_COUNT];
+    
+    QMutex _finishedMutex;
+    QWaitCondition _finishedCondition;
+    bool _finished[MetavoxelNode::CHILD_COUNT];
+};
+
+ParallelTour::ParallelTour(MetavoxelVisitation& visitation, float lodBase) :
+    _visitation(visitation),
+    _lodBase(lodBase),
+    _octantCount(0) {
+}
+
+ParallelTour::~ParallelTour() {
+    for (int i = 0; i < _octantCount; i++) {
+        delete _visitors[i];
+    }
+}
+
+void ParallelTour::addOctant(int index, MetavoxelVisitor* visitor) {
+    _indices[_octantCount] = index;
+    _visitors[_octantCount] = visitor;
+    _completed[_octantCount] = false;
+    _finished[_octantCount] = false;
+    _octantCount++;
+}
+
+void ParallelTour::maybeVisitOctant(int octant) {
+    if (!_claimed[octant].testAndSetOrdered(0, 1)) {
+        return;
+    }
+    if (_cancelled.loadAcquire() == 0) {
+        MetavoxelVisitation visitation(NULL, *_visitors[octant], _visitation.inputNodes.size(), 0);
+        prepareChild(_visitation, visitation, _indices[octant], _lodBase);
+        _completed[octant] = static_cast<MetavoxelGuide*>(visitation.info.inputValues.last().getInlineValue<
+            SharedObjectPointer>().data())->guide(visitation);
+    }
+    QMutexLocker locker(&_finishedMutex);
+    _finished[octant] = true;
+    _finishedCondition.wakeAll();
+}
+
+void ParallelTour::waitForOctant(int octant) {
+    QMutexLocker locker(&_finishedMutex);
+    while (!_finished[octant]) {
+        _finishedCondition.wait(&_finishedMutex);
+    }
+}
+
+bool ParallelTour::mergeOctant(int octant) {
+    return _visitation.visitor.merge(*_visitors[octant]) && _completed[octant];
+}
+
+/// Visits one octant of a parallel tour on the global thread pool.
+class OctantVisitor : public QRunnable {
+public:
+    
+    OctantVisitor(const QSharedPointer<ParallelTour>& tour, int octant) : _tour(tour), _octant(octant) { }
+    
+    virtual void run() { _tour->maybeVisitOctant(_octant); }
+
+private:
+    
+    QSharedPointer<ParallelTour> _tour;
+    int _octant;
+};
+
+static void guideInParallel(MetavoxelVisitation& visitation, MetavoxelVisitor* clone) {
+    // visit the root here; only the octants beneath it are worth splitting up
+    float lodBase;
+    int encodedOrder = visitNode(visitation, lodBase);
+    if (encodedOrder == MetavoxelVisitor::SHORT_CIRCUIT || encodedOrder == MetavoxelVisitor::STOP_RECURSION) {
+        delete clone;
+        return;
+    }
+    // hand the octants to the pool in visitation order, so that the nearest are visited first by those who care;
+    // the pool's tasks share the tour, since some may not get to run until after we've returned
+    QSharedPointer<ParallelTour> tour(new ParallelTour(visitation, lodBase));
+    for (int i = 0; i < MetavoxelNode::CHILD_COUNT; i++) {
+        tour->addOctant(encodedOrder & ORDER_ELEMENT_MASK, (i == 0) ? clone : visitation.visitor.createClone());
+        encodedOrder >>= ORDER_ELEMENT_BITS;
+    }
+    for (int i = 0; i < tour->getOctantCount(); i++) {
+        QThreadPool::globalInstance()->start(new OctantVisitor(tour, i));
+    }
+    
+    // go through the octants in order, visiting those that nobody's started on and merging the results; once the tour
+    // has been short-circuited, we skip any not yet visited
+    bool proceed = true;
+    for (int i = 0; i < tour->getOctantCount(); i++) {
+        tour->maybeVisitOctant(i);
+        tour->waitForOctant(i);
+        if (proceed && !(proceed = tour->mergeOctant(i))) {
+            tour->cancel();
+        }
+    }
+}
+
 ThrobbingMetavoxelGuide::ThrobbingMetavoxelGuide() : _rate(10.0) {
 }
 
@@ -1429,6 +2196,33 @@ void ScriptedMetavoxelGuide::setURL(const ParameterizedURL& url) {
     _minimumHandle = QScriptString();
 }
 
+MetavoxelVisitation::MetavoxelVisitation(MetavoxelVisitation* previous, MetavoxelVisitor& visitor,
+        int inputCount, int outputCount) :
+    previous(previous),
+    visitor(visitor),
+    inputNodes(inputCount),
+    outputNodes(outputCount),
+    _next(NULL) {
+    
+    info.parentInfo = previous ? &previous->info : NULL;
+    info.size = previous ? previous->info.size * 0.5f : 0.0f;
+    info.inputValues.resize(inputCount);
+    info.outputValues.resize(outputCount);
+    info.isLODLeaf = false;
+    info.isLeaf = false;
+}
+
+MetavoxelVisitation::~MetavoxelVisitation() {
+    delete _next;
+}
+
+MetavoxelVisitation& MetavoxelVisitation::getNext() {
+    if (!_next) {
+        _next = new MetavoxelVisitation(this, visitor, inputNodes.size(), outputNodes.size());
+    }
+    return *_next;
+}
+
 bool MetavoxelVisitation::allInputNodesLeaves() const {
     foreach (MetavoxelNode* node, inputNodes) {
         if (node && !node->isLeaf()) {
@@ -1518,6 +2312,7 @@ QByteArray Spanner::getRendererClassName() const {
 }
 
 int Spanner::_visit = 0;
+QMutex Spanner::_visitMutex(QMutex::Recursive);
 
 SpannerRenderer::SpannerRenderer() {
 }
@@ -14,10 +14,12 @@
 
 #include <QBitArray>
 #include <QHash>
+#include <QMutex>
 #include <QSharedData>
 #include <QSharedPointer>
 #include <QScriptString>
 #include <QScriptValue>
+#include <QSet>
 #include <QVector>
 
 #include <glm/glm.hpp>
@@ -27,6 +29,7 @@
 
 class QScriptContext;
 
+class MetavoxelDeltaCache;
 class MetavoxelNode;
 class MetavoxelVisitation;
 class MetavoxelVisitor;
@@ -54,6 +57,70 @@ public:
 
 DECLARE_STREAMABLE_METATYPE(MetavoxelLOD)
 
+/// A node in a spanner index.
+class SpannerIndexNode : public QSharedData {
+public:
+    
+    static const int CHILD_COUNT = 8;
+    
+    /// A spanner along with the bounds at which it was placed.
+    class Entry {
+    public:
+        SharedObjectPointer spanner;
+        Box bounds;
+    };
+    
+    QVector<Entry> entries;
+    QExplicitlySharedDataPointer<SpannerIndexNode> children[CHILD_COUNT];
+};
+
+/// A loose octree over the spanners of an attribute, kept alongside the attribute's sets so that ray queries can test each
+/// spanner once, nearest cells first, rather than touring the sets of every node they cover.  Each spanner lives in exactly
+/// one node: the deepest whose cell is no smaller than the spanner, found by the spanner's center.  A node's bounds are its
+/// cell grown by half its size on each side, and so contain all of its spanners.  Like the data, copies share their nodes and
+/// edits copy only the paths they change.
+class SpannerIndex {
+public:
+    
+    SpannerIndex(float size = 1.0f);
+    
+    float getSize() const { return _size; }
+    
+    /// Sets the size of the indexed volume (centered on the origin), reinserting the spanners already present.
+    void setSize(float size);
+    
+    int getSpannerCount() const { return _spannerCount; }
+    
+    /// Adds a spanner placed at the specified bounds, unless it's already there.
+    void insert(const SharedObjectPointer& spanner, const Box& bounds);
+    
+    /// Removes a spanner placed at the specified bounds.  If it's not where the bounds say it should be (because it was
+    /// placed with other bounds), the entire index is searched.
+    /// \return whether the spanner was found
+    bool remove(const SharedObjectPointer& spanner, const Box& bounds);
+    
+    /// Removes the spanner if present at the specified bounds; otherwise, inserts it.
+    void toggle(const SharedObjectPointer& spanner, const Box& bounds);
+    
+    /// Replaces a spanner with another placed at the same bounds, if the old one is present.
+    void replace(const SharedObjectPointer& oldSpanner, const SharedObjectPointer& newSpanner, const Box& bounds);
+    
+    /// Checks whether the spanner is present where the bounds say it should be.
+    bool contains(const SharedObjectPointer& spanner, const Box& bounds) const;
+    
+    /// Finds the first spanner intersecting the provided ray.
+    SharedObjectPointer findFirstRayIntersection(const glm::vec3& origin, const glm::vec3& direction, float& distance) const;
+    
+private:
+    
+    /// Returns the depth of the node in which to place the specified bounds.
+    int getDepth(const Box& bounds) const;
+    
+    float _size;
+    int _spannerCount;
+    QExplicitlySharedDataPointer<SpannerIndexNode> _root;
+};
+
 /// The base metavoxel representation shared between server and client.
 class MetavoxelData {
 public:
@@ -90,7 +157,8 @@ public:
         
     void clear(const AttributePointer& attribute);
 
-    /// Convenience function that finds the first spanner intersecting the provided ray.    
+    /// Convenience function that finds the first spanner intersecting the provided ray.  Unless limited by LOD, this uses
+    /// the attribute's spanner index.
     SharedObjectPointer findFirstRaySpannerIntersection(const glm::vec3& origin, const glm::vec3& direction,
         const AttributePointer& attribute, float& distance, const MetavoxelLOD& lod = MetavoxelLOD());
 
@@ -104,8 +172,20 @@ public:
     void write(Bitstream& out, const MetavoxelLOD& lod = MetavoxelLOD()) const;
 
     void readDelta(const MetavoxelData& reference, const MetavoxelLOD& referenceLOD, Bitstream& in, const MetavoxelLOD& lod);
+    
+    /// Appends to the supplied list the bounds of the nodes that differ from those of a previous version of the data (as
+    /// read from a delta or left by an edit).  Versions share their unchanged subtrees, so this only descends the paths that
+    /// changed, and its cost scales with the size of the change rather than that of the data.
+    void getChangedRegions(const MetavoxelData& previous, QVector<Box>& regions) const;
+    
+    /// Checks whether a voxel overlaps any of a set of regions like those returned by getChangedRegions.  Both are aligned
+    /// to the octree, so they overlap only if one contains the other; merely touching doesn't count, whatever the rounding.
+    static bool overlapsRegions(const glm::vec3& center, float size, const QVector<Box>& regions);
+    
+    /// Writes the changes from the reference.
+    /// \param cache if non-null, a cache through which to share encoded roots with other streams
     void writeDelta(const MetavoxelData& reference, const MetavoxelLOD& referenceLOD,
-        Bitstream& out, const MetavoxelLOD& lod) const;
+        Bitstream& out, const MetavoxelLOD& lod, MetavoxelDeltaCache* cache = NULL) const;
 
     MetavoxelNode* getRoot(const AttributePointer& attribute) const { return _roots.value(attribute); }
     MetavoxelNode* createRoot(const AttributePointer& attribute);
@@ -120,8 +200,15 @@ private:
     void incrementRootReferenceCounts();
     void decrementRootReferenceCounts();
     
+    /// Returns the spanner index for the attribute, building it from the attribute's sets if we don't have one.
+    SpannerIndex& getSpannerIndex(const AttributePointer& attribute);
+    
     float _size;
     QHash<AttributePointer, MetavoxelNode*> _roots;
+    
+    /// Spanner indices for the attributes we've edited or queried since they were last changed by other means (tours that
+    /// write to them, reading, setting); the rest are rebuilt when next needed.
+    QHash<AttributePointer, SpannerIndex> _spannerIndices;
 };
 
 Bitstream& operator<<(Bitstream& out, const MetavoxelData& data);
@@ -151,14 +238,74 @@ public:
     void setMinimum(const glm::vec3& lastMinimum, int index);
 };
 
-/// A single node within a metavoxel layer.
+/// Shares the encodings of attribute roots between streams that write the same changes at the same levels of detail, as
+/// the server's sessions do for clients that stand together and have acknowledged the same data.  Entries are keyed on
+/// node identity, so the cache must be cleared before any of the nodes written through it can be deleted.  Only roots of
+/// attributes whose encoding doesn't depend on the stream are shared; the rest are written directly.
+class MetavoxelDeltaCache {
+public:
+    
+    MetavoxelDeltaCache();
+    
+    /// Writes the root in full if the reference is null, its subdivision if the reference is the root itself, or its delta
+    /// from the reference otherwise.
+    /// \thread any thread
+    void writeRoot(const MetavoxelNode& root, const MetavoxelNode* reference, MetavoxelStreamState& state);
+    
+    /// Clears the cached encodings along with the hit and miss counts.
+    void clear();
+    
+    int getHits() const { return _hits; }
+    int getMisses() const { return _misses; }
+
+private:
+    
+    class Key {
+    public:
+        const Attribute* attribute;
+        const MetavoxelNode* root;
+        const MetavoxelNode* reference;
+        glm::vec3 minimum;
+        float size;
+        MetavoxelLOD lod;
+        MetavoxelLOD referenceLOD;
+        
+        bool operator==(const Key& other) const;
+    };
+    
+    friend uint qHash(const Key& key, uint seed);
+    
+    class Encoding {
+    public:
+        QByteArray data;
+        qint64 bits;
+    };
+    
+    QMutex _mutex;
+    QHash<Key, Encoding> _encodings;
+    int _hits;
+    int _misses;
+};
+
+/// A node in a metavoxel octree.  Nodes and their child arrays are allocated from pools of fixed-size blocks, and leaves
+/// (the majority of nodes) don't carry a child array at all.
 class MetavoxelNode {
 public:
 
     static const int CHILD_COUNT = 8;
 
+    /// Returns the number of nodes currently allocated.
+    static int getNodeCount();
+    
+    /// Returns the number of bytes reserved for nodes and their child arrays, including the free blocks in the pools.
+    static quint64 getMemoryUsage();
+
+    static void* operator new(size_t size);
+    static void operator delete(void* pointer);
+
     MetavoxelNode(const AttributeValue& attributeValue, const MetavoxelNode* copyChildren = NULL);
     MetavoxelNode(const AttributePointer& attribute, const MetavoxelNode* copy);
+    ~MetavoxelNode();
     
     void setAttributeValue(const AttributeValue& attributeValue);
 
@@ -169,10 +316,10 @@ public:
 
     void mergeChildren(const AttributePointer& attribute, bool postRead = false);
 
-    MetavoxelNode* getChild(int index) const { return _children[index]; }
-    void setChild(int index, MetavoxelNode* child) { _children[index] = child; }
+    MetavoxelNode* getChild(int index) const { return _children ? _children[index] : NULL; }
+    void setChild(int index, MetavoxelNode* child);
 
-    bool isLeaf() const;
+    bool isLeaf() const { return !_children; }
 
     void read(MetavoxelStreamState& state);
     void write(MetavoxelStreamState& state) const;
@@ -203,9 +350,12 @@ private:
     
     friend class MetavoxelVisitation;
     
+    /// Makes sure that we have a child array, allocating an empty one if necessary.
+    void allocateChildren();
+    
     int _referenceCount;
     void* _attributeValue;
-    MetavoxelNode* _children[CHILD_COUNT];
+    MetavoxelNode** _children; ///< null for leaves; otherwise, an array of CHILD_COUNT non-null children
 };
 
 /// Contains information about a metavoxel (explicit or procedural).
@@ -269,12 +419,36 @@ public:
     /// \return the encoded order in which to traverse the children, zero to stop recursion, or -1 to short-circuit the tour
     virtual int visit(MetavoxelInfo& info) = 0;
 
+    /// Creates a clone of this visitor through the clone function and marks it as such.
+    MetavoxelVisitor* createClone() const;
+
+    /// Checks whether this visitor is a clone visiting part of a parallel tour.
+    bool isClone() const { return _clone; }
+
+    /// Creates a copy of this visitor to visit one of the top-level octants on another thread, or returns NULL (the default)
+    /// if the visitor must make the whole tour on the calling thread.  Only visitors without outputs are toured in parallel.
+    /// Octants are handed out in visitation order, so visitors that depend on that order (like ray intersections) will
+    /// have their nearest octants visited first.
+    virtual MetavoxelVisitor* clone() const;
+    
+    /// Merges the results of a clone once it has visited its octant.  Clones are merged on the calling thread in visitation
+    /// order, up to and including the first that short-circuited.
+    /// \return true to continue, false to short-circuit the tour
+    virtual bool merge(MetavoxelVisitor& clone);
+
 protected:
 
+    /// Checks whether the spanner has yet to be visited on this tour, marking it as visited if so.  Clones keep their own
+    /// marks, since the spanners' are shared between threads, and so may visit spanners that other clones visit as well.
+    bool testAndSetVisited(Spanner* spanner);
+
     QVector<AttributePointer> _inputs;
     QVector<AttributePointer> _outputs;
     MetavoxelLOD _lod;
     float _minimumLODThresholdMultiplier;
+    
+    bool _clone;
+    QSet<Spanner*> _spannersVisited;
 };
 
 /// Base class for visitors to spanners.
@@ -295,10 +469,24 @@ public:
     virtual void prepare();
     virtual int visit(MetavoxelInfo& info);
 
+    /// Visits the spanners that the clone found, skipping those already visited.
+    virtual bool merge(MetavoxelVisitor& clone);
+
 protected:
     
+    /// Visits a spanner or, if we're a clone, records it to be visited when we're merged.
+    bool visitOrDefer(Spanner* spanner, const glm::vec3& clipMinimum, float clipSize);
+    
+    class SpannerVisit {
+    public:
+        Spanner* spanner;
+        glm::vec3 clipMinimum;
+        float clipSize;
+    };
+    
     int _spannerInputCount;
     int _spannerMaskCount;
+    QVector<SpannerVisit> _deferredVisits;
 };
 
 /// Base class for ray intersection visitors.
@@ -340,10 +528,26 @@ public:
     virtual void prepare();
     virtual int visit(MetavoxelInfo& info, float distance);
     
+    /// Visits the spanners that the clone found, in the order found, skipping those already visited.
+    virtual bool merge(MetavoxelVisitor& clone);
+    
 protected:
     
+    /// Visits a spanner or, if we're a clone, records it to be visited when we're merged.
+    /// \param clipped whether the intersection was with the spanner clipped to a voxel, in which case the spanner may be
+    /// visited again
+    bool visitOrDefer(Spanner* spanner, float distance, bool clipped);
+    
+    class SpannerHit {
+    public:
+        Spanner* spanner;
+        float distance;
+        bool clipped;
+    };
+    
     int _spannerInputCount;
     int _spannerMaskCount;
+    QVector<SpannerHit> _deferredHits;
 };
 
 /// Interface for objects that guide metavoxel visitors.
@@ -434,8 +638,20 @@ public:
     QVector<MetavoxelNode*> outputNodes;
     MetavoxelInfo info;
     
+    MetavoxelVisitation(MetavoxelVisitation* previous, MetavoxelVisitor& visitor, int inputCount, int outputCount);
+    ~MetavoxelVisitation();
+    
     bool allInputNodesLeaves() const;
     AttributeValue getInheritedOutputValue(int index) const;
+    
+    /// Returns the visitation to use for our children.  It's created on first use and then reused for each child (and
+    /// their children's children, and so on) for the rest of the tour, so that each depth allocates its state once.
+    MetavoxelVisitation& getNext();
+
+private:
+    Q_DISABLE_COPY(MetavoxelVisitation)
+    
+    MetavoxelVisitation* _next;
 };
 
 /// An object that spans multiple octree cells.
@@ -451,6 +667,10 @@ public:
     /// Increments the value of the global visit counter.
     static void incrementVisit() { _visit++; }
     
+    /// Returns the lock to hold while visiting spanners when another thread may be visiting them too, since the visit
+    /// counter is global.
+    static QMutex& getVisitMutex() { return _visitMutex; }
+    
     Spanner();
     
     void setBounds(const Box& bounds);
@@ -513,6 +733,7 @@ private:
     int _lastVisit; ///< the identifier of the last visit
     
     static int _visit; ///< the global visit counter
+    static QMutex _visitMutex;
 };
 
 /// Base class for objects that can render spanners.
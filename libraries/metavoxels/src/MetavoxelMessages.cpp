@@ -15,9 +15,17 @@ void MetavoxelEditMessage::apply(MetavoxelData& data, const WeakSharedObjectHash
     static_cast<const MetavoxelEdit*>(edit.data())->apply(data, objects);
 }
 
+bool MetavoxelEditMessage::visitsSpanners() const {
+    return static_cast<const MetavoxelEdit*>(edit.data())->visitsSpanners();
+}
+
 MetavoxelEdit::~MetavoxelEdit() {
 }
 
+bool MetavoxelEdit::visitsSpanners() const {
+    return true;
+}
+
 BoxSetEdit::BoxSetEdit(const Box& region, float granularity, const OwnedAttributeValue& value) :
     region(region), granularity(granularity), value(value) {
 }
@@ -146,6 +154,10 @@ void GlobalSetEdit::apply(MetavoxelData& data, const WeakSharedObjectHash& objec
     data.guide(visitor);
 }
 
+bool GlobalSetEdit::visitsSpanners() const {
+    return qobject_cast<SpannerSetAttribute*>(value.getAttribute().data()) != NULL;
+}
+
 InsertSpannerEdit::InsertSpannerEdit(const AttributePointer& attribute, const SharedObjectPointer& spanner) :
     attribute(attribute),
     spanner(spanner) {
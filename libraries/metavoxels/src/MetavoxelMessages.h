@@ -57,6 +57,11 @@ DECLARE_STREAMABLE_METATYPE(ClientStateMessage)
 /// A message preceding metavoxel delta information.  The actual delta will follow it in the stream.
 class MetavoxelDeltaMessage {
     STREAMABLE
+
+public:
+    
+    /// The level of detail at which the delta was written, which may be coarser than the one requested by the client.
+    STREAM MetavoxelLOD lod;
 };
 
 DECLARE_STREAMABLE_METATYPE(MetavoxelDeltaMessage)
@@ -70,6 +75,8 @@ public:
     STREAM QVariant edit;
     
     void apply(MetavoxelData& data, const WeakSharedObjectHash& objects) const;
+    
+    bool visitsSpanners() const;
 };
 
 DECLARE_STREAMABLE_METATYPE(MetavoxelEditMessage)
@@ -81,6 +88,10 @@ public:
     virtual ~MetavoxelEdit();
     
     virtual void apply(MetavoxelData& data, const WeakSharedObjectHash& objects) const = 0;
+    
+    /// Checks whether applying the edit may visit spanners, and so rely on the global visit counter that spanner writes
+    /// also use.  Unless they know otherwise, edits assume that they do.
+    virtual bool visitsSpanners() const;
 };
 
 /// An edit that sets the region within a box to a value.
@@ -112,6 +123,8 @@ public:
     GlobalSetEdit(const OwnedAttributeValue& value = OwnedAttributeValue());
     
     virtual void apply(MetavoxelData& data, const WeakSharedObjectHash& objects) const;
+    
+    virtual bool visitsSpanners() const;
 };
 
 DECLARE_STREAMABLE_METATYPE(GlobalSetEdit)
@@ -0,0 +1,236 @@
+//
+//  MetavoxelPersister.cpp
+//  libraries/metavoxels/src
+//
+//  Created by Andrzej Kapolka on 5/28/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <QDataStream>
+#include <QDir>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QtDebug>
+
+#include <SharedUtil.h>
+
+#include "MetavoxelMessages.h"
+#include "MetavoxelPersister.h"
+
+const quint32 SNAPSHOT_MAGIC = 0x484D5653; // "HMVS"
+const quint32 LOG_MAGIC = 0x484D564C; // "HMVL"
+const quint32 PERSISTENCE_VERSION = 1;
+
+const QString SNAPSHOT_FILENAME = "snapshot";
+const QString LOG_FILENAME_PREFIX = "edits.";
+
+/// Writes a snapshot on the persister's pool and then lets it know, on its own thread, that it's done.
+class SnapshotWriter : public QRunnable {
+public:
+
+    SnapshotWriter(MetavoxelPersister* persister, int generation) : _persister(persister), _generation(generation) { }
+
+    virtual void run();
+
+private:
+
+    MetavoxelPersister* _persister;
+    int _generation;
+};
+
+void SnapshotWriter::run() {
+    _persister->_snapshotSucceeded = _persister->writeSnapshot(_generation);
+    QMetaObject::invokeMethod(_persister, "finishSnapshot", Qt::QueuedConnection, Q_ARG(int, _generation));
+}
+
+MetavoxelPersister::MetavoxelPersister(const QString& directory, QObject* parent) :
+    QObject(parent),
+    _directory(directory),
+    _generation(-1),
+    _editsSinceSnapshot(0),
+    _snapshotPending(false),
+    _snapshotSucceeded(false),
+    _loadUsecs(0),
+    _lastSnapshotPauseUsecs(0),
+    _lastSnapshotWriteUsecs(0) {
+
+    QDir().mkpath(directory);
+    _writePool.setMaxThreadCount(1);
+}
+
+MetavoxelPersister::~MetavoxelPersister() {
+    waitForSnapshot();
+}
+
+static void addObjects(WeakSharedObjectHash& objects, const WeakSharedObjectHash& loaded) {
+    for (WeakSharedObjectHash::const_iterator it = loaded.constBegin(); it != loaded.constEnd(); it++) {
+        objects.insert(it.key(), it.value());
+    }
+}
+
+bool MetavoxelPersister::load(MetavoxelData& data) {
+    quint64 start = usecTimestampNow();
+    bool loaded = false;
+
+    // the logged edits refer to spanners by the IDs they had when the edits were made, which are the ones they were
+    // written under
+    WeakSharedObjectHash objects;
+
+    int generation = 0;
+    QFile snapshotFile(getSnapshotPath());
+    if (snapshotFile.open(QIODevice::ReadOnly)) {
+        QByteArray contents = snapshotFile.readAll();
+        QDataStream stream(contents);
+        quint32 magic, version;
+        qint32 firstLogGeneration;
+        stream >> magic >> version >> firstLogGeneration;
+        if (magic == SNAPSHOT_MAGIC && version == PERSISTENCE_VERSION) {
+            Bitstream in(stream, Bitstream::FULL_METADATA);
+            data.read(in);
+            addObjects(objects, in.getWeakSharedObjectHash());
+            generation = firstLogGeneration;
+            loaded = true;
+
+        } else {
+            qWarning() << "Ignoring unrecognized metavoxel snapshot" << snapshotFile.fileName();
+        }
+    }
+
+    // replay the logs that follow, in order
+    for (;; generation++) {
+        QFile log(getLogPath(generation));
+        if (!log.open(QIODevice::ReadOnly)) {
+            break;
+        }
+        QByteArray contents = log.readAll();
+        QDataStream stream(contents);
+        quint32 magic, version;
+        stream >> magic >> version;
+        if (magic != LOG_MAGIC || version != PERSISTENCE_VERSION) {
+            qWarning() << "Ignoring unrecognized metavoxel edit log" << log.fileName();
+            continue;
+        }
+        while (!stream.atEnd()) {
+            QByteArray record;
+            stream >> record;
+            if (stream.status() != QDataStream::Ok) {
+                // the server went down partway through writing this one
+                qWarning() << "Truncated metavoxel edit log" << log.fileName();
+                break;
+            }
+            QDataStream recordStream(record);
+            Bitstream in(recordStream, Bitstream::FULL_METADATA);
+            QVariant message;
+            in >> message;
+            addObjects(objects, in.getWeakSharedObjectHash());
+            if (message.userType() == MetavoxelEditMessage::Type) {
+                message.value<MetavoxelEditMessage>().apply(data, objects);
+                loaded = true;
+            }
+        }
+    }
+    _generation = generation - 1;
+
+    _loadUsecs = usecTimestampNow() - start;
+    return loaded;
+}
+
+void MetavoxelPersister::logEdit(const MetavoxelEditMessage& edit) {
+    if (!_log.isOpen()) {
+        return;
+    }
+    // each record gets a stream of its own so that it can be read without the ones before it
+    QByteArray record;
+    {
+        QDataStream recordStream(&record, QIODevice::WriteOnly);
+        Bitstream out(recordStream, Bitstream::FULL_METADATA);
+        out << QVariant::fromValue(edit);
+        out.flush();
+    }
+    QDataStream stream(&_log);
+    stream << record;
+    _log.flush();
+    _editsSinceSnapshot++;
+}
+
+bool MetavoxelPersister::snapshot(const MetavoxelData& data) {
+    if (_snapshotPending) {
+        return false;
+    }
+    quint64 start = usecTimestampNow();
+
+    // edits from here on go into a new log, which is the first that the snapshot won't include
+    _log.close();
+    _log.setFileName(getLogPath(++_generation));
+    if (_log.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        QDataStream stream(&_log);
+        stream << LOG_MAGIC << PERSISTENCE_VERSION;
+        _log.flush();
+
+    } else {
+        qWarning() << "Couldn't open metavoxel edit log" << _log.fileName() << _log.errorString();
+    }
+    _editsSinceSnapshot = 0;
+
+    // copying only shares the roots; edits replace the nodes along the paths they change rather than modifying them,
+    // so the copy stays as it is while the worker writes it
+    _snapshotData = data;
+    _snapshotPending = true;
+    _writePool.start(new SnapshotWriter(this, _generation));
+
+    _lastSnapshotPauseUsecs = usecTimestampNow() - start;
+    return true;
+}
+
+void MetavoxelPersister::waitForSnapshot() {
+    _writePool.waitForDone();
+    finishSnapshot(_generation);
+}
+
+void MetavoxelPersister::finishSnapshot(int generation) {
+    // we may already have finished by waiting, and the notification may be for an earlier snapshot
+    if (!_snapshotPending || generation != _generation) {
+        return;
+    }
+    _snapshotPending = false;
+
+    // release the copy here, as node reference counts aren't atomic
+    _snapshotData = MetavoxelData();
+
+    if (_snapshotSucceeded) {
+        // the earlier logs are all in the snapshot now
+        for (int i = generation - 1; i >= 0 && QFile::remove(getLogPath(i)); i--);
+    }
+}
+
+QString MetavoxelPersister::getSnapshotPath() const {
+    return _directory + "/" + SNAPSHOT_FILENAME;
+}
+
+QString MetavoxelPersister::getLogPath(int generation) const {
+    return _directory + "/" + LOG_FILENAME_PREFIX + QString::number(generation);
+}
+
+bool MetavoxelPersister::writeSnapshot(int generation) {
+    quint64 start = usecTimestampNow();
+    QByteArray contents;
+    {
+        QDataStream stream(&contents, QIODevice::WriteOnly);
+        stream << SNAPSHOT_MAGIC << PERSISTENCE_VERSION << (qint32)generation;
+        Bitstream out(stream, Bitstream::FULL_METADATA);
+        _snapshotData.write(out);
+        out.flush();
+    }
+
+    // the save file replaces the old snapshot only once the new one has been written in full
+    QSaveFile file(getSnapshotPath());
+    bool succeeded = file.open(QIODevice::WriteOnly) && file.write(contents) == contents.size() && file.commit();
+    if (!succeeded) {
+        qWarning() << "Couldn't write metavoxel snapshot" << file.fileName() << file.errorString();
+    }
+    _lastSnapshotWriteUsecs = usecTimestampNow() - start;
+    return succeeded;
+}
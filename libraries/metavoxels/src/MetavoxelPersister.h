@@ -0,0 +1,97 @@
+//
+//  MetavoxelPersister.h
+//  libraries/metavoxels/src
+//
+//  Created by Andrzej Kapolka on 5/28/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_MetavoxelPersister_h
+#define hifi_MetavoxelPersister_h
+
+#include <QFile>
+#include <QObject>
+#include <QThreadPool>
+
+#include "MetavoxelData.h"
+
+class MetavoxelEditMessage;
+
+/// Keeps metavoxel data on disk as a snapshot plus a log of the edits applied since.  Each snapshot starts a new log
+/// generation; the snapshot records the first generation it doesn't include, and the logs before it are removed once it
+/// has been committed, so that a crash at any point leaves something to load.  Snapshots are written on a worker thread
+/// from a copy of the data that shares its nodes, so edits may continue while they're written.
+class MetavoxelPersister : public QObject {
+    Q_OBJECT
+
+public:
+
+    MetavoxelPersister(const QString& directory, QObject* parent = NULL);
+    virtual ~MetavoxelPersister();
+
+    /// Loads the last snapshot (if any) and replays the edit logs that follow it.  Spanners loaded get new IDs, so call
+    /// snapshot afterwards to start a log consistent with them.
+    /// \return true if anything was loaded
+    bool load(MetavoxelData& data);
+
+    /// Appends an edit to the current log.  Call once the edit has been applied.
+    void logEdit(const MetavoxelEditMessage& edit);
+
+    /// Starts a new log generation and begins writing a snapshot of the data as it stands.
+    /// \return false if the previous snapshot is still being written
+    bool snapshot(const MetavoxelData& data);
+
+    /// Blocks until any snapshot in progress has been written.
+    void waitForSnapshot();
+
+    bool isSnapshotPending() const { return _snapshotPending; }
+
+    /// Returns the number of edits logged since the last snapshot was started.
+    int getEditsSinceSnapshot() const { return _editsSinceSnapshot; }
+
+    quint64 getLoadUsecs() const { return _loadUsecs; }
+
+    /// Returns the time the caller of the last snapshot was held up for, including any time that edits spent waiting
+    /// for it as reported through addSnapshotPause.
+    quint64 getLastSnapshotPauseUsecs() const { return _lastSnapshotPauseUsecs; }
+    
+    /// Adds time that the caller spent waiting for the snapshot in progress (for the spanner visit lock, say).
+    void addSnapshotPause(quint64 usecs) { _lastSnapshotPauseUsecs += usecs; }
+
+    /// Returns the time taken to write the last snapshot on the worker thread.
+    quint64 getLastSnapshotWriteUsecs() const { return _lastSnapshotWriteUsecs; }
+
+private slots:
+
+    void finishSnapshot(int generation);
+
+private:
+
+    friend class SnapshotWriter;
+
+    QString getSnapshotPath() const;
+    QString getLogPath(int generation) const;
+
+    /// Writes the snapshot data.
+    /// \thread the worker thread
+    bool writeSnapshot(int generation);
+
+    QString _directory;
+    int _generation;
+    QFile _log;
+    int _editsSinceSnapshot;
+
+    QThreadPool _writePool;
+    MetavoxelData _snapshotData;
+    bool _snapshotPending;
+    bool _snapshotSucceeded;
+
+    quint64 _loadUsecs;
+    quint64 _lastSnapshotPauseUsecs;
+    quint64 _lastSnapshotWriteUsecs;
+};
+
+#endif // hifi_MetavoxelPersister_h
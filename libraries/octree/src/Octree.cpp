@@ -43,6 +43,7 @@ Octree::Octree(bool shouldReaverage) :
     _shouldReaverage(shouldReaverage),
     _stopImport(false),
     _lock(),
+    _writeLockCount(0),
     _isViewing(false) 
 {
 }
@@ -227,9 +227,14 @@ public:
     // Octree does not currently handle its own locking, caller must use these to lock/unlock
     void lockForRead() { _lock.lockForRead(); }
     bool tryLockForRead() { return _lock.tryLockForRead(); }
-    void lockForWrite() { _lock.lockForWrite(); }
-    bool tryLockForWrite() { return _lock.tryLockForWrite(); }
+    void lockForWrite() { _lock.lockForWrite(); _writeLockCount++; }
+    bool tryLockForWrite() { bool locked = _lock.tryLockForWrite(); _writeLockCount += locked ? 1 : 0; return locked; }
     void unlock() { _lock.unlock(); }
+
+    /// The number of times the tree has been locked for writing. Code that lets go of the lock between reading the tree
+    /// and writing back to it can compare this to tell whether anyone else has written to the tree in between.
+    /// \thread only meaningful while holding the lock
+    quint32 getWriteLockCount() const { return _writeLockCount; }
     // output hints from the encode process
     typedef enum {
         Lock,
@@ -307,6 +312,7 @@ protected:
     bool _stopImport;
 
     QReadWriteLock _lock;
+    quint32 _writeLockCount;
     
     /// This tree is receiving inbound viewer datagrams.
     bool _isViewing;
@@ -44,8 +44,8 @@ public:
     /// have these packets get sent. If running in non-threaded mode, the caller must still call process() on a regular
     /// interval to ensure that the packets are actually sent. Can be called even before servers are known, in 
     /// which case  up to MaxPendingMessages of the released messages will be buffered and actually released when 
-    /// servers are known.
-    void releaseQueuedMessages();
+    /// servers are known. Subclasses that hold edits back to coalesce them should queue them before calling this.
+    virtual void releaseQueuedMessages();
 
     /// are we in sending mode. If we're not in sending mode then all packets and messages will be ignored and
     /// not queued and not sent
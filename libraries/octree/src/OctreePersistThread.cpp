@@ -9,7 +9,10 @@
 //  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
 //
 
+#include <cstdio>
+
 #include <QDebug>
+#include <QFile>
 #include <PerfStat.h>
 #include <SharedUtil.h>
 
@@ -79,13 +82,29 @@ bool OctreePersistThread::process() {
         if (sinceLastSave > intervalToCheck) {
             // check the dirty bit and persist here...
             _lastCheck = usecTimestampNow();
-            if (_tree->isDirty()) {
-                qDebug() << "saving Octrees to file " << _filename << "...";
-                _tree->writeToSVOFile(_filename.toLocal8Bit().constData());
-                _tree->clearDirtyBit(); // tree is clean after saving
-                qDebug("DONE saving Octrees to file...");
-            }
+            persist();
         }
     }
     return isStillRunning();  // keep running till they terminate us
 }
+
+void OctreePersistThread::persist() {
+    // never replace the file with a tree we haven't finished loading from it
+    if (!_initialLoadComplete || !_tree->isDirty()) {
+        return;
+    }
+
+    qDebug() << "saving Octrees to file " << _filename << "...";
+
+    QString snapshotFilename = _filename + ".snapshot";
+    _tree->writeToSVOFile(snapshotFilename.toLocal8Bit().constData());
+    _tree->clearDirtyBit(); // tree is clean after saving
+
+    // rename replaces the old file atomically where it is allowed to, otherwise remove the old file first
+    if (rename(snapshotFilename.toLocal8Bit().constData(), _filename.toLocal8Bit().constData()) != 0) {
+        QFile::remove(_filename);
+        QFile::rename(snapshotFilename, _filename);
+    }
+
+    qDebug("DONE saving Octrees to file...");
+}
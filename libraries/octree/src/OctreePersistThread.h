@@ -29,6 +29,11 @@ public:
     bool isInitialLoadComplete() const { return _initialLoadComplete; }
     quint64 getLoadElapsedTime() const { return _loadTimeUSecs; }
 
+    /// Saves the tree if it has changed. The snapshot is written beside the persist file and then moved over it, so a
+    /// server that dies mid-save leaves the previous snapshot intact for whichever server takes over next.
+    /// Call from outside the thread only once it has been terminated.
+    void persist();
+
 signals:
     void loadCompleted();
 
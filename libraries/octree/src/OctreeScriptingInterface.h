@@ -90,6 +90,23 @@ public slots:
     /// returns the total bytes queued by this object over its lifetime
     long long unsigned int getLifetimeBytesQueued() const { return _packetSender->getLifetimeBytesQueued(); }
 
+    /// returns the send queue depth below which the given percentage (0 to 100) of sent packets found the queue
+    long long unsigned int getSendQueueDepthPercentile(float percentile) const
+        { return _packetSender->getQueueDepthHistogram().getPercentile(percentile); }
+
+    /// returns the time in usecs below which the given percentage (0 to 100) of sent packets waited in the send queue
+    long long unsigned int getSendQueueWaitTimePercentile(float percentile) const
+        { return _packetSender->getQueueWaitTimeHistogram().getPercentile(percentile); }
+
+    /// returns the send queue depth histogram formatted for display
+    QString getSendQueueDepthHistogram() const { return _packetSender->getQueueDepthHistogram().toString(); }
+
+    /// returns the send queue wait time (usecs) histogram formatted for display
+    QString getSendQueueWaitTimeHistogram() const { return _packetSender->getQueueWaitTimeHistogram().toString(); }
+
+    /// returns the number of packets dropped because the send queue was full
+    int getSendQueueDroppedPackets() const { return _packetSender->getDroppedPacketCount(); }
+
 protected:
     /// attached OctreeEditPacketSender that handles queuing and sending of packets to VS
     OctreeEditPacketSender* _packetSender;
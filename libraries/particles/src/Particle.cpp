@@ -9,6 +9,9 @@
 //  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
 //
 
+#include <cmath>
+#include <limits>
+
 #include <QtCore/QObject>
 
 #include <Octree.h>
@@ -372,6 +375,9 @@ Particle Particle::fromEditPacket(const unsigned char* data, int length, int& pr
 
     bool isNewParticle = (editID == NEW_PARTICLE);
 
+    // assume the best
+    valid = true;
+
     // special case for handling "new" particles
     if (isNewParticle) {
         // If this is a NEW_PARTICLE, then we assume that there's an additional uint32_t creatorToken, that
@@ -396,15 +402,10 @@ Particle Particle::fromEditPacket(const unsigned char* data, int length, int& pr
             // the user attempted to edit a particle that doesn't exist
             qDebug() << "user attempted to edit a particle that doesn't exist...";
             valid = false;
-            return newParticle;
         }
         newParticle._id = editID;
         newParticle._newlyCreated = false;
     }
-    
-    // if we got this far, then our result will be valid
-    valid = true;
-    
 
     // lastEdited
     memcpy(&newParticle._lastEdited, dataAt, sizeof(newParticle._lastEdited));
@@ -420,69 +421,191 @@ Particle Particle::fromEditPacket(const unsigned char* data, int length, int& pr
         processedBytes += sizeof(packetContainsBits);
     }
 
+    // even an edit of a particle we don't have is read through, so that the caller can find the next edit
+    processedBytes += newParticle.readEditPacketProperties(dataAt, packetContainsBits, isNewParticle);
+
+    const bool wantDebugging = false;
+    if (wantDebugging) {
+        qDebug("Particle::fromEditPacket()...");
+        qDebug() << "   Particle id in packet:" << editID;
+        newParticle.debugDump();
+    }
+
+    return newParticle;
+}
+
+uint32_t Particle::editPacketParticleID(const unsigned char* data) {
+    int octets = numberOfThreeBitSectionsInCode(data);
+    int lengthOfOctcode = bytesRequiredForCodeLength(octets);
+
+    uint32_t editID;
+    memcpy(&editID, data + lengthOfOctcode, sizeof(editID));
+    return editID;
+}
+
+int Particle::readEditPacket(const unsigned char* data, int length, bool& applied) {
+    const unsigned char* dataAt = data;
+    int processedBytes = 0;
+
+    // skip the octcode and the id, our caller found us by it
+    int octets = numberOfThreeBitSectionsInCode(data);
+    int lengthOfOctcode = bytesRequiredForCodeLength(octets);
+    dataAt += lengthOfOctcode + sizeof(uint32_t);
+    processedBytes += lengthOfOctcode + sizeof(uint32_t);
+
+    // lastEdited
+    quint64 lastEdited;
+    memcpy(&lastEdited, dataAt, sizeof(lastEdited));
+    dataAt += sizeof(lastEdited);
+    processedBytes += sizeof(lastEdited);
+
+    uint16_t packetContainsBits;
+    memcpy(&packetContainsBits, dataAt, sizeof(packetContainsBits));
+    dataAt += sizeof(packetContainsBits);
+    processedBytes += sizeof(packetContainsBits);
+
+    // an edit older than what we have is read into a scratch particle (that doesn't take up an id), just to get past it
+    applied = (lastEdited > _lastEdited);
+    if (applied) {
+        _lastEdited = lastEdited;
+        processedBytes += readEditPacketProperties(dataAt, packetContainsBits, false);
+    } else {
+        Particle staleEdit(ParticleID(UNKNOWN_PARTICLE_ID), ParticleProperties());
+        processedBytes += staleEdit.readEditPacketProperties(dataAt, packetContainsBits, false);
+    }
+    return processedBytes;
+}
+
+// 24 bit fixed point position in domain units, which are clamped to the domain
+static int packQuantizedPosition(unsigned char* buffer, const glm::vec3& position) {
+    unsigned char* bufferAt = buffer;
+    for (int i = 0; i < 3; i++) {
+        uint32_t quantized = (uint32_t)(glm::clamp(position[i], 0.0f, 1.0f) * QUANTIZED_POSITION_SCALE + 0.5f);
+        for (int j = 0; j < QUANTIZED_POSITION_BYTES; j++) {
+            *bufferAt++ = (unsigned char)(quantized >> (j * BITS_IN_BYTE));
+        }
+    }
+    return bufferAt - buffer;
+}
+
+static int unpackQuantizedPosition(const unsigned char* buffer, glm::vec3& position) {
+    const unsigned char* bufferAt = buffer;
+    for (int i = 0; i < 3; i++) {
+        uint32_t quantized = 0;
+        for (int j = 0; j < QUANTIZED_POSITION_BYTES; j++) {
+            quantized |= (uint32_t)(*bufferAt++) << (j * BITS_IN_BYTE);
+        }
+        position[i] = quantized / QUANTIZED_POSITION_SCALE;
+    }
+    return bufferAt - buffer;
+}
+
+// 16 bit velocity components relative to a shared power of two that bounds the largest of them
+static int packQuantizedVelocity(unsigned char* buffer, const glm::vec3& velocity) {
+    float largestComponent = glm::max(glm::abs(velocity.x), glm::max(glm::abs(velocity.y), glm::abs(velocity.z)));
+    int exponent = 0;
+    frexpf(largestComponent, &exponent);
+    exponent = glm::clamp(exponent, (int)std::numeric_limits<int8_t>::min(), (int)std::numeric_limits<int8_t>::max());
+
+    int8_t packedExponent = exponent;
+    memcpy(buffer, &packedExponent, sizeof(packedExponent));
+    unsigned char* bufferAt = buffer + sizeof(packedExponent);
+    for (int i = 0; i < 3; i++) {
+        float mantissa = glm::clamp(ldexpf(velocity[i], -exponent), -1.0f, 1.0f);
+        int16_t quantized = (int16_t)glm::round(mantissa * QUANTIZED_VELOCITY_SCALE);
+        memcpy(bufferAt, &quantized, sizeof(quantized));
+        bufferAt += sizeof(quantized);
+    }
+    return bufferAt - buffer;
+}
+
+static int unpackQuantizedVelocity(const unsigned char* buffer, glm::vec3& velocity) {
+    int8_t exponent;
+    memcpy(&exponent, buffer, sizeof(exponent));
+    const unsigned char* bufferAt = buffer + sizeof(exponent);
+    for (int i = 0; i < 3; i++) {
+        int16_t quantized;
+        memcpy(&quantized, bufferAt, sizeof(quantized));
+        bufferAt += sizeof(quantized);
+        velocity[i] = ldexpf(quantized / QUANTIZED_VELOCITY_SCALE, exponent);
+    }
+    return bufferAt - buffer;
+}
+
+int Particle::readEditPacketProperties(const unsigned char* data, uint16_t packetContainsBits, bool isNewParticle) {
+    const unsigned char* dataAt = data;
+    int processedBytes = 0;
 
     // radius
     if (isNewParticle || ((packetContainsBits & CONTAINS_RADIUS) == CONTAINS_RADIUS)) {
-        memcpy(&newParticle._radius, dataAt, sizeof(newParticle._radius));
-        dataAt += sizeof(newParticle._radius);
-        processedBytes += sizeof(newParticle._radius);
+        memcpy(&_radius, dataAt, sizeof(_radius));
+        dataAt += sizeof(_radius);
+        processedBytes += sizeof(_radius);
     }
 
-    // position
-    if (isNewParticle || ((packetContainsBits & CONTAINS_POSITION) == CONTAINS_POSITION)) {
-        memcpy(&newParticle._position, dataAt, sizeof(newParticle._position));
-        dataAt += sizeof(newParticle._position);
-        processedBytes += sizeof(newParticle._position);
+    // position, edits of existing particles send it quantized
+    if (isNewParticle) {
+        memcpy(&_position, dataAt, sizeof(_position));
+        dataAt += sizeof(_position);
+        processedBytes += sizeof(_position);
+    } else if ((packetContainsBits & CONTAINS_POSITION) == CONTAINS_POSITION) {
+        int bytes = unpackQuantizedPosition(dataAt, _position);
+        dataAt += bytes;
+        processedBytes += bytes;
     }
 
     // color
     if (isNewParticle || ((packetContainsBits & CONTAINS_COLOR) == CONTAINS_COLOR)) {
-        memcpy(newParticle._color, dataAt, sizeof(newParticle._color));
-        dataAt += sizeof(newParticle._color);
-        processedBytes += sizeof(newParticle._color);
+        memcpy(_color, dataAt, sizeof(_color));
+        dataAt += sizeof(_color);
+        processedBytes += sizeof(_color);
     }
 
-    // velocity
-    if (isNewParticle || ((packetContainsBits & CONTAINS_VELOCITY) == CONTAINS_VELOCITY)) {
-        memcpy(&newParticle._velocity, dataAt, sizeof(newParticle._velocity));
-        dataAt += sizeof(newParticle._velocity);
-        processedBytes += sizeof(newParticle._velocity);
+    // velocity, edits of existing particles send it quantized
+    if (isNewParticle) {
+        memcpy(&_velocity, dataAt, sizeof(_velocity));
+        dataAt += sizeof(_velocity);
+        processedBytes += sizeof(_velocity);
+    } else if ((packetContainsBits & CONTAINS_VELOCITY) == CONTAINS_VELOCITY) {
+        int bytes = unpackQuantizedVelocity(dataAt, _velocity);
+        dataAt += bytes;
+        processedBytes += bytes;
     }
 
     // gravity
     if (isNewParticle || ((packetContainsBits & CONTAINS_GRAVITY) == CONTAINS_GRAVITY)) {
-        memcpy(&newParticle._gravity, dataAt, sizeof(newParticle._gravity));
-        dataAt += sizeof(newParticle._gravity);
-        processedBytes += sizeof(newParticle._gravity);
+        memcpy(&_gravity, dataAt, sizeof(_gravity));
+        dataAt += sizeof(_gravity);
+        processedBytes += sizeof(_gravity);
     }
 
     // damping
     if (isNewParticle || ((packetContainsBits & CONTAINS_DAMPING) == CONTAINS_DAMPING)) {
-        memcpy(&newParticle._damping, dataAt, sizeof(newParticle._damping));
-        dataAt += sizeof(newParticle._damping);
-        processedBytes += sizeof(newParticle._damping);
+        memcpy(&_damping, dataAt, sizeof(_damping));
+        dataAt += sizeof(_damping);
+        processedBytes += sizeof(_damping);
     }
 
     // lifetime
     if (isNewParticle || ((packetContainsBits & CONTAINS_LIFETIME) == CONTAINS_LIFETIME)) {
-        memcpy(&newParticle._lifetime, dataAt, sizeof(newParticle._lifetime));
-        dataAt += sizeof(newParticle._lifetime);
-        processedBytes += sizeof(newParticle._lifetime);
+        memcpy(&_lifetime, dataAt, sizeof(_lifetime));
+        dataAt += sizeof(_lifetime);
+        processedBytes += sizeof(_lifetime);
     }
 
     // TODO: make inHand and shouldDie into single bits
     // inHand
     if (isNewParticle || ((packetContainsBits & CONTAINS_INHAND) == CONTAINS_INHAND)) {
-        memcpy(&newParticle._inHand, dataAt, sizeof(newParticle._inHand));
-        dataAt += sizeof(newParticle._inHand);
-        processedBytes += sizeof(newParticle._inHand);
+        memcpy(&_inHand, dataAt, sizeof(_inHand));
+        dataAt += sizeof(_inHand);
+        processedBytes += sizeof(_inHand);
     }
 
     // shouldDie
     if (isNewParticle || ((packetContainsBits & CONTAINS_SHOULDDIE) == CONTAINS_SHOULDDIE)) {
-        memcpy(&newParticle._shouldDie, dataAt, sizeof(newParticle._shouldDie));
-        dataAt += sizeof(newParticle._shouldDie);
-        processedBytes += sizeof(newParticle._shouldDie);
+        memcpy(&_shouldDie, dataAt, sizeof(_shouldDie));
+        dataAt += sizeof(_shouldDie);
+        processedBytes += sizeof(_shouldDie);
     }
 
     // script
@@ -492,7 +615,7 @@ Particle Particle::fromEditPacket(const unsigned char* data, int length, int& pr
         dataAt += sizeof(scriptLength);
         processedBytes += sizeof(scriptLength);
         QString tempString((const char*)dataAt);
-        newParticle._script = tempString;
+        _script = tempString;
         dataAt += scriptLength;
         processedBytes += scriptLength;
     }
@@ -504,40 +627,33 @@ Particle Particle::fromEditPacket(const unsigned char* data, int length, int& pr
         dataAt += sizeof(modelURLLength);
         processedBytes += sizeof(modelURLLength);
         QString tempString((const char*)dataAt);
-        newParticle._modelURL = tempString;
+        _modelURL = tempString;
         dataAt += modelURLLength;
         processedBytes += modelURLLength;
     }
 
     // modelScale
     if (isNewParticle || ((packetContainsBits & CONTAINS_MODEL_SCALE) == CONTAINS_MODEL_SCALE)) {
-        memcpy(&newParticle._modelScale, dataAt, sizeof(newParticle._modelScale));
-        dataAt += sizeof(newParticle._modelScale);
-        processedBytes += sizeof(newParticle._modelScale);
+        memcpy(&_modelScale, dataAt, sizeof(_modelScale));
+        dataAt += sizeof(_modelScale);
+        processedBytes += sizeof(_modelScale);
     }
 
     // modelTranslation
     if (isNewParticle || ((packetContainsBits & CONTAINS_MODEL_TRANSLATION) == CONTAINS_MODEL_TRANSLATION)) {
-        memcpy(&newParticle._modelTranslation, dataAt, sizeof(newParticle._modelTranslation));
-        dataAt += sizeof(newParticle._modelTranslation);
-        processedBytes += sizeof(newParticle._modelTranslation);
+        memcpy(&_modelTranslation, dataAt, sizeof(_modelTranslation));
+        dataAt += sizeof(_modelTranslation);
+        processedBytes += sizeof(_modelTranslation);
     }
 
     // modelRotation
     if (isNewParticle || ((packetContainsBits & CONTAINS_MODEL_ROTATION) == CONTAINS_MODEL_ROTATION)) {
-        int bytes = unpackOrientationQuatFromBytes(dataAt, newParticle._modelRotation);
+        int bytes = unpackOrientationQuatFromBytes(dataAt, _modelRotation);
         dataAt += bytes;
         processedBytes += bytes;
     }
 
-    const bool wantDebugging = false;
-    if (wantDebugging) {
-        qDebug("Particle::fromEditPacket()...");
-        qDebug() << "   Particle id in packet:" << editID;
-        newParticle.debugDump();
-    }
-
-    return newParticle;
+    return processedBytes;
 }
 
 void Particle::debugDump() const {
@@ -621,12 +737,16 @@ bool Particle::encodeParticleEditMessageDetails(PacketType command, ParticleID i
         sizeOut += sizeof(radius);
     }
 
-    // position
-    if (isNewParticle || ((packetContainsBits & CONTAINS_POSITION) == CONTAINS_POSITION)) {
+    // position, quantized for edits of existing particles
+    if (isNewParticle) {
         glm::vec3 position = properties.getPosition() / (float)TREE_SCALE;
         memcpy(copyAt, &position, sizeof(position));
         copyAt += sizeof(position);
         sizeOut += sizeof(position);
+    } else if ((packetContainsBits & CONTAINS_POSITION) == CONTAINS_POSITION) {
+        int bytes = packQuantizedPosition(copyAt, properties.getPosition() / (float)TREE_SCALE);
+        copyAt += bytes;
+        sizeOut += bytes;
     }
 
     // color
@@ -637,12 +757,16 @@ bool Particle::encodeParticleEditMessageDetails(PacketType command, ParticleID i
         sizeOut += sizeof(color);
     }
 
-    // velocity
-    if (isNewParticle || ((packetContainsBits & CONTAINS_VELOCITY) == CONTAINS_VELOCITY)) {
+    // velocity, quantized for edits of existing particles
+    if (isNewParticle) {
         glm::vec3 velocity = properties.getVelocity() / (float)TREE_SCALE;
         memcpy(copyAt, &velocity, sizeof(velocity));
         copyAt += sizeof(velocity);
         sizeOut += sizeof(velocity);
+    } else if ((packetContainsBits & CONTAINS_VELOCITY) == CONTAINS_VELOCITY) {
+        int bytes = packQuantizedVelocity(copyAt, properties.getVelocity() / (float)TREE_SCALE);
+        copyAt += bytes;
+        sizeOut += bytes;
     }
 
     // gravity
@@ -817,16 +941,18 @@ void Particle::applyHardCollision(const CollisionInfo& collisionInfo) {
     setVelocity(velocity);
 }
 
+void Particle::updateShouldDie() {
+    bool shouldDie = (getAge() > getLifetime()) || getShouldDie();
+    setShouldDie(shouldDie);
+}
+
 void Particle::update(const quint64& now) {
     float timeElapsed = (float)(now - _lastUpdated) / (float)(USECS_PER_SECOND);
     _lastUpdated = now;
 
-    // calculate our default shouldDie state... then allow script to change it if it wants...
+    // ParticleSimulation does the same integration for whole trees of particles at a time, after the tree has set the
+    // default shouldDie state and run the scripts
     bool isInHand = getInHand();
-    bool shouldDie = (getAge() > getLifetime()) || getShouldDie();
-    setShouldDie(shouldDie);
-
-    executeUpdateScripts(); // allow the javascript to alter our state
 
     // If the ball is in hand, it doesn't move or have gravity effect it
     if (!isInHand) {
@@ -848,62 +974,6 @@ void Particle::update(const quint64& now) {
     }
 }
 
-void Particle::startParticleScriptContext(ScriptEngine& engine, ParticleScriptObject& particleScriptable) {
-    if (_voxelEditSender) {
-        engine.getVoxelsScriptingInterface()->setPacketSender(_voxelEditSender);
-    }
-    if (_particleEditSender) {
-        engine.getParticlesScriptingInterface()->setPacketSender(_particleEditSender);
-    }
-
-    // Add the "this" Particle object
-    engine.registerGlobalObject("Particle", &particleScriptable);
-    engine.evaluate();
-}
-
-void Particle::endParticleScriptContext(ScriptEngine& engine, ParticleScriptObject& particleScriptable) {
-    if (_voxelEditSender) {
-        _voxelEditSender->releaseQueuedMessages();
-    }
-    if (_particleEditSender) {
-        _particleEditSender->releaseQueuedMessages();
-    }
-}
-
-void Particle::executeUpdateScripts() {
-    // Only run this particle script if there's a script attached directly to the particle.
-    if (!_script.isEmpty()) {
-        ScriptEngine engine(_script);
-        ParticleScriptObject particleScriptable(this);
-        startParticleScriptContext(engine, particleScriptable);
-        particleScriptable.emitUpdate();
-        endParticleScriptContext(engine, particleScriptable);
-    }
-}
-
-void Particle::collisionWithParticle(Particle* other, const glm::vec3& penetration) {
-    // Only run this particle script if there's a script attached directly to the particle.
-    if (!_script.isEmpty()) {
-        ScriptEngine engine(_script);
-        ParticleScriptObject particleScriptable(this);
-        startParticleScriptContext(engine, particleScriptable);
-        ParticleScriptObject otherParticleScriptable(other);
-        particleScriptable.emitCollisionWithParticle(&otherParticleScriptable, penetration);
-        endParticleScriptContext(engine, particleScriptable);
-    }
-}
-
-void Particle::collisionWithVoxel(VoxelDetail* voxelDetails, const glm::vec3& penetration) {
-    // Only run this particle script if there's a script attached directly to the particle.
-    if (!_script.isEmpty()) {
-        ScriptEngine engine(_script);
-        ParticleScriptObject particleScriptable(this);
-        startParticleScriptContext(engine, particleScriptable);
-        particleScriptable.emitCollisionWithVoxel(*voxelDetails, penetration);
-        endParticleScriptContext(engine, particleScriptable);
-    }
-}
-
 void Particle::setAge(float age) {
     quint64 ageInUsecs = age * USECS_PER_SECOND;
     _created = usecTimestampNow() - ageInUsecs;
@@ -964,6 +1034,52 @@ ParticleProperties::ParticleProperties() :
 }
 
 
+void ParticleProperties::merge(const ParticleProperties& newer) {
+    if (newer._positionChanged) {
+        setPosition(newer._position);
+    }
+    if (newer._colorChanged) {
+        setColor(newer._color);
+    }
+    if (newer._radiusChanged) {
+        setRadius(newer._radius);
+    }
+    if (newer._velocityChanged) {
+        setVelocity(newer._velocity);
+    }
+    if (newer._gravityChanged) {
+        setGravity(newer._gravity);
+    }
+    if (newer._dampingChanged) {
+        setDamping(newer._damping);
+    }
+    if (newer._lifetimeChanged) {
+        setLifetime(newer._lifetime);
+    }
+    if (newer._scriptChanged) {
+        setScript(newer._script);
+    }
+    if (newer._inHandChanged) {
+        setInHand(newer._inHand);
+    }
+    if (newer._shouldDieChanged) {
+        setShouldDie(newer._shouldDie);
+    }
+    if (newer._modelURLChanged) {
+        setModelURL(newer._modelURL);
+    }
+    if (newer._modelScaleChanged) {
+        setModelScale(newer._modelScale);
+    }
+    if (newer._modelTranslationChanged) {
+        setModelTranslation(newer._modelTranslation);
+    }
+    if (newer._modelRotationChanged) {
+        setModelRotation(newer._modelRotation);
+    }
+    _lastEdited = qMax(_lastEdited, newer._lastEdited);
+}
+
 uint16_t ParticleProperties::getChangedBits() const {
     uint16_t changedBits = 0;
     if (_radiusChanged) {
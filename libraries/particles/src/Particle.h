@@ -48,10 +48,16 @@ const uint16_t CONTAINS_INHAND = 128;
 const uint16_t CONTAINS_SCRIPT = 256;
 const uint16_t CONTAINS_SHOULDDIE = 512;
 const uint16_t CONTAINS_MODEL_URL = 1024;
-const uint16_t CONTAINS_MODEL_TRANSLATION = 1024;
+const uint16_t CONTAINS_MODEL_TRANSLATION = 8192;
 const uint16_t CONTAINS_MODEL_ROTATION = 2048;
 const uint16_t CONTAINS_MODEL_SCALE = 4096;
 
+/// Edits of existing particles send positions as 24 bit fixed point domain units (about a millimeter at TREE_SCALE), and
+/// velocities as 16 bit components that share an 8 bit exponent
+const int QUANTIZED_POSITION_BYTES = 3;
+const float QUANTIZED_POSITION_SCALE = (float)((1 << (QUANTIZED_POSITION_BYTES * BITS_IN_BYTE)) - 1);
+const float QUANTIZED_VELOCITY_SCALE = 32767.0f;
+
 const float DEFAULT_LIFETIME = 10.0f; // particles live for 10 seconds by default
 const float DEFAULT_DAMPING = 0.99f;
 const float DEFAULT_RADIUS = 0.1f / TREE_SCALE;
@@ -73,6 +79,9 @@ class ParticleProperties {
 public:
     ParticleProperties();
 
+    /// Takes over the properties that are set in newer edit, for coalescing edits of the same particle.
+    void merge(const ParticleProperties& newer);
+
     QScriptValue copyToScriptValue(QScriptEngine* engine) const;
     void copyFromScriptValue(const QScriptValue& object);
 
@@ -201,6 +210,14 @@ public:
     /// creates an NEW particle from an PACKET_TYPE_PARTICLE_ADD_OR_EDIT edit data buffer
     static Particle fromEditPacket(const unsigned char* data, int length, int& processedBytes, ParticleTree* tree, bool& valid);
 
+    /// \return the id of the particle a PACKET_TYPE_PARTICLE_ADD_OR_EDIT edit data buffer is for, NEW_PARTICLE for an add
+    static uint32_t editPacketParticleID(const unsigned char* data);
+
+    /// Reads an edit of this existing particle straight into it, unless the particle was edited more recently than that.
+    /// \param applied[out] whether the edit was newer and has been applied
+    /// \return the number of bytes of the edit, whether it was applied or not
+    int readEditPacket(const unsigned char* data, int length, bool& applied);
+
     virtual ~Particle();
     virtual void init(glm::vec3 position, float radius, rgbColor color, glm::vec3 velocity,
             glm::vec3 gravity = DEFAULT_GRAVITY, float damping = DEFAULT_DAMPING, float lifetime = DEFAULT_LIFETIME,
@@ -238,6 +255,7 @@ public:
 
     /// The last updated/simulated time of this particle from the time perspective of the authoritative server/source
     quint64 getLastUpdated() const { return _lastUpdated; }
+    void setLastUpdated(quint64 lastUpdated) { _lastUpdated = lastUpdated; }
 
     /// The last edited time of this particle from the time perspective of the authoritative server/source
     quint64 getLastEdited() const { return _lastEdited; }
@@ -296,9 +314,10 @@ public:
     
     void applyHardCollision(const CollisionInfo& collisionInfo);
 
+    /// calculates our default shouldDie state, before the scripts get a chance to change it
+    void updateShouldDie();
+
     void update(const quint64& now);
-    void collisionWithParticle(Particle* other, const glm::vec3& penetration);
-    void collisionWithVoxel(VoxelDetail* voxel, const glm::vec3& penetration);
 
     void debugDump() const;
 
@@ -321,13 +340,12 @@ public:
     static void handleAddParticleResponse(const QByteArray& packet);
 
 protected:
+    /// reads the properties of an edit that follow its bitmask of included properties
+    int readEditPacketProperties(const unsigned char* data, uint16_t packetContainsBits, bool isNewParticle);
+
     static VoxelEditPacketSender* _voxelEditSender;
     static ParticleEditPacketSender* _particleEditSender;
 
-    void startParticleScriptContext(ScriptEngine& engine, ParticleScriptObject& particleScriptable);
-    void endParticleScriptContext(ScriptEngine& engine, ParticleScriptObject& particleScriptable);
-    void executeUpdateScripts();
-
     void setAge(float age);
 
     glm::vec3 _position;
@@ -370,6 +388,8 @@ class ParticleScriptObject  : public QObject {
     Q_OBJECT
 public:
     ParticleScriptObject(Particle* particle) { _particle = particle; }
+
+    void setParticle(Particle* particle) { _particle = particle; }
     //~ParticleScriptObject() { qDebug() << "~ParticleScriptObject() this=" << this; }
 
     void emitUpdate() { emit update(); }
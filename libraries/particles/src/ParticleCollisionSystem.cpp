@@ -15,6 +15,8 @@
 #include <AvatarData.h>
 #include <HeadData.h>
 #include <HandData.h>
+#include <ShapeCollider.h>
+#include <SphereShape.h>
 
 #include "Particle.h"
 #include "ParticleCollisionSystem.h"
@@ -25,7 +27,12 @@ const int MAX_COLLISIONS_PER_PARTICLE = 16;
 
 ParticleCollisionSystem::ParticleCollisionSystem(ParticleEditPacketSender* packetSender,
     ParticleTree* particles, VoxelTree* voxels, AbstractAudioInterface* audio,
-    AvatarHashMap* avatars) : _collisions(MAX_COLLISIONS_PER_PARTICLE) {
+    AvatarHashMap* avatars) :
+    _collisions(MAX_COLLISIONS_PER_PARTICLE),
+    _lastUpdateTime(0),
+    _totalUpdateTime(0),
+    _updates(0)
+{
     init(packetSender, particles, voxels, audio, avatars);
 }
 
@@ -42,7 +49,7 @@ void ParticleCollisionSystem::init(ParticleEditPacketSender* packetSender,
 ParticleCollisionSystem::~ParticleCollisionSystem() {
 }
 
-bool ParticleCollisionSystem::updateOperation(OctreeElement* element, void* extraData) {
+bool ParticleCollisionSystem::collectParticlesOperation(OctreeElement* element, void* extraData) {
     ParticleCollisionSystem* system = static_cast<ParticleCollisionSystem*>(extraData);
     ParticleTreeElement* particleTreeElement = static_cast<ParticleTreeElement*>(element);
 
@@ -50,8 +57,7 @@ bool ParticleCollisionSystem::updateOperation(OctreeElement* element, void* extr
     QList<Particle>& particles = particleTreeElement->getParticles();
     uint16_t numberOfParticles = particles.size();
     for (uint16_t i = 0; i < numberOfParticles; i++) {
-        Particle* particle = &particles[i];
-        system->checkParticle(particle);
+        system->_frameParticles.append(&particles[i]);
     }
 
     return true;
@@ -59,18 +65,98 @@ bool ParticleCollisionSystem::updateOperation(OctreeElement* element, void* extr
 
 
 void ParticleCollisionSystem::update() {
+    quint64 start = usecTimestampNow();
+
     // update all particles
     if (_particles->tryLockForRead()) {
-        _particles->recurseTreeWithOperation(updateOperation, this);
+        _frameParticles.resize(0);
+        _particles->recurseTreeWithOperation(collectParticlesOperation, this);
+        buildBroadPhase();
+
+        foreach (Particle* particle, _frameParticles) {
+            updateCollisionWithVoxels(particle);
+        }
+        for (int i = 0; i < _particlePairs.size(); i++) {
+            updateCollisionWithParticle(_frameParticles.at(_particlePairs.at(i).first),
+                _frameParticles.at(_particlePairs.at(i).second));
+        }
+        for (int i = 0; i < _avatarPairs.size(); i++) {
+            updateCollisionWithAvatar(_frameParticles.at(_avatarPairs.at(i).first),
+                _frameAvatars.at(_avatarPairs.at(i).second));
+        }
+
+        sendParticlePropertiesUpdates();
         _particles->unlock();
     }
+
+    _lastUpdateTime = usecTimestampNow() - start;
+    _totalUpdateTime += _lastUpdateTime;
+    _updates++;
+}
+
+static bool broadPhaseBoundsLessThan(const BroadPhaseBounds& boundsA, const BroadPhaseBounds& boundsB) {
+    return boundsA.minimum.x < boundsB.minimum.x;
 }
 
+void ParticleCollisionSystem::buildBroadPhase() {
+    _broadPhaseBounds.resize(0);
+    _particlePairs.resize(0);
+    _avatarPairs.resize(0);
+    _frameAvatars.resize(0);
+
+    for (int i = 0; i < _frameParticles.size(); i++) {
+        const Particle* particle = _frameParticles.at(i);
+        glm::vec3 extent(particle->getRadius());
+        BroadPhaseBounds bounds = { particle->getPosition() - extent, particle->getPosition() + extent, i };
+        _broadPhaseBounds.append(bounds);
+    }
+
+    if (_avatars) {
+        foreach (const AvatarSharedPointer& avatarPointer, _avatars->getAvatarHash()) {
+            // use a very generous bounding radius since the arms can stretch
+            AvatarData* avatar = avatarPointer.data();
+            glm::vec3 extent(2.0f * avatar->getBoundingRadius() / (float)TREE_SCALE);
+            glm::vec3 center = avatar->getPosition() / (float)TREE_SCALE;
+            BroadPhaseBounds bounds = { center - extent, center + extent, -1 - _frameAvatars.size() };
+            _broadPhaseBounds.append(bounds);
+            _frameAvatars.append(avatar);
+        }
+    }
+
+    // sweep along x, keeping the bounds that are still open at each start point active
+    std::sort(_broadPhaseBounds.begin(), _broadPhaseBounds.end(), broadPhaseBoundsLessThan);
+    _activeBounds.resize(0);
+    for (int i = 0; i < _broadPhaseBounds.size(); i++) {
+        const BroadPhaseBounds& bounds = _broadPhaseBounds.at(i);
+        for (int j = 0; j < _activeBounds.size(); ) {
+            const BroadPhaseBounds& active = _broadPhaseBounds.at(_activeBounds.at(j));
+            if (active.maximum.x < bounds.minimum.x) {
+                // it ends before we start, and so it does before everything after us
+                _activeBounds[j] = _activeBounds.last();
+                _activeBounds.pop_back();
+                continue;
+            }
+            j++;
 
-void ParticleCollisionSystem::checkParticle(Particle* particle) {
-    updateCollisionWithVoxels(particle);
-    updateCollisionWithParticles(particle);
-    updateCollisionWithAvatars(particle);
+            bool overlaps = active.minimum.y <= bounds.maximum.y && bounds.minimum.y <= active.maximum.y &&
+                active.minimum.z <= bounds.maximum.z && bounds.minimum.z <= active.maximum.z;
+            if (!overlaps || (active.index < 0 && bounds.index < 0)) {
+                continue;
+            }
+            if (active.index >= 0 && bounds.index >= 0) {
+                _particlePairs.append(qMakePair(qMin(active.index, bounds.index), qMax(active.index, bounds.index)));
+                continue;
+            }
+            int particleIndex = qMax(active.index, bounds.index);
+            int avatarIndex = -1 - qMin(active.index, bounds.index);
+
+            // particles that are in hand, don't collide with avatars
+            if (!_frameParticles.at(particleIndex)->getInHand()) {
+                _avatarPairs.append(qMakePair(particleIndex, avatarIndex));
+            }
+        }
+        _activeBounds.append(i);
+    }
 }
 
 void ParticleCollisionSystem::emitGlobalParticleCollisionWithVoxel(Particle* particle, 
@@ -97,10 +183,12 @@ void ParticleCollisionSystem::updateCollisionWithVoxels(Particle* particle) {
     collisionInfo._damping = DAMPING;
     collisionInfo._elasticity = ELASTICITY;
     VoxelDetail* voxelDetails = NULL;
-    if (_voxels->findSpherePenetration(center, radius, collisionInfo._penetration, (void**)&voxelDetails)) {
+    if (_voxels && _voxels->findSpherePenetration(center, radius, collisionInfo._penetration, (void**)&voxelDetails)) {
 
         // let the particles run their collision scripts if they have them
-        particle->collisionWithVoxel(voxelDetails, collisionInfo._penetration);
+        if (!particle->getScript().isEmpty()) {
+            _particles->getScriptRuntime()->runCollisionWithVoxel(particle, *voxelDetails, collisionInfo._penetration);
+        }
 
         // findSpherePenetration() only computes the penetration but we also want some other collision info
         // so we compute it ourselves here.  Note that we must multiply scale by TREE_SCALE when feeding 
@@ -120,23 +208,30 @@ void ParticleCollisionSystem::updateCollisionWithVoxels(Particle* particle) {
     }
 }
 
-void ParticleCollisionSystem::updateCollisionWithParticles(Particle* particleA) {
-    glm::vec3 center = particleA->getPosition() * (float)(TREE_SCALE);
-    float radius = particleA->getRadius() * (float)(TREE_SCALE);
+void ParticleCollisionSystem::updateCollisionWithParticle(Particle* particleA, Particle* particleB) {
     //const float ELASTICITY = 0.4f;
     //const float DAMPING = 0.0f;
     const float COLLISION_FREQUENCY = 0.5f;
-    glm::vec3 penetration;
-    Particle* particleB;
-    if (_particles->findSpherePenetration(center, radius, penetration, (void**)&particleB, Octree::NoLock)) {
+
+    // We've considered making "inHand" particles not collide, if we want to do that,
+    // we should skip the pair here... but now, we do allow inHand particles to collide
+    SphereShape sphereA(particleA->getRadius(), particleA->getPosition());
+    SphereShape sphereB(particleB->getRadius(), particleB->getPosition());
+    _collisions.clear();
+    if (ShapeCollider::sphereSphere(&sphereA, &sphereB, _collisions)) {
         // NOTE: 'penetration' is the depth that 'particleA' overlaps 'particleB'.  It points from A into B.
+        glm::vec3 penetration = _collisions.getCollision(0)->_penetration;
 
         // Even if the particles overlap... when the particles are already moving appart
         // we don't want to count this as a collision.
         glm::vec3 relativeVelocity = particleA->getVelocity() - particleB->getVelocity();
         if (glm::dot(relativeVelocity, penetration) > 0.0f) {
-            particleA->collisionWithParticle(particleB, penetration);
-            particleB->collisionWithParticle(particleA, penetration * -1.0f); // the penetration is reversed
+            // let the particles run their collision scripts if they have them
+            if (!particleA->getScript().isEmpty() || !particleB->getScript().isEmpty()) {
+                ParticleScriptRuntime* scriptRuntime = _particles->getScriptRuntime();
+                scriptRuntime->runCollisionWithParticle(particleA, particleB, penetration);
+                scriptRuntime->runCollisionWithParticle(particleB, particleA, penetration * -1.0f); // the penetration is reversed
+            }
 
             CollisionInfo collision;
             collision._penetration = penetration;
@@ -157,24 +252,12 @@ void ParticleCollisionSystem::updateCollisionWithParticles(Particle* particleA)
             // handle particle A
             particleA->setVelocity(particleA->getVelocity() - axialVelocity * (2.0f * massB / totalMass));
             particleA->setPosition(particleA->getPosition() - 0.5f * penetration);
-            ParticleProperties propertiesA;
-            ParticleID idA(particleA->getID());
-            propertiesA.copyFromParticle(*particleA);
-            propertiesA.setVelocity(particleA->getVelocity() * (float)TREE_SCALE);
-            propertiesA.setPosition(particleA->getPosition() * (float)TREE_SCALE);
-            _packetSender->queueParticleEditMessage(PacketTypeParticleAddOrEdit, idA, propertiesA);
+            queueParticlePropertiesUpdate(particleA);
 
             // handle particle B
             particleB->setVelocity(particleB->getVelocity() + axialVelocity * (2.0f * massA / totalMass));
-            particleA->setPosition(particleB->getPosition() + 0.5f * penetration);
-            ParticleProperties propertiesB;
-            ParticleID idB(particleB->getID());
-            propertiesB.copyFromParticle(*particleB);
-            propertiesB.setVelocity(particleB->getVelocity() * (float)TREE_SCALE);
-            propertiesB.setPosition(particleB->getPosition() * (float)TREE_SCALE);
-            _packetSender->queueParticleEditMessage(PacketTypeParticleAddOrEdit, idB, propertiesB);
-
-            _packetSender->releaseQueuedMessages();
+            particleB->setPosition(particleB->getPosition() + 0.5f * penetration);
+            queueParticlePropertiesUpdate(particleB);
 
             updateCollisionSound(particleA, penetration, COLLISION_FREQUENCY);
         }
@@ -185,12 +268,7 @@ void ParticleCollisionSystem::updateCollisionWithParticles(Particle* particleA)
 const float MIN_EXPECTED_FRAME_PERIOD = 0.0167f;  // 1/60th of a second
 const float HALTING_SPEED = 9.8 * MIN_EXPECTED_FRAME_PERIOD / (float)(TREE_SCALE);
 
-void ParticleCollisionSystem::updateCollisionWithAvatars(Particle* particle) {
-    // particles that are in hand, don't collide with avatars
-    if (!_avatars || particle->getInHand()) {
-        return;
-    }
-
+void ParticleCollisionSystem::updateCollisionWithAvatar(Particle* particle, AvatarData* avatar) {
     glm::vec3 center = particle->getPosition() * (float)(TREE_SCALE);
     float radius = particle->getRadius() * (float)(TREE_SCALE);
     const float ELASTICITY = 0.9f;
@@ -198,68 +276,81 @@ void ParticleCollisionSystem::updateCollisionWithAvatars(Particle* particle) {
     const float COLLISION_FREQUENCY = 0.5f;
     glm::vec3 penetration;
 
-    _collisions.clear();
-    foreach (const AvatarSharedPointer& avatarPointer, _avatars->getAvatarHash()) {
-        AvatarData* avatar = avatarPointer.data();
-
-        // use a very generous bounding radius since the arms can stretch
-        float totalRadius = 2.f * avatar->getBoundingRadius() + radius;
-        glm::vec3 relativePosition = center - avatar->getPosition();
-        if (glm::dot(relativePosition, relativePosition) > (totalRadius * totalRadius)) {
-            continue;
-        }
+    // the broad phase only checked the bounds of the avatar's generous bounding sphere, so check the sphere itself
+    float totalRadius = 2.f * avatar->getBoundingRadius() + radius;
+    glm::vec3 relativePosition = center - avatar->getPosition();
+    if (glm::dot(relativePosition, relativePosition) > (totalRadius * totalRadius)) {
+        return;
+    }
 
-        if (avatar->findParticleCollisions(center, radius, _collisions)) {
-            int numCollisions = _collisions.size();
-            for (int i = 0; i < numCollisions; ++i) {
-                CollisionInfo* collision = _collisions.getCollision(i);
-                collision->_damping = DAMPING;
-                collision->_elasticity = ELASTICITY;
-    
-                collision->_addedVelocity /= (float)(TREE_SCALE);
-                glm::vec3 relativeVelocity = collision->_addedVelocity - particle->getVelocity();
-    
-                if (glm::dot(relativeVelocity, collision->_penetration) <= 0.f) {
-                    // only collide when particle and collision point are moving toward each other
-                    // (doing this prevents some "collision snagging" when particle penetrates the object)
-    
-                    // HACK BEGIN: to allow paddle hands to "hold" particles we attenuate soft collisions against them.
-                    if (collision->_type == PADDLE_HAND_COLLISION) {
-                        // NOTE: the physics are wrong (particles cannot roll) but it IS possible to catch a slow moving particle.
-                        // TODO: make this less hacky when we have more per-collision details
-                        float elasticity = ELASTICITY;
-                        float attenuationFactor = glm::length(collision->_addedVelocity) / HALTING_SPEED;
-                        float damping = DAMPING;
-                        if (attenuationFactor < 1.f) {
-                            collision->_addedVelocity *= attenuationFactor;
-                            elasticity *= attenuationFactor;
-                            // NOTE: the math below keeps the damping piecewise continuous,
-                            // while ramping it up to 1 when attenuationFactor = 0
-                            damping = DAMPING + (1.f - attenuationFactor) * (1.f - DAMPING);
-                        }
-                        collision->_damping = damping;
+    _collisions.clear();
+    if (avatar->findParticleCollisions(center, radius, _collisions)) {
+        int numCollisions = _collisions.size();
+        for (int i = 0; i < numCollisions; ++i) {
+            CollisionInfo* collision = _collisions.getCollision(i);
+            collision->_damping = DAMPING;
+            collision->_elasticity = ELASTICITY;
+
+            collision->_addedVelocity /= (float)(TREE_SCALE);
+            glm::vec3 relativeVelocity = collision->_addedVelocity - particle->getVelocity();
+
+            if (glm::dot(relativeVelocity, collision->_penetration) <= 0.f) {
+                // only collide when particle and collision point are moving toward each other
+                // (doing this prevents some "collision snagging" when particle penetrates the object)
+
+                // HACK BEGIN: to allow paddle hands to "hold" particles we attenuate soft collisions against them.
+                if (collision->_type == PADDLE_HAND_COLLISION) {
+                    // NOTE: the physics are wrong (particles cannot roll) but it IS possible to catch a slow moving particle.
+                    // TODO: make this less hacky when we have more per-collision details
+                    float elasticity = ELASTICITY;
+                    float attenuationFactor = glm::length(collision->_addedVelocity) / HALTING_SPEED;
+                    float damping = DAMPING;
+                    if (attenuationFactor < 1.f) {
+                        collision->_addedVelocity *= attenuationFactor;
+                        elasticity *= attenuationFactor;
+                        // NOTE: the math below keeps the damping piecewise continuous,
+                        // while ramping it up to 1 when attenuationFactor = 0
+                        damping = DAMPING + (1.f - attenuationFactor) * (1.f - DAMPING);
                     }
-                    // HACK END
-    
-                    updateCollisionSound(particle, collision->_penetration, COLLISION_FREQUENCY);
-                    collision->_penetration /= (float)(TREE_SCALE);
-                    particle->applyHardCollision(*collision);
-                    queueParticlePropertiesUpdate(particle);
+                    collision->_damping = damping;
                 }
+                // HACK END
+
+                updateCollisionSound(particle, collision->_penetration, COLLISION_FREQUENCY);
+                collision->_penetration /= (float)(TREE_SCALE);
+                particle->applyHardCollision(*collision);
+                queueParticlePropertiesUpdate(particle);
             }
         }
     }
 }
 
 void ParticleCollisionSystem::queueParticlePropertiesUpdate(Particle* particle) {
-    // queue the result for sending to the particle server
-    ParticleProperties properties;
-    ParticleID particleID(particle->getID());
-    properties.copyFromParticle(*particle);
-
-    properties.setPosition(particle->getPosition() * (float)TREE_SCALE);
-    properties.setVelocity(particle->getVelocity() * (float)TREE_SCALE);
-    _packetSender->queueParticleEditMessage(PacketTypeParticleAddOrEdit, particleID, properties);
+    // a particle can collide several times in one update, only its final state needs to be sent
+    if (!_updatedParticleSet.contains(particle)) {
+        _updatedParticleSet.insert(particle);
+        _updatedParticles.append(particle);
+    }
+}
+
+void ParticleCollisionSystem::sendParticlePropertiesUpdates() {
+    if (_packetSender) {
+        // queue the results for sending to the particle server, packed into as few packets as they fit in
+        foreach (Particle* particle, _updatedParticles) {
+            ParticleProperties properties;
+            ParticleID particleID(particle->getID());
+            properties.copyFromParticle(*particle);
+
+            properties.setPosition(particle->getPosition() * (float)TREE_SCALE);
+            properties.setVelocity(particle->getVelocity() * (float)TREE_SCALE);
+            _packetSender->queueParticleEditMessage(PacketTypeParticleAddOrEdit, particleID, properties);
+        }
+        if (!_updatedParticles.isEmpty()) {
+            _packetSender->releaseQueuedMessages();
+        }
+    }
+    _updatedParticles.resize(0);
+    _updatedParticleSet.clear();
 }
 
 
@@ -288,7 +379,7 @@ void ParticleCollisionSystem::updateCollisionSound(Particle* particle, const glm
     // (sometimes the average penetration of a bunch of voxels is a zero length vector which cannot be normalized) 
     // however the check below will fail (NaN comparisons always fail) and everything will be fine.
 
-    if (normalSpeed > AUDIBLE_COLLISION_THRESHOLD) {
+    if (_audio && normalSpeed > AUDIBLE_COLLISION_THRESHOLD) {
         //  Volume is proportional to collision velocity
         //  Base frequency is modified upward by the angle of the collision
         //  Noise is a function of the angle of collision
@@ -17,6 +17,9 @@
 
 #include <QtScript/QScriptEngine>
 #include <QtCore/QObject>
+#include <QtCore/QPair>
+#include <QtCore/QSet>
+#include <QtCore/QVector>
 
 #include <AvatarHashMap.h>
 #include <CollisionInfo.h>
@@ -33,6 +36,14 @@ class VoxelTree;
 
 const glm::vec3 NO_ADDED_VELOCITY = glm::vec3(0);
 
+/// The bounds of a particle, or of the generous bounding sphere of an avatar, for the broad phase
+class BroadPhaseBounds {
+public:
+    glm::vec3 minimum;
+    glm::vec3 maximum;
+    int index; // of the particle, or -1 minus the index of the avatar
+};
+
 class ParticleCollisionSystem : public QObject {
 Q_OBJECT
 public:
@@ -45,21 +56,35 @@ public:
                                 
     ~ParticleCollisionSystem();
 
+    /// Rebuilds the broad phase from the current particles and avatars, resolves the collisions among the candidate pairs
+    /// it yields and sends the edits to the particles that collided in one batch.
     void update();
 
-    void checkParticle(Particle* particle);
     void updateCollisionWithVoxels(Particle* particle);
-    void updateCollisionWithParticles(Particle* particle);
-    void updateCollisionWithAvatars(Particle* particle);
+    void updateCollisionWithParticle(Particle* particleA, Particle* particleB);
+    void updateCollisionWithAvatar(Particle* particle, AvatarData* avatar);
+
+    /// Marks the particle to have its properties sent to the particle server once this update is done.
     void queueParticlePropertiesUpdate(Particle* particle);
     void updateCollisionSound(Particle* particle, const glm::vec3 &penetration, float frequency);
 
+    int getCandidateParticlePairCount() const { return _particlePairs.size(); }
+    int getCandidateAvatarPairCount() const { return _avatarPairs.size(); }
+
+    quint64 getLastUpdateTime() const { return _lastUpdateTime; }
+    quint64 getAverageUpdateTime() const { return _updates == 0 ? 0 : _totalUpdateTime / _updates; }
+
 signals:
     void particleCollisionWithVoxel(const ParticleID& particleID, const VoxelDetail& voxel, const CollisionInfo& penetration);
     void particleCollisionWithParticle(const ParticleID& idA, const ParticleID& idB, const CollisionInfo& penetration);
 
 private:
-    static bool updateOperation(OctreeElement* element, void* extraData);
+    static bool collectParticlesOperation(OctreeElement* element, void* extraData);
+
+    /// Sweeps the bounds of the particles and avatars along x, keeping the pairs that overlap on all three axes.
+    void buildBroadPhase();
+    void sendParticlePropertiesUpdates();
+
     void emitGlobalParticleCollisionWithVoxel(Particle* particle, VoxelDetail* voxelDetails, const CollisionInfo& penetration);
     void emitGlobalParticleCollisionWithParticle(Particle* particleA, Particle* particleB, const CollisionInfo& penetration);
 
@@ -69,6 +94,20 @@ private:
     AbstractAudioInterface* _audio;
     AvatarHashMap* _avatars;
     CollisionList _collisions;
+
+    QVector<Particle*> _frameParticles;
+    QVector<AvatarData*> _frameAvatars;
+    QVector<BroadPhaseBounds> _broadPhaseBounds;
+    QVector<int> _activeBounds;
+    QVector<QPair<int, int> > _particlePairs;
+    QVector<QPair<int, int> > _avatarPairs;
+
+    QVector<Particle*> _updatedParticles;
+    QSet<Particle*> _updatedParticleSet;
+
+    quint64 _lastUpdateTime;
+    quint64 _totalUpdateTime;
+    quint64 _updates;
 };
 
 #endif // hifi_ParticleCollisionSystem_h
@@ -16,6 +16,16 @@
 #include "ParticleEditPacketSender.h"
 #include "Particle.h"
 
+// more held back edits than this are queued without waiting for the release, a packet won't hold more anyway
+const int MAX_COALESCED_PARTICLE_EDITS = 1000;
+
+ParticleEditPacketSender::ParticleEditPacketSender() :
+    _coalescedEditCount(0),
+    _sentEditCount(0),
+    _sentEditBytes(0),
+    _editStatsStarted(usecTimestampNow())
+{
+}
 
 void ParticleEditPacketSender::sendEditParticleMessage(PacketType type, ParticleID particleID, const ParticleProperties& properties) {
     // allows app to disable sending if for example voxels have been disabled
@@ -28,6 +38,9 @@ void ParticleEditPacketSender::sendEditParticleMessage(PacketType type, Particle
 
     // This encodes the voxel edit message into a buffer...
     if (Particle::encodeParticleEditMessageDetails(type, particleID, properties, &bufferOut[0], _maxPacketSize, sizeOut)){
+        _sentEditCount++;
+        _sentEditBytes += sizeOut;
+
         // If we don't have voxel jurisdictions, then we will simply queue up these packets and wait till we have
         // jurisdictions for processing
         if (!serversExist()) {
@@ -49,12 +62,70 @@ void ParticleEditPacketSender::queueParticleEditMessage(PacketType type, Particl
         return; // bail early
     }
 
+    // new particles all share the same id, so only edits of known particles can be merged
+    if (type != PacketTypeParticleAddOrEdit || particleID.id == NEW_PARTICLE) {
+        QMutexLocker locker(&_coalescedEditsLock);
+        queueEncodedEditMessage(type, particleID, properties);
+        return;
+    }
+
+    QMutexLocker locker(&_coalescedEditsLock);
+    QHash<uint32_t, ParticleProperties>::iterator edit = _coalescedEdits.find(particleID.id);
+    if (edit != _coalescedEdits.end()) {
+        edit.value().merge(properties);
+        _coalescedEditCount++;
+        return;
+    }
+    _coalescedEdits.insert(particleID.id, properties);
+    _coalescedEditOrder.append(particleID.id);
+
+    if (_coalescedEditOrder.size() >= MAX_COALESCED_PARTICLE_EDITS) {
+        queueCoalescedEdits();
+    }
+}
+
+void ParticleEditPacketSender::releaseQueuedMessages() {
+    _coalescedEditsLock.lock();
+    queueCoalescedEdits();
+    _coalescedEditsLock.unlock();
+
+    OctreeEditPacketSender::releaseQueuedMessages();
+}
+
+void ParticleEditPacketSender::queueCoalescedEdits() {
+    // in the order the particles were first edited in
+    foreach (uint32_t particleID, _coalescedEditOrder) {
+        queueEncodedEditMessage(PacketTypeParticleAddOrEdit, ParticleID(particleID), _coalescedEdits.value(particleID));
+    }
+    _coalescedEdits.clear();
+    _coalescedEditOrder.resize(0);
+}
+
+void ParticleEditPacketSender::queueEncodedEditMessage(PacketType type, ParticleID particleID,
+                                                       const ParticleProperties& properties) {
     // use MAX_PACKET_SIZE since it's static and guaranteed to be larger than _maxPacketSize
     static unsigned char bufferOut[MAX_PACKET_SIZE];
     int sizeOut = 0;
 
     if (Particle::encodeParticleEditMessageDetails(type, particleID, properties, &bufferOut[0], _maxPacketSize, sizeOut)) {
+        _sentEditCount++;
+        _sentEditBytes += sizeOut;
         queueOctreeEditMessage(type, bufferOut, sizeOut);
     }
 }
 
+float ParticleEditPacketSender::getAverageBytesPerEdit() const {
+    return _sentEditCount == 0 ? 0.0f : (float)_sentEditBytes / _sentEditCount;
+}
+
+float ParticleEditPacketSender::getEditsPerSecond() const {
+    quint64 elapsed = usecTimestampNow() - _editStatsStarted;
+    return elapsed == 0 ? 0.0f : (float)_sentEditCount * USECS_PER_SECOND / elapsed;
+}
+
+void ParticleEditPacketSender::resetEditStats() {
+    _coalescedEditCount = 0;
+    _sentEditCount = 0;
+    _sentEditBytes = 0;
+    _editStatsStarted = usecTimestampNow();
+}
@@ -12,6 +12,10 @@
 #ifndef hifi_ParticleEditPacketSender_h
 #define hifi_ParticleEditPacketSender_h
 
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
+
 #include <OctreeEditPacketSender.h>
 #include "Particle.h"
 
@@ -19,6 +23,8 @@
 class ParticleEditPacketSender :  public OctreeEditPacketSender {
     Q_OBJECT
 public:
+    ParticleEditPacketSender();
+
     /// Send particle add message immediately
     /// NOTE: ParticleProperties assumes that all distances are in meter units
     void sendEditParticleMessage(PacketType type, ParticleID particleID, const ParticleProperties& properties);
@@ -26,11 +32,36 @@ public:
     /// Queues an array of several voxel edit messages. Will potentially send a pending multi-command packet. Determines
     /// which voxel-server node or nodes the packet should be sent to. Can be called even before voxel servers are known, in
     /// which case up to MaxPendingMessages will be buffered and processed when voxel servers are known.
+    /// Edits of existing particles are held until the queued messages are released, and later edits of the same particle
+    /// are merged into them, so that only one edit per particle goes out per release.
     /// NOTE: ParticleProperties assumes that all distances are in meter units
     void queueParticleEditMessage(PacketType type, ParticleID particleID, const ParticleProperties& properties);
 
+    /// Queues the held back edits before releasing the queued messages.
+    virtual void releaseQueuedMessages();
+
     // My server type is the particle server
     virtual unsigned char getMyNodeType() const { return NodeType::ParticleServer; }
     virtual void adjustEditPacketForClockSkew(unsigned char* codeColorBuffer, ssize_t length, int clockSkew);
+
+    /// number of edits that were merged into an edit of the same particle instead of being sent
+    quint64 getCoalescedEditCount() const { return _coalescedEditCount; }
+    quint64 getSentEditCount() const { return _sentEditCount; }
+    float getAverageBytesPerEdit() const;
+    float getEditsPerSecond() const;
+    void resetEditStats();
+
+private:
+    void queueCoalescedEdits();
+    void queueEncodedEditMessage(PacketType type, ParticleID particleID, const ParticleProperties& properties);
+
+    QMutex _coalescedEditsLock;
+    QHash<uint32_t, ParticleProperties> _coalescedEdits;
+    QVector<uint32_t> _coalescedEditOrder;
+
+    quint64 _coalescedEditCount;
+    quint64 _sentEditCount;
+    quint64 _sentEditBytes;
+    quint64 _editStatsStarted;
 };
 #endif // hifi_ParticleEditPacketSender_h
@@ -0,0 +1,222 @@
+//
+//  ParticleScriptRuntime.cpp
+//  libraries/particles/src
+//
+//  Created by Brad Hefta-Gaub on 5/20/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDebug>
+#include <QtCore/QSet>
+
+#include <SharedUtil.h> // usecTimestampNow()
+#include <VoxelDetail.h>
+
+// see the note in Particle.cpp, we can't link to script-engine without a circular reference
+#include "../../script-engine/src/ScriptEngine.h"
+
+#include "ParticlesScriptingInterface.h"
+#include "Particle.h"
+#include "ParticleScriptRuntime.h"
+
+/// more distinct scripts than this and the ones no particle is running anymore are thrown out
+const int MAX_CACHED_PARTICLE_SCRIPTS = 256;
+
+ParticleScriptRuntime::ParticleScriptRuntime() :
+    _engine(new ScriptEngine()),
+    _compiledScripts(),
+    _bindings(),
+    _compileCacheHits(0),
+    _compileCacheMisses(0),
+    _lastTickScriptTime(0),
+    _totalTickScriptTime(0),
+    _ticks(0)
+{
+    _engine->init();
+}
+
+ParticleScriptRuntime::~ParticleScriptRuntime() {
+    foreach (const ParticleScriptBinding& binding, _bindings) {
+        delete binding.scriptObject;
+    }
+    _bindings.clear();
+    _compiledScripts.clear();
+    delete _engine;
+}
+
+float ParticleScriptRuntime::getCompileCacheHitRate() const {
+    quint64 lookups = _compileCacheHits + _compileCacheMisses;
+    return lookups == 0 ? 0.0f : (float)_compileCacheHits / (float)lookups;
+}
+
+void ParticleScriptRuntime::resetStats() {
+    _compileCacheHits = 0;
+    _compileCacheMisses = 0;
+    _lastTickScriptTime = 0;
+    _totalTickScriptTime = 0;
+    _ticks = 0;
+}
+
+void ParticleScriptRuntime::runUpdateScripts(const QVector<Particle*>& particles) {
+    quint64 start = usecTimestampNow();
+    beginScriptBatch();
+
+    QSet<uint32_t> updatedParticleIDs;
+    foreach (Particle* particle, particles) {
+        ParticleScriptBinding* binding = bindingForParticle(particle);
+        if (binding) {
+            binding->scriptObject->emitUpdate();
+            logUncaughtException("update");
+            updatedParticleIDs.insert(particle->getID());
+        }
+    }
+
+    // particles that weren't part of this tick have died or dropped their scripts
+    QList<uint32_t> scriptedParticleIDs = _bindings.keys();
+    foreach (uint32_t particleID, scriptedParticleIDs) {
+        if (!updatedParticleIDs.contains(particleID)) {
+            removeBinding(particleID);
+        }
+    }
+
+    if (_compiledScripts.size() > MAX_CACHED_PARTICLE_SCRIPTS) {
+        QSet<QByteArray> runningScriptHashes;
+        foreach (const ParticleScriptBinding& binding, _bindings) {
+            runningScriptHashes.insert(binding.scriptHash);
+        }
+        QHash<QByteArray, QScriptValue>::iterator it = _compiledScripts.begin();
+        while (it != _compiledScripts.end()) {
+            if (runningScriptHashes.contains(it.key())) {
+                ++it;
+            } else {
+                it = _compiledScripts.erase(it);
+            }
+        }
+    }
+
+    endScriptBatch();
+
+    if (!particles.isEmpty()) {
+        _lastTickScriptTime = usecTimestampNow() - start;
+        _totalTickScriptTime += _lastTickScriptTime;
+        _ticks++;
+    }
+}
+
+void ParticleScriptRuntime::runCollisionWithParticle(Particle* particle, Particle* other, const glm::vec3& penetration) {
+    if (particle->getScript().isEmpty()) {
+        return;
+    }
+    beginScriptBatch();
+    ParticleScriptBinding* binding = bindingForParticle(particle);
+    if (binding) {
+        ParticleScriptObject otherScriptObject(other);
+        binding->scriptObject->emitCollisionWithParticle(&otherScriptObject, penetration);
+        logUncaughtException("collisionWithParticle");
+    }
+    endScriptBatch();
+}
+
+void ParticleScriptRuntime::runCollisionWithVoxel(Particle* particle, const VoxelDetail& voxelDetails,
+                                                  const glm::vec3& penetration) {
+    if (particle->getScript().isEmpty()) {
+        return;
+    }
+    beginScriptBatch();
+    ParticleScriptBinding* binding = bindingForParticle(particle);
+    if (binding) {
+        binding->scriptObject->emitCollisionWithVoxel(voxelDetails, penetration);
+        logUncaughtException("collisionWithVoxel");
+    }
+    endScriptBatch();
+}
+
+ParticleScriptBinding* ParticleScriptRuntime::bindingForParticle(Particle* particle) {
+    QByteArray scriptHash = QCryptographicHash::hash(particle->getScript().toUtf8(), QCryptographicHash::Md5);
+
+    QHash<uint32_t, ParticleScriptBinding>::iterator it = _bindings.find(particle->getID());
+    if (it != _bindings.end()) {
+        if (it.value().scriptHash == scriptHash) {
+            // particles live by value in their elements, so the one we're bound to may have moved since the last call
+            it.value().scriptObject->setParticle(particle);
+            return &it.value();
+        }
+        // the script was changed out from under the particle, start it over with the new one
+        removeBinding(particle->getID());
+    }
+
+    QScriptValue scriptFunction = compiledScript(scriptHash, particle->getScript());
+    if (!scriptFunction.isFunction()) {
+        return NULL;
+    }
+
+    ParticleScriptBinding binding;
+    binding.scriptHash = scriptHash;
+    binding.scriptObject = new ParticleScriptObject(particle);
+    binding.scriptValue = _engine->getEngine()->newQObject(binding.scriptObject);
+
+    // run the body of the script once against this particle, which is what connects its handlers
+    scriptFunction.call(QScriptValue(), QScriptValueList() << binding.scriptValue);
+    logUncaughtException("setup");
+
+    return &_bindings.insert(particle->getID(), binding).value();
+}
+
+QScriptValue ParticleScriptRuntime::compiledScript(const QByteArray& scriptHash, const QString& script) {
+    QHash<QByteArray, QScriptValue>::const_iterator it = _compiledScripts.constFind(scriptHash);
+    if (it != _compiledScripts.constEnd()) {
+        _compileCacheHits++;
+        return it.value();
+    }
+    _compileCacheMisses++;
+
+    // wrap the script so that "Particle" and whatever the script declares at the top level are local to each particle,
+    // keeping the wrapper on the script's first line so that exception line numbers still match the script
+    QScriptValue scriptFunction = _engine->getEngine()->evaluate("(function (Particle) { " + script + "\n})");
+    if (_engine->getEngine()->hasUncaughtException()) {
+        logUncaughtException("compile");
+        scriptFunction = QScriptValue();
+    }
+
+    // cache failures too, so that a broken script isn't recompiled every tick
+    _compiledScripts.insert(scriptHash, scriptFunction);
+    return scriptFunction;
+}
+
+void ParticleScriptRuntime::removeBinding(uint32_t particleID) {
+    ParticleScriptBinding binding = _bindings.take(particleID);
+
+    // deleting the object disconnects the handlers the script connected to it
+    delete binding.scriptObject;
+}
+
+void ParticleScriptRuntime::beginScriptBatch() {
+    if (Particle::getVoxelEditPacketSender()) {
+        _engine->getVoxelsScriptingInterface()->setPacketSender(Particle::getVoxelEditPacketSender());
+    }
+    if (Particle::getParticleEditPacketSender()) {
+        _engine->getParticlesScriptingInterface()->setPacketSender(Particle::getParticleEditPacketSender());
+    }
+}
+
+void ParticleScriptRuntime::endScriptBatch() {
+    if (Particle::getVoxelEditPacketSender()) {
+        Particle::getVoxelEditPacketSender()->releaseQueuedMessages();
+    }
+    if (Particle::getParticleEditPacketSender()) {
+        Particle::getParticleEditPacketSender()->releaseQueuedMessages();
+    }
+}
+
+void ParticleScriptRuntime::logUncaughtException(const char* when) {
+    QScriptEngine* engine = _engine->getEngine();
+    if (engine->hasUncaughtException()) {
+        qDebug() << "Uncaught exception in particle script" << when << "at line" << engine->uncaughtExceptionLineNumber()
+            << ":" << engine->uncaughtException().toString();
+        engine->clearExceptions();
+    }
+}
@@ -0,0 +1,88 @@
+//
+//  ParticleScriptRuntime.h
+//  libraries/particles/src
+//
+//  Created by Brad Hefta-Gaub on 5/20/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_ParticleScriptRuntime_h
+#define hifi_ParticleScriptRuntime_h
+
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+#include <QtScript/QScriptValue>
+
+class Particle;
+class ParticleScriptObject;
+class ScriptEngine;
+struct VoxelDetail;
+
+/// The script state of a single particle: the object its script sees as "Particle" and the hash of the script that was run
+/// against it, so that the binding can be rebuilt if the script changes.
+class ParticleScriptBinding {
+public:
+    QByteArray scriptHash;
+    ParticleScriptObject* scriptObject;
+    QScriptValue scriptValue;
+};
+
+/// Runs the scripts attached to the particles of a tree in one long-lived script engine. Each distinct script is compiled
+/// once into a function taking the "Particle" object, and that function is run once per particle so that the handlers it
+/// connects (and any variables it declares) persist from tick to tick.
+/// \thread must only be used by the thread that updates the tree, since that's where the script engine lives
+class ParticleScriptRuntime {
+public:
+    ParticleScriptRuntime();
+    ~ParticleScriptRuntime();
+
+    /// Emits update to every particle in the batch. Particles scripted in earlier ticks that aren't in the batch are
+    /// considered gone, and their bindings are dropped.
+    void runUpdateScripts(const QVector<Particle*>& particles);
+
+    void runCollisionWithParticle(Particle* particle, Particle* other, const glm::vec3& penetration);
+    void runCollisionWithVoxel(Particle* particle, const VoxelDetail& voxelDetails, const glm::vec3& penetration);
+
+    quint64 getCompileCacheHits() const { return _compileCacheHits; }
+    quint64 getCompileCacheMisses() const { return _compileCacheMisses; }
+    float getCompileCacheHitRate() const;
+
+    int getCompiledScriptCount() const { return _compiledScripts.size(); }
+    int getScriptedParticleCount() const { return _bindings.size(); }
+
+    quint64 getLastTickScriptTime() const { return _lastTickScriptTime; }
+    quint64 getAverageTickScriptTime() const { return _ticks == 0 ? 0 : _totalTickScriptTime / _ticks; }
+
+    void resetStats();
+
+private:
+    /// \return the binding for the particle, running its script to create one if needed, or NULL if the script doesn't run
+    ParticleScriptBinding* bindingForParticle(Particle* particle);
+    QScriptValue compiledScript(const QByteArray& scriptHash, const QString& script);
+    void removeBinding(uint32_t particleID);
+
+    void beginScriptBatch();
+    void endScriptBatch();
+    void logUncaughtException(const char* when);
+
+    ScriptEngine* _engine;
+    QHash<QByteArray, QScriptValue> _compiledScripts;
+    QHash<uint32_t, ParticleScriptBinding> _bindings;
+
+    quint64 _compileCacheHits;
+    quint64 _compileCacheMisses;
+
+    quint64 _lastTickScriptTime;
+    quint64 _totalTickScriptTime;
+    quint64 _ticks;
+};
+
+#endif // hifi_ParticleScriptRuntime_h
@@ -0,0 +1,227 @@
+//
+//  ParticleSimulation.cpp
+//  libraries/particles/src
+//
+//  Created by Brad Hefta-Gaub on 5/21/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <xmmintrin.h>
+
+#include <QtCore/QRunnable>
+
+#include <AABox.h>
+#include <SharedUtil.h>
+
+#include "Particle.h"
+#include "ParticleSimulation.h"
+
+/// fewer particles than this per thread and it's cheaper to integrate them all on the calling thread
+const int MIN_PARTICLES_PER_INTEGRATOR = 4096;
+
+const int PARTICLES_PER_SIMD_STEP = 4;
+
+class ParticleIntegrator : public QRunnable {
+public:
+    ParticleIntegrator(ParticleSimulation* simulation, int begin, int end) :
+        _simulation(simulation), _begin(begin), _end(end) { }
+
+    virtual void run() { _simulation->integrateRange(_begin, _end); }
+
+private:
+    ParticleSimulation* _simulation;
+    int _begin;
+    int _end;
+};
+
+ParticleSimulation::ParticleSimulation() {
+}
+
+quint64 ParticleSimulation::keyForParticle(const Particle& particle) {
+    return ((quint64)particle.getCreatorTokenID() << 32) | particle.getID();
+}
+
+void ParticleSimulation::clear() {
+    // resize rather than clear, so that the arrays keep their memory from tick to tick
+    _particles.resize(0);
+    _elements.resize(0);
+    _particleKeys.resize(0);
+    _lastUpdated.resize(0);
+    _lastEdited.resize(0);
+    _timeElapsed.resize(0);
+    _positionX.resize(0);
+    _positionY.resize(0);
+    _positionZ.resize(0);
+    _velocityX.resize(0);
+    _velocityY.resize(0);
+    _velocityZ.resize(0);
+    _gravityX.resize(0);
+    _gravityY.resize(0);
+    _gravityZ.resize(0);
+    _damping.resize(0);
+    _elementCornerX.resize(0);
+    _elementCornerY.resize(0);
+    _elementCornerZ.resize(0);
+    _elementScale.resize(0);
+    _hasLeftElement.resize(0);
+}
+
+void ParticleSimulation::addParticle(Particle* particle, ParticleTreeElement* element, const AABox& elementBox) {
+    _particles.append(particle);
+    _elements.append(element);
+    _particleKeys.append(keyForParticle(*particle));
+    _lastUpdated.append(particle->getLastUpdated());
+    _lastEdited.append(particle->getLastEdited());
+
+    // the time elapsed is filled in by integrate(), once we know what time we're integrating to
+    _timeElapsed.append(particle->getInHand() ? 0.0f : 1.0f);
+
+    const glm::vec3& position = particle->getPosition();
+    _positionX.append(position.x);
+    _positionY.append(position.y);
+    _positionZ.append(position.z);
+
+    const glm::vec3& velocity = particle->getVelocity();
+    _velocityX.append(velocity.x);
+    _velocityY.append(velocity.y);
+    _velocityZ.append(velocity.z);
+
+    const glm::vec3& gravity = particle->getGravity();
+    _gravityX.append(gravity.x);
+    _gravityY.append(gravity.y);
+    _gravityZ.append(gravity.z);
+
+    _damping.append(particle->getDamping());
+
+    const glm::vec3& corner = elementBox.getCorner();
+    _elementCornerX.append(corner.x);
+    _elementCornerY.append(corner.y);
+    _elementCornerZ.append(corner.z);
+    _elementScale.append(elementBox.getScale());
+    _hasLeftElement.append(false);
+}
+
+void ParticleSimulation::integrate(quint64 now) {
+    int particleCount = _particles.size();
+    for (int i = 0; i < particleCount; i++) {
+        // particles in hand don't move, and were given no time to move in
+        if (_timeElapsed[i] != 0.0f) {
+            _timeElapsed[i] = (float)(now - _lastUpdated[i]) / (float)USECS_PER_SECOND;
+        }
+    }
+
+    int integratorCount = qMin(particleCount / MIN_PARTICLES_PER_INTEGRATOR, _workerPool.maxThreadCount());
+    if (integratorCount <= 1) {
+        integrateRange(0, particleCount);
+        return;
+    }
+
+    // keep the ranges a multiple of the SIMD width so that only the last one has a scalar tail
+    int particlesPerIntegrator = (particleCount / integratorCount) & ~(PARTICLES_PER_SIMD_STEP - 1);
+    for (int i = 0; i < integratorCount - 1; i++) {
+        _workerPool.start(new ParticleIntegrator(this, i * particlesPerIntegrator, (i + 1) * particlesPerIntegrator));
+    }
+    integrateRange((integratorCount - 1) * particlesPerIntegrator, particleCount);
+    _workerPool.waitForDone();
+}
+
+void ParticleSimulation::integrateRange(int begin, int end) {
+    float* timeElapsed = _timeElapsed.data();
+    float* positionX = _positionX.data();
+    float* positionY = _positionY.data();
+    float* positionZ = _positionZ.data();
+    float* velocityX = _velocityX.data();
+    float* velocityY = _velocityY.data();
+    float* velocityZ = _velocityZ.data();
+    const float* gravityX = _gravityX.constData();
+    const float* gravityY = _gravityY.constData();
+    const float* gravityZ = _gravityZ.constData();
+    const float* damping = _damping.constData();
+
+    // this is the same integration as Particle::update(), four particles at a time
+    const __m128 ZERO = _mm_setzero_ps();
+    const __m128 SIGN_BIT = _mm_set1_ps(-0.0f);
+    int i = begin;
+    for (; i + PARTICLES_PER_SIMD_STEP <= end; i += PARTICLES_PER_SIMD_STEP) {
+        __m128 dt = _mm_loadu_ps(timeElapsed + i);
+        __m128 vx = _mm_loadu_ps(velocityX + i);
+        __m128 vy = _mm_loadu_ps(velocityY + i);
+        __m128 vz = _mm_loadu_ps(velocityZ + i);
+        __m128 px = _mm_add_ps(_mm_loadu_ps(positionX + i), _mm_mul_ps(vx, dt));
+        __m128 py = _mm_add_ps(_mm_loadu_ps(positionY + i), _mm_mul_ps(vy, dt));
+        __m128 pz = _mm_add_ps(_mm_loadu_ps(positionZ + i), _mm_mul_ps(vz, dt));
+
+        // handle bounces off the ground, for the particles that moved
+        __m128 bounced = _mm_and_ps(_mm_cmple_ps(py, ZERO), _mm_cmpgt_ps(dt, ZERO));
+        vy = _mm_xor_ps(vy, _mm_and_ps(bounced, SIGN_BIT));
+        py = _mm_andnot_ps(bounced, py);
+
+        // handle gravity
+        vx = _mm_add_ps(vx, _mm_mul_ps(_mm_loadu_ps(gravityX + i), dt));
+        vy = _mm_add_ps(vy, _mm_mul_ps(_mm_loadu_ps(gravityY + i), dt));
+        vz = _mm_add_ps(vz, _mm_mul_ps(_mm_loadu_ps(gravityZ + i), dt));
+
+        // handle damping
+        __m128 d = _mm_loadu_ps(damping + i);
+        vx = _mm_sub_ps(vx, _mm_mul_ps(_mm_mul_ps(vx, d), dt));
+        vy = _mm_sub_ps(vy, _mm_mul_ps(_mm_mul_ps(vy, d), dt));
+        vz = _mm_sub_ps(vz, _mm_mul_ps(_mm_mul_ps(vz, d), dt));
+
+        _mm_storeu_ps(positionX + i, px);
+        _mm_storeu_ps(positionY + i, py);
+        _mm_storeu_ps(positionZ + i, pz);
+        _mm_storeu_ps(velocityX + i, vx);
+        _mm_storeu_ps(velocityY + i, vy);
+        _mm_storeu_ps(velocityZ + i, vz);
+    }
+    for (; i < end; i++) {
+        float dt = timeElapsed[i];
+        positionX[i] += velocityX[i] * dt;
+        positionY[i] += velocityY[i] * dt;
+        positionZ[i] += velocityZ[i] * dt;
+
+        if (positionY[i] <= 0.0f && dt > 0.0f) {
+            velocityY[i] = -velocityY[i];
+            positionY[i] = 0.0f;
+        }
+
+        velocityX[i] += gravityX[i] * dt;
+        velocityY[i] += gravityY[i] * dt;
+        velocityZ[i] += gravityZ[i] * dt;
+
+        velocityX[i] -= (velocityX[i] * damping[i]) * dt;
+        velocityY[i] -= (velocityY[i] * damping[i]) * dt;
+        velocityZ[i] -= (velocityZ[i] * damping[i]) * dt;
+    }
+
+    // now that everyone has moved, see who has left their element and needs to be re-bucketed
+    const float* elementCornerX = _elementCornerX.constData();
+    const float* elementCornerY = _elementCornerY.constData();
+    const float* elementCornerZ = _elementCornerZ.constData();
+    const float* elementScale = _elementScale.constData();
+    bool* hasLeftElement = _hasLeftElement.data();
+    for (i = begin; i < end; i++) {
+        float scale = elementScale[i];
+        float x = positionX[i] - elementCornerX[i];
+        float y = positionY[i] - elementCornerY[i];
+        float z = positionZ[i] - elementCornerZ[i];
+        hasLeftElement[i] = !(x >= 0.0f && x <= scale && y >= 0.0f && y <= scale && z >= 0.0f && z <= scale);
+    }
+}
+
+void ParticleSimulation::commitParticle(int index, quint64 now) {
+    commitParticleTo(index, *_particles[index], now);
+}
+
+bool ParticleSimulation::commitParticleTo(int index, Particle& particle, quint64 now) {
+    if (particle.getLastUpdated() != _lastUpdated[index] || particle.getLastEdited() != _lastEdited[index]) {
+        return false;
+    }
+    particle.setPosition(glm::vec3(_positionX[index], _positionY[index], _positionZ[index]));
+    particle.setVelocity(glm::vec3(_velocityX[index], _velocityY[index], _velocityZ[index]));
+    particle.setLastUpdated(now);
+    return true;
+}
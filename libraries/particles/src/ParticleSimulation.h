@@ -0,0 +1,94 @@
+//
+//  ParticleSimulation.h
+//  libraries/particles/src
+//
+//  Created by Brad Hefta-Gaub on 5/21/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_ParticleSimulation_h
+#define hifi_ParticleSimulation_h
+
+#include <stdint.h>
+
+#include <QtCore/QThreadPool>
+#include <QtCore/QVector>
+
+class AABox;
+class Particle;
+class ParticleTreeElement;
+
+/// The physics stage of a particle tree update. The hot physics state of the particles (position, velocity, gravity and
+/// damping) is copied out of the tree into structure-of-arrays form, so that it can be integrated four particles at a time
+/// across worker threads without holding the tree lock, and then written back.
+class ParticleSimulation {
+public:
+    ParticleSimulation();
+
+    void clear();
+
+    /// Copies the physics state of a particle in.
+    /// \thread caller must hold the tree lock
+    void addParticle(Particle* particle, ParticleTreeElement* element, const AABox& elementBox);
+
+    int getParticleCount() const { return _particles.size(); }
+
+    /// Advances every particle added since the last clear() to the given time.
+    /// \thread doesn't touch the tree, so it can run without the tree lock
+    void integrate(quint64 now);
+
+    /// Writes the integrated state of a particle back to it.
+    /// \thread caller must hold the tree lock, and the particle must still be where it was when it was added
+    void commitParticle(int index, quint64 now);
+
+    /// Writes the integrated state to the particle given, for when the one that was added may have been moved or replaced.
+    /// \return false if the particle has been updated or edited since it was added, in which case it was left alone
+    bool commitParticleTo(int index, Particle& particle, quint64 now);
+
+    Particle* getParticle(int index) const { return _particles.at(index); }
+    ParticleTreeElement* getElement(int index) const { return _elements.at(index); }
+    quint64 getParticleKey(int index) const { return _particleKeys.at(index); }
+
+    /// Particles created locally share an ID until the server assigns them theirs, so they're told apart by their creator
+    /// token ID as well.
+    static quint64 keyForParticle(const Particle& particle);
+
+    /// \return whether the integrated position of the particle is outside the element it was in
+    bool hasLeftElement(int index) const { return _hasLeftElement.at(index); }
+
+    /// Integrates a range of particles, for the worker threads.
+    void integrateRange(int begin, int end);
+
+private:
+    QVector<Particle*> _particles;
+    QVector<ParticleTreeElement*> _elements;
+    QVector<quint64> _particleKeys;
+    QVector<quint64> _lastUpdated;
+    QVector<quint64> _lastEdited;
+
+    QVector<float> _timeElapsed; // zero for particles that are in hand and don't move
+    QVector<float> _positionX;
+    QVector<float> _positionY;
+    QVector<float> _positionZ;
+    QVector<float> _velocityX;
+    QVector<float> _velocityY;
+    QVector<float> _velocityZ;
+    QVector<float> _gravityX;
+    QVector<float> _gravityY;
+    QVector<float> _gravityZ;
+    QVector<float> _damping;
+
+    // the bounds of each particle's element, to tell which ones have to be moved to another
+    QVector<float> _elementCornerX;
+    QVector<float> _elementCornerY;
+    QVector<float> _elementCornerZ;
+    QVector<float> _elementScale;
+    QVector<bool> _hasLeftElement;
+
+    QThreadPool _workerPool;
+};
+
+#endif // hifi_ParticleSimulation_h
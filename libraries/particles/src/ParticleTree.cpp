@@ -11,10 +11,28 @@
 
 #include "ParticleTree.h"
 
-ParticleTree::ParticleTree(bool shouldReaverage) : Octree(shouldReaverage) {
+ParticleTree::ParticleTree(bool shouldReaverage) :
+    Octree(shouldReaverage),
+    _scriptRuntime(NULL),
+    _particleEditCount(0),
+    _staleParticleEditCount(0),
+    _particleEditBytes(0),
+    _particleEditStatsStarted(usecTimestampNow())
+{
     _rootNode = createNewElement();
 }
 
+ParticleTree::~ParticleTree() {
+    delete _scriptRuntime;
+}
+
+ParticleScriptRuntime* ParticleTree::getScriptRuntime() {
+    if (!_scriptRuntime) {
+        _scriptRuntime = new ParticleScriptRuntime();
+    }
+    return _scriptRuntime;
+}
+
 ParticleTreeElement* ParticleTree::createNewElement(unsigned char * octalCode) {
     ParticleTreeElement* newElement = new ParticleTreeElement(octalCode);
     newElement->setTree(this);
@@ -372,6 +390,24 @@ bool ParticleTree::findByIDOperation(OctreeElement* element, void* extraData) {
 }
 
 
+class FindForEditArgs {
+public:
+    uint32_t id;
+    Particle* foundParticle;
+    ParticleTreeElement* foundElement;
+};
+
+bool ParticleTree::findForEditOperation(OctreeElement* element, void* extraData) {
+    FindForEditArgs* args = static_cast<FindForEditArgs*>(extraData);
+    ParticleTreeElement* particleTreeElement = static_cast<ParticleTreeElement*>(element);
+    args->foundParticle = particleTreeElement->getParticleWithID(args->id);
+    if (args->foundParticle) {
+        args->foundElement = particleTreeElement;
+        return false; // stop searching
+    }
+    return true;
+}
+
 const Particle* ParticleTree::findParticleByID(uint32_t id, bool alreadyLocked) {
     FindByIDArgs args = { id, false, NULL };
 
@@ -393,6 +429,34 @@ int ParticleTree::processEditPacketData(PacketType packetType, const unsigned ch
     // we handle these types of "edit" packets
     switch (packetType) {
         case PacketTypeParticleAddOrEdit: {
+            uint32_t editID = Particle::editPacketParticleID(editData);
+            if (editID != NEW_PARTICLE) {
+                // edits of existing particles are read straight into the particle, where it is in the tree
+                FindForEditArgs args = { editID, NULL, NULL };
+                recurseTreeWithOperation(findForEditOperation, &args);
+
+                bool applied = false;
+                if (args.foundParticle) {
+                    processedBytes = args.foundParticle->readEditPacket(editData, maxLength, applied);
+                } else {
+                    // the user attempted to edit a particle that doesn't exist, read past it
+                    qDebug() << "user attempted to edit a particle that doesn't exist...";
+                    Particle missingParticle(ParticleID(UNKNOWN_PARTICLE_ID), ParticleProperties());
+                    processedBytes = missingParticle.readEditPacket(editData, maxLength, applied);
+                    applied = false;
+                }
+
+                if (applied) {
+                    args.foundElement->markWithChangedTime();
+                    _isDirty = true;
+                } else {
+                    _staleParticleEditCount++;
+                }
+                _particleEditCount++;
+                _particleEditBytes += processedBytes;
+                break;
+            }
+
             bool isValid;
             Particle newParticle = Particle::fromEditPacket(editData, maxLength, processedBytes, this, isValid);
             if (isValid) {
@@ -416,6 +480,15 @@ int ParticleTree::processEditPacketData(PacketType packetType, const unsigned ch
     return processedBytes;
 }
 
+float ParticleTree::getAverageBytesPerParticleEdit() const {
+    return _particleEditCount == 0 ? 0.0f : (float)_particleEditBytes / _particleEditCount;
+}
+
+float ParticleTree::getParticleEditsPerSecond() const {
+    quint64 elapsed = usecTimestampNow() - _particleEditStatsStarted;
+    return elapsed == 0 ? 0.0f : (float)_particleEditCount * USECS_PER_SECOND / elapsed;
+}
+
 void ParticleTree::notifyNewlyCreatedParticle(const Particle& newParticle, const SharedNodePointer& senderNode) {
     _newlyCreatedHooksLock.lockForRead();
     for (size_t i = 0; i < _newlyCreatedHooks.size(); i++) {
@@ -442,10 +515,17 @@ void ParticleTree::removeNewlyCreatedHook(NewlyCreatedParticleHook* hook) {
 }
 
 
-bool ParticleTree::updateOperation(OctreeElement* element, void* extraData) {
+bool ParticleTree::prepareUpdateOperation(OctreeElement* element, void* extraData) {
     ParticleTreeUpdateArgs* args = static_cast<ParticleTreeUpdateArgs*>(extraData);
     ParticleTreeElement* particleTreeElement = static_cast<ParticleTreeElement*>(element);
-    particleTreeElement->update(*args);
+    particleTreeElement->prepareUpdate(*args);
+    return true;
+}
+
+bool ParticleTree::commitSimulationOperation(OctreeElement* element, void* extraData) {
+    ParticleTreeCommitArgs* args = static_cast<ParticleTreeCommitArgs*>(extraData);
+    ParticleTreeElement* particleTreeElement = static_cast<ParticleTreeElement*>(element);
+    particleTreeElement->commitSimulation(*args);
     return true;
 }
 
@@ -461,29 +541,62 @@ bool ParticleTree::pruneOperation(OctreeElement* element, void* extraData) {
 }
 
 void ParticleTree::update() {
+    lockForWrite();
+    ParticleTreeUpdateArgs args;
+
+    // run all of the update scripts in one batch, while nothing has moved the particles they point to
+    recurseTreeWithOperation(prepareUpdateOperation, &args);
+    if (!args._scriptedParticles.isEmpty() || _scriptRuntime) {
+        getScriptRuntime()->runUpdateScripts(args._scriptedParticles);
+    }
+
+    // then copy out the physics state the scripts left behind
+    _simulation.clear();
+    int particleCount = args._particles.size();
+    for (int i = 0; i < particleCount; i++) {
+        _simulation.addParticle(args._particles[i], args._elements[i], args._elements[i]->getAABox());
+    }
+    quint32 gatheredWriteLockCount = getWriteLockCount();
+    unlock();
+
+    // the physics doesn't touch the tree, so edits and queries can go ahead while it runs
+    quint64 now = usecTimestampNow();
+    _simulation.integrate(now);
+
     lockForWrite();
     _isDirty = true;
 
-    ParticleTreeUpdateArgs args = { };
-    recurseTreeWithOperation(updateOperation, &args);
+    QList<Particle> movingParticles;
+    if (getWriteLockCount() == gatheredWriteLockCount + 1) {
+        // nobody else has written to the tree since we let go of it, so every particle is right where we left it
+        for (int i = 0; i < particleCount; i++) {
+            _simulation.commitParticle(i, now);
 
-    // now add back any of the particles that moved elements....
-    int movingParticles = args._movingParticles.size();
-    for (int i = 0; i < movingParticles; i++) {
-        bool shouldDie = args._movingParticles[i].getShouldDie();
-
-        // if the particle is still inside our total bounds, then re-add it
-        AABox treeBounds = getRoot()->getAABox();
-
-        if (!shouldDie && treeBounds.contains(args._movingParticles[i].getPosition())) {
-            storeParticle(args._movingParticles[i]);
-        } else {
-            uint32_t particleID = args._movingParticles[i].getID();
-            quint64 deletedAt = usecTimestampNow();
-            _recentlyDeletedParticlesLock.lockForWrite();
-            _recentlyDeletedParticleIDs.insert(deletedAt, particleID);
-            _recentlyDeletedParticlesLock.unlock();
+            // If the particle wants to die, or if it's left its element, then take it out.
+            // These will be added back or deleted completely
+            Particle* particle = _simulation.getParticle(i);
+            if (particle->getShouldDie() || _simulation.hasLeftElement(i)) {
+                movingParticles.push_back(*particle);
+
+                // QList keeps particles this large out of line, so removing one leaves the others where they are
+                _simulation.getElement(i)->removeParticle(particle);
+            }
         }
+    } else {
+        // the tree was changed while we were simulating, so the particles have to be looked up again
+        ParticleTreeCommitArgs commitArgs;
+        commitArgs._simulation = &_simulation;
+        commitArgs._now = now;
+        for (int i = 0; i < particleCount; i++) {
+            commitArgs._simulationIndices.insert(_simulation.getParticleKey(i), i);
+        }
+        recurseTreeWithOperation(commitSimulationOperation, &commitArgs);
+        movingParticles = commitArgs._movingParticles;
+    }
+
+    // now add back any of the particles that moved elements....
+    foreach (const Particle& particle, movingParticles) {
+        restoreMovingParticle(particle);
     }
 
     // prune the tree...
@@ -491,6 +604,25 @@ void ParticleTree::update() {
     unlock();
 }
 
+void ParticleTree::restoreMovingParticle(const Particle& particle) {
+    // if the particle is still inside our total bounds, then re-add it
+    AABox treeBounds = getRoot()->getAABox();
+
+    if (!particle.getShouldDie() && treeBounds.contains(particle.getPosition())) {
+        // we just took it out of the tree, so there's no need to look for it before storing it
+        glm::vec3 position = particle.getPosition();
+        float size = std::max(MINIMUM_PARTICLE_ELEMENT_SIZE, particle.getRadius());
+        ParticleTreeElement* element = (ParticleTreeElement*)getOrCreateChildElementAt(position.x, position.y, position.z, size);
+        element->storeParticle(particle);
+    } else {
+        uint32_t particleID = particle.getID();
+        quint64 deletedAt = usecTimestampNow();
+        _recentlyDeletedParticlesLock.lockForWrite();
+        _recentlyDeletedParticleIDs.insert(deletedAt, particleID);
+        _recentlyDeletedParticlesLock.unlock();
+    }
+}
+
 
 bool ParticleTree::hasParticlesDeletedSince(quint64 sinceTime) {
     // we can probably leverage the ordered nature of QMultiMap to do this quickly...
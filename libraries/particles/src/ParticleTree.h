@@ -13,6 +13,8 @@
 #define hifi_ParticleTree_h
 
 #include <Octree.h>
+#include "ParticleScriptRuntime.h"
+#include "ParticleSimulation.h"
 #include "ParticleTreeElement.h"
 
 class NewlyCreatedParticleHook {
@@ -24,6 +26,7 @@ class ParticleTree : public Octree {
     Q_OBJECT
 public:
     ParticleTree(bool shouldReaverage = false);
+    virtual ~ParticleTree();
 
     /// Implements our type specific root element factory
     virtual ParticleTreeElement* createNewElement(unsigned char * octalCode = NULL);
@@ -73,26 +76,53 @@ public:
     void processEraseMessage(const QByteArray& dataByteArray, const SharedNodePointer& sourceNode);
     void handleAddParticleResponse(const QByteArray& packet);
 
+    /// The runtime the scripts of our particles run in, created on first use by the thread that updates the tree.
+    ParticleScriptRuntime* getScriptRuntime();
+
+    /// \return the script runtime, or NULL if no particle script has run yet
+    const ParticleScriptRuntime* getExistingScriptRuntime() const { return _scriptRuntime; }
+
+    /// number of edit messages for existing particles that have been processed, including stale ones
+    quint64 getParticleEditCount() const { return _particleEditCount; }
+
+    /// number of edit messages that were older than the particle they edited and were ignored
+    quint64 getStaleParticleEditCount() const { return _staleParticleEditCount; }
+    float getAverageBytesPerParticleEdit() const;
+    float getParticleEditsPerSecond() const;
+
 private:
 
-    static bool updateOperation(OctreeElement* element, void* extraData);
+    static bool prepareUpdateOperation(OctreeElement* element, void* extraData);
+    static bool commitSimulationOperation(OctreeElement* element, void* extraData);
     static bool findAndUpdateOperation(OctreeElement* element, void* extraData);
     static bool findAndUpdateWithIDandPropertiesOperation(OctreeElement* element, void* extraData);
     static bool findNearPointOperation(OctreeElement* element, void* extraData);
     static bool findInSphereOperation(OctreeElement* element, void* extraData);
     static bool pruneOperation(OctreeElement* element, void* extraData);
     static bool findByIDOperation(OctreeElement* element, void* extraData);
+    static bool findForEditOperation(OctreeElement* element, void* extraData);
     static bool findAndDeleteOperation(OctreeElement* element, void* extraData);
     static bool findAndUpdateParticleIDOperation(OctreeElement* element, void* extraData);
 
     void notifyNewlyCreatedParticle(const Particle& newParticle, const SharedNodePointer& senderNode);
 
+    /// Puts a particle that was just taken out of the tree back in, or forgets it if it died or left the tree.
+    void restoreMovingParticle(const Particle& particle);
+
     QReadWriteLock _newlyCreatedHooksLock;
     std::vector<NewlyCreatedParticleHook*> _newlyCreatedHooks;
 
 
     QReadWriteLock _recentlyDeletedParticlesLock;
     QMultiMap<quint64, uint32_t> _recentlyDeletedParticleIDs;
+
+    ParticleScriptRuntime* _scriptRuntime;
+    ParticleSimulation _simulation;
+
+    quint64 _particleEditCount;
+    quint64 _staleParticleEditCount;
+    quint64 _particleEditBytes;
+    quint64 _particleEditStatsStarted;
 };
 
 #endif // hifi_ParticleTree_h
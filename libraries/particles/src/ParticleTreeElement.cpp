@@ -66,15 +66,37 @@ bool ParticleTreeElement::appendElementData(OctreePacketData* packetData) const
     return success;
 }
 
-void ParticleTreeElement::update(ParticleTreeUpdateArgs& args) {
+void ParticleTreeElement::prepareUpdate(ParticleTreeUpdateArgs& args) {
+    if (_particles->isEmpty()) {
+        return;
+    }
     markWithChangedTime();
-    // TODO: early exit when _particles is empty
 
-    // update our contained particles
     QList<Particle>::iterator particleItr = _particles->begin();
     while(particleItr != _particles->end()) {
         Particle& particle = (*particleItr);
-        particle.update(_lastChanged);
+        particle.updateShouldDie();
+        if (!particle.getScript().isEmpty()) {
+            args._scriptedParticles.push_back(&particle);
+        }
+        args._particles.push_back(&particle);
+        args._elements.push_back(this);
+        ++particleItr;
+    }
+}
+
+void ParticleTreeElement::commitSimulation(ParticleTreeCommitArgs& args) {
+    QList<Particle>::iterator particleItr = _particles->begin();
+    while(particleItr != _particles->end()) {
+        Particle& particle = (*particleItr);
+        QHash<quint64, int>::const_iterator index =
+            args._simulationIndices.constFind(ParticleSimulation::keyForParticle(particle));
+        if (index == args._simulationIndices.constEnd()
+                || !args._simulation->commitParticleTo(index.value(), particle, args._now)) {
+            // this one is new or was edited while the simulation ran, it will be simulated next time around
+            ++particleItr;
+            continue;
+        }
 
         // If the particle wants to die, or if it's left our bounding box, then move it
         // into the arguments moving particles. These will be added back or deleted completely
@@ -87,10 +109,6 @@ void ParticleTreeElement::update(ParticleTreeUpdateArgs& args) {
             ++particleItr;
         }
     }
-    // TODO: if _particles is empty after while loop consider freeing memory in _particles if
-    // internal array is too big (QList internal array does not decrease size except in dtor and
-    // assignment operator).  Otherwise _particles could become a "resource leak" for large
-    // roaming piles of particles.
 }
 
 bool ParticleTreeElement::findSpherePenetration(const glm::vec3& center, float radius,
@@ -275,6 +293,16 @@ const Particle* ParticleTreeElement::getParticleWithID(uint32_t id) const {
     return foundParticle;
 }
 
+Particle* ParticleTreeElement::getParticleWithID(uint32_t id) {
+    uint16_t numberOfParticles = _particles->size();
+    for (uint16_t i = 0; i < numberOfParticles; i++) {
+        if ((*_particles)[i].getID() == id) {
+            return &(*_particles)[i];
+        }
+    }
+    return NULL;
+}
+
 bool ParticleTreeElement::removeParticleWithID(uint32_t id) {
     bool foundParticle = false;
     uint16_t numberOfParticles = _particles->size();
@@ -288,6 +316,17 @@ bool ParticleTreeElement::removeParticleWithID(uint32_t id) {
     return foundParticle;
 }
 
+bool ParticleTreeElement::removeParticle(const Particle* particle) {
+    uint16_t numberOfParticles = _particles->size();
+    for (uint16_t i = 0; i < numberOfParticles; i++) {
+        if (&(*_particles)[i] == particle) {
+            _particles->removeAt(i);
+            return true;
+        }
+    }
+    return false;
+}
+
 int ParticleTreeElement::readElementDataFromBuffer(const unsigned char* data, int bytesLeftToRead,
             ReadBitstreamToTreeParams& args) {
 
@@ -15,9 +15,12 @@
 //#include <vector>
 
 #include <OctreeElement.h>
+#include <QHash>
 #include <QList>
+#include <QVector>
 
 #include "Particle.h"
+#include "ParticleSimulation.h"
 #include "ParticleTree.h"
 
 class ParticleTree;
@@ -25,6 +28,17 @@ class ParticleTreeElement;
 
 class ParticleTreeUpdateArgs {
 public:
+    QVector<Particle*> _scriptedParticles;
+    QVector<Particle*> _particles;
+    QVector<ParticleTreeElement*> _elements;
+};
+
+/// Used to write the simulation results back when the tree changed while the simulation was running
+class ParticleTreeCommitArgs {
+public:
+    ParticleSimulation* _simulation;
+    QHash<quint64, int> _simulationIndices;
+    quint64 _now;
     QList<Particle> _movingParticles;
 };
 
@@ -96,7 +110,13 @@ public:
     QList<Particle>& getParticles() { return *_particles; }
     bool hasParticles() const { return _particles->size() > 0; }
 
-    void update(ParticleTreeUpdateArgs& args);
+    /// Sets the default shouldDie state of our particles and collects them for the tree, which runs the update scripts of
+    /// the ones that have them in one batch and then simulates them all
+    void prepareUpdate(ParticleTreeUpdateArgs& args);
+
+    /// Looks our particles up in the simulation by ID and writes back the results for any that haven't been touched since
+    /// it started. Particles that should die or have left our bounds are moved into the arguments.
+    void commitSimulation(ParticleTreeCommitArgs& args);
     void setTree(ParticleTree* tree) { _myTree = tree; }
 
     bool updateParticle(const Particle& particle);
@@ -117,9 +137,13 @@ public:
     void getParticlesForUpdate(const AABox& box, QVector<Particle*>& foundParticles);
 
     const Particle* getParticleWithID(uint32_t id) const;
+    Particle* getParticleWithID(uint32_t id);
 
     bool removeParticleWithID(uint32_t id);
 
+    /// removes the particle stored at the given address
+    bool removeParticle(const Particle* particle);
+
 protected:
     virtual void init(unsigned char * octalCode);
 
@@ -77,6 +77,9 @@ public:
 
     bool hasScript() const { return !_scriptContents.isEmpty(); }
 
+    /// Access the underlying engine, for hosts like the particle script runtime that evaluate their own code in it
+    QScriptEngine* getEngine() { return &_engine; }
+
 public slots:
     void stop();
 
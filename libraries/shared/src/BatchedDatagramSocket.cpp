@@ -0,0 +1,217 @@
+//
+//  BatchedDatagramSocket.cpp
+//  libraries/shared/src
+//
+//  Created by Stephen Birarda on 5/14/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <cstring>
+
+#include <QtCore/QtGlobal>
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include <QtCore/QDebug>
+
+#include "SharedUtil.h"
+
+#include "BatchedDatagramSocket.h"
+
+#ifdef Q_OS_LINUX
+
+struct DatagramBatch {
+    char buffers[DATAGRAM_BATCH_SIZE][MAX_PACKET_SIZE];
+    sockaddr_in addresses[DATAGRAM_BATCH_SIZE];
+    iovec vectors[DATAGRAM_BATCH_SIZE];
+    mmsghdr messages[DATAGRAM_BATCH_SIZE];
+
+    DatagramBatch() {
+        memset(messages, 0, sizeof(messages));
+        for (int i = 0; i < DATAGRAM_BATCH_SIZE; i++) {
+            vectors[i].iov_base = buffers[i];
+            vectors[i].iov_len = MAX_PACKET_SIZE;
+            messages[i].msg_hdr.msg_name = &addresses[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+};
+
+BatchedDatagramSocket::BatchedDatagramSocket(QUdpSocket& socket) :
+    _socket(socket),
+    _isEnabled(true),
+    _receiveBatch(new DatagramBatch()),
+    _numReceivedDatagrams(0),
+    _nextReceivedIndex(0),
+    _sendBatch(new DatagramBatch()),
+    _numQueuedDatagrams(0)
+{
+
+}
+
+BatchedDatagramSocket::~BatchedDatagramSocket() {
+    delete _receiveBatch;
+    delete _sendBatch;
+}
+
+int BatchedDatagramSocket::receiveBatch() {
+    if (!_isEnabled) {
+        return 0;
+    }
+
+    // the message headers are reused, so reset the lengths the last call wrote back into them
+    for (int i = 0; i < DATAGRAM_BATCH_SIZE; i++) {
+        _receiveBatch->vectors[i].iov_len = MAX_PACKET_SIZE;
+        _receiveBatch->messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    }
+
+    int numReceived = recvmmsg(_socket.socketDescriptor(), _receiveBatch->messages, DATAGRAM_BATCH_SIZE,
+                               MSG_DONTWAIT, NULL);
+
+    if (numReceived < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            qDebug() << "recvmmsg failed with error" << errno << "- falling back to unbatched socket reads.";
+            _isEnabled = false;
+        }
+        numReceived = 0;
+    }
+
+    _numReceivedDatagrams = numReceived;
+    _nextReceivedIndex = 0;
+
+    return numReceived;
+}
+
+bool BatchedDatagramSocket::takeBufferedDatagram(QByteArray& destinationByteArray, HifiSockAddr& senderSockAddr) {
+    if (!hasBufferedDatagrams()) {
+        return false;
+    }
+
+    int index = _nextReceivedIndex++;
+    const mmsghdr& message = _receiveBatch->messages[index];
+    const sockaddr_in& senderAddress = _receiveBatch->addresses[index];
+
+    destinationByteArray.resize(message.msg_len);
+    memcpy(destinationByteArray.data(), _receiveBatch->buffers[index], message.msg_len);
+
+    senderSockAddr.setAddress(QHostAddress(ntohl(senderAddress.sin_addr.s_addr)));
+    senderSockAddr.setPort(ntohs(senderAddress.sin_port));
+
+    return true;
+}
+
+char* BatchedDatagramSocket::nextSendSlot() {
+    if (!_isEnabled || _numQueuedDatagrams == DATAGRAM_BATCH_SIZE) {
+        return NULL;
+    }
+    return _sendBatch->buffers[_numQueuedDatagrams];
+}
+
+void BatchedDatagramSocket::commitSendSlot(int size, const HifiSockAddr& destinationSockAddr) {
+    int index = _numQueuedDatagrams++;
+
+    sockaddr_in& destinationAddress = _sendBatch->addresses[index];
+    destinationAddress.sin_family = AF_INET;
+    destinationAddress.sin_addr.s_addr = htonl(destinationSockAddr.getAddress().toIPv4Address());
+    destinationAddress.sin_port = htons(destinationSockAddr.getPort());
+
+    _sendBatch->vectors[index].iov_len = size;
+}
+
+int BatchedDatagramSocket::flushQueuedDatagrams() {
+    int numSyscalls = 0;
+    int numSent = 0;
+
+    while (numSent < _numQueuedDatagrams) {
+        int result = sendmmsg(_socket.socketDescriptor(), _sendBatch->messages + numSent, _numQueuedDatagrams - numSent, 0);
+        ++numSyscalls;
+
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) {
+                // the kernel won't take batched sends at all, so the rest of this batch (and everything after it)
+                // goes through the QUdpSocket
+                qDebug() << "sendmmsg failed with error" << errno << "- falling back to unbatched socket writes.";
+                _isEnabled = false;
+                break;
+            }
+
+            // the failure belongs to the first datagram in the remaining run (EMSGSIZE, say), drop just that one
+            qDebug() << "ERROR in sendmmsg:" << errno;
+            ++numSent;
+        } else {
+            numSent += result;
+        }
+    }
+
+    for (; numSent < _numQueuedDatagrams; numSent++) {
+        const sockaddr_in& destinationAddress = _sendBatch->addresses[numSent];
+        _socket.writeDatagram(_sendBatch->buffers[numSent], _sendBatch->vectors[numSent].iov_len,
+                              QHostAddress(ntohl(destinationAddress.sin_addr.s_addr)), ntohs(destinationAddress.sin_port));
+        ++numSyscalls;
+    }
+
+    _numQueuedDatagrams = 0;
+
+    return numSyscalls;
+}
+
+#else
+
+struct DatagramBatch {
+};
+
+BatchedDatagramSocket::BatchedDatagramSocket(QUdpSocket& socket) :
+    _socket(socket),
+    _isEnabled(false),
+    _receiveBatch(NULL),
+    _numReceivedDatagrams(0),
+    _nextReceivedIndex(0),
+    _sendBatch(NULL),
+    _numQueuedDatagrams(0)
+{
+
+}
+
+BatchedDatagramSocket::~BatchedDatagramSocket() {
+
+}
+
+int BatchedDatagramSocket::receiveBatch() {
+    return 0;
+}
+
+bool BatchedDatagramSocket::takeBufferedDatagram(QByteArray& destinationByteArray, HifiSockAddr& senderSockAddr) {
+    return false;
+}
+
+char* BatchedDatagramSocket::nextSendSlot() {
+    return NULL;
+}
+
+void BatchedDatagramSocket::commitSendSlot(int size, const HifiSockAddr& destinationSockAddr) {
+
+}
+
+int BatchedDatagramSocket::flushQueuedDatagrams() {
+    return 0;
+}
+
+#endif
+
+bool BatchedDatagramSocket::hasBufferedDatagrams() const {
+    return _nextReceivedIndex < _numReceivedDatagrams;
+}
@@ -0,0 +1,72 @@
+//
+//  BatchedDatagramSocket.h
+//  libraries/shared/src
+//
+//  Created by Stephen Birarda on 5/14/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Moves many datagrams per syscall (recvmmsg/sendmmsg) on the descriptor of a bound QUdpSocket.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_BatchedDatagramSocket_h
+#define hifi_BatchedDatagramSocket_h
+
+#include <QtCore/QByteArray>
+#include <QtNetwork/QUdpSocket>
+
+#include "HifiSockAddr.h"
+
+const int DATAGRAM_BATCH_SIZE = 64;
+
+struct DatagramBatch;
+
+/// Batched receive and send for the descriptor of a bound QUdpSocket. Only available on Linux - everywhere else, or once
+/// the kernel has rejected a batched call, isEnabled() returns false and callers should go through the QUdpSocket.
+class BatchedDatagramSocket {
+public:
+    BatchedDatagramSocket(QUdpSocket& socket);
+    ~BatchedDatagramSocket();
+
+    bool isEnabled() const { return _isEnabled; }
+
+    /// Pulls as many as DATAGRAM_BATCH_SIZE datagrams off the socket in a single non-blocking call.
+    /// \return the number of datagrams received, zero if none were waiting or batching is unavailable
+    int receiveBatch();
+
+    bool hasBufferedDatagrams() const;
+
+    /// Copies the oldest datagram from the last received batch into destinationByteArray.
+    /// \return false if there was no buffered datagram left
+    bool takeBufferedDatagram(QByteArray& destinationByteArray, HifiSockAddr& senderSockAddr);
+
+    /// Returns the next free send slot, which has room for MAX_PACKET_SIZE bytes. Callers fill it and then call
+    /// commitSendSlot. Queueing and flushing are not thread-safe and should happen on the thread that owns the socket.
+    /// \return NULL if batching is unavailable or the batch is full and needs to be flushed first
+    char* nextSendSlot();
+    void commitSendSlot(int size, const HifiSockAddr& destinationSockAddr);
+
+    int getNumQueuedDatagrams() const { return _numQueuedDatagrams; }
+
+    /// Sends every queued datagram with as few sendmmsg calls as the kernel allows.
+    /// \return the number of syscalls made
+    int flushQueuedDatagrams();
+
+private:
+    BatchedDatagramSocket(const BatchedDatagramSocket&); // not copyable
+    void operator=(const BatchedDatagramSocket&);
+
+    QUdpSocket& _socket;
+    bool _isEnabled;
+
+    DatagramBatch* _receiveBatch;
+    int _numReceivedDatagrams;
+    int _nextReceivedIndex;
+
+    DatagramBatch* _sendBatch;
+    int _numQueuedDatagrams;
+};
+
+#endif // hifi_BatchedDatagramSocket_h
@@ -0,0 +1,317 @@
+//
+//  BoundedMPSCQueue.h
+//  libraries/shared/src
+//
+//  Created by Brad Hefta-Gaub on 5/16/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Lock-free multi-producer single-consumer ring used to hand packets between threads.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_BoundedMPSCQueue_h
+#define hifi_BoundedMPSCQueue_h
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
+#include <QtCore/QWaitCondition>
+
+#include "Log2Histogram.h"
+#include "SharedUtil.h"
+
+const int DEFAULT_MPSC_QUEUE_CAPACITY = 4096;
+const int DEFAULT_MPSC_OVERFLOW_CAPACITY = 4 * DEFAULT_MPSC_QUEUE_CAPACITY;
+
+/// Bounded ring (after Dmitry Vyukov's bounded queue) that any number of threads can enqueue into without taking a lock,
+/// drained by a single consumer thread. If the ring ever fills, producers spill into a locked overflow list rather than
+/// block, so callers that produce and consume on the same thread can't deadlock. Once anything has spilled, producers
+/// keep spilling until the consumer takes over the overflow, which it does only when every cell claimed in the ring has
+/// been published and drained, so each producer's items come out in the order it put them in. The overflow is capped too,
+/// so a stalled consumer can't grow memory without limit: once it's full, new items are dropped and counted. The consumer
+/// records the queue depth and the time each item spent queued.
+template<typename T> class BoundedMPSCQueue {
+public:
+    BoundedMPSCQueue(int capacity = DEFAULT_MPSC_QUEUE_CAPACITY, int overflowCapacity = DEFAULT_MPSC_OVERFLOW_CAPACITY);
+    ~BoundedMPSCQueue();
+
+    /// \return false if both the ring and the overflow were full, in which case the value was dropped
+    /// \thread any thread
+    bool enqueue(const T& value);
+
+    /// \thread consumer thread only
+    bool tryDequeue(T& value);
+
+    /// Spins briefly, then yields, then parks until a producer enqueues or maxParkMsecs pass.
+    /// \return true if there is something to dequeue
+    /// \thread consumer thread only
+    bool waitForItems(unsigned long maxParkMsecs);
+
+    /// Wakes a parked consumer, for instance so that it can notice it is being terminated.
+    void wakeConsumer();
+
+    /// Approximate number of queued items, safe to call from any thread.
+    int size() const;
+    bool isEmpty() const { return size() == 0; }
+
+    /// Returns a snapshot of the depth histogram, safe to call from any thread.
+    Log2Histogram getDepthHistogram() const;
+    
+    /// Returns a snapshot of the wait time histogram, safe to call from any thread.
+    Log2Histogram getWaitTimeHistogram() const;
+    
+    void resetHistograms();
+
+    /// Returns the number of items dropped because the overflow was full, safe to call from any thread.
+    int getDroppedCount() const { return _droppedCount.load(); }
+
+private:
+    BoundedMPSCQueue(const BoundedMPSCQueue&); // not copyable
+    void operator=(const BoundedMPSCQueue&);
+
+    class Entry {
+    public:
+        Entry() : enqueueTime(0) { }
+        Entry(const T& value, quint64 enqueueTime) : value(value), enqueueTime(enqueueTime) { }
+        T value;
+        quint64 enqueueTime;
+    };
+
+    class Cell {
+    public:
+        QAtomicInt sequence;
+        Entry entry;
+    };
+
+    bool tryEnqueueInRing(const T& value, quint64 enqueueTime);
+    bool tryDequeueFromRing(Entry& entry);
+    bool isRingDrained() const;
+    bool hasItemForConsumer() const;
+    void recordDequeue(const Entry& entry);
+
+    Cell* _cells;
+    unsigned int _mask;
+    QAtomicInt _enqueuePosition;
+    QAtomicInt _dequeuePosition;
+
+    QMutex _overflowMutex;
+    QVector<Entry> _overflow;
+    QAtomicInt _overflowSize;
+    int _overflowCapacity;
+    QAtomicInt _droppedCount;
+    QVector<Entry> _drainingOverflow;
+    int _drainingOverflowIndex;
+    QAtomicInt _drainingOverflowRemaining;
+
+    QMutex _parkMutex;
+    QWaitCondition _itemsAvailable;
+    QAtomicInt _isConsumerParked;
+
+    // the consumer holds this only for the moment it takes to record a sample, so it is uncontended but for stats reads
+    mutable QMutex _histogramMutex;
+    Log2Histogram _depthHistogram;
+    Log2Histogram _waitTimeHistogram;
+};
+
+template<typename T> inline BoundedMPSCQueue<T>::BoundedMPSCQueue(int capacity, int overflowCapacity) :
+    _enqueuePosition(0),
+    _dequeuePosition(0),
+    _overflowSize(0),
+    _overflowCapacity(overflowCapacity),
+    _droppedCount(0),
+    _drainingOverflowIndex(0),
+    _drainingOverflowRemaining(0),
+    _isConsumerParked(0) {
+
+    // round the capacity up to a power of two so that positions can be masked into cells
+    unsigned int ringSize = 2;
+    while (ringSize < (unsigned int)capacity) {
+        ringSize <<= 1;
+    }
+    _mask = ringSize - 1;
+    _cells = new Cell[ringSize];
+    for (unsigned int i = 0; i < ringSize; i++) {
+        _cells[i].sequence.store(i);
+    }
+}
+
+template<typename T> inline BoundedMPSCQueue<T>::~BoundedMPSCQueue() {
+    delete[] _cells;
+}
+
+template<typename T> inline bool BoundedMPSCQueue<T>::enqueue(const T& value) {
+    quint64 enqueueTime = usecTimestampNow();
+
+    // once anything has spilled, keep spilling until the consumer catches up so that ordering is preserved
+    if (_overflowSize.loadAcquire() > 0 || !tryEnqueueInRing(value, enqueueTime)) {
+        QMutexLocker locker(&_overflowMutex);
+        if (_overflow.size() >= _overflowCapacity) {
+            locker.unlock();
+            _droppedCount.fetchAndAddRelaxed(1);
+            return false;
+        }
+        _overflow.append(Entry(value, enqueueTime));
+        _overflowSize.storeRelease(_overflow.size());
+    }
+
+    // the ordered read pairs with the consumer's ordered write before it parks, so one of us always sees the other
+    if (_isConsumerParked.fetchAndAddOrdered(0)) {
+        QMutexLocker locker(&_parkMutex);
+        _itemsAvailable.wakeAll();
+    }
+    return true;
+}
+
+template<typename T> inline bool BoundedMPSCQueue<T>::tryEnqueueInRing(const T& value, quint64 enqueueTime) {
+    unsigned int position = _enqueuePosition.load();
+    Cell* cell;
+    forever {
+        cell = &_cells[position & _mask];
+        unsigned int sequence = cell->sequence.loadAcquire();
+        int difference = (int)(sequence - position);
+        if (difference == 0) {
+            // the cell is free, try to claim it
+            if (_enqueuePosition.testAndSetRelaxed(position, position + 1)) {
+                break;
+            }
+            position = _enqueuePosition.load();
+
+        } else if (difference < 0) {
+            // the consumer hasn't freed this cell yet, so the ring is full
+            return false;
+
+        } else {
+            // another producer claimed this cell first
+            position = _enqueuePosition.load();
+        }
+    }
+    cell->entry.value = value;
+    cell->entry.enqueueTime = enqueueTime;
+    cell->sequence.storeRelease(position + 1);
+    return true;
+}
+
+template<typename T> inline bool BoundedMPSCQueue<T>::tryDequeueFromRing(Entry& entry) {
+    unsigned int position = _dequeuePosition.load();
+    Cell& cell = _cells[position & _mask];
+    if (cell.sequence.loadAcquire() != position + 1) {
+        return false;
+    }
+    entry = cell.entry;
+
+    // drop the cell's references so the consumer ends up holding the only copy
+    cell.entry = Entry();
+    cell.sequence.storeRelease(position + _mask + 1);
+    _dequeuePosition.storeRelease(position + 1);
+    return true;
+}
+
+template<typename T> inline bool BoundedMPSCQueue<T>::tryDequeue(T& value) {
+    Entry entry;
+    if (_drainingOverflowIndex < _drainingOverflow.size()) {
+        // finish what we took from the overflow before anything its producers have since put in the ring
+        entry = _drainingOverflow[_drainingOverflowIndex];
+        _drainingOverflow[_drainingOverflowIndex++] = Entry();
+        _drainingOverflowRemaining.fetchAndAddRelease(-1);
+
+    } else if (!tryDequeueFromRing(entry)) {
+        // a cell claimed but not yet published may hold an item queued before the spill by a producer whose later items
+        // are in the overflow, so we can't take over the overflow until the ring has been drained of every claimed cell
+        if (_overflowSize.loadAcquire() == 0 || !isRingDrained()) {
+            return false;
+        }
+        // the ring has been emptied of everything queued before the spill, so take over the overflow
+        QMutexLocker locker(&_overflowMutex);
+        _drainingOverflow.resize(0);
+        _drainingOverflow.swap(_overflow);
+        _drainingOverflowIndex = 0;
+        _drainingOverflowRemaining.storeRelease(_drainingOverflow.size() - 1);
+        _overflowSize.storeRelease(0);
+        locker.unlock();
+
+        entry = _drainingOverflow[_drainingOverflowIndex];
+        _drainingOverflow[_drainingOverflowIndex++] = Entry();
+    }
+
+    recordDequeue(entry);
+    value = entry.value;
+    return true;
+}
+
+template<typename T> inline void BoundedMPSCQueue<T>::recordDequeue(const Entry& entry) {
+    int depth = size() + 1;
+    quint64 waitTime = usecTimestampNow() - entry.enqueueTime;
+    
+    QMutexLocker locker(&_histogramMutex);
+    _depthHistogram.addSample(depth);
+    _waitTimeHistogram.addSample(waitTime);
+}
+
+template<typename T> inline bool BoundedMPSCQueue<T>::isRingDrained() const {
+    return (unsigned int)_dequeuePosition.load() == (unsigned int)_enqueuePosition.load();
+}
+
+template<typename T> inline bool BoundedMPSCQueue<T>::hasItemForConsumer() const {
+    unsigned int position = _dequeuePosition.load();
+    return _drainingOverflowIndex < _drainingOverflow.size()
+        || _cells[position & _mask].sequence.loadAcquire() == position + 1
+        || (_overflowSize.loadAcquire() > 0 && isRingDrained());
+}
+
+template<typename T> inline bool BoundedMPSCQueue<T>::waitForItems(unsigned long maxParkMsecs) {
+    const int SPIN_ITERATIONS = 64;
+    for (int i = 0; i < SPIN_ITERATIONS; i++) {
+        if (hasItemForConsumer()) {
+            return true;
+        }
+    }
+
+    const int YIELD_ITERATIONS = 8;
+    for (int i = 0; i < YIELD_ITERATIONS; i++) {
+        QThread::yieldCurrentThread();
+        if (hasItemForConsumer()) {
+            return true;
+        }
+    }
+
+    QMutexLocker locker(&_parkMutex);
+    _isConsumerParked.fetchAndStoreOrdered(1);
+    if (!hasItemForConsumer()) {
+        _itemsAvailable.wait(&_parkMutex, maxParkMsecs);
+    }
+    _isConsumerParked.fetchAndStoreOrdered(0);
+
+    return hasItemForConsumer();
+}
+
+template<typename T> inline void BoundedMPSCQueue<T>::wakeConsumer() {
+    QMutexLocker locker(&_parkMutex);
+    _itemsAvailable.wakeAll();
+}
+
+template<typename T> inline int BoundedMPSCQueue<T>::size() const {
+    unsigned int queuedInRing = (unsigned int)_enqueuePosition.load() - (unsigned int)_dequeuePosition.load();
+    return (int)queuedInRing + _overflowSize.load() + _drainingOverflowRemaining.load();
+}
+
+template<typename T> inline Log2Histogram BoundedMPSCQueue<T>::getDepthHistogram() const {
+    QMutexLocker locker(&_histogramMutex);
+    return _depthHistogram;
+}
+
+template<typename T> inline Log2Histogram BoundedMPSCQueue<T>::getWaitTimeHistogram() const {
+    QMutexLocker locker(&_histogramMutex);
+    return _waitTimeHistogram;
+}
+
+template<typename T> inline void BoundedMPSCQueue<T>::resetHistograms() {
+    QMutexLocker locker(&_histogramMutex);
+    _depthHistogram.reset();
+    _waitTimeHistogram.reset();
+}
+
+#endif // hifi_BoundedMPSCQueue_h
@@ -0,0 +1,70 @@
+//
+//  Log2Histogram.cpp
+//  libraries/shared/src
+//
+//  Created by Brad Hefta-Gaub on 5/16/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <cstring>
+
+#include "Log2Histogram.h"
+
+Log2Histogram::Log2Histogram() {
+    reset();
+}
+
+void Log2Histogram::addSample(quint64 sample) {
+    int bucket = 0;
+    for (quint64 remaining = sample; remaining > 0 && bucket < NUM_BUCKETS - 1; remaining >>= 1) {
+        bucket++;
+    }
+    _buckets[bucket]++;
+    _sampleCount++;
+    if (sample > _maximum) {
+        _maximum = sample;
+    }
+}
+
+void Log2Histogram::reset() {
+    memset(_buckets, 0, sizeof(_buckets));
+    _sampleCount = 0;
+    _maximum = 0;
+}
+
+quint64 Log2Histogram::getBucketUpperBound(int bucket) {
+    return (quint64)1 << bucket;
+}
+
+quint64 Log2Histogram::getPercentile(float percentile) const {
+    if (_sampleCount == 0) {
+        return 0;
+    }
+    const float PERCENT = 100.0f;
+    quint64 samplesNeeded = (quint64)(_sampleCount * percentile / PERCENT);
+    quint64 samplesSeen = 0;
+    for (int i = 0; i < NUM_BUCKETS - 1; i++) {
+        samplesSeen += _buckets[i];
+        if (samplesSeen >= samplesNeeded && samplesSeen > 0) {
+            return getBucketUpperBound(i);
+        }
+    }
+    return _maximum;
+}
+
+QString Log2Histogram::toString() const {
+    QString result;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        if (_buckets[i] > 0) {
+            if (i == NUM_BUCKETS - 1) {
+                result += QString(">=%1: %2  ").arg(getBucketUpperBound(i - 1)).arg(_buckets[i]);
+            } else {
+                result += QString("<%1: %2  ").arg(getBucketUpperBound(i)).arg(_buckets[i]);
+            }
+        }
+    }
+    return result.trimmed();
+}
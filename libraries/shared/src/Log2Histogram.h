@@ -0,0 +1,46 @@
+//
+//  Log2Histogram.h
+//  libraries/shared/src
+//
+//  Created by Brad Hefta-Gaub on 5/16/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_Log2Histogram_h
+#define hifi_Log2Histogram_h
+
+#include <QtCore/QString>
+
+/// Counts samples in power of two buckets. Bucket 0 holds zero, bucket N holds [2^(N-1), 2^N), and the last bucket
+/// also collects everything above it. Recording is cheap enough to do per packet, but is not thread-safe.
+class Log2Histogram {
+public:
+    static const int NUM_BUCKETS = 24;
+
+    Log2Histogram();
+
+    void addSample(quint64 sample);
+    void reset();
+
+    quint64 getSampleCount() const { return _sampleCount; }
+    quint64 getBucketCount(int bucket) const { return _buckets[bucket]; }
+    quint64 getMaximum() const { return _maximum; }
+
+    static quint64 getBucketUpperBound(int bucket);
+
+    /// Returns the upper bound of the bucket holding the given percentile (0 to 100) of samples.
+    quint64 getPercentile(float percentile) const;
+
+    /// Formats the non-empty buckets as a single line for stats pages, e.g. "<1: 10  <2: 3  <4: 1"
+    QString toString() const;
+
+private:
+    quint64 _buckets[NUM_BUCKETS];
+    quint64 _sampleCount;
+    quint64 _maximum;
+};
+
+#endif // hifi_Log2Histogram_h
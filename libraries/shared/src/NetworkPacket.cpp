@@ -18,7 +18,8 @@
 #include "NetworkPacket.h"
 
 void NetworkPacket::copyContents(const SharedNodePointer& destinationNode, const QByteArray& packet) {
-    if (packet.size() && packet.size() <= MAX_PACKET_SIZE) {
+    if (packet.size() <= MAX_PACKET_SIZE) {
+        // an empty packet is allowed so that queues can clear out the slots they've handed off
         _destinationNode = destinationNode;
         _byteArray = packet;
     } else {
@@ -26,6 +26,7 @@
 /// Storage of not-yet processed inbound, or not yet sent outbound generic UDP network packet
 class NetworkPacket {
 public:
+    NetworkPacket() { } // empty packet, used by queues for unused slots
     NetworkPacket(const NetworkPacket& packet); // copy constructor
     NetworkPacket& operator= (const NetworkPacket& other);    // copy assignment
 
@@ -38,6 +39,7 @@ public:
 
     const SharedNodePointer& getDestinationNode() const { return _destinationNode; }
     const QByteArray& getByteArray() const { return _byteArray; }
+    QByteArray& getByteArray() { return _byteArray; }
 
 private:
     void copyContents(const SharedNodePointer& destinationNode, const QByteArray& byteArray);
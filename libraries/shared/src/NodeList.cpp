@@ -65,21 +65,32 @@ NodeList::NodeList(char newOwnerType, unsigned short int newSocketListenPort) :
     _nodeHash(),
     _nodeHashMutex(QMutex::Recursive),
     _nodeSocket(this),
+    _packetBufferPool(),
+    _batchedSocket(_nodeSocket),
     _ownerType(newOwnerType),
     _nodeTypesOfInterest(),
     _sessionUUID(),
     _numNoReplyDomainCheckIns(0),
+    _domainListVersion(0),
+    _pendingDomainListVersion(0),
+    _pendingDomainListPackets(),
     _assignmentServerSocket(),
     _publicSockAddr(),
     _hasCompletedInitialSTUNFailure(false),
     _stunRequestsSinceSuccess(0),
     _numCollectedPackets(0),
     _numCollectedBytes(0),
+    _numReceiveSyscalls(0),
+    _numSendSyscalls(0),
     _packetStatTimer()
 {
     _nodeSocket.bind(QHostAddress::AnyIPv4, newSocketListenPort);
     qDebug() << "NodeList socket is listening on" << _nodeSocket.localPort();
     
+    if (_batchedSocket.isEnabled()) {
+        qDebug() << "NodeList socket will batch up to" << DATAGRAM_BATCH_SIZE << "datagrams per syscall";
+    }
+    
     // clear our NodeList when the domain changes
     connect(&_domainInfo, &DomainInfo::hostnameChanged, this, &NodeList::reset);
     
@@ -189,16 +200,28 @@ bool NodeList::packetVersionAndHashMatch(const QByteArray& packet) {
 
 qint64 NodeList::writeDatagram(const QByteArray& datagram, const HifiSockAddr& destinationSockAddr,
                                const QUuid& connectionSecret) {
-    QByteArray datagramCopy = datagram;
+    // we can't touch the caller's datagram, so stamp the hash into a recycled buffer instead of detaching a fresh copy
+    QByteArray sendBuffer = _packetBufferPool.acquire();
+    sendBuffer.append(datagram);
+    
+    qint64 bytesWritten = writeDatagramInPlace(sendBuffer.data(), sendBuffer.size(), destinationSockAddr, connectionSecret);
     
+    _packetBufferPool.release(sendBuffer);
+    
+    return bytesWritten;
+}
+
+qint64 NodeList::writeDatagramInPlace(char* data, qint64 size, const HifiSockAddr& destinationSockAddr,
+                                      const QUuid& connectionSecret) {
     // setup the MD5 hash for source verification in the header
-    replaceHashInPacketGivenConnectionUUID(datagramCopy, connectionSecret);
+    replaceHashInPacketGivenConnectionUUID(data, size, connectionSecret);
     
     // stat collection for packets
     ++_numCollectedPackets;
-    _numCollectedBytes += datagram.size();
+    _numCollectedBytes += size;
     
-    qint64 bytesWritten = _nodeSocket.writeDatagram(datagramCopy, destinationSockAddr.getAddress(), destinationSockAddr.getPort());
+    ++_numSendSyscalls;
+    qint64 bytesWritten = _nodeSocket.writeDatagram(data, size, destinationSockAddr.getAddress(), destinationSockAddr.getPort());
     
     if (bytesWritten < 0) {
         qDebug() << "ERROR in writeDatagram:" << _nodeSocket.error() << "-" << _nodeSocket.errorString();
@@ -207,31 +230,128 @@ qint64 NodeList::writeDatagram(const QByteArray& datagram, const HifiSockAddr& d
     return bytesWritten;
 }
 
+const HifiSockAddr* NodeList::destinationSockAddrForNode(const SharedNodePointer& destinationNode,
+                                                         const HifiSockAddr& overridenSockAddr) {
+    if (!overridenSockAddr.isNull()) {
+        return &overridenSockAddr;
+    }
+    
+    // if we don't have an ovveriden address, assume they want to send to the node's active socket
+    // this will be NULL if we don't yet have a socket to send to
+    return destinationNode->getActiveSocket();
+}
+
 qint64 NodeList::writeDatagram(const QByteArray& datagram, const SharedNodePointer& destinationNode,
                                const HifiSockAddr& overridenSockAddr) {
     if (destinationNode) {
-        // if we don't have an ovveriden address, assume they want to send to the node's active socket
-        const HifiSockAddr* destinationSockAddr = &overridenSockAddr;
-        if (overridenSockAddr.isNull()) {
-            if (destinationNode->getActiveSocket()) {
-                // use the node's active socket as the destination socket
-                destinationSockAddr = destinationNode->getActiveSocket();
-            } else {
-                // we don't have a socket to send to, return 0
-                return 0;
-            }
-        }
+        const HifiSockAddr* destinationSockAddr = destinationSockAddrForNode(destinationNode, overridenSockAddr);
         
-        writeDatagram(datagram, *destinationSockAddr, destinationNode->getConnectionSecret());
+        if (destinationSockAddr) {
+            return writeDatagram(datagram, *destinationSockAddr, destinationNode->getConnectionSecret());
+        }
     }
     
-    // didn't have a destinationNode to send to, return 0
+    // didn't have a destinationNode or socket to send to, return 0
     return 0;
 }
 
 qint64 NodeList::writeDatagram(const char* data, qint64 size, const SharedNodePointer& destinationNode,
                                const HifiSockAddr& overridenSockAddr) {
-    return writeDatagram(QByteArray(data, size), destinationNode, overridenSockAddr);
+    // wrap the caller's data without copying it, the pooled send buffer takes the only copy
+    return writeDatagram(QByteArray::fromRawData(data, size), destinationNode, overridenSockAddr);
+}
+
+qint64 NodeList::writeDatagramInPlace(char* data, qint64 size, const SharedNodePointer& destinationNode,
+                                      const HifiSockAddr& overridenSockAddr) {
+    if (destinationNode) {
+        const HifiSockAddr* destinationSockAddr = destinationSockAddrForNode(destinationNode, overridenSockAddr);
+        
+        if (destinationSockAddr) {
+            return writeDatagramInPlace(data, size, *destinationSockAddr, destinationNode->getConnectionSecret());
+        }
+    }
+    
+    return 0;
+}
+
+qint64 NodeList::writeDatagramInPlace(QByteArray& datagram, const SharedNodePointer& destinationNode,
+                                      const HifiSockAddr& overridenSockAddr) {
+    if (!datagram.isDetached()) {
+        // writing into a shared datagram would detach (and allocate), so take the copying path
+        return writeDatagram(datagram, destinationNode, overridenSockAddr);
+    }
+    
+    return writeDatagramInPlace(datagram.data(), datagram.size(), destinationNode, overridenSockAddr);
+}
+
+bool NodeList::readDatagram(QByteArray& destinationByteArray, HifiSockAddr& senderSockAddr) {
+    if (!destinationByteArray.isDetached()) {
+        // the last datagram read into this array is still referenced elsewhere (typically queued for a packet
+        // processor), so grab a recycled buffer rather than detaching into a fresh allocation
+        destinationByteArray = _packetBufferPool.acquire();
+    }
+    
+    if (_batchedSocket.takeBufferedDatagram(destinationByteArray, senderSockAddr)) {
+        return true;
+    }
+    
+    ++_numReceiveSyscalls;
+    if (!_nodeSocket.hasPendingDatagrams()) {
+        return false;
+    }
+    
+    // the first datagram always goes through QUdpSocket - reading it is what re-arms the socket's read notifier
+    _numReceiveSyscalls += 2;
+    destinationByteArray.resize(_nodeSocket.pendingDatagramSize());
+    _nodeSocket.readDatagram(destinationByteArray.data(), destinationByteArray.size(),
+                             senderSockAddr.getAddressPointer(), senderSockAddr.getPortPointer());
+    
+    if (_batchedSocket.isEnabled()) {
+        // pull whatever else is waiting in a single call, it is handed out by the following reads
+        ++_numReceiveSyscalls;
+        _batchedSocket.receiveBatch();
+    }
+    
+    return true;
+}
+
+qint64 NodeList::queueDatagram(const char* data, qint64 size, const SharedNodePointer& destinationNode,
+                               const HifiSockAddr& overridenSockAddr) {
+    if (!_batchedSocket.isEnabled() || !destinationNode || size > MAX_PACKET_SIZE) {
+        return writeDatagram(data, size, destinationNode, overridenSockAddr);
+    }
+    
+    const HifiSockAddr* destinationSockAddr = destinationSockAddrForNode(destinationNode, overridenSockAddr);
+    if (!destinationSockAddr) {
+        return 0;
+    }
+    
+    char* sendSlot = _batchedSocket.nextSendSlot();
+    if (!sendSlot) {
+        // the batch is full, push it out and start on the next one
+        flushQueuedDatagrams();
+        sendSlot = _batchedSocket.nextSendSlot();
+    }
+    
+    memcpy(sendSlot, data, size);
+    replaceHashInPacketGivenConnectionUUID(sendSlot, size, destinationNode->getConnectionSecret());
+    _batchedSocket.commitSendSlot(size, *destinationSockAddr);
+    
+    ++_numCollectedPackets;
+    _numCollectedBytes += size;
+    
+    return size;
+}
+
+qint64 NodeList::queueDatagram(const QByteArray& datagram, const SharedNodePointer& destinationNode,
+                               const HifiSockAddr& overridenSockAddr) {
+    return queueDatagram(datagram.constData(), datagram.size(), destinationNode, overridenSockAddr);
+}
+
+void NodeList::flushQueuedDatagrams() {
+    if (_batchedSocket.getNumQueuedDatagrams() > 0) {
+        _numSendSyscalls += _batchedSocket.flushQueuedDatagrams();
+    }
 }
 
 qint64 NodeList::sendStatsToDomainServer(const QJsonObject& statsObject) {
@@ -412,6 +532,11 @@ void NodeList::eraseAllNodes() {
 void NodeList::reset() {
     eraseAllNodes();
     _numNoReplyDomainCheckIns = 0;
+    
+    // the next list we get from the domain-server needs to be a full one
+    _domainListVersion = 0;
+    _pendingDomainListVersion = 0;
+    _pendingDomainListPackets.clear();
 
     // refresh the owner UUID to the NULL UUID
     setSessionUUID(QUuid());
@@ -573,7 +698,13 @@ void NodeList::killNodeWithUUID(const QUuid& nodeUUID) {
     }
 }
 
-NodeHash::iterator NodeList::killNodeAtHashIterator(NodeHash::iterator& nodeItemToKill) {
+NodeHash::iterator NodeList::killNodeAtHashIterator(NodeHash::iterator& nodeItemToKill, bool listedRemoval) {
+    if (!listedRemoval) {
+        // the domain-server won't necessarily list a change for a node we dropped on our own (say, after a brief silence),
+        // so a delta might never bring it back; forget our version (and any list in progress) to get a full one next
+        _domainListVersion = 0;
+        _pendingDomainListPackets.fill(false);
+    }
     qDebug() << "Killed" << *nodeItemToKill.value();
     emit nodeKilled(nodeItemToKill.value());
     return _nodeHash.erase(nodeItemToKill);
@@ -626,6 +757,11 @@ void NodeList::sendDomainServerCheckIn() {
                 packetStream << nodeTypeOfInterest;
             }
             
+            if (domainPacketType == PacketTypeDomainListRequest) {
+                // tell the domain-server which list we last received in full so it can send us just what changed since
+                packetStream << _domainListVersion;
+            }
+            
             writeDatagram(domainServerPacket, _domainInfo.getSockAddr(), _domainInfo.getConnectionSecret());
             const int NUM_DOMAIN_SERVER_CHECKINS_PER_STUN_REQUEST = 5;
             static unsigned int numDomainCheckins = 0;
@@ -687,8 +823,29 @@ int NodeList::processDomainServerList(const QByteArray& packet) {
     packetStream >> newUUID;
     setSessionUUID(newUUID);
     
-    // pull each node in the packet
+    DomainListType_t listType;
+    quint32 baseVersion, listVersion;
+    quint16 packetIndex, numPackets;
+    packetStream >> listType >> baseVersion >> listVersion >> packetIndex >> numPackets;
+    
+    // pull each node record in the packet
+    DomainListRecordType_t recordType;
+    
     while(packetStream.device()->pos() < packet.size()) {
+        packetStream >> recordType;
+        
+        if (recordType == DomainListRecordType::Removal) {
+            packetStream >> nodeUUID;
+            
+            // the domain-server told us about this one, so our list version still holds
+            QMutexLocker locker(&_nodeHashMutex);
+            NodeHash::iterator nodeItemToKill = _nodeHash.find(nodeUUID);
+            if (nodeItemToKill != _nodeHash.end()) {
+                killNodeAtHashIterator(nodeItemToKill, true);
+            }
+            continue;
+        }
+        
         packetStream >> nodeType >> nodeUUID >> nodePublicSocket >> nodeLocalSocket;
 
         // if the public socket address is 0 then it's reachable at the same IP
@@ -701,6 +858,23 @@ int NodeList::processDomainServerList(const QByteArray& packet) {
         
         packetStream >> connectionUUID;
         node->setConnectionSecret(connectionUUID);
+        
+        readNodes++;
+    }
+    
+    // a list can span several packets, only acknowledge its version once we have all of them
+    if (listVersion != _pendingDomainListVersion || _pendingDomainListPackets.size() != numPackets) {
+        _pendingDomainListVersion = listVersion;
+        _pendingDomainListPackets.fill(false, numPackets);
+    }
+    
+    if (packetIndex < numPackets) {
+        _pendingDomainListPackets.setBit(packetIndex);
+    }
+    
+    if (_pendingDomainListPackets.count(true) == numPackets
+        && (listType == DomainListType::Full || baseVersion == _domainListVersion)) {
+        _domainListVersion = listVersion;
     }
     
     // ping inactive nodes in conjunction with receipt of list from domain-server
@@ -918,9 +1092,16 @@ void NodeList::getPacketStats(float& packetsPerSecond, float& bytesPerSecond) {
     bytesPerSecond = (float) _numCollectedBytes / ((float) _packetStatTimer.elapsed() / 1000.0f);
 }
 
+void NodeList::getSyscallStats(float& receiveSyscallsPerSecond, float& sendSyscallsPerSecond) {
+    receiveSyscallsPerSecond = (float) _numReceiveSyscalls / ((float) _packetStatTimer.elapsed() / 1000.0f);
+    sendSyscallsPerSecond = (float) _numSendSyscalls / ((float) _packetStatTimer.elapsed() / 1000.0f);
+}
+
 void NodeList::resetPacketStats() {
     _numCollectedPackets = 0;
     _numCollectedBytes = 0;
+    _numReceiveSyscalls = 0;
+    _numSendSyscalls = 0;
     _packetStatTimer.restart();
 }
 
@@ -24,6 +24,7 @@
 #include <unistd.h> // not on windows, not needed for mac or windows
 #endif
 
+#include <QtCore/QBitArray>
 #include <QtCore/QElapsedTimer>
 #include <QtCore/QMutex>
 #include <QtCore/QSet>
@@ -32,8 +33,10 @@
 #include <QtNetwork/QHostAddress>
 #include <QtNetwork/QUdpSocket>
 
+#include "BatchedDatagramSocket.h"
 #include "DomainInfo.h"
 #include "Node.h"
+#include "PacketBufferPool.h"
 
 const quint64 NODE_SILENCE_THRESHOLD_USECS = 2 * 1000 * 1000;
 const quint64 DOMAIN_SERVER_CHECK_IN_USECS = 1 * 1000000;
@@ -64,6 +67,19 @@ namespace PingType {
     const PingType_t Symmetric = 3;
 }
 
+/// A DomainList is either the full set of nodes a node is interested in, or the changes since a version it acknowledged
+typedef quint8 DomainListType_t;
+namespace DomainListType {
+    const DomainListType_t Full = 0;
+    const DomainListType_t Delta = 1;
+}
+
+typedef quint8 DomainListRecordType_t;
+namespace DomainListRecordType {
+    const DomainListRecordType_t Node = 0;
+    const DomainListRecordType_t Removal = 1;
+}
+
 class NodeList : public QObject {
     Q_OBJECT
 public:
@@ -76,6 +92,7 @@ public:
     void setSessionUUID(const QUuid& sessionUUID);
 
     QUdpSocket& getNodeSocket() { return _nodeSocket; }
+    PacketBufferPool& getPacketBufferPool() { return _packetBufferPool; }
     
     bool packetVersionAndHashMatch(const QByteArray& packet);
     
@@ -83,6 +100,25 @@ public:
                          const HifiSockAddr& overridenSockAddr = HifiSockAddr());
     qint64 writeDatagram(const char* data, qint64 size, const SharedNodePointer& destinationNode,
                          const HifiSockAddr& overridenSockAddr = HifiSockAddr());
+    
+    /// Stamps the verification hash directly into the header of the passed datagram and sends it without a copy.
+    qint64 writeDatagramInPlace(char* data, qint64 size, const SharedNodePointer& destinationNode,
+                                const HifiSockAddr& overridenSockAddr = HifiSockAddr());
+    /// Sends in place if the caller is the only owner of the datagram, otherwise falls back to a pooled copy.
+    qint64 writeDatagramInPlace(QByteArray& datagram, const SharedNodePointer& destinationNode,
+                                const HifiSockAddr& overridenSockAddr = HifiSockAddr());
+    
+    /// Reads the next datagram off the node socket, draining it in batches where the platform supports it.
+    bool readDatagram(QByteArray& destinationByteArray, HifiSockAddr& senderSockAddr);
+    
+    /// Queues a datagram to go out with the next flushQueuedDatagrams call, so that a frame's worth of sends costs a
+    /// handful of syscalls. Falls back to an immediate write where batching is unavailable.
+    qint64 queueDatagram(const char* data, qint64 size, const SharedNodePointer& destinationNode,
+                         const HifiSockAddr& overridenSockAddr = HifiSockAddr());
+    qint64 queueDatagram(const QByteArray& datagram, const SharedNodePointer& destinationNode,
+                         const HifiSockAddr& overridenSockAddr = HifiSockAddr());
+    void flushQueuedDatagrams();
+    
     qint64 sendStatsToDomainServer(const QJsonObject& statsObject);
 
     void(*linkedDataCreateCallback)(Node *);
@@ -91,6 +127,7 @@ public:
     int size() const { return _nodeHash.size(); }
 
     int getNumNoReplyDomainCheckIns() const { return _numNoReplyDomainCheckIns; }
+    quint32 getDomainListVersion() const { return _domainListVersion; }
     DomainInfo& getDomainInfo() { return _domainInfo; }
     
     const NodeSet& getNodeInterestSet() const { return _nodeTypesOfInterest; }
@@ -125,6 +162,7 @@ public:
     SharedNodePointer soloNodeOfType(char nodeType);
 
     void getPacketStats(float &packetsPerSecond, float &bytesPerSecond);
+    void getSyscallStats(float& receiveSyscallsPerSecond, float& sendSyscallsPerSecond);
     void resetPacketStats();
     
     void loadData(QSettings* settings);
@@ -156,8 +194,13 @@ private:
     
     qint64 writeDatagram(const QByteArray& datagram, const HifiSockAddr& destinationSockAddr,
                          const QUuid& connectionSecret);
+    qint64 writeDatagramInPlace(char* data, qint64 size, const HifiSockAddr& destinationSockAddr,
+                                const QUuid& connectionSecret);
+    const HifiSockAddr* destinationSockAddrForNode(const SharedNodePointer& destinationNode,
+                                                   const HifiSockAddr& overridenSockAddr);
 
-    NodeHash::iterator killNodeAtHashIterator(NodeHash::iterator& nodeItemToKill);
+    /// \param listedRemoval whether the domain-server's list removed the node, as opposed to our removing it on our own
+    NodeHash::iterator killNodeAtHashIterator(NodeHash::iterator& nodeItemToKill, bool listedRemoval = false);
 
     void processDomainServerAuthRequest(const QByteArray& packet);
     void requestAuthForDomainServer();
@@ -169,17 +212,24 @@ private:
     NodeHash _nodeHash;
     QMutex _nodeHashMutex;
     QUdpSocket _nodeSocket;
+    PacketBufferPool _packetBufferPool;
+    BatchedDatagramSocket _batchedSocket;
     NodeType_t _ownerType;
     NodeSet _nodeTypesOfInterest;
     DomainInfo _domainInfo;
     QUuid _sessionUUID;
     int _numNoReplyDomainCheckIns;
+    quint32 _domainListVersion;
+    quint32 _pendingDomainListVersion;
+    QBitArray _pendingDomainListPackets;
     HifiSockAddr _assignmentServerSocket;
     HifiSockAddr _publicSockAddr;
     bool _hasCompletedInitialSTUNFailure;
     unsigned int _stunRequestsSinceSuccess;
     int _numCollectedPackets;
     int _numCollectedBytes;
+    int _numReceiveSyscalls;
+    int _numSendSyscalls;
     QElapsedTimer _packetStatTimer;
 };
 
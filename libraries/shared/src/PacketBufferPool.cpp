@@ -0,0 +1,78 @@
+//
+//  PacketBufferPool.cpp
+//  libraries/shared/src
+//
+//  Created by Stephen Birarda on 5/12/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <QtCore/QMutexLocker>
+
+#include "SharedUtil.h"
+
+#include "PacketBufferPool.h"
+
+PacketBufferPool::PacketBufferPool(int maxRetainedBuffers) :
+    _mutex(),
+    _freeBuffers(),
+    _maxRetainedBuffers(maxRetainedBuffers),
+    _numAllocations(0),
+    _numReuses(0),
+    _allocationStatTimer()
+{
+    _freeBuffers.reserve(_maxRetainedBuffers);
+    _allocationStatTimer.start();
+}
+
+QByteArray PacketBufferPool::acquire() {
+    QMutexLocker locker(&_mutex);
+
+    if (!_freeBuffers.isEmpty()) {
+        ++_numReuses;
+
+        QByteArray recycledBuffer = _freeBuffers.last();
+        _freeBuffers.removeLast();
+        return recycledBuffer;
+    }
+
+    ++_numAllocations;
+    locker.unlock();
+
+    QByteArray freshBuffer;
+    freshBuffer.reserve(MAX_PACKET_SIZE);
+    return freshBuffer;
+}
+
+void PacketBufferPool::release(QByteArray& buffer) {
+    if (buffer.isDetached() && buffer.capacity() >= MAX_PACKET_SIZE) {
+        // with the capacity reserved, shrinking to zero keeps the allocation around for the next acquire
+        buffer.reserve(MAX_PACKET_SIZE);
+        buffer.resize(0);
+
+        QMutexLocker locker(&_mutex);
+        if (_freeBuffers.size() < _maxRetainedBuffers) {
+            _freeBuffers.append(buffer);
+        }
+    }
+
+    buffer = QByteArray();
+}
+
+void PacketBufferPool::getAllocationStats(float& allocationsPerSecond, float& reusesPerSecond) {
+    QMutexLocker locker(&_mutex);
+
+    float elapsedSeconds = (float) _allocationStatTimer.elapsed() / 1000.0f;
+    allocationsPerSecond = elapsedSeconds > 0.0f ? _numAllocations / elapsedSeconds : 0.0f;
+    reusesPerSecond = elapsedSeconds > 0.0f ? _numReuses / elapsedSeconds : 0.0f;
+}
+
+void PacketBufferPool::resetAllocationStats() {
+    QMutexLocker locker(&_mutex);
+
+    _numAllocations = 0;
+    _numReuses = 0;
+    _allocationStatTimer.restart();
+}
@@ -0,0 +1,48 @@
+//
+//  PacketBufferPool.h
+//  libraries/shared/src
+//
+//  Created by Stephen Birarda on 5/12/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Recycles MAX_PACKET_SIZE datagram buffers so that steady state send and receive paths don't hit the allocator.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_PacketBufferPool_h
+#define hifi_PacketBufferPool_h
+
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
+
+const int DEFAULT_MAX_RETAINED_PACKET_BUFFERS = 256;
+
+/// Thread-safe pool of datagram buffers, each with MAX_PACKET_SIZE bytes of reserved capacity.
+class PacketBufferPool {
+public:
+    PacketBufferPool(int maxRetainedBuffers = DEFAULT_MAX_RETAINED_PACKET_BUFFERS);
+
+    /// Returns an empty buffer with room for a full packet, recycling a released buffer if one is available.
+    QByteArray acquire();
+
+    /// Hands the buffer back to the pool and clears the caller's reference to it. Buffers that are still shared
+    /// with another QByteArray, or that are too small to hold a full packet, are simply dropped.
+    void release(QByteArray& buffer);
+
+    void getAllocationStats(float& allocationsPerSecond, float& reusesPerSecond);
+    void resetAllocationStats();
+
+private:
+    QMutex _mutex;
+    QVector<QByteArray> _freeBuffers;
+    int _maxRetainedBuffers;
+    int _numAllocations;
+    int _numReuses;
+    QElapsedTimer _allocationStatTimer;
+};
+
+#endif // hifi_PacketBufferPool_h
@@ -52,10 +52,11 @@ PacketVersion versionForPacketType(PacketType type) {
         case PacketTypeEnvironmentData:
             return 1;
         case PacketTypeParticleData:
+        case PacketTypeParticleAddOrEdit:
             return 1;
         case PacketTypeDomainList:
         case PacketTypeDomainListRequest:
-            return 1;
+            return 2;
         case PacketTypeCreateAssignment:
         case PacketTypeRequestAssignment:
             return 1;
@@ -67,6 +68,8 @@ PacketVersion versionForPacketType(PacketType type) {
         case PacketTypeVoxelSet:
         case PacketTypeVoxelSetDestructive:
             return 1;
+        case PacketTypeMetavoxelData:
+            return 1;
         default:
             return 0;
     }
@@ -94,9 +97,7 @@ int populatePacketHeader(char* packet, PacketType type, const QUuid& connectionU
     
     QUuid packUUID = connectionUUID.isNull() ? NodeList::getInstance()->getSessionUUID() : connectionUUID;
     
-    QByteArray rfcUUID = packUUID.toRfc4122();
-    memcpy(position, rfcUUID.constData(), NUM_BYTES_RFC4122_UUID);
-    position += NUM_BYTES_RFC4122_UUID;
+    position += packRfc4122UUID(packUUID, position);
     
     // pack 16 bytes of zeros where the md5 hash will be placed one data is packed
     memset(position, 0, NUM_BYTES_MD5_HASH);
@@ -129,14 +130,31 @@ QByteArray hashFromPacketHeader(const QByteArray& packet) {
     return packet.mid(numBytesForPacketHeader(packet) - NUM_BYTES_MD5_HASH, NUM_BYTES_MD5_HASH);
 }
 
+static QByteArray hashForPacketDataAndConnectionUUID(const char* packet, int packetSize, const QUuid& connectionUUID) {
+    // feed the payload and the connection secret to the hash separately so neither needs to be copied into a temporary
+    int numHeaderBytes = numBytesForPacketHeader(packet);
+    
+    char rfcConnectionUUID[NUM_BYTES_RFC4122_UUID];
+    packRfc4122UUID(connectionUUID, rfcConnectionUUID);
+    
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    hash.addData(packet + numHeaderBytes, packetSize - numHeaderBytes);
+    hash.addData(rfcConnectionUUID, NUM_BYTES_RFC4122_UUID);
+    
+    return hash.result();
+}
+
 QByteArray hashForPacketAndConnectionUUID(const QByteArray& packet, const QUuid& connectionUUID) {
-    return QCryptographicHash::hash(packet.mid(numBytesForPacketHeader(packet)) + connectionUUID.toRfc4122(),
-                                    QCryptographicHash::Md5);
+    return hashForPacketDataAndConnectionUUID(packet.constData(), packet.size(), connectionUUID);
 }
 
 void replaceHashInPacketGivenConnectionUUID(QByteArray& packet, const QUuid& connectionUUID) {
-    packet.replace(numBytesForPacketHeader(packet) - NUM_BYTES_MD5_HASH, NUM_BYTES_MD5_HASH,
-                   hashForPacketAndConnectionUUID(packet, connectionUUID));
+    replaceHashInPacketGivenConnectionUUID(packet.data(), packet.size(), connectionUUID);
+}
+
+void replaceHashInPacketGivenConnectionUUID(char* packet, int packetSize, const QUuid& connectionUUID) {
+    QByteArray packetHash = hashForPacketDataAndConnectionUUID(packet, packetSize, connectionUUID);
+    memcpy(packet + numBytesForPacketHeader(packet) - NUM_BYTES_MD5_HASH, packetHash.constData(), NUM_BYTES_MD5_HASH);
 }
 
 PacketType packetTypeForPacket(const QByteArray& packet) {
@@ -85,6 +85,7 @@ QUuid uuidFromPacketHeader(const QByteArray& packet);
 QByteArray hashFromPacketHeader(const QByteArray& packet);
 QByteArray hashForPacketAndConnectionUUID(const QByteArray& packet, const QUuid& connectionUUID);
 void replaceHashInPacketGivenConnectionUUID(QByteArray& packet, const QUuid& connectionUUID);
+void replaceHashInPacketGivenConnectionUUID(char* packet, int packetSize, const QUuid& connectionUUID);
 
 PacketType packetTypeForPacket(const QByteArray& packet);
 PacketType packetTypeForPacket(const char* packet);
@@ -49,15 +49,12 @@ PacketSender::~PacketSender() {
 
 
 void PacketSender::queuePacketForSending(const SharedNodePointer& destinationNode, const QByteArray& packet) {
-    NetworkPacket networkPacket(destinationNode, packet);
-    lock();
-    _packets.push_back(networkPacket);
-    unlock();
+    // the queue wakes our sending thread if it had parked waiting for packets
+    if (!_packets.enqueue(NetworkPacket(destinationNode, packet))) {
+        return; // counted as dropped by the queue
+    }
     _totalPacketsQueued++;
     _totalBytesQueued += packet.size();
-
-    // Make sure to  wake our actual processing thread because we  now have packets for it to process.
-    _hasPackets.wakeAll();
 }
 
 void PacketSender::setPacketsPerSecond(int packetsPerSecond) {
@@ -73,7 +70,7 @@ bool PacketSender::process() {
 }
 
 void PacketSender::terminating() {
-    _hasPackets.wakeAll();
+    _packets.wakeConsumer();
 }
 
 bool PacketSender::threadedProcess() {
@@ -84,7 +81,7 @@ bool PacketSender::threadedProcess() {
     }
 
     // in threaded mode, we keep running and just empty our packet queue sleeping enough to keep our PPS on target
-    while (_packets.size() > 0) {
+    while (!_packets.isEmpty()) {
         // Recalculate our SEND_INTERVAL_USECS each time, in case the caller has changed it on us..
         int packetsPerSecondTarget = (_packetsPerSecond > MINIMUM_PACKETS_PER_SECOND)
                                             ? _packetsPerSecond : MINIMUM_PACKETS_PER_SECOND;
@@ -118,10 +115,9 @@ bool PacketSender::threadedProcess() {
 
     // if threaded and we haven't slept? We want to wait for our consumer to signal us with new packets
     if (!hasSlept) {
-        // wait till we have packets        
-        _waitingOnPacketsMutex.lock();
-        _hasPackets.wait(&_waitingOnPacketsMutex);
-        _waitingOnPacketsMutex.unlock();
+        // wait till we have packets, spinning briefly before parking
+        const unsigned long MAX_PARK_MSECS = 100;
+        _packets.waitForItems(MAX_PARK_MSECS);
     }
 
     return isStillRunning();
@@ -163,7 +159,7 @@ bool PacketSender::nonThreadedProcess() {
         averageCallTime = _usecsPerProcessCallHint;
     }
 
-    if (_packets.size() == 0) {
+    if (_packets.isEmpty()) {
         // in non-threaded mode, if there's nothing to do, just return, keep running till they terminate us
         return isStillRunning();
     }
@@ -259,25 +255,22 @@ bool PacketSender::nonThreadedProcess() {
         }
     }
 
-    int packetsLeft = _packets.size();
+    NetworkPacket temporary;
 
     // Now that we know how many packets to send this call to process, just send them.
-    while ((packetsSentThisCall < packetsToSendThisCall) && (packetsLeft > 0)) {
-        lock();
-        NetworkPacket& packet = _packets.front();
-        NetworkPacket temporary = packet; // make a copy
-        _packets.erase(_packets.begin());
-        packetsLeft = _packets.size();
-        unlock();
-
-        // send the packet through the NodeList...
-        NodeList::getInstance()->writeDatagram(temporary.getByteArray(), temporary.getDestinationNode());
+    while ((packetsSentThisCall < packetsToSendThisCall) && _packets.tryDequeue(temporary)) {
+        // send the packet through the NodeList, stamping the hash in place if the queue held the only reference
+        NodeList* nodeList = NodeList::getInstance();
+        int packetSize = temporary.getByteArray().size();
+        nodeList->writeDatagramInPlace(temporary.getByteArray(), temporary.getDestinationNode());
         packetsSentThisCall++;
         _packetsOverCheckInterval++;
         _totalPacketsSent++;
-        _totalBytesSent += temporary.getByteArray().size();
+        _totalBytesSent += packetSize;
+        
+        emit packetSent(packetSize);
         
-        emit packetSent(temporary.getByteArray().size());
+        nodeList->getPacketBufferPool().release(temporary.getByteArray());
         
         _lastSendTime = now;
     }
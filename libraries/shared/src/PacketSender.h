@@ -14,8 +14,7 @@
 #ifndef hifi_PacketSender_h
 #define hifi_PacketSender_h
 
-#include <QWaitCondition>
-
+#include "BoundedMPSCQueue.h"
 #include "GenericThread.h"
 #include "NetworkPacket.h"
 #include "NodeList.h"
@@ -52,11 +51,22 @@ public:
     virtual void terminating();
 
     /// are there packets waiting in the send queue to be sent
-    bool hasPacketsToSend() const { return _packets.size() > 0; }
+    bool hasPacketsToSend() const { return !_packets.isEmpty(); }
 
     /// how many packets are there in the send queue waiting to be sent
     int packetsToSendCount() const { return _packets.size(); }
 
+    /// histogram of how many packets were queued each time one was taken off the queue to be sent
+    Log2Histogram getQueueDepthHistogram() const { return _packets.getDepthHistogram(); }
+
+    /// histogram of how long (in usecs) each packet waited in the send queue
+    Log2Histogram getQueueWaitTimeHistogram() const { return _packets.getWaitTimeHistogram(); }
+
+    void resetQueueHistograms() { _packets.resetHistograms(); }
+
+    /// how many packets have been dropped because the send queue was full
+    int getDroppedPacketCount() const { return _packets.getDroppedCount(); }
+
     /// If you're running in non-threaded mode, call this to give us a hint as to how frequently you will call process.
     /// This has no effect in threaded mode. This is only considered a hint in non-threaded mode.
     /// \param int usecsPerProcessCall expected number of usecs between calls to process in non-threaded mode.
@@ -104,7 +114,7 @@ protected:
     SimpleMovingAverage _averageProcessCallTime;
 
 private:
-    std::vector<NetworkPacket> _packets;
+    BoundedMPSCQueue<NetworkPacket> _packets;
     quint64 _lastSendTime;
 
     bool threadedProcess();
@@ -119,9 +129,6 @@ private:
 
     quint64 _totalPacketsQueued;
     quint64 _totalBytesQueued;
-
-    QWaitCondition _hasPackets;
-    QMutex _waitingOnPacketsMutex;
 };
 
 #endif // hifi_PacketSender_h
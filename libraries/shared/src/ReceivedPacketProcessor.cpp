@@ -13,37 +13,33 @@
 #include "ReceivedPacketProcessor.h"
 #include "SharedUtil.h"
 
+const int MAX_PACKETS_PER_BATCH = 256;
+const unsigned long MAX_PARK_MSECS = 100;
+
 void ReceivedPacketProcessor::terminating() {
-    _hasPackets.wakeAll();
+    _packets.wakeConsumer();
 }
 
 void ReceivedPacketProcessor::queueReceivedPacket(const SharedNodePointer& destinationNode, const QByteArray& packet) {
     // Make sure our Node and NodeList knows we've heard from this node.
     destinationNode->setLastHeardMicrostamp(usecTimestampNow());
 
-    NetworkPacket networkPacket(destinationNode, packet);
-    lock();
-    _packets.push_back(networkPacket);
-    unlock();
-    
-    // Make sure to  wake our actual processing thread because we  now have packets for it to process.
-    _hasPackets.wakeAll();
+    // the queue wakes our processing thread if it had parked waiting for packets
+    _packets.enqueue(NetworkPacket(destinationNode, packet));
 }
 
 bool ReceivedPacketProcessor::process() {
-
-    if (_packets.size() == 0) {
-        _waitingOnPacketsMutex.lock();
-        _hasPackets.wait(&_waitingOnPacketsMutex);
-        _waitingOnPacketsMutex.unlock();
+    if (isThreaded() && !_packets.waitForItems(MAX_PARK_MSECS)) {
+        return isStillRunning();
     }
-    while (_packets.size() > 0) {
-        lock(); // lock to make sure nothing changes on us
-        NetworkPacket& packet = _packets.front(); // get the oldest packet
-        NetworkPacket temporary = packet; // make a copy of the packet in case the vector is resized on us
-        _packets.erase(_packets.begin()); // remove the oldest packet
-        unlock(); // let others add to the packets
-        processPacket(temporary.getDestinationNode(), temporary.getByteArray()); // process our temporary copy
+
+    // drain a batch at a time, so that a steady stream of packets still lets us check whether we've been terminated
+    NetworkPacket packet;
+    for (int i = 0; i < MAX_PACKETS_PER_BATCH && _packets.tryDequeue(packet); i++) {
+        processPacket(packet.getDestinationNode(), packet.getByteArray());
+
+        // hand the datagram buffer back so the receive thread can read into it again
+        NodeList::getInstance()->getPacketBufferPool().release(packet.getByteArray());
     }
     return isStillRunning();  // keep running till they terminate us
 }
@@ -12,8 +12,7 @@
 #ifndef hifi_ReceivedPacketProcessor_h
 #define hifi_ReceivedPacketProcessor_h
 
-#include <QWaitCondition>
-
+#include "BoundedMPSCQueue.h"
 #include "GenericThread.h"
 #include "NetworkPacket.h"
 
@@ -31,11 +30,22 @@ public:
     void queueReceivedPacket(const SharedNodePointer& destinationNode, const QByteArray& packet);
 
     /// Are there received packets waiting to be processed
-    bool hasPacketsToProcess() const { return _packets.size() > 0; }
+    bool hasPacketsToProcess() const { return !_packets.isEmpty(); }
 
     /// How many received packets waiting are to be processed
     int packetsToProcessCount() const { return _packets.size(); }
 
+    /// histogram of how many packets were queued each time one was taken off the queue
+    Log2Histogram getQueueDepthHistogram() const { return _packets.getDepthHistogram(); }
+
+    /// histogram of how long (in usecs) each packet waited in the queue before processing started
+    Log2Histogram getQueueWaitTimeHistogram() const { return _packets.getWaitTimeHistogram(); }
+
+    void resetQueueHistograms() { _packets.resetHistograms(); }
+
+    /// how many received packets have been dropped because the queue was full
+    int getDroppedPacketCount() const { return _packets.getDroppedCount(); }
+
 protected:
     /// Callback for processing of recieved packets. Implement this to process the incoming packets.
     /// \param sockaddr& senderAddress the address of the sender
@@ -51,9 +61,7 @@ protected:
 
 private:
 
-    std::vector<NetworkPacket> _packets;
-    QWaitCondition _hasPackets;
-    QMutex _waitingOnPacketsMutex;
+    BoundedMPSCQueue<NetworkPacket> _packets;
 };
 
 #endif // hifi_ReceivedPacketProcessor_h
@@ -16,10 +16,13 @@
 #include <QtDebug>
 
 #include "ResourceCache.h"
+#include "SharedUtil.h"
 
 ResourceCache::ResourceCache(QObject* parent) :
     QObject(parent),
-    _lastLRUKey(0) {
+    _lastLRUKey(0),
+    _unusedResourcesMaxSize(DEFAULT_UNUSED_MAX_SIZE),
+    _unusedResourcesSize(0) {
 }
 
 ResourceCache::~ResourceCache() {
@@ -29,6 +32,11 @@ ResourceCache::~ResourceCache() {
     }
 }
 
+void ResourceCache::setUnusedResourceCacheSize(qint64 unusedResourcesMaxSize) {
+    _unusedResourcesMaxSize = unusedResourcesMaxSize;
+    reserveUnusedResourceSpace(0);
+}
+
 QSharedPointer<Resource> ResourceCache::getResource(const QUrl& url, const QUrl& fallback, bool delayLoad, void* extra) {
     if (!url.isValid() && fallback.isValid()) {
         return getResource(fallback, QUrl(), delayLoad);
@@ -42,57 +50,189 @@ QSharedPointer<Resource> ResourceCache::getResource(const QUrl& url, const QUrl&
         _resources.insert(url, resource);
         
     } else {
-        _unusedResources.remove(resource->getLRUKey());
+        removeUnusedResource(resource);
     }
     return resource;
 }
 
 void ResourceCache::addUnusedResource(const QSharedPointer<Resource>& resource) {
-    const int RETAINED_RESOURCE_COUNT = 50;
-    if (_unusedResources.size() > RETAINED_RESOURCE_COUNT) {
-        // unload the oldest resource
+    reserveUnusedResourceSpace(resource->getBytes());
+    resource->setLRUKey(++_lastLRUKey);
+    _unusedResources.insert(resource->getLRUKey(), resource);
+    _unusedResourcesSize += resource->getBytes();
+}
+
+void ResourceCache::removeUnusedResource(const QSharedPointer<Resource>& resource) {
+    if (_unusedResources.remove(resource->getLRUKey()) > 0) {
+        _unusedResourcesSize -= resource->getBytes();
+    }
+}
+
+void ResourceCache::reserveUnusedResourceSpace(qint64 bytes) {
+    // unload the oldest resources until the new bytes fit
+    while (!_unusedResources.isEmpty() && _unusedResourcesSize + bytes > _unusedResourcesMaxSize) {
         QMap<int, QSharedPointer<Resource> >::iterator it = _unusedResources.begin();
+        _unusedResourcesSize -= it.value()->getBytes();
         it.value()->setCache(NULL);
         _unusedResources.erase(it);
     }
-    resource->setLRUKey(++_lastLRUKey);
-    _unusedResources.insert(resource->getLRUKey(), resource);
 }
 
 void ResourceCache::attemptRequest(Resource* resource) {
-    if (_requestLimit <= 0) {
-        // wait until a slot becomes available
-        _pendingRequests.append(resource);
-        return;
-    }
-    _requestLimit--;
-    _loadingRequests.append(resource);
-    resource->makeRequest();
+    HostRequests& host = _hostRequests[resource->getHost()];
+    resource->_queuedPriority = resource->getLoadPriority();
+    enqueueRequest(host, resource);
+    scheduleRequests(host);
 }
 
 void ResourceCache::requestCompleted(Resource* resource) {
     _loadingRequests.removeOne(resource);
-    _requestLimit++;
     
-    // look for the highest priority pending request
-    int highestIndex = -1;
-    float highestPriority = -FLT_MAX;
-    for (int i = 0; i < _pendingRequests.size(); ) {
-        Resource* resource = _pendingRequests.at(i).data();
-        if (!resource) {
-            _pendingRequests.removeAt(i);
+    QHash<QString, HostRequests>::iterator host = _hostRequests.find(resource->getHost());
+    if (host != _hostRequests.end()) {
+        host.value().loading.removeOne(resource);
+        scheduleRequests(host.value());
+    }
+}
+
+void ResourceCache::scheduleRequests(HostRequests& host) {
+    updateQueuedPriorities();
+    
+    while (!host.pending.isEmpty()) {
+        Resource* next = host.pending.first();
+        
+        // owners may have gone away since it was placed, in which case it goes back to where it now belongs
+        float priority = next->getLoadPriority();
+        if (priority != next->_queuedPriority) {
+            next->_queuedPriority = priority;
+            siftDown(host.pending, 0);
+            continue;
+        }
+        if (host.loading.size() < _requestLimit) {
+            dequeueRequest(host, next);
+            startRequest(host, next);
             continue;
         }
+        
+        // see if there's something in flight we'd rather wait for; the priority gap must be clear and the victim must
+        // not have been cancelled recently, so that two requests of similar priority don't keep preempting each other
+        const float MAX_PREEMPTED_PROGRESS = 0.5f;
+        const float MIN_PREEMPTION_PRIORITY_GAP = 1.0f; // priorities are typically negated distances, so one meter
+        const quint64 PREEMPTION_COOLDOWN_USECS = 2 * 1000 * 1000;
+        quint64 now = usecTimestampNow();
+        Resource* victim = NULL;
+        float lowestPriority = priority - MIN_PREEMPTION_PRIORITY_GAP;
+        foreach (Resource* loading, host.loading) {
+            float loadingPriority = loading->getLoadPriority();
+            if (loadingPriority < lowestPriority && loading->getProgress() < MAX_PREEMPTED_PROGRESS &&
+                    now - loading->_lastPreempted >= PREEMPTION_COOLDOWN_USECS) {
+                lowestPriority = loadingPriority;
+                victim = loading;
+            }
+        }
+        if (!victim) {
+            break;
+        }
+        victim->cancelRequest();
+        victim->_lastPreempted = now;
+        host.loading.removeOne(victim);
+        _loadingRequests.removeOne(victim);
+        
+        dequeueRequest(host, next);
+        startRequest(host, next);
+        
+        victim->_queuedPriority = lowestPriority;
+        enqueueRequest(host, victim);
+    }
+}
+
+void ResourceCache::startRequest(HostRequests& host, Resource* resource) {
+    host.loading.append(resource);
+    _loadingRequests.append(resource);
+    resource->makeRequest();
+}
+
+void ResourceCache::enqueueRequest(HostRequests& host, Resource* resource) {
+    resource->_queueIndex = host.pending.size();
+    host.pending.append(resource);
+    siftUp(host.pending, resource->_queueIndex);
+    _pendingRequestCount++;
+}
+
+void ResourceCache::dequeueRequest(HostRequests& host, Resource* resource) {
+    int index = resource->_queueIndex;
+    resource->_queueIndex = -1;
+    _reprioritizedRequests.remove(resource);
+    _pendingRequestCount--;
+    
+    // move the last one into the gap and let it find its place
+    Resource* last = host.pending.last();
+    host.pending.removeLast();
+    if (last != resource) {
+        host.pending[index] = last;
+        last->_queueIndex = index;
+        siftUp(host.pending, index);
+        siftDown(host.pending, last->_queueIndex);
+    }
+}
+
+void ResourceCache::requestPriorityChanged(Resource* resource) {
+    if (resource->_queueIndex != -1) {
+        _reprioritizedRequests.insert(resource);
+    }
+}
+
+void ResourceCache::updateQueuedPriorities() {
+    foreach (Resource* resource, _reprioritizedRequests) {
         float priority = resource->getLoadPriority();
-        if (priority >= highestPriority) {
-            highestPriority = priority;
-            highestIndex = i;
+        if (priority == resource->_queuedPriority) {
+            continue;
         }
-        i++;
+        QVector<Resource*>& pending = _hostRequests.find(resource->getHost()).value().pending;
+        resource->_queuedPriority = priority;
+        siftUp(pending, resource->_queueIndex);
+        siftDown(pending, resource->_queueIndex);
     }
-    if (highestIndex >= 0) {
-        attemptRequest(_pendingRequests.takeAt(highestIndex));
+    _reprioritizedRequests.clear();
+}
+
+void ResourceCache::siftUp(QVector<Resource*>& heap, int index) {
+    Resource* resource = heap.at(index);
+    while (index > 0) {
+        int parentIndex = (index - 1) / 2;
+        Resource* parent = heap.at(parentIndex);
+        if (parent->_queuedPriority >= resource->_queuedPriority) {
+            break;
+        }
+        heap[index] = parent;
+        parent->_queueIndex = index;
+        index = parentIndex;
+    }
+    heap[index] = resource;
+    resource->_queueIndex = index;
+}
+
+void ResourceCache::siftDown(QVector<Resource*>& heap, int index) {
+    Resource* resource = heap.at(index);
+    int size = heap.size();
+    forever {
+        int childIndex = index * 2 + 1;
+        if (childIndex >= size) {
+            break;
+        }
+        if (childIndex + 1 < size && heap.at(childIndex + 1)->_queuedPriority > heap.at(childIndex)->_queuedPriority) {
+            childIndex++;
+        }
+        Resource* child = heap.at(childIndex);
+        if (child->_queuedPriority <= resource->_queuedPriority) {
+            break;
+        }
+        heap[index] = child;
+        child->_queueIndex = index;
+        index = childIndex;
     }
+    heap[index] = resource;
+    resource->_queueIndex = index;
 }
 
 QNetworkAccessManager* ResourceCache::_networkAccessManager = NULL;
@@ -100,7 +240,9 @@ QNetworkAccessManager* ResourceCache::_networkAccessManager = NULL;
 const int DEFAULT_REQUEST_LIMIT = 10;
 int ResourceCache::_requestLimit = DEFAULT_REQUEST_LIMIT;
 
-QList<QPointer<Resource> > ResourceCache::_pendingRequests;
+QHash<QString, ResourceCache::HostRequests> ResourceCache::_hostRequests;
+QSet<Resource*> ResourceCache::_reprioritizedRequests;
+int ResourceCache::_pendingRequestCount = 0;
 QList<Resource*> ResourceCache::_loadingRequests;
 
 Resource::Resource(const QUrl& url, bool delayLoad) :
@@ -111,13 +253,21 @@ Resource::Resource(const QUrl& url, bool delayLoad) :
     _loaded(false),
     _lruKey(0),
     _reply(NULL),
+    _queueIndex(-1),
+    _queuedPriority(-FLT_MAX),
+    _lastPreempted(0),
+    _bytesReceived(0),
+    _bytesTotal(0),
+    _bytes(0),
     _attempts(0) {
     
     if (!(url.isValid() && ResourceCache::getNetworkAccessManager())) {
         _startedLoading = _failedToLoad = true;
         return;
     }
-    _request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferCache);
+    // have the network cache revalidate stale copies (with the ETag or Last-Modified date it saved) rather than use them
+    // as they are, so that changed resources are picked up and unchanged ones cost a 304 instead of a download
+    _request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferNetwork);
     
     // start loading immediately unless instructed otherwise
     if (!delayLoad) {    
@@ -126,6 +276,9 @@ Resource::Resource(const QUrl& url, bool delayLoad) :
 }
 
 Resource::~Resource() {
+    if (_queueIndex != -1) {
+        ResourceCache::dequeueRequest(ResourceCache::_hostRequests.find(getHost()).value(), this);
+    }
     if (_reply) {
         ResourceCache::requestCompleted(this);
         delete _reply;
@@ -141,6 +294,7 @@ void Resource::ensureLoading() {
 void Resource::setLoadPriority(const QPointer<QObject>& owner, float priority) {
     if (!(_failedToLoad || _loaded)) {
         _loadPriorities.insert(owner, priority);
+        ResourceCache::requestPriorityChanged(this);
     }
 }
 
@@ -152,11 +306,13 @@ void Resource::setLoadPriorities(const QHash<QPointer<QObject>, float>& prioriti
             it != priorities.constEnd(); it++) {
         _loadPriorities.insert(it.key(), it.value());
     }
+    ResourceCache::requestPriorityChanged(this);
 }
 
 void Resource::clearLoadPriority(const QPointer<QObject>& owner) {
     if (!(_failedToLoad || _loaded)) {
         _loadPriorities.remove(owner);
+        ResourceCache::requestPriorityChanged(this);
     }
 }
 
@@ -206,6 +362,14 @@ void Resource::reinsert() {
     _cache->_resources.insert(_url, _self);
 }
 
+void Resource::setBytes(qint64 bytes) {
+    // keep the cache's total straight if we're sitting in its unused list
+    if (_cache && _cache->_unusedResources.value(_lruKey).data() == this) {
+        _cache->_unusedResourcesSize += bytes - _bytes;
+    }
+    _bytes = bytes;
+}
+
 const int REPLY_TIMEOUT_MS = 5000;
 
 void Resource::handleDownloadProgress(qint64 bytesReceived, qint64 bytesTotal) {
@@ -215,6 +379,7 @@ void Resource::handleDownloadProgress(qint64 bytesReceived, qint64 bytesTotal) {
         _replyTimer->start(REPLY_TIMEOUT_MS);
         return;
     }
+    setBytes(qMax(bytesReceived, _bytesReceived));
     _reply->disconnect(this);
     QNetworkReply* reply = _reply;
     _reply = NULL;
@@ -249,6 +414,17 @@ void Resource::makeRequest() {
     _bytesReceived = _bytesTotal = 0;
 }
 
+void Resource::cancelRequest() {
+    _reply->disconnect(this);
+    _reply->abort();
+    _reply->deleteLater();
+    _reply = NULL;
+    _replyTimer->disconnect(this);
+    _replyTimer->deleteLater();
+    _replyTimer = NULL;
+    _bytesReceived = _bytesTotal = 0;
+}
+
 void Resource::handleReplyError(QNetworkReply::NetworkError error, QDebug debug) {
     _reply->disconnect(this);
     _reply->deleteLater();
@@ -18,8 +18,10 @@
 #include <QNetworkRequest>
 #include <QObject>
 #include <QPointer>
+#include <QSet>
 #include <QSharedPointer>
 #include <QUrl>
+#include <QVector>
 #include <QWeakPointer>
 
 class QNetworkAccessManager;
@@ -28,6 +30,8 @@ class QTimer;
 
 class Resource;
 
+const qint64 DEFAULT_UNUSED_MAX_SIZE = 100 * 1024 * 1024;
+
 /// Base class for resource caches.
 class ResourceCache : public QObject {
     Q_OBJECT
@@ -37,16 +41,23 @@ public:
     static void setNetworkAccessManager(QNetworkAccessManager* manager) { _networkAccessManager = manager; }
     static QNetworkAccessManager* getNetworkAccessManager() { return _networkAccessManager; }
 
+    /// Sets the number of requests that may be in flight to any one host at once.
     static void setRequestLimit(int limit) { _requestLimit = limit; }
     static int getRequestLimit() { return _requestLimit; }
 
     static const QList<Resource*>& getLoadingRequests() { return _loadingRequests; }
 
-    static int getPendingRequestCount() { return _pendingRequests.size(); }
+    static int getPendingRequestCount() { return _pendingRequestCount; }
 
     ResourceCache(QObject* parent = NULL);
     virtual ~ResourceCache();
 
+    /// Sets the number of bytes' worth of resources no longer in use to keep around in case they're wanted again.
+    void setUnusedResourceCacheSize(qint64 unusedResourcesMaxSize);
+    qint64 getUnusedResourceCacheSize() const { return _unusedResourcesMaxSize; }
+
+    qint64 getUnusedResourcesSize() const { return _unusedResourcesSize; }
+
 protected:
 
     QMap<int, QSharedPointer<Resource> > _unusedResources;
@@ -63,6 +74,7 @@ protected:
         const QSharedPointer<Resource>& fallback, bool delayLoad, const void* extra) = 0;
 
     void addUnusedResource(const QSharedPointer<Resource>& resource);
+    void removeUnusedResource(const QSharedPointer<Resource>& resource);
     
     static void attemptRequest(Resource* resource);
     static void requestCompleted(Resource* resource);
@@ -70,13 +82,44 @@ protected:
 private:
     
     friend class Resource;
+    
+    /// The requests to one host: those in flight, and a binary max-heap of those waiting, ordered by the priority they
+    /// had when last placed.
+    class HostRequests {
+    public:
+        QList<Resource*> loading;
+        QVector<Resource*> pending;
+    };
+    
+    /// Starts the highest priority requests waiting for the host while there's room, and makes room by cancelling
+    /// requests in flight that are of clearly lower priority, not far along, and not themselves recently cancelled.
+    static void scheduleRequests(HostRequests& host);
+    
+    static void startRequest(HostRequests& host, Resource* resource);
+    static void enqueueRequest(HostRequests& host, Resource* resource);
+    static void dequeueRequest(HostRequests& host, Resource* resource);
+    
+    /// Called when the priority of a waiting request changes; it's only moved in the queue when next we schedule.
+    static void requestPriorityChanged(Resource* resource);
+    static void updateQueuedPriorities();
+    
+    static void siftUp(QVector<Resource*>& heap, int index);
+    static void siftDown(QVector<Resource*>& heap, int index);
 
     QHash<QUrl, QWeakPointer<Resource> > _resources;
     int _lastLRUKey;
     
+    qint64 _unusedResourcesMaxSize;
+    qint64 _unusedResourcesSize;
+    
+    /// Unloads the least recently used unused resources until there's room for the specified number of bytes.
+    void reserveUnusedResourceSpace(qint64 bytes);
+    
     static QNetworkAccessManager* _networkAccessManager;
     static int _requestLimit;
-    static QList<QPointer<Resource> > _pendingRequests;
+    static QHash<QString, HostRequests> _hostRequests;
+    static QSet<Resource*> _reprioritizedRequests;
+    static int _pendingRequestCount;
     static QList<Resource*> _loadingRequests;
 };
 
@@ -116,6 +159,9 @@ public:
     /// For loading resources, returns the number of total bytes (or zero if unknown).
     qint64 getBytesTotal() const { return _bytesTotal; }
 
+    /// Returns the number of bytes the resource accounts for in the cache, by default the size of what was downloaded.
+    qint64 getBytes() const { return _bytes; }
+
     /// For loading resources, returns the load progress.
     float getProgress() const { return (_bytesTotal == 0) ? 0.0f : (float)_bytesReceived / _bytesTotal; }
 
@@ -134,12 +180,17 @@ protected:
     /// Called when the download has finished.  The recipient should delete the reply when done with it.
     virtual void downloadFinished(QNetworkReply* reply) = 0;
 
-    /// Should be called by subclasses when all the loading that will be done has been done.
-    Q_INVOKABLE void finishedLoading(bool success);
+    /// Should be called by subclasses when all the loading that will be done has been done.  Also called when a request
+    /// fails for good, which subclasses that request resources again after loading them may want to intercept.
+    Q_INVOKABLE virtual void finishedLoading(bool success);
 
     /// Reinserts this resource into the cache.
     virtual void reinsert();
 
+    /// Sets the number of bytes the resource accounts for, for subclasses whose loaded form differs in size from the
+    /// downloaded one.
+    void setBytes(qint64 bytes);
+
     QUrl _url;
     QNetworkRequest _request;
     bool _startedLoading;
@@ -162,6 +213,12 @@ private:
     
     void makeRequest();
     
+    /// Abandons the request in flight so that it can be made again later.
+    void cancelRequest();
+    
+    /// Returns the name of the host whose request limit applies to the resource.
+    QString getHost() const { return _url.host(); }
+    
     void handleReplyError(QNetworkReply::NetworkError error, QDebug debug);
     
     friend class ResourceCache;
@@ -169,9 +226,12 @@ private:
     int _lruKey;
     QNetworkReply* _reply;
     QTimer* _replyTimer;
-    int _index;
+    int _queueIndex;
+    float _queuedPriority;
+    quint64 _lastPreempted;
     qint64 _bytesReceived;
     qint64 _bytesTotal;
+    qint64 _bytes;
     int _attempts;
 };
 
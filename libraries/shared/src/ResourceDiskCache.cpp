@@ -0,0 +1,326 @@
+//
+//  ResourceDiskCache.cpp
+//  libraries/shared/src
+//
+//  Created by Andrzej Kapolka on 5/24/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtDebug>
+
+#include "ResourceDiskCache.h"
+
+static const quint32 INDEX_MAGIC = 0x48524443;
+static const quint32 INDEX_VERSION = 1;
+
+static const QString INDEX_FILENAME = "index";
+static const QString CONTENT_DIRECTORY = "content";
+
+/// How long after a change we wait before writing the index, so that bursts of inserts only write it once.
+const int INDEX_SAVE_DELAY_MSECS = 2000;
+
+ResourceDiskCache::ResourceDiskCache(const QString& directory, qint64 maximumSize, QObject* parent) :
+    QAbstractNetworkCache(parent),
+    _directory(directory),
+    _maximumSize(maximumSize),
+    _size(0),
+    _lastUse(0) {
+    
+    _saveTimer.setSingleShot(true);
+    connect(&_saveTimer, SIGNAL(timeout()), SLOT(saveIndex()));
+    
+    QDir().mkpath(_directory + "/" + CONTENT_DIRECTORY);
+    loadIndex();
+}
+
+ResourceDiskCache::~ResourceDiskCache() {
+    foreach (QIODevice* device, _preparedDevices.keys()) {
+        delete device;
+    }
+    if (_saveTimer.isActive()) {
+        saveIndex();
+    }
+}
+
+void ResourceDiskCache::setMaximumCacheSize(qint64 maximumSize) {
+    _maximumSize = maximumSize;
+    evict();
+}
+
+QNetworkCacheMetaData ResourceDiskCache::metaData(const QUrl& url) {
+    return _entries.value(url).metaData;
+}
+
+void ResourceDiskCache::updateMetaData(const QNetworkCacheMetaData& metaData) {
+    // a revalidation came back unchanged; the new headers carry the new expiry
+    QHash<QUrl, Entry>::iterator it = _entries.find(metaData.url());
+    if (it == _entries.end()) {
+        return;
+    }
+    it.value().metaData = metaData;
+    touchContent(it.value().contentHash);
+    scheduleSave();
+}
+
+QIODevice* ResourceDiskCache::data(const QUrl& url) {
+    QHash<QUrl, Entry>::const_iterator it = _entries.constFind(url);
+    if (it == _entries.constEnd()) {
+        return NULL;
+    }
+    QByteArray contentHash = it.value().contentHash;
+    QFile* file = new QFile(getContentPath(contentHash));
+    if (!file->open(QIODevice::ReadOnly)) {
+        // someone removed the body out from under us
+        delete file;
+        remove(url);
+        return NULL;
+    }
+    touchContent(contentHash);
+    return file;
+}
+
+bool ResourceDiskCache::remove(const QUrl& url) {
+    // drop anything still being downloaded for the URL
+    for (QHash<QIODevice*, QNetworkCacheMetaData>::iterator it = _preparedDevices.begin();
+            it != _preparedDevices.end(); ) {
+        if (it.value().url() == url) {
+            delete it.key();
+            it = _preparedDevices.erase(it);
+        } else {
+            it++;
+        }
+    }
+    QHash<QUrl, Entry>::iterator it = _entries.find(url);
+    if (it == _entries.end()) {
+        return false;
+    }
+    QByteArray contentHash = it.value().contentHash;
+    _entries.erase(it);
+    detachEntry(url, contentHash);
+    scheduleSave();
+    return true;
+}
+
+QIODevice* ResourceDiskCache::prepare(const QNetworkCacheMetaData& metaData) {
+    if (!metaData.isValid() || !metaData.url().isValid() || !metaData.saveToDisk()) {
+        return NULL;
+    }
+    // don't bother buffering anything we've been told won't fit
+    foreach (const QNetworkCacheMetaData::RawHeader& header, metaData.rawHeaders()) {
+        if (header.first.toLower() == "content-length" && header.second.toLongLong() > _maximumSize) {
+            return NULL;
+        }
+    }
+    QBuffer* buffer = new QBuffer();
+    buffer->open(QIODevice::ReadWrite);
+    _preparedDevices.insert(buffer, metaData);
+    return buffer;
+}
+
+void ResourceDiskCache::insert(QIODevice* device) {
+    QHash<QIODevice*, QNetworkCacheMetaData>::iterator prepared = _preparedDevices.find(device);
+    if (prepared == _preparedDevices.end()) {
+        qWarning() << "Tried to insert a device that wasn't prepared by ResourceDiskCache.";
+        return;
+    }
+    QNetworkCacheMetaData metaData = prepared.value();
+    _preparedDevices.erase(prepared);
+    QByteArray data = static_cast<QBuffer*>(device)->data();
+    delete device;
+    
+    if (data.size() > _maximumSize) {
+        remove(metaData.url());
+        return;
+    }
+    QByteArray contentHash = QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+    
+    // the same body may already be there under another URL
+    if (!_contents.contains(contentHash)) {
+        QSaveFile file(getContentPath(contentHash));
+        if (!(file.open(QIODevice::WriteOnly) && file.write(data) == data.size() && file.commit())) {
+            qWarning() << "Failed to write cached body for" << metaData.url() << file.errorString();
+            remove(metaData.url());
+            return;
+        }
+        Content newContent;
+        newContent.size = data.size();
+        newContent.lastUsed = 0;
+        _contents.insert(contentHash, newContent);
+        _size += newContent.size;
+    }
+    
+    QUrl url = metaData.url();
+    QByteArray previousHash = _entries.value(url).contentHash;
+    if (previousHash != contentHash) {
+        if (!previousHash.isEmpty()) {
+            detachEntry(url, previousHash);
+        }
+        _contents[contentHash].urls.append(url);
+    }
+    Entry& entry = _entries[url];
+    entry.contentHash = contentHash;
+    entry.metaData = metaData;
+    touchContent(contentHash);
+    
+    evict();
+    scheduleSave();
+}
+
+void ResourceDiskCache::clear() {
+    foreach (const QByteArray& contentHash, _contents.keys()) {
+        QFile::remove(getContentPath(contentHash));
+    }
+    _entries.clear();
+    _contents.clear();
+    _contentsByUse.clear();
+    _size = 0;
+    saveIndex();
+}
+
+void ResourceDiskCache::saveIndex() {
+    _saveTimer.stop();
+    
+    QSaveFile file(_directory + "/" + INDEX_FILENAME);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Failed to save resource cache index:" << file.errorString();
+        return;
+    }
+    QDataStream out(&file);
+    out << INDEX_MAGIC << INDEX_VERSION;
+    
+    out << (quint32)_contents.size();
+    for (QHash<QByteArray, Content>::const_iterator it = _contents.constBegin(); it != _contents.constEnd(); it++) {
+        out << it.key() << it.value().size << it.value().lastUsed;
+    }
+    out << (quint32)_entries.size();
+    for (QHash<QUrl, Entry>::const_iterator it = _entries.constBegin(); it != _entries.constEnd(); it++) {
+        out << it.key() << it.value().contentHash << it.value().metaData;
+    }
+    if (!file.commit()) {
+        qWarning() << "Failed to save resource cache index:" << file.errorString();
+    }
+}
+
+void ResourceDiskCache::loadIndex() {
+    QFile file(_directory + "/" + INDEX_FILENAME);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    QDataStream in(&file);
+    quint32 magic, version;
+    in >> magic >> version;
+    if (magic != INDEX_MAGIC || version != INDEX_VERSION) {
+        qDebug() << "Ignoring resource cache index of unknown version.";
+        return;
+    }
+    
+    quint32 contentCount;
+    in >> contentCount;
+    for (quint32 i = 0; i < contentCount && in.status() == QDataStream::Ok; i++) {
+        QByteArray contentHash;
+        Content content;
+        in >> contentHash >> content.size >> content.lastUsed;
+        
+        // only keep bodies that are still there, and still the size we wrote
+        if (QFileInfo(getContentPath(contentHash)).size() != content.size) {
+            continue;
+        }
+        _contents.insert(contentHash, content);
+        _contentsByUse.insert(content.lastUsed, contentHash);
+        _size += content.size;
+        _lastUse = qMax(_lastUse, content.lastUsed);
+    }
+    
+    quint32 entryCount;
+    in >> entryCount;
+    for (quint32 i = 0; i < entryCount && in.status() == QDataStream::Ok; i++) {
+        QUrl url;
+        Entry entry;
+        in >> url >> entry.contentHash >> entry.metaData;
+        
+        QHash<QByteArray, Content>::iterator content = _contents.find(entry.contentHash);
+        if (content != _contents.end()) {
+            content.value().urls.append(url);
+            _entries.insert(url, entry);
+        }
+    }
+    if (in.status() != QDataStream::Ok) {
+        qWarning() << "Resource cache index was truncated; keeping what could be read.";
+    }
+    
+    // bodies that no entry refers to (say, from a crash between writing one and saving the index) are just dead weight
+    foreach (const QByteArray& contentHash, _contents.keys()) {
+        if (_contents.value(contentHash).urls.isEmpty()) {
+            removeContent(contentHash);
+        }
+    }
+    evict();
+}
+
+void ResourceDiskCache::scheduleSave() {
+    if (!_saveTimer.isActive()) {
+        _saveTimer.start(INDEX_SAVE_DELAY_MSECS);
+    }
+}
+
+QString ResourceDiskCache::getContentPath(const QByteArray& contentHash) const {
+    return _directory + "/" + CONTENT_DIRECTORY + "/" + QString::fromLatin1(contentHash);
+}
+
+void ResourceDiskCache::touchContent(const QByteArray& contentHash) {
+    QHash<QByteArray, Content>::iterator it = _contents.find(contentHash);
+    if (it == _contents.end()) {
+        return;
+    }
+    if (it.value().lastUsed != 0) {
+        _contentsByUse.remove(it.value().lastUsed);
+    }
+    it.value().lastUsed = ++_lastUse;
+    _contentsByUse.insert(it.value().lastUsed, contentHash);
+}
+
+void ResourceDiskCache::detachEntry(const QUrl& url, const QByteArray& contentHash) {
+    QHash<QByteArray, Content>::iterator it = _contents.find(contentHash);
+    if (it == _contents.end()) {
+        return;
+    }
+    it.value().urls.removeOne(url);
+    if (it.value().urls.isEmpty()) {
+        removeContent(contentHash);
+    }
+}
+
+void ResourceDiskCache::removeContent(const QByteArray& contentHash) {
+    QHash<QByteArray, Content>::iterator it = _contents.find(contentHash);
+    if (it == _contents.end()) {
+        return;
+    }
+    foreach (const QUrl& url, it.value().urls) {
+        _entries.remove(url);
+    }
+    _contentsByUse.remove(it.value().lastUsed);
+    _size -= it.value().size;
+    _contents.erase(it);
+    QFile::remove(getContentPath(contentHash));
+}
+
+void ResourceDiskCache::evict() {
+    bool evicted = false;
+    while (_size > _maximumSize && !_contentsByUse.isEmpty()) {
+        removeContent(_contentsByUse.begin().value());
+        evicted = true;
+    }
+    if (evicted) {
+        scheduleSave();
+    }
+}
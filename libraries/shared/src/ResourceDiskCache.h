@@ -0,0 +1,104 @@
+//
+//  ResourceDiskCache.h
+//  libraries/shared/src
+//
+//  Created by Andrzej Kapolka on 5/24/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_ResourceDiskCache_h
+#define hifi_ResourceDiskCache_h
+
+#include <QAbstractNetworkCache>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QTimer>
+#include <QUrl>
+
+const qint64 DEFAULT_RESOURCE_DISK_CACHE_SIZE = 512 * 1024 * 1024;
+
+/// A disk cache for QNetworkAccessManager that stores each distinct body once, named by the hash of its content, so that
+/// a file served from several URLs only takes up the space of one. Bodies are evicted least recently used first once
+/// their total passes the maximum size. QNetworkAccessManager revalidates the entries that have gone stale using their
+/// ETag or Last-Modified date, and only downloads again the ones that have changed.
+class ResourceDiskCache : public QAbstractNetworkCache {
+    Q_OBJECT
+
+public:
+    
+    ResourceDiskCache(const QString& directory, qint64 maximumSize = DEFAULT_RESOURCE_DISK_CACHE_SIZE,
+        QObject* parent = NULL);
+    virtual ~ResourceDiskCache();
+    
+    const QString& getDirectory() const { return _directory; }
+    
+    void setMaximumCacheSize(qint64 maximumSize);
+    qint64 getMaximumCacheSize() const { return _maximumSize; }
+    
+    /// Returns the number of distinct bodies stored.
+    int getContentCount() const { return _contents.size(); }
+    
+    virtual QNetworkCacheMetaData metaData(const QUrl& url);
+    virtual void updateMetaData(const QNetworkCacheMetaData& metaData);
+    virtual QIODevice* data(const QUrl& url);
+    virtual bool remove(const QUrl& url);
+    virtual qint64 cacheSize() const { return _size; }
+    virtual QIODevice* prepare(const QNetworkCacheMetaData& metaData);
+    virtual void insert(QIODevice* device);
+    
+public slots:
+    
+    virtual void clear();
+    
+    /// Writes the index of entries to disk, which otherwise happens shortly after they change.
+    void saveIndex();
+    
+private:
+    
+    class Entry {
+    public:
+        QNetworkCacheMetaData metaData;
+        QByteArray contentHash;
+    };
+    
+    class Content {
+    public:
+        qint64 size;
+        quint64 lastUsed;
+        QList<QUrl> urls;
+    };
+    
+    void loadIndex();
+    void scheduleSave();
+    
+    QString getContentPath(const QByteArray& contentHash) const;
+    
+    /// Marks a body as just used, for the eviction order.
+    void touchContent(const QByteArray& contentHash);
+    
+    /// Detaches an entry from its body, removing the body if nothing else refers to it.
+    void detachEntry(const QUrl& url, const QByteArray& contentHash);
+    void removeContent(const QByteArray& contentHash);
+    
+    /// Evicts the least recently used bodies until the total fits.
+    void evict();
+    
+    QString _directory;
+    qint64 _maximumSize;
+    qint64 _size;
+    
+    QHash<QUrl, Entry> _entries;
+    QHash<QByteArray, Content> _contents;
+    QMap<quint64, QByteArray> _contentsByUse;
+    quint64 _lastUse;
+    
+    QHash<QIODevice*, QNetworkCacheMetaData> _preparedDevices;
+    
+    QTimer _saveTimer;
+};
+
+#endif // hifi_ResourceDiskCache_h
@@ -0,0 +1,100 @@
+//
+//  ShapeBatch.cpp
+//  libraries/shared/src
+//
+//  Created by Andrew Meadows on 05/23/2014.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include "ShapeBatch.h"
+
+ShapeBatch::ShapeBatch() {
+}
+
+void ShapeBatch::clear() {
+    _sphereX.resize(0);
+    _sphereY.resize(0);
+    _sphereZ.resize(0);
+    _sphereRadius.resize(0);
+    _sphereIndices.resize(0);
+
+    _capsuleX.resize(0);
+    _capsuleY.resize(0);
+    _capsuleZ.resize(0);
+    _capsuleAxisX.resize(0);
+    _capsuleAxisY.resize(0);
+    _capsuleAxisZ.resize(0);
+    _capsuleHalfHeight.resize(0);
+    _capsuleRadius.resize(0);
+    _capsuleIndices.resize(0);
+
+    _shapes.resize(0);
+}
+
+void ShapeBatch::addShape(const Shape* shape) {
+    int type = shape->getType();
+    if (type == Shape::SPHERE_SHAPE) {
+        int sphereIndex = _sphereIndices.size();
+        _sphereX.resize(sphereIndex + 1);
+        _sphereY.resize(sphereIndex + 1);
+        _sphereZ.resize(sphereIndex + 1);
+        _sphereRadius.resize(sphereIndex + 1);
+        _sphereIndices.append(_shapes.size());
+        _shapes.append(shape);
+        setSphere(sphereIndex, static_cast<const SphereShape*>(shape));
+
+    } else if (type == Shape::CAPSULE_SHAPE) {
+        int capsuleIndex = _capsuleIndices.size();
+        _capsuleX.resize(capsuleIndex + 1);
+        _capsuleY.resize(capsuleIndex + 1);
+        _capsuleZ.resize(capsuleIndex + 1);
+        _capsuleAxisX.resize(capsuleIndex + 1);
+        _capsuleAxisY.resize(capsuleIndex + 1);
+        _capsuleAxisZ.resize(capsuleIndex + 1);
+        _capsuleHalfHeight.resize(capsuleIndex + 1);
+        _capsuleRadius.resize(capsuleIndex + 1);
+        _capsuleIndices.append(_shapes.size());
+        _shapes.append(shape);
+        setCapsule(capsuleIndex, static_cast<const CapsuleShape*>(shape));
+
+    } else if (type == Shape::LIST_SHAPE) {
+        const ListShape* list = static_cast<const ListShape*>(shape);
+        for (int i = 0; i < list->size(); i++) {
+            addShape(list->getSubShape(i));
+        }
+    }
+}
+
+void ShapeBatch::updateTransforms() {
+    for (int i = 0; i < _sphereIndices.size(); i++) {
+        setSphere(i, static_cast<const SphereShape*>(_shapes.at(_sphereIndices.at(i))));
+    }
+    for (int i = 0; i < _capsuleIndices.size(); i++) {
+        setCapsule(i, static_cast<const CapsuleShape*>(_shapes.at(_capsuleIndices.at(i))));
+    }
+}
+
+void ShapeBatch::setSphere(int sphereIndex, const SphereShape* sphere) {
+    const glm::vec3& position = sphere->getPosition();
+    _sphereX[sphereIndex] = position.x;
+    _sphereY[sphereIndex] = position.y;
+    _sphereZ[sphereIndex] = position.z;
+    _sphereRadius[sphereIndex] = sphere->getRadius();
+}
+
+void ShapeBatch::setCapsule(int capsuleIndex, const CapsuleShape* capsule) {
+    const glm::vec3& position = capsule->getPosition();
+    glm::vec3 axis;
+    capsule->computeNormalizedAxis(axis);
+    _capsuleX[capsuleIndex] = position.x;
+    _capsuleY[capsuleIndex] = position.y;
+    _capsuleZ[capsuleIndex] = position.z;
+    _capsuleAxisX[capsuleIndex] = axis.x;
+    _capsuleAxisY[capsuleIndex] = axis.y;
+    _capsuleAxisZ[capsuleIndex] = axis.z;
+    _capsuleHalfHeight[capsuleIndex] = capsule->getHalfHeight();
+    _capsuleRadius[capsuleIndex] = capsule->getRadius();
+}
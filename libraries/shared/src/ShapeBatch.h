@@ -0,0 +1,68 @@
+//
+//  ShapeBatch.h
+//  libraries/shared/src
+//
+//  Created by Andrew Meadows on 05/23/2014.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_ShapeBatch_h
+#define hifi_ShapeBatch_h
+
+#include <QVector>
+
+#include "CapsuleShape.h"
+#include "ListShape.h"
+#include "SphereShape.h"
+
+/// The spheres and capsules of a set of shapes laid out as structure-of-arrays, so that ShapeCollider can collide one
+/// shape against all of them four at a time. Lists are flattened into their sub shapes. The batch keeps pointers to the
+/// shapes: call updateTransforms() after they move, and rebuild it if they are added, removed or resized.
+class ShapeBatch {
+public:
+    ShapeBatch();
+
+    void clear();
+
+    /// adds a sphere, a capsule or the sub shapes of a list, other shapes are ignored
+    void addShape(const Shape* shape);
+
+    /// re-reads the positions and rotations of the shapes
+    void updateTransforms();
+
+    /// \return number of spheres and capsules in the batch, in the order they were added
+    int size() const { return _shapes.size(); }
+    const Shape* getShape(int index) const { return _shapes.at(index); }
+
+    int getSphereCount() const { return _sphereIndices.size(); }
+    int getCapsuleCount() const { return _capsuleIndices.size(); }
+
+    // spheres
+    QVector<float> _sphereX;
+    QVector<float> _sphereY;
+    QVector<float> _sphereZ;
+    QVector<float> _sphereRadius;
+    QVector<int> _sphereIndices; // index of each sphere in the batch
+
+    // capsules, as their centers, normalized axes, half heights and radii
+    QVector<float> _capsuleX;
+    QVector<float> _capsuleY;
+    QVector<float> _capsuleZ;
+    QVector<float> _capsuleAxisX;
+    QVector<float> _capsuleAxisY;
+    QVector<float> _capsuleAxisZ;
+    QVector<float> _capsuleHalfHeight;
+    QVector<float> _capsuleRadius;
+    QVector<int> _capsuleIndices; // index of each capsule in the batch
+
+private:
+    void setSphere(int sphereIndex, const SphereShape* sphere);
+    void setCapsule(int capsuleIndex, const CapsuleShape* capsule);
+
+    QVector<const Shape*> _shapes;
+};
+
+#endif // hifi_ShapeBatch_h
@@ -10,10 +10,15 @@
 //
 
 #include <iostream>
+#include <xmmintrin.h>
+
+#include <QVarLengthArray>
+#include <QtAlgorithms>
 
 #include <glm/gtx/norm.hpp>
 
 #include "GeometryUtil.h"
+#include "ShapeBatch.h"
 #include "ShapeCollider.h"
 
 // NOTE:
@@ -54,13 +59,16 @@ bool collideShapes(const Shape* shapeA, const Shape* shapeB, CollisionList& coll
 }
 
 static CollisionList tempCollisions(32);
+static ShapeBatch tempBatch;
 
 bool collideShapesCoarse(const QVector<const Shape*>& shapesA, const QVector<const Shape*>& shapesB, CollisionInfo& collision) {
     tempCollisions.clear();
+    tempBatch.clear();
+    foreach (const Shape* shapeB, shapesB) {
+        tempBatch.addShape(shapeB);
+    }
     foreach (const Shape* shapeA, shapesA) {
-        foreach (const Shape* shapeB, shapesB) {
-            ShapeCollider::collideShapes(shapeA, shapeB, tempCollisions);
-        }
+        collideShapeWithBatch(shapeA, tempBatch, tempCollisions);
     }
     if (tempCollisions.size() > 0) {
         glm::vec3 totalPenetration(0.0f);
@@ -77,6 +85,228 @@ bool collideShapesCoarse(const QVector<const Shape*>& shapesA, const QVector<con
     return false;
 }
 
+// The batch is only a filter: shapes are candidates when they come a little closer than touching, so that rounding
+// differences never drop a pair that the pairwise methods would report, and the pairwise methods have the final say.
+const float BATCH_CANDIDATE_SLACK = 1.0001f;
+const int BATCH_WIDTH = 4;
+
+/// loads four consecutive values, padding past the end of the array with zeros
+static inline __m128 loadBatch(const QVector<float>& values, int index) {
+    if (index + BATCH_WIDTH <= values.size()) {
+        return _mm_loadu_ps(values.constData() + index);
+    }
+    float tail[BATCH_WIDTH] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int i = index; i < values.size(); i++) {
+        tail[i - index] = values.at(i);
+    }
+    return _mm_loadu_ps(tail);
+}
+
+/// \return mask of the lanes of the batch starting at index that hold shapes
+static inline int laneMask(int index, int count) {
+    return (count - index >= BATCH_WIDTH) ? 0xf : (1 << (count - index)) - 1;
+}
+
+static inline __m128 dot4(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+}
+
+/// clamps values to [-limit, limit]
+static inline __m128 clamp4(__m128 value, __m128 limit) {
+    return _mm_min_ps(_mm_max_ps(value, _mm_sub_ps(_mm_setzero_ps(), limit)), limit);
+}
+
+static inline __m128 select4(__m128 mask, __m128 ifTrue, __m128 ifFalse) {
+    return _mm_or_ps(_mm_and_ps(mask, ifTrue), _mm_andnot_ps(mask, ifFalse));
+}
+
+/// squared distances from points to segments, where the segments are given by their centers, unit axes and half heights
+static inline __m128 pointSegmentDistance2(__m128 px, __m128 py, __m128 pz, __m128 cx, __m128 cy, __m128 cz,
+        __m128 ax, __m128 ay, __m128 az, __m128 halfHeight) {
+    __m128 dx = _mm_sub_ps(px, cx);
+    __m128 dy = _mm_sub_ps(py, cy);
+    __m128 dz = _mm_sub_ps(pz, cz);
+    __m128 t = clamp4(dot4(dx, dy, dz, ax, ay, az), halfHeight);
+    dx = _mm_sub_ps(dx, _mm_mul_ps(t, ax));
+    dy = _mm_sub_ps(dy, _mm_mul_ps(t, ay));
+    dz = _mm_sub_ps(dz, _mm_mul_ps(t, az));
+    return dot4(dx, dy, dz, dx, dy, dz);
+}
+
+/// squared distances between the closest points of two sets of segments (after Ericson's closest points of segments)
+static inline __m128 segmentSegmentDistance2(__m128 cAx, __m128 cAy, __m128 cAz, __m128 aAx, __m128 aAy, __m128 aAz,
+        __m128 halfHeightA, __m128 cBx, __m128 cBy, __m128 cBz, __m128 aBx, __m128 aBy, __m128 aBz, __m128 halfHeightB) {
+    __m128 rx = _mm_sub_ps(cAx, cBx);
+    __m128 ry = _mm_sub_ps(cAy, cBy);
+    __m128 rz = _mm_sub_ps(cAz, cBz);
+    __m128 b = dot4(aAx, aAy, aAz, aBx, aBy, aBz);
+    __m128 c = dot4(aAx, aAy, aAz, rx, ry, rz);
+    __m128 f = dot4(aBx, aBy, aBz, rx, ry, rz);
+
+    // closest approach of the lines, or the center of A for parallel segments
+    __m128 epsilon = _mm_set1_ps(EPSILON);
+    __m128 denominator = _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(b, b));
+    __m128 notParallel = _mm_cmpgt_ps(denominator, epsilon);
+    __m128 s = _mm_div_ps(_mm_sub_ps(_mm_mul_ps(b, f), c), _mm_max_ps(denominator, epsilon));
+    s = clamp4(_mm_and_ps(notParallel, s), halfHeightA);
+
+    // the closest point of B to that, and if B had to be clamped the closest point of A to B's end
+    __m128 t = _mm_add_ps(_mm_mul_ps(b, s), f);
+    __m128 clampedT = clamp4(t, halfHeightB);
+    __m128 sFromT = clamp4(_mm_sub_ps(_mm_mul_ps(b, clampedT), c), halfHeightA);
+    s = select4(_mm_cmpneq_ps(t, clampedT), sFromT, s);
+
+    __m128 dx = _mm_sub_ps(_mm_add_ps(rx, _mm_mul_ps(s, aAx)), _mm_mul_ps(clampedT, aBx));
+    __m128 dy = _mm_sub_ps(_mm_add_ps(ry, _mm_mul_ps(s, aAy)), _mm_mul_ps(clampedT, aBy));
+    __m128 dz = _mm_sub_ps(_mm_add_ps(rz, _mm_mul_ps(s, aAz)), _mm_mul_ps(clampedT, aBz));
+    return dot4(dx, dy, dz, dx, dy, dz);
+}
+
+/// \return mask of the lanes where distance2 is within reach of the summed radii
+static inline int candidateMask(__m128 distance2, __m128 radiusA, __m128 radiusB) {
+    __m128 totalRadius = _mm_add_ps(radiusA, radiusB);
+    __m128 reach2 = _mm_mul_ps(_mm_mul_ps(totalRadius, totalRadius), _mm_set1_ps(BATCH_CANDIDATE_SLACK));
+    return _mm_movemask_ps(_mm_cmple_ps(distance2, reach2));
+}
+
+typedef QVarLengthArray<int, 64> CandidateList;
+
+static void appendCandidates(int mask, const QVector<int>& batchIndices, int index, CandidateList& candidates) {
+    for (int lane = 0; mask != 0; lane++, mask >>= 1) {
+        if (mask & 1) {
+            candidates.append(batchIndices.at(index + lane));
+        }
+    }
+}
+
+static void findSphereCandidates(const SphereShape* sphereA, const ShapeBatch& batchB, CandidateList& candidates) {
+    const glm::vec3& position = sphereA->getPosition();
+    __m128 px = _mm_set1_ps(position.x);
+    __m128 py = _mm_set1_ps(position.y);
+    __m128 pz = _mm_set1_ps(position.z);
+    __m128 radiusA = _mm_set1_ps(sphereA->getRadius());
+
+    int numSpheres = batchB.getSphereCount();
+    for (int i = 0; i < numSpheres; i += BATCH_WIDTH) {
+        __m128 dx = _mm_sub_ps(loadBatch(batchB._sphereX, i), px);
+        __m128 dy = _mm_sub_ps(loadBatch(batchB._sphereY, i), py);
+        __m128 dz = _mm_sub_ps(loadBatch(batchB._sphereZ, i), pz);
+        __m128 distance2 = dot4(dx, dy, dz, dx, dy, dz);
+        int mask = candidateMask(distance2, radiusA, loadBatch(batchB._sphereRadius, i)) & laneMask(i, numSpheres);
+        appendCandidates(mask, batchB._sphereIndices, i, candidates);
+    }
+
+    int numCapsules = batchB.getCapsuleCount();
+    for (int i = 0; i < numCapsules; i += BATCH_WIDTH) {
+        __m128 distance2 = pointSegmentDistance2(px, py, pz,
+            loadBatch(batchB._capsuleX, i), loadBatch(batchB._capsuleY, i), loadBatch(batchB._capsuleZ, i),
+            loadBatch(batchB._capsuleAxisX, i), loadBatch(batchB._capsuleAxisY, i), loadBatch(batchB._capsuleAxisZ, i),
+            loadBatch(batchB._capsuleHalfHeight, i));
+        int mask = candidateMask(distance2, radiusA, loadBatch(batchB._capsuleRadius, i)) & laneMask(i, numCapsules);
+        appendCandidates(mask, batchB._capsuleIndices, i, candidates);
+    }
+}
+
+static void findCapsuleCandidates(const CapsuleShape* capsuleA, const ShapeBatch& batchB, CandidateList& candidates) {
+    const glm::vec3& center = capsuleA->getPosition();
+    glm::vec3 axis;
+    capsuleA->computeNormalizedAxis(axis);
+    __m128 cx = _mm_set1_ps(center.x);
+    __m128 cy = _mm_set1_ps(center.y);
+    __m128 cz = _mm_set1_ps(center.z);
+    __m128 ax = _mm_set1_ps(axis.x);
+    __m128 ay = _mm_set1_ps(axis.y);
+    __m128 az = _mm_set1_ps(axis.z);
+    __m128 halfHeightA = _mm_set1_ps(capsuleA->getHalfHeight());
+    __m128 radiusA = _mm_set1_ps(capsuleA->getRadius());
+
+    int numSpheres = batchB.getSphereCount();
+    for (int i = 0; i < numSpheres; i += BATCH_WIDTH) {
+        __m128 distance2 = pointSegmentDistance2(loadBatch(batchB._sphereX, i), loadBatch(batchB._sphereY, i),
+            loadBatch(batchB._sphereZ, i), cx, cy, cz, ax, ay, az, halfHeightA);
+        int mask = candidateMask(distance2, radiusA, loadBatch(batchB._sphereRadius, i)) & laneMask(i, numSpheres);
+        appendCandidates(mask, batchB._sphereIndices, i, candidates);
+    }
+
+    // capsuleCapsule() may take its closest points up to a radius past the ends of the capsules' segments, so the
+    // segments are extended by as much here
+    __m128 extendedHalfHeightA = _mm_add_ps(halfHeightA, radiusA);
+    __m128 parallelEpsilon = _mm_set1_ps(2.0f * EPSILON);
+    __m128 slack = _mm_set1_ps(BATCH_CANDIDATE_SLACK);
+    __m128 signBit = _mm_set1_ps(-0.0f);
+    int numCapsules = batchB.getCapsuleCount();
+    for (int i = 0; i < numCapsules; i += BATCH_WIDTH) {
+        __m128 bx = loadBatch(batchB._capsuleX, i);
+        __m128 by = loadBatch(batchB._capsuleY, i);
+        __m128 bz = loadBatch(batchB._capsuleZ, i);
+        __m128 axisBx = loadBatch(batchB._capsuleAxisX, i);
+        __m128 axisBy = loadBatch(batchB._capsuleAxisY, i);
+        __m128 axisBz = loadBatch(batchB._capsuleAxisZ, i);
+        __m128 halfHeightB = loadBatch(batchB._capsuleHalfHeight, i);
+        __m128 radiusB = loadBatch(batchB._capsuleRadius, i);
+
+        __m128 distance2 = segmentSegmentDistance2(cx, cy, cz, ax, ay, az, extendedHalfHeightA,
+            bx, by, bz, axisBx, axisBy, axisBz, _mm_add_ps(halfHeightB, radiusB));
+        int mask = candidateMask(distance2, radiusA, radiusB);
+
+        // capsuleCapsule() has a looser test of its own for (nearly) parallel capsules, which also passes them here,
+        // with a margin on what counts as parallel so that rounding can't put the two tests on different sides of it
+        __m128 aDotB = dot4(ax, ay, az, axisBx, axisBy, axisBz);
+        __m128 parallel = _mm_cmple_ps(_mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(aDotB, aDotB)), parallelEpsilon);
+        int parallelMask = _mm_movemask_ps(parallel);
+        if (parallelMask) {
+            __m128 dx = _mm_sub_ps(bx, cx);
+            __m128 dy = _mm_sub_ps(by, cy);
+            __m128 dz = _mm_sub_ps(bz, cz);
+            __m128 axialDistance = dot4(dx, dy, dz, axisBx, axisBy, axisBz);
+            dx = _mm_sub_ps(dx, _mm_mul_ps(axialDistance, axisBx));
+            dy = _mm_sub_ps(dy, _mm_mul_ps(axialDistance, axisBy));
+            dz = _mm_sub_ps(dz, _mm_mul_ps(axialDistance, axisBz));
+            __m128 totalRadius = _mm_add_ps(radiusA, radiusB);
+            __m128 axialReach = _mm_mul_ps(_mm_add_ps(totalRadius, _mm_add_ps(halfHeightA, halfHeightB)), slack);
+            __m128 withinReach = _mm_and_ps(_mm_cmple_ps(_mm_andnot_ps(signBit, axialDistance), axialReach),
+                _mm_cmple_ps(dot4(dx, dy, dz, dx, dy, dz), _mm_mul_ps(_mm_mul_ps(totalRadius, totalRadius), slack)));
+            mask |= _mm_movemask_ps(withinReach) & parallelMask;
+        }
+        appendCandidates(mask & laneMask(i, numCapsules), batchB._capsuleIndices, i, candidates);
+    }
+}
+
+bool collideShapeWithBatch(const Shape* shapeA, const ShapeBatch& batchB, CollisionList& collisions,
+        QVector<int>* touchedIndices) {
+    int typeA = shapeA->getType();
+    if (typeA == Shape::LIST_SHAPE) {
+        const ListShape* listA = static_cast<const ListShape*>(shapeA);
+        bool touching = false;
+        for (int i = 0; i < listA->size() && !collisions.isFull(); ++i) {
+            touching = collideShapeWithBatch(listA->getSubShape(i), batchB, collisions, touchedIndices) || touching;
+        }
+        return touching;
+    }
+
+    CandidateList candidates;
+    if (typeA == Shape::SPHERE_SHAPE) {
+        findSphereCandidates(static_cast<const SphereShape*>(shapeA), batchB, candidates);
+    } else if (typeA == Shape::CAPSULE_SHAPE) {
+        findCapsuleCandidates(static_cast<const CapsuleShape*>(shapeA), batchB, candidates);
+    } else {
+        return false;
+    }
+
+    // the spheres and capsules were searched separately, resolve them in the order they were added to the batch
+    qSort(candidates.begin(), candidates.end());
+    bool touching = false;
+    for (int i = 0; i < candidates.size() && !collisions.isFull(); ++i) {
+        if (collideShapes(shapeA, batchB.getShape(candidates[i]), collisions)) {
+            touching = true;
+            if (touchedIndices) {
+                touchedIndices->append(candidates[i]);
+            }
+        }
+    }
+    return touching;
+}
+
 bool sphereSphere(const SphereShape* sphereA, const SphereShape* sphereB, CollisionList& collisions) {
     glm::vec3 BA = sphereB->getPosition() - sphereA->getPosition();
     float distanceSquared = glm::dot(BA, BA);
@@ -309,7 +539,7 @@ bool capsuleCapsule(const CapsuleShape* capsuleA, const CapsuleShape* capsuleB,
         // capsules are approximiately parallel but might still collide
         glm::vec3 BA = centerB - centerA;
         float axialDistance = glm::dot(BA, axisB);
-        if (axialDistance > totalRadius + capsuleA->getHalfHeight() + capsuleB->getHalfHeight()) {
+        if (fabs(axialDistance) > totalRadius + capsuleA->getHalfHeight() + capsuleB->getHalfHeight()) {
             return false;
         }
         BA = BA - axialDistance * axisB;     // BA now points from centerA to axisB (perp to axis)
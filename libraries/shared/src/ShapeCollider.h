@@ -18,6 +18,8 @@
 #include "SharedUtil.h" 
 #include "SphereShape.h"
 
+class ShapeBatch;
+
 namespace ShapeCollider {
 
     /// \param shapeA pointer to first shape
@@ -32,6 +34,17 @@ namespace ShapeCollider {
     /// \return true if any shapes collide
     bool collideShapesCoarse(const QVector<const Shape*>& shapesA, const QVector<const Shape*>& shapesB, CollisionInfo& collision);
 
+    /// Collides one shape with every shape of a batch. The batch is tested for overlap four shapes at a time, and only the
+    /// shapes that might touch shapeA go through the pairwise methods, so the collisions are the same as those of
+    /// collideShapes() with each of them, in batch order.
+    /// \param shapeA pointer to the shape
+    /// \param batchB the shapes to collide it with
+    /// \param[out] collisions where to append collision details
+    /// \param[out] touchedIndices if not NULL, where to append the batch index of the shape of each appended collision
+    /// \return true if shapeA touches any of them
+    bool collideShapeWithBatch(const Shape* shapeA, const ShapeBatch& batchB, CollisionList& collisions,
+        QVector<int>* touchedIndices = NULL);
+
     /// \param sphereA pointer to first shape
     /// \param sphereB pointer to second shape
     /// \param[out] collisions where to append collision details
@@ -63,10 +63,22 @@ void ThreadedAssignment::addPacketStatsAndSendStatsPacket(QJsonObject &statsObje
     
     float packetsPerSecond, bytesPerSecond;
     nodeList->getPacketStats(packetsPerSecond, bytesPerSecond);
+    
+    float receiveSyscallsPerSecond, sendSyscallsPerSecond;
+    nodeList->getSyscallStats(receiveSyscallsPerSecond, sendSyscallsPerSecond);
     nodeList->resetPacketStats();
     
     statsObject["packets_per_second"] = packetsPerSecond;
     statsObject["bytes_per_second"] = bytesPerSecond;
+    statsObject["receive_syscalls_per_second"] = receiveSyscallsPerSecond;
+    statsObject["send_syscalls_per_second"] = sendSyscallsPerSecond;
+    
+    float allocationsPerSecond, reusesPerSecond;
+    nodeList->getPacketBufferPool().getAllocationStats(allocationsPerSecond, reusesPerSecond);
+    nodeList->getPacketBufferPool().resetAllocationStats();
+    
+    statsObject["packet_buffer_allocations_per_second"] = allocationsPerSecond;
+    statsObject["packet_buffer_reuses_per_second"] = reusesPerSecond;
     
     nodeList->sendStatsToDomainServer(statsObject);
 }
@@ -85,14 +97,5 @@ void ThreadedAssignment::checkInWithDomainServerOrExit() {
 }
 
 bool ThreadedAssignment::readAvailableDatagram(QByteArray& destinationByteArray, HifiSockAddr& senderSockAddr) {
-    NodeList* nodeList = NodeList::getInstance();
-    
-    if (nodeList->getNodeSocket().hasPendingDatagrams()) {
-        destinationByteArray.resize(nodeList->getNodeSocket().pendingDatagramSize());
-        nodeList->getNodeSocket().readDatagram(destinationByteArray.data(), destinationByteArray.size(),
-                                               senderSockAddr.getAddressPointer(), senderSockAddr.getPortPointer());
-        return true;
-    } else {
-        return false;
-    }
+    return NodeList::getInstance()->readDatagram(destinationByteArray, senderSockAddr);
 }
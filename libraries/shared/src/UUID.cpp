@@ -9,9 +9,27 @@
 //  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
 //
 
+#include <cstring>
+
+#include <QtCore/QtEndian>
+
 #include "UUID.h"
 
 QString uuidStringWithoutCurlyBraces(const QUuid& uuid) {
     QString uuidStringNoBraces = uuid.toString().mid(1, uuid.toString().length() - 2);
     return uuidStringNoBraces;
 }
+
+int packRfc4122UUID(const QUuid& uuid, char* destination) {
+    uchar* position = reinterpret_cast<uchar*>(destination);
+    
+    qToBigEndian(uuid.data1, position);
+    position += sizeof(uuid.data1);
+    qToBigEndian(uuid.data2, position);
+    position += sizeof(uuid.data2);
+    qToBigEndian(uuid.data3, position);
+    position += sizeof(uuid.data3);
+    memcpy(position, uuid.data4, sizeof(uuid.data4));
+    
+    return NUM_BYTES_RFC4122_UUID;
+}
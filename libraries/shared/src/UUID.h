@@ -18,4 +18,8 @@ const int NUM_BYTES_RFC4122_UUID = 16;
 
 QString uuidStringWithoutCurlyBraces(const QUuid& uuid);
 
+/// Writes the RFC 4122 form of the UUID to destination without allocating a QByteArray (see QUuid::toRfc4122).
+/// \return the number of bytes written
+int packRfc4122UUID(const QUuid& uuid, char* destination);
+
 #endif // hifi_UUID_h
@@ -9,11 +9,17 @@
 //  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
 //
 
+#include <limits.h>
 #include <stdlib.h>
 
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QThreadPool>
+
 #include <SharedUtil.h>
 
 #include <MetavoxelMessages.h>
+#include <MetavoxelPersister.h>
 
 #include "MetavoxelTests.h"
 
@@ -130,6 +136,831 @@ static bool testSerialization(Bitstream::MetadataType metadataType) {
     return false;
 }
 
+/// Fills the color attribute with random values down to a fixed granularity.
+class RandomColorVisitor : public MetavoxelVisitor {
+public:
+    
+    RandomColorVisitor(float granularity);
+    
+    virtual int visit(MetavoxelInfo& info);
+
+private:
+    
+    float _granularity;
+};
+
+RandomColorVisitor::RandomColorVisitor(float granularity) :
+    MetavoxelVisitor(QVector<AttributePointer>(), QVector<AttributePointer>() <<
+        AttributeRegistry::getInstance()->getColorAttribute()),
+    _granularity(granularity) {
+}
+
+int RandomColorVisitor::visit(MetavoxelInfo& info) {
+    if (info.size > _granularity) {
+        return DEFAULT_ORDER;
+    }
+    info.outputValues[0] = AttributeValue(_outputs.at(0), encodeInline<QRgb>(qRgba(rand(), rand(), rand(), 255)));
+    return STOP_RECURSION;
+}
+
+static QByteArray writeDelta(const MetavoxelData& data, const MetavoxelData& reference, const MetavoxelLOD& lod,
+        const MetavoxelLOD& referenceLOD, MetavoxelDeltaCache* cache) {
+    QByteArray array;
+    QDataStream outStream(&array, QIODevice::WriteOnly);
+    Bitstream out(outStream);
+    data.writeDelta(reference, referenceLOD, out, lod, cache);
+    out.flush();
+    return array;
+}
+
+/// Checks that deltas written through the cache match those written directly, whether encoded or reused.
+/// \return true if they didn't.
+static bool testDeltaCache() {
+    MetavoxelData reference;
+    const float TEST_GRANULARITY = 1.0f / 16.0f;
+    RandomColorVisitor visitor(TEST_GRANULARITY);
+    reference.guide(visitor);
+    MetavoxelData data = reference;
+    data.guide(visitor);
+    
+    MetavoxelLOD referenceLOD(glm::vec3(), 1.0f);
+    MetavoxelLOD lod(glm::vec3(0.25f, 0.25f, 0.25f), 0.5f);
+    MetavoxelDeltaCache cache;
+    
+    // a changed root, then an unchanged root that became subdivided
+    QByteArray direct = writeDelta(data, reference, lod, referenceLOD, NULL);
+    if (writeDelta(data, reference, lod, referenceLOD, &cache) != direct ||
+            writeDelta(data, reference, lod, referenceLOD, &cache) != direct) {
+        qDebug() << "Cached delta doesn't match direct delta.";
+        return true;
+    }
+    direct = writeDelta(reference, reference, lod, referenceLOD, NULL);
+    if (writeDelta(reference, reference, lod, referenceLOD, &cache) != direct ||
+            writeDelta(reference, reference, lod, referenceLOD, &cache) != direct) {
+        qDebug() << "Cached subdivision doesn't match direct subdivision.";
+        return true;
+    }
+    if (cache.getHits() != 2 || cache.getMisses() != 2) {
+        qDebug() << "Expected two hits and two misses, got" << cache.getHits() << cache.getMisses();
+        return true;
+    }
+    return false;
+}
+
+/// Compares two data sets by their contents rather than by node identity.
+static bool contentsEqual(const MetavoxelData& first, const MetavoxelData& second) {
+    QByteArray firstArray, secondArray;
+    {
+        QDataStream outStream(&firstArray, QIODevice::WriteOnly);
+        Bitstream out(outStream);
+        first.write(out);
+        out.flush();
+    }
+    {
+        QDataStream outStream(&secondArray, QIODevice::WriteOnly);
+        Bitstream out(outStream);
+        second.write(out);
+        out.flush();
+    }
+    return firstArray == secondArray;
+}
+
+static float getMegabytesPerSecond(qint64 bytes, qint64 nsecs) {
+    const float BYTES_PER_MEGABYTE = 1024.0f * 1024.0f;
+    const float NSECS_PER_SECOND = 1000000000.0f;
+    return bytes * NSECS_PER_SECOND / (BYTES_PER_MEGABYTE * qMax(nsecs, (qint64)1));
+}
+
+/// Times writing and reading a large MetavoxelData, both through a byte array (which the Bitstream accesses directly)
+/// and through a generic device.
+/// \return true if the data read back didn't match what was written.
+static bool benchmarkSerialization() {
+    MetavoxelData data;
+    const float BENCHMARK_GRANULARITY = 1.0f / 64.0f;
+    RandomColorVisitor visitor(BENCHMARK_GRANULARITY);
+    data.guide(visitor);
+    
+    const int BENCHMARK_ITERATIONS = 10;
+    QElapsedTimer timer;
+    
+    QByteArray array;
+    timer.start();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        array.clear();
+        QDataStream outStream(&array, QIODevice::WriteOnly);
+        Bitstream out(outStream);
+        data.write(out);
+        out.flush();
+    }
+    qint64 writeNsecs = timer.nsecsElapsed();
+    
+    MetavoxelData dataRead;
+    timer.restart();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        QDataStream inStream(array);
+        Bitstream in(inStream);
+        dataRead.read(in);
+    }
+    qint64 readNsecs = timer.nsecsElapsed();
+    
+    if (!contentsEqual(dataRead, data)) {
+        qDebug() << "Metavoxel data read from byte array doesn't match data written.";
+        return true;
+    }
+    qint64 totalBytes = (qint64)array.size() * BENCHMARK_ITERATIONS;
+    qDebug() << "Byte array:" << array.size() << "bytes, write" << getMegabytesPerSecond(totalBytes, writeNsecs) <<
+        "MB/s, read" << getMegabytesPerSecond(totalBytes, readNsecs) << "MB/s";
+    
+    CircularBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    timer.restart();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        buffer.seek(0);
+        QDataStream outStream(&buffer);
+        Bitstream out(outStream);
+        data.write(out);
+        out.flush();
+    }
+    writeNsecs = timer.nsecsElapsed();
+    
+    dataRead = MetavoxelData();
+    timer.restart();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        buffer.seek(0);
+        QDataStream inStream(&buffer);
+        Bitstream in(inStream);
+        dataRead.read(in);
+    }
+    readNsecs = timer.nsecsElapsed();
+    
+    if (!contentsEqual(dataRead, data)) {
+        qDebug() << "Metavoxel data read from device doesn't match data written.";
+        return true;
+    }
+    totalBytes = buffer.size() * BENCHMARK_ITERATIONS;
+    qDebug() << "Device:" << buffer.size() << "bytes, write" << getMegabytesPerSecond(totalBytes, writeNsecs) <<
+        "MB/s, read" << getMegabytesPerSecond(totalBytes, readNsecs) << "MB/s";
+    qDebug();
+    
+    return false;
+}
+
+/// Counts the voxels in the color attribute.
+class CountingVisitor : public MetavoxelVisitor {
+public:
+    
+    CountingVisitor();
+    
+    int getCount() const { return _count; }
+    
+    virtual int visit(MetavoxelInfo& info);
+
+private:
+    
+    int _count;
+};
+
+CountingVisitor::CountingVisitor() :
+    MetavoxelVisitor(QVector<AttributePointer>() << AttributeRegistry::getInstance()->getColorAttribute()),
+    _count(0) {
+}
+
+int CountingVisitor::visit(MetavoxelInfo& info) {
+    _count++;
+    return info.isLeaf ? STOP_RECURSION : DEFAULT_ORDER;
+}
+
+/// Reports the number of nodes and the memory they take for a large MetavoxelData, and times tours that read it and
+/// tours that rewrite it.
+/// \return true if the nodes weren't all released along with the data.
+static bool benchmarkNodes() {
+    int initialNodeCount = MetavoxelNode::getNodeCount();
+    int nodeCount;
+    {
+        MetavoxelData data;
+        const float BENCHMARK_GRANULARITY = 1.0f / 64.0f;
+        RandomColorVisitor writeVisitor(BENCHMARK_GRANULARITY);
+        data.guide(writeVisitor);
+        nodeCount = MetavoxelNode::getNodeCount() - initialNodeCount;
+        
+        const int BENCHMARK_ITERATIONS = 10;
+        QElapsedTimer timer;
+        CountingVisitor readVisitor;
+        timer.start();
+        for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+            data.guide(readVisitor);
+        }
+        qint64 readNsecs = timer.nsecsElapsed();
+        
+        timer.restart();
+        for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+            data.guide(writeVisitor);
+        }
+        qint64 writeNsecs = timer.nsecsElapsed();
+        
+        const float NSECS_PER_SECOND = 1000000000.0f;
+        qDebug() << nodeCount << "nodes," << (float)MetavoxelNode::getMemoryUsage() / MetavoxelNode::getNodeCount() <<
+            "bytes per node including free blocks," << sizeof(MetavoxelNode) << "bytes per leaf";
+        qDebug() << "Read tours visited" << readVisitor.getCount() * NSECS_PER_SECOND / qMax(readNsecs, (qint64)1) <<
+            "voxels/s, write tours" << nodeCount * BENCHMARK_ITERATIONS * NSECS_PER_SECOND / qMax(writeNsecs, (qint64)1) <<
+            "voxels/s";
+        qDebug();
+    }
+    if (MetavoxelNode::getNodeCount() != initialNodeCount) {
+        qDebug() << "Expected" << initialNodeCount << "nodes after releasing data, found" << MetavoxelNode::getNodeCount();
+        return true;
+    }
+    return false;
+}
+
+/// Counts the leaves in the color attribute, optionally only those overlapping a set of regions.
+class RegionCountingVisitor : public MetavoxelVisitor {
+public:
+    
+    RegionCountingVisitor(const QVector<Box>& regions = QVector<Box>());
+    
+    int getCount() const { return _count; }
+    
+    virtual int visit(MetavoxelInfo& info);
+
+private:
+    
+    QVector<Box> _regions;
+    int _count;
+};
+
+RegionCountingVisitor::RegionCountingVisitor(const QVector<Box>& regions) :
+    MetavoxelVisitor(QVector<AttributePointer>() << AttributeRegistry::getInstance()->getColorAttribute()),
+    _regions(regions),
+    _count(0) {
+}
+
+int RegionCountingVisitor::visit(MetavoxelInfo& info) {
+    if (!(_regions.isEmpty() || MetavoxelData::overlapsRegions(info.getCenter(), info.size, _regions))) {
+        return STOP_RECURSION;
+    }
+    if (!info.isLeaf) {
+        return DEFAULT_ORDER;
+    }
+    _count++;
+    return STOP_RECURSION;
+}
+
+/// Applies small deltas to a large MetavoxelData, keeping a count of its leaves up to date by touring only the regions
+/// that changed (as the client does with its points), and compares the time taken with that of a full tour.
+/// \return true if the data or the count diverged from those on the sending side.
+static bool benchmarkDeltaApplication() {
+    MetavoxelData serverData;
+    const float BENCHMARK_GRANULARITY = 1.0f / 64.0f;
+    RandomColorVisitor visitor(BENCHMARK_GRANULARITY);
+    serverData.guide(visitor);
+    
+    MetavoxelData clientData;
+    {
+        QByteArray array;
+        QDataStream outStream(&array, QIODevice::WriteOnly);
+        Bitstream out(outStream);
+        serverData.write(out);
+        out.flush();
+        
+        QDataStream inStream(array);
+        Bitstream in(inStream);
+        clientData.read(in);
+    }
+    QElapsedTimer timer;
+    timer.start();
+    RegionCountingVisitor fullVisitor;
+    clientData.guide(fullVisitor);
+    qint64 fullNsecs = timer.nsecsElapsed();
+    int leafCount = fullVisitor.getCount();
+    
+    const int DELTA_COUNT = 100;
+    qint64 applyNsecs = 0;
+    int regionCount = 0;
+    for (int i = 0; i < DELTA_COUNT; i++) {
+        // a small edit that stays within the bounds, so that the data doesn't expand
+        const float EDIT_SIZE = 1.0f / 16.0f;
+        glm::vec3 minimum = glm::vec3(randFloat(), randFloat(), randFloat()) * (1.0f - EDIT_SIZE) - glm::vec3(0.5f, 0.5f, 0.5f);
+        MetavoxelEditMessage edit = { QVariant::fromValue(BoxSetEdit(Box(minimum, minimum +
+            glm::vec3(EDIT_SIZE, EDIT_SIZE, EDIT_SIZE)), BENCHMARK_GRANULARITY,
+            OwnedAttributeValue(AttributeRegistry::getInstance()->getColorAttribute(),
+                encodeInline<QRgb>(qRgba(rand(), rand(), rand(), 255))))) };
+        MetavoxelData previousServerData = serverData;
+        edit.apply(serverData, SharedObject::getWeakHash());
+        QByteArray delta = writeDelta(serverData, previousServerData, MetavoxelLOD(), MetavoxelLOD(), NULL);
+        
+        timer.restart();
+        MetavoxelData previousClientData = clientData;
+        QDataStream inStream(delta);
+        Bitstream in(inStream);
+        clientData.readDelta(previousClientData, MetavoxelLOD(), in, MetavoxelLOD());
+        QVector<Box> regions;
+        clientData.getChangedRegions(previousClientData, regions);
+        RegionCountingVisitor previousVisitor(regions);
+        previousClientData.guide(previousVisitor);
+        RegionCountingVisitor currentVisitor(regions);
+        clientData.guide(currentVisitor);
+        applyNsecs += timer.nsecsElapsed();
+        
+        leafCount += currentVisitor.getCount() - previousVisitor.getCount();
+        regionCount += regions.size();
+    }
+    if (!contentsEqual(clientData, serverData)) {
+        qDebug() << "Metavoxel data read from deltas doesn't match data written.";
+        return true;
+    }
+    RegionCountingVisitor finalVisitor;
+    clientData.guide(finalVisitor);
+    if (finalVisitor.getCount() != leafCount) {
+        qDebug() << "Leaf count kept up to date by region was" << leafCount << ", full count" << finalVisitor.getCount();
+        return true;
+    }
+    const float NSECS_PER_USEC = 1000.0f;
+    qDebug() << "Full tour of" << finalVisitor.getCount() << "leaves took" << fullNsecs / NSECS_PER_USEC <<
+        "usecs; small deltas took" << applyNsecs / (DELTA_COUNT * NSECS_PER_USEC) << "usecs each to apply, with" <<
+        (float)regionCount / DELTA_COUNT << "changed regions on average";
+    qDebug();
+    return false;
+}
+
+/// Records the minima of the color leaves in the order visited, stopping after a maximum number.
+class LeafRecordingVisitor : public MetavoxelVisitor {
+public:
+    
+    LeafRecordingVisitor(bool parallel, int maximumLeaves = INT_MAX);
+    
+    const QVector<glm::vec3>& getLeaves() const { return _leaves; }
+    
+    virtual int visit(MetavoxelInfo& info);
+    virtual MetavoxelVisitor* clone() const;
+    virtual bool merge(MetavoxelVisitor& clone);
+
+private:
+    
+    bool _parallel;
+    int _maximumLeaves;
+    QVector<glm::vec3> _leaves;
+};
+
+LeafRecordingVisitor::LeafRecordingVisitor(bool parallel, int maximumLeaves) :
+    MetavoxelVisitor(QVector<AttributePointer>() << AttributeRegistry::getInstance()->getColorAttribute()),
+    _parallel(parallel),
+    _maximumLeaves(maximumLeaves) {
+}
+
+int LeafRecordingVisitor::visit(MetavoxelInfo& info) {
+    if (!info.isLeaf) {
+        return DEFAULT_ORDER;
+    }
+    if (_leaves.size() == _maximumLeaves) {
+        return SHORT_CIRCUIT;
+    }
+    _leaves.append(info.minimum);
+    return STOP_RECURSION;
+}
+
+MetavoxelVisitor* LeafRecordingVisitor::clone() const {
+    if (!_parallel) {
+        return NULL;
+    }
+    LeafRecordingVisitor* visitor = new LeafRecordingVisitor(*this);
+    visitor->_leaves.clear();
+    return visitor;
+}
+
+bool LeafRecordingVisitor::merge(MetavoxelVisitor& clone) {
+    const QVector<glm::vec3>& leaves = static_cast<LeafRecordingVisitor&>(clone)._leaves;
+    int count = qMin(leaves.size(), _maximumLeaves - _leaves.size());
+    for (int i = 0; i < count; i++) {
+        _leaves.append(leaves.at(i));
+    }
+    return count == leaves.size();
+}
+
+/// Checks that parallel tours visit the same leaves in the same order as sequential ones, including when short-circuited,
+/// and compares their speeds.
+/// \return true if the leaves differed.
+static bool testParallelTours() {
+    MetavoxelData data;
+    const float TEST_GRANULARITY = 1.0f / 64.0f;
+    RandomColorVisitor randomVisitor(TEST_GRANULARITY);
+    data.guide(randomVisitor);
+    
+    const int BENCHMARK_ITERATIONS = 10;
+    QElapsedTimer timer;
+    qint64 nsecs[2];
+    QVector<glm::vec3> leaves[2];
+    for (int i = 0; i < 2; i++) {
+        timer.start();
+        for (int j = 0; j < BENCHMARK_ITERATIONS; j++) {
+            LeafRecordingVisitor visitor(i == 1);
+            data.guide(visitor);
+            leaves[i] = visitor.getLeaves();
+        }
+        nsecs[i] = timer.nsecsElapsed();
+    }
+    if (leaves[0] != leaves[1]) {
+        qDebug() << "Parallel tour visited" << leaves[1].size() << "leaves, sequential" << leaves[0].size();
+        return true;
+    }
+    qDebug() << "Sequential tours took" << nsecs[0] / BENCHMARK_ITERATIONS << "ns, parallel" <<
+        nsecs[1] / BENCHMARK_ITERATIONS << "ns," << QThreadPool::globalInstance()->maxThreadCount() << "threads";
+    qDebug();
+    
+    // stop partway through an octant other than the first
+    const int MAXIMUM_LEAVES = leaves[0].size() / 3;
+    LeafRecordingVisitor sequentialVisitor(false, MAXIMUM_LEAVES);
+    data.guide(sequentialVisitor);
+    LeafRecordingVisitor parallelVisitor(true, MAXIMUM_LEAVES);
+    data.guide(parallelVisitor);
+    if (sequentialVisitor.getLeaves() != parallelVisitor.getLeaves()) {
+        qDebug() << "Short-circuited parallel tour visited" << parallelVisitor.getLeaves().size() << "leaves, sequential" <<
+            sequentialVisitor.getLeaves().size();
+        return true;
+    }
+    return false;
+}
+
+static MetavoxelEditMessage createRandomBoxEdit() {
+    glm::vec3 minimum(randFloat(), randFloat(), randFloat());
+    const float MAX_EDIT_SIZE = 0.25f;
+    glm::vec3 maximum = minimum + glm::vec3(randFloat(), randFloat(), randFloat()) * MAX_EDIT_SIZE;
+    const float EDIT_GRANULARITY = 1.0f / 32.0f;
+    MetavoxelEditMessage edit = { QVariant::fromValue(BoxSetEdit(Box(minimum, maximum), EDIT_GRANULARITY,
+        OwnedAttributeValue(AttributeRegistry::getInstance()->getColorAttribute(),
+            encodeInline<QRgb>(qRgba(rand(), rand(), rand(), 255))))) };
+    return edit;
+}
+
+/// Persists a large MetavoxelData while editing it, timing the snapshot pause, the snapshot write, and the load.
+/// \return true if the data loaded didn't match the data persisted.
+static bool benchmarkPersistence() {
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        qDebug() << "Couldn't create directory for persistence benchmark.";
+        return true;
+    }
+    MetavoxelData data;
+    const float BENCHMARK_GRANULARITY = 1.0f / 64.0f;
+    RandomColorVisitor visitor(BENCHMARK_GRANULARITY);
+    data.guide(visitor);
+    
+    const int EDITS_PER_PHASE = 100;
+    {
+        MetavoxelPersister persister(directory.path());
+        persister.load(data);
+        persister.snapshot(data);
+        
+        // edit while the snapshot is being written, then once it's done
+        for (int i = 0; i < EDITS_PER_PHASE; i++) {
+            MetavoxelEditMessage edit = createRandomBoxEdit();
+            edit.apply(data, SharedObject::getWeakHash());
+            persister.logEdit(edit);
+        }
+        persister.waitForSnapshot();
+        qDebug() << "Snapshot paused for" << persister.getLastSnapshotPauseUsecs() << "usecs, written in" <<
+            persister.getLastSnapshotWriteUsecs() << "usecs";
+        
+        for (int i = 0; i < EDITS_PER_PHASE; i++) {
+            MetavoxelEditMessage edit = createRandomBoxEdit();
+            edit.apply(data, SharedObject::getWeakHash());
+            persister.logEdit(edit);
+        }
+    }
+    
+    MetavoxelData dataLoaded;
+    MetavoxelPersister persister(directory.path());
+    if (!persister.load(dataLoaded)) {
+        qDebug() << "Nothing loaded from persisted data.";
+        return true;
+    }
+    qDebug() << "Loaded snapshot and" << EDITS_PER_PHASE * 2 << "edits in" << persister.getLoadUsecs() << "usecs";
+    qDebug();
+    
+    if (!contentsEqual(dataLoaded, data)) {
+        qDebug() << "Metavoxel data loaded doesn't match data persisted.";
+        return true;
+    }
+    return false;
+}
+
+/// Writes the expected pattern to a reliable channel.
+static void writeStream(ReliableChannel* channel, int length) {
+    channel->setMessagesEnabled(false);
+    const int CHUNK_SIZE = 1024 * 1024;
+    QByteArray chunk;
+    for (int offset = 0; offset < length; offset += chunk.size()) {
+        chunk.resize(qMin(CHUNK_SIZE, length - offset));
+        for (int i = 0; i < chunk.size(); i++) {
+            chunk[i] = CongestedEndpoint::getStreamByte(offset + i);
+        }
+        channel->getBuffer().write(chunk);
+    }
+}
+
+/// Sends as much as the sequencer's budget allows over a bottleneck with a lossy reverse path, streaming reliable data
+/// alongside, and checks that we keep the link busy without filling its queue.
+/// \return true if the link was underused or overfilled, the estimates were off, or the streamed data was corrupted.
+static bool testCongestionControl() {
+    const int BOTTLENECK_BYTES_PER_SECOND = 100000;
+    const float LOSS_PROBABILITY = 0.01f;
+    const quint64 PROPAGATION_DELAY = 40 * USECS_PER_MSEC;
+    CongestedEndpoint server(BOTTLENECK_BYTES_PER_SECOND, LOSS_PROBABILITY, PROPAGATION_DELAY);
+    CongestedEndpoint client(BOTTLENECK_BYTES_PER_SECOND * 10, LOSS_PROBABILITY, PROPAGATION_DELAY);
+    server.setOther(&client);
+    client.setOther(&server);
+    
+    const int STREAMED_BYTES = 50000;
+    writeStream(server.getSequencer().getReliableOutputChannel(1), STREAMED_BYTES);
+    
+    // the server fills each packet to its budget, much as it would with metavoxel deltas; the client just acknowledges
+    const int SIMULATION_MSECS = 30 * MSECS_PER_SECOND;
+    const int SEND_INTERVAL_MSECS = 10;
+    const int MAX_PAYLOAD_SIZE = 20000;
+    for (int msecs = 0; msecs < SIMULATION_MSECS; msecs++) {
+        usecTimestampNowForceClockSkew((int)(msecs * USECS_PER_MSEC));
+        server.deliverDatagrams();
+        client.deliverDatagrams();
+        if (msecs % SEND_INTERVAL_MSECS == 0) {
+            server.sendPacket(qMin(server.getSequencer().getSendBudget(), MAX_PAYLOAD_SIZE));
+            client.sendPacket(0);
+        }
+    }
+    usecTimestampNowForceClockSkew(0);
+    
+    const DatagramSequencer& sequencer = server.getSequencer();
+    float throughput = (client.getPayloadBytesReceived() + client.getStreamBytesReceived()) * (float)MSECS_PER_SECOND /
+        SIMULATION_MSECS;
+    qDebug() << "Throughput" << throughput << "bytes/sec over a" << BOTTLENECK_BYTES_PER_SECOND << "bytes/sec bottleneck";
+    qDebug() << "Estimated bandwidth" << sequencer.getBandwidth() << "bytes/sec, round trip" <<
+        sequencer.getRoundTripTime() << "usecs, minimum" << sequencer.getMinimumRoundTripTime() << "usecs";
+    qDebug() << "Average queuing delay" << server.getAverageQueuingDelay() << "usecs," << sequencer.getPacketsLost() <<
+        "packets lost";
+    qDebug();
+    
+    const float MIN_UTILIZATION = 0.5f;
+    if (throughput < BOTTLENECK_BYTES_PER_SECOND * MIN_UTILIZATION) {
+        qDebug() << "Bottleneck underused.";
+        return true;
+    }
+    const float MAX_AVERAGE_QUEUING_DELAY = 250.0f * USECS_PER_MSEC;
+    if (server.getAverageQueuingDelay() > MAX_AVERAGE_QUEUING_DELAY) {
+        qDebug() << "Bottleneck queue overfilled.";
+        return true;
+    }
+    const float MAX_BANDWIDTH_ERROR = 0.5f;
+    if (qAbs(sequencer.getBandwidth() - BOTTLENECK_BYTES_PER_SECOND) > BOTTLENECK_BYTES_PER_SECOND * MAX_BANDWIDTH_ERROR) {
+        qDebug() << "Bandwidth estimate off.";
+        return true;
+    }
+    if (client.isStreamCorrupted() || client.getStreamBytesReceived() != STREAMED_BYTES) {
+        qDebug() << "Sent/received streamed data mismatch.";
+        return true;
+    }
+    return false;
+}
+
+/// Streams a large amount of reliable data through a pair of sequencers over a fast, slightly lossy link, so that the
+/// span tracking and buffering dominate.
+/// \return true if the streamed data was corrupted or never arrived.
+static bool benchmarkReliableStream() {
+    const int LINK_BYTES_PER_SECOND = 1000 * 1000 * 1000;
+    const float LOSS_PROBABILITY = 0.001f;
+    CongestedEndpoint sender(LINK_BYTES_PER_SECOND, LOSS_PROBABILITY, 0);
+    CongestedEndpoint receiver(LINK_BYTES_PER_SECOND, LOSS_PROBABILITY, 0);
+    sender.setOther(&receiver);
+    receiver.setOther(&sender);
+    
+    const int BENCHMARK_PACKET_SIZE = 64 * 1024;
+    sender.getSequencer().setMaxPacketSize(BENCHMARK_PACKET_SIZE);
+    const int STREAMED_BYTES = 50 * 1024 * 1024;
+    writeStream(sender.getSequencer().getReliableOutputChannel(1), STREAMED_BYTES);
+    
+    QElapsedTimer timer;
+    timer.start();
+    const qint64 MAX_BENCHMARK_NSECS = 60LL * 1000 * 1000 * 1000;
+    while (receiver.getStreamBytesReceived() < STREAMED_BYTES && !receiver.isStreamCorrupted()) {
+        if (timer.nsecsElapsed() > MAX_BENCHMARK_NSECS) {
+            qDebug() << "Reliable stream stalled after" << receiver.getStreamBytesReceived() << "bytes.";
+            return true;
+        }
+        sender.sendPacket(0);
+        receiver.sendPacket(0);
+        sender.deliverDatagrams();
+        receiver.deliverDatagrams();
+    }
+    qint64 elapsed = timer.nsecsElapsed();
+    
+    if (receiver.isStreamCorrupted()) {
+        qDebug() << "Sent/received streamed data mismatch.";
+        return true;
+    }
+    qDebug() << "Reliable stream:" << STREAMED_BYTES << "bytes," << getMegabytesPerSecond(STREAMED_BYTES, elapsed) <<
+        "MB/s," << sender.getSequencer().getPacketsLost() << "packets lost";
+    qDebug();
+    return false;
+}
+
+/// Writes an object the way Bitstream did before it had streaming plans: by walking the properties through reflection and
+/// boxing each value in a QVariant.
+static void writeObjectReflectively(Bitstream& out, const QObject* object) {
+    const QMetaObject* metaObject = object->metaObject();
+    out << metaObject;
+    for (int i = 0; i < metaObject->propertyCount(); i++) {
+        QMetaProperty property = metaObject->property(i);
+        if (!property.isStored(object)) {
+            continue;
+        }
+        const TypeStreamer* streamer = Bitstream::getTypeStreamer(property.userType());
+        if (streamer) {
+            streamer->write(out, property.read(object));
+        }
+    }
+}
+
+/// Reads an object written by writeObjectReflectively into an existing instance.
+static void readObjectReflectively(Bitstream& in, QObject* object) {
+    const QMetaObject* metaObject;
+    in >> metaObject;
+    for (int i = 0; i < metaObject->propertyCount(); i++) {
+        QMetaProperty property = metaObject->property(i);
+        if (!property.isStored(object)) {
+            continue;
+        }
+        const TypeStreamer* streamer = Bitstream::getTypeStreamer(property.userType());
+        if (streamer) {
+            property.write(object, streamer->read(in));
+        }
+    }
+}
+
+/// Converts a count of objects streamed in some number of nanoseconds to objects per second.
+static float getObjectsPerSecond(qint64 objects, qint64 nsecs) {
+    const float NSECS_PER_SECOND = 1000000000.0f;
+    return objects * NSECS_PER_SECOND / qMax(nsecs, (qint64)1);
+}
+
+/// Streams many small shared objects both by reflection and through the cached streaming plans, comparing the rates.
+/// \return true if the objects read back didn't match those written.
+static bool benchmarkObjectStreaming() {
+    const int OBJECT_COUNT = 10000;
+    QVector<SharedObjectPointer> objects, objectsRead;
+    for (int i = 0; i < OBJECT_COUNT; i++) {
+        objects.append(new TestSharedObjectB(randFloat(), createRandomBytes()));
+        objectsRead.append(new TestSharedObjectB());
+    }
+    const int BENCHMARK_ITERATIONS = 10;
+    const qint64 TOTAL_OBJECTS = (qint64)OBJECT_COUNT * BENCHMARK_ITERATIONS;
+    QElapsedTimer timer;
+    
+    for (int reflective = 1; reflective >= 0; reflective--) {
+        QByteArray array;
+        timer.start();
+        for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+            array.clear();
+            QDataStream outStream(&array, QIODevice::WriteOnly);
+            Bitstream out(outStream);
+            foreach (const SharedObjectPointer& object, objects) {
+                if (reflective) {
+                    writeObjectReflectively(out, object.data());
+                } else {
+                    out << static_cast<const QObject*>(object.data());
+                }
+            }
+            out.flush();
+        }
+        qint64 writeNsecs = timer.nsecsElapsed();
+        
+        timer.restart();
+        for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+            QDataStream inStream(array);
+            Bitstream in(inStream);
+            foreach (const SharedObjectPointer& object, objectsRead) {
+                if (reflective) {
+                    readObjectReflectively(in, object.data());
+                } else {
+                    ObjectReader objectReader;
+                    in >> objectReader;
+                    objectReader.read(in, object.data());
+                }
+            }
+        }
+        qint64 readNsecs = timer.nsecsElapsed();
+        
+        for (int i = 0; i < OBJECT_COUNT; i++) {
+            if (!objects.at(i)->equals(objectsRead.at(i).data())) {
+                qDebug() << "Objects read" << (reflective ? "by reflection" : "through plans") << "don't match those written.";
+                return true;
+            }
+            TestSharedObjectB* objectRead = static_cast<TestSharedObjectB*>(objectsRead.at(i).data());
+            objectRead->setFoo(0.0f);
+            objectRead->setBar(QByteArray());
+        }
+        qDebug() << (reflective ? "Reflection:" : "Streaming plans:") << "write" <<
+            getObjectsPerSecond(TOTAL_OBJECTS, writeNsecs) << "objects/s, read" <<
+            getObjectsPerSecond(TOTAL_OBJECTS, readNsecs) << "objects/s";
+    }
+    qDebug();
+    return false;
+}
+
+/// Fills the data with many small spheres and compares ray queries through the spanner index with tours of the spanner sets,
+/// then measures the rate of edits that keep the index up to date.
+/// \return true if the index missed a hit closer than the one found by touring.
+static bool benchmarkSpannerIndex() {
+    const AttributePointer& attribute = AttributeRegistry::getInstance()->getSpannersAttribute();
+    const int SPANNER_COUNT = 100000;
+    const float SPANNER_RADIUS = 0.001f;
+    const float SPANNER_GRANULARITY = 1.0f / 128.0f;
+    QVector<SharedObjectPointer> spanners;
+    for (int i = 0; i < SPANNER_COUNT; i++) {
+        // keep the spheres well inside the bounds, so that the data doesn't expand
+        Sphere* sphere = new Sphere();
+        sphere->setTranslation((glm::vec3(randFloat(), randFloat(), randFloat()) - glm::vec3(0.5f, 0.5f, 0.5f)) * 0.99f);
+        sphere->setScale(SPANNER_RADIUS);
+        sphere->setPlacementGranularity(SPANNER_GRANULARITY);
+        spanners.append(sphere);
+    }
+    MetavoxelData data;
+    QElapsedTimer timer;
+    timer.start();
+    foreach (const SharedObjectPointer& spanner, spanners) {
+        data.insert(attribute, spanner);
+    }
+    qint64 insertNsecs = timer.nsecsElapsed();
+    
+    // the first query builds the index from the sets
+    timer.restart();
+    float distance = 0.0f;
+    data.findFirstRaySpannerIntersection(glm::vec3(), glm::vec3(0.0f, 0.0f, 1.0f), attribute, distance);
+    qint64 buildNsecs = timer.nsecsElapsed();
+    
+    // rays from outside the volume toward random points within
+    const int RAY_COUNT = 1000;
+    QVector<glm::vec3> origins, directions;
+    for (int i = 0; i < RAY_COUNT; i++) {
+        glm::vec3 origin = (glm::vec3(randFloat(), randFloat(), randFloat()) - glm::vec3(0.5f, 0.5f, 0.5f)) * 4.0f;
+        origins.append(origin);
+        directions.append(glm::normalize(glm::vec3(randFloat(), randFloat(), randFloat()) -
+            glm::vec3(0.5f, 0.5f, 0.5f) - origin));
+    }
+    
+    // an LOD that subdivides everywhere has the query tour the sets rather than use the index
+    const float EVERYWHERE_THRESHOLD = 0.0001f;
+    MetavoxelLOD tourLOD(glm::vec3(), EVERYWHERE_THRESHOLD);
+    QVector<SharedObjectPointer> tourHits, indexHits;
+    QVector<float> tourDistances, indexDistances;
+    for (int tour = 1; tour >= 0; tour--) {
+        QVector<SharedObjectPointer>& hits = tour ? tourHits : indexHits;
+        QVector<float>& distances = tour ? tourDistances : indexDistances;
+        timer.restart();
+        for (int i = 0; i < RAY_COUNT; i++) {
+            hits.append(data.findFirstRaySpannerIntersection(origins.at(i), directions.at(i), attribute, distance,
+                tour ? tourLOD : MetavoxelLOD()));
+            distances.append(distance);
+        }
+        qDebug() << (tour ? "Touring spanner sets:" : "Spanner index:") <<
+            getObjectsPerSecond(RAY_COUNT, timer.nsecsElapsed()) << "ray queries/s";
+    }
+    int hitCount = 0;
+    const float DISTANCE_EPSILON = 0.0001f;
+    for (int i = 0; i < RAY_COUNT; i++) {
+        if (tourHits.at(i) && (!indexHits.at(i) || indexDistances.at(i) > tourDistances.at(i) + DISTANCE_EPSILON)) {
+            qDebug() << "Spanner index missed a hit found by touring the sets.";
+            return true;
+        }
+        if (indexHits.at(i)) {
+            hitCount++;
+        }
+    }
+    
+    // remove and reinsert a portion of the spanners, updating the index along with the sets
+    const int EDIT_COUNT = 10000;
+    timer.restart();
+    for (int i = 0; i < EDIT_COUNT; i++) {
+        data.remove(attribute, spanners.at(i));
+    }
+    for (int i = 0; i < EDIT_COUNT; i++) {
+        data.insert(attribute, spanners.at(i));
+    }
+    qint64 editNsecs = timer.nsecsElapsed();
+    for (int i = 0; i < RAY_COUNT; i++) {
+        SharedObjectPointer hit = data.findFirstRaySpannerIntersection(origins.at(i), directions.at(i), attribute, distance);
+        if (hit != indexHits.at(i)) {
+            qDebug() << "Spanner index gave different results after removing and reinserting spanners.";
+            return true;
+        }
+    }
+    
+    const float NSECS_PER_USEC = 1000.0f;
+    qDebug() << "Inserted" << SPANNER_COUNT << "spanners at" << getObjectsPerSecond(SPANNER_COUNT, insertNsecs) <<
+        "spanners/s; building the index took" << buildNsecs / NSECS_PER_USEC << "usecs;" << hitCount << "of" <<
+        RAY_COUNT << "rays hit";
+    qDebug() << "Indexed edits:" << getObjectsPerSecond(EDIT_COUNT * 2, editNsecs) << "edits/s";
+    qDebug();
+    return false;
+}
+
 bool MetavoxelTests::run() {
     
     qDebug() << "Running transmission tests...";
@@ -161,10 +992,26 @@ bool MetavoxelTests::run() {
     qDebug() << "Created" << sharedObjectsCreated << "shared objects, destroyed" << sharedObjectsDestroyed;
     qDebug();
     
+    qDebug() << "Running congestion control test...";
+    qDebug();
+    
+    if (testCongestionControl()) {
+        return true;
+    }
+    
     qDebug() << "Running serialization tests...";
     qDebug();
     
-    if (testSerialization(Bitstream::HASH_METADATA) || testSerialization(Bitstream::FULL_METADATA)) {
+    if (testSerialization(Bitstream::HASH_METADATA) || testSerialization(Bitstream::FULL_METADATA) || testDeltaCache() ||
+            testParallelTours()) {
+        return true;
+    }
+    
+    qDebug() << "Running serialization benchmarks...";
+    qDebug();
+    
+    if (benchmarkSerialization() || benchmarkNodes() || benchmarkDeltaApplication() || benchmarkPersistence() ||
+            benchmarkReliableStream() || benchmarkObjectStreaming() || benchmarkSpannerIndex()) {
         return true;
     }
     
@@ -393,6 +1240,91 @@ void Endpoint::readReliableChannel() {
     streamedBytesReceived += bytes.size();
 }
 
+// datagrams that would be queued for longer than this at the bottleneck are dropped
+const quint64 MAX_QUEUING_DELAY = 500 * USECS_PER_MSEC;
+
+CongestedEndpoint::CongestedEndpoint(int bytesPerSecond, float lossProbability, quint64 propagationDelay) :
+    _other(NULL),
+    _bytesPerSecond(bytesPerSecond),
+    _lossProbability(lossProbability),
+    _propagationDelay(propagationDelay),
+    _queueClearTime(0),
+    _payloadBytesReceived(0),
+    _streamBytesReceived(0),
+    _streamCorrupted(false),
+    _totalQueuingDelay(0),
+    _datagramsQueued(0) {
+    
+    connect(&_sequencer, SIGNAL(readyToWrite(const QByteArray&)), SLOT(sendDatagram(const QByteArray&)));
+    connect(&_sequencer, SIGNAL(readyToRead(Bitstream&)), SLOT(readPacket(Bitstream&)));
+    
+    ReliableChannel* input = _sequencer.getReliableInputChannel(1);
+    input->setMessagesEnabled(false);
+    connect(&input->getBuffer(), SIGNAL(readyRead()), SLOT(readStream()));
+}
+
+void CongestedEndpoint::sendPacket(int payloadSize) {
+    Bitstream& out = _sequencer.startPacket();
+    out << QByteArray(payloadSize, 0);
+    _sequencer.endPacket();
+}
+
+void CongestedEndpoint::deliverDatagrams() {
+    // the queue is first in, first out and the delay constant, so the datagrams arrive in the order sent
+    quint64 now = usecTimestampNow();
+    while (!_datagramsInTransit.isEmpty() && _datagramsInTransit.first().second <= now) {
+        _other->_sequencer.receivedDatagram(_datagramsInTransit.takeFirst().first);
+    }
+}
+
+float CongestedEndpoint::getAverageQueuingDelay() const {
+    return _datagramsQueued == 0 ? 0.0f : (float)_totalQueuingDelay / _datagramsQueued;
+}
+
+void CongestedEndpoint::sendDatagram(const QByteArray& datagram) {
+    // wait for the bottleneck to clear what's ahead of us, unless that would take too long
+    quint64 now = usecTimestampNow();
+    quint64 queuingDelay = qMax(_queueClearTime, now) - now;
+    if (queuingDelay > MAX_QUEUING_DELAY) {
+        return;
+    }
+    _totalQueuingDelay += queuingDelay;
+    _datagramsQueued++;
+    _queueClearTime = now + queuingDelay + datagram.size() * USECS_PER_SECOND / _bytesPerSecond;
+    
+    // some that make it through are lost anyway
+    if (randFloat() < _lossProbability) {
+        return;
+    }
+    // have to copy the datagram; the one we're passed is a reference to a shared buffer
+    _datagramsInTransit.append(QPair<QByteArray, quint64>(QByteArray(datagram.constData(), datagram.size()),
+        _queueClearTime + _propagationDelay));
+}
+
+void CongestedEndpoint::readPacket(Bitstream& in) {
+    QByteArray payload;
+    in >> payload;
+    _payloadBytesReceived += payload.size();
+}
+
+void CongestedEndpoint::readStream() {
+    // check the data in place rather than copying it out
+    CircularBuffer& buffer = _sequencer.getReliableInputChannel(1)->getBuffer();
+    int available = buffer.bytesAvailable();
+    for (int position = 0; position < available; ) {
+        int length = available - position;
+        const char* data = buffer.getContiguousData(buffer.pos() + position, length);
+        for (int i = 0; i < length; i++) {
+            if (data[i] != getStreamByte(_streamBytesReceived + i)) {
+                _streamCorrupted = true;
+            }
+        }
+        _streamBytesReceived += length;
+        position += length;
+    }
+    buffer.seek(buffer.pos() + available);
+}
+
 TestSharedObjectA::TestSharedObjectA(float foo) :
         _foo(foo) {
     sharedObjectsCreated++;    
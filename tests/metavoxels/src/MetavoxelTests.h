@@ -67,6 +67,59 @@ private:
     CircularBuffer _dataStreamed;
 };
 
+/// Represents an endpoint sending over a simulated link with limited bandwidth, a bounded queue, propagation delay and
+/// random loss.  Time may be simulated by skewing the clock.  Data streamed on reliable channel one is expected to follow
+/// the pattern given by getStreamByte.
+class CongestedEndpoint : public QObject {
+    Q_OBJECT
+
+public:
+    
+    /// Returns the byte expected at the specified offset of the stream.
+    static char getStreamByte(int offset) { return (char)(offset * 31 + (offset >> 11)); }
+    
+    CongestedEndpoint(int bytesPerSecond, float lossProbability, quint64 propagationDelay);
+    
+    void setOther(CongestedEndpoint* other) { _other = other; }
+    
+    DatagramSequencer& getSequencer() { return _sequencer; }
+    
+    /// Sends a packet with a payload of the specified size.
+    void sendPacket(int payloadSize);
+    
+    /// Delivers to the other endpoint the datagrams that have reached it by now.
+    void deliverDatagrams();
+    
+    int getPayloadBytesReceived() const { return _payloadBytesReceived; }
+    
+    int getStreamBytesReceived() const { return _streamBytesReceived; }
+    bool isStreamCorrupted() const { return _streamCorrupted; }
+    
+    /// Returns the average time that our datagrams spent queued at the bottleneck, in microseconds.
+    float getAverageQueuingDelay() const;
+
+private slots:
+    
+    void sendDatagram(const QByteArray& datagram);
+    void readPacket(Bitstream& in);
+    void readStream();
+    
+private:
+    
+    DatagramSequencer _sequencer;
+    CongestedEndpoint* _other;
+    int _bytesPerSecond;
+    float _lossProbability;
+    quint64 _propagationDelay;
+    quint64 _queueClearTime;
+    QList<QPair<QByteArray, quint64> > _datagramsInTransit;
+    int _payloadBytesReceived;
+    int _streamBytesReceived;
+    bool _streamCorrupted;
+    quint64 _totalQueuingDelay;
+    int _datagramsQueued;
+};
+
 /// A simple shared object.
 class TestSharedObjectA : public SharedObject {
     Q_OBJECT
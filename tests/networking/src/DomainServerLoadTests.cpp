@@ -0,0 +1,203 @@
+//
+//  DomainServerLoadTests.cpp
+//  tests/networking/src
+//
+//  Created by Stephen Birarda on 5/19/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <QtCore/QDataStream>
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QStringList>
+
+#include <DomainInfo.h>
+#include <NodeList.h>
+#include <PacketHeaders.h>
+#include <SharedUtil.h>
+
+#include "DomainServerLoadTests.h"
+
+const int DEFAULT_NUM_SIMULATED_NODES = 1000;
+
+DomainServerLoadTests::DomainServerLoadTests(int& argc, char** argv) :
+    QCoreApplication(argc, argv),
+    _numNodes(DEFAULT_NUM_SIMULATED_NODES),
+    _packetsReceived(0),
+    _bytesReceived(0),
+    _fullListPackets(0),
+    _deltaListPackets(0),
+    _nodeRecordsReceived(0),
+    _removalRecordsReceived(0) {
+
+    // usage: networking-tests [domain-server hostname] [number of nodes]
+    QStringList argumentList = arguments();
+    QString hostname = argumentList.value(1, DEFAULT_ASSIGNMENT_SERVER_HOSTNAME);
+    _domainServerSockAddr = HifiSockAddr(hostname, DEFAULT_DOMAIN_SERVER_PORT);
+
+    if (argumentList.size() > 2) {
+        _numNodes = argumentList.at(2).toInt();
+    }
+
+    NodeList::createInstance(NodeType::Agent);
+}
+
+void DomainServerLoadTests::sendConnectRequests(int numRequests) {
+    QUdpSocket& socket = NodeList::getInstance()->getNodeSocket();
+    HifiSockAddr localSockAddr(QHostAddress(getHostOrderLocalAddress()), socket.localPort());
+
+    for (int i = 0; i < numRequests; i++) {
+        QByteArray connectPacket = byteArrayWithPopulatedHeader(PacketTypeDomainConnectRequest);
+        QDataStream packetStream(&connectPacket, QIODevice::Append);
+
+        // no registration token, let the domain-server tell us our public socket, and be interested in every other agent
+        // so that the list each node receives grows with the population
+        packetStream << (quint8) 0 << NodeType::Agent << HifiSockAddr() << localSockAddr << (quint8) 1 << NodeType::Agent;
+
+        socket.writeDatagram(connectPacket, _domainServerSockAddr.getAddress(), _domainServerSockAddr.getPort());
+    }
+}
+
+void DomainServerLoadTests::sendCheckIns() {
+    QUdpSocket& socket = NodeList::getInstance()->getNodeSocket();
+    HifiSockAddr localSockAddr(QHostAddress(getHostOrderLocalAddress()), socket.localPort());
+
+    for (QHash<QUuid, SimulatedNode>::const_iterator it = _nodes.constBegin(); it != _nodes.constEnd(); it++) {
+        QByteArray checkInPacket = byteArrayWithPopulatedHeader(PacketTypeDomainListRequest, it.key());
+        QDataStream packetStream(&checkInPacket, QIODevice::Append);
+
+        packetStream << NodeType::Agent << HifiSockAddr() << localSockAddr << (quint8) 1 << NodeType::Agent
+            << it.value().listVersion;
+
+        // we connected without authentication, so there is no connection secret
+        replaceHashInPacketGivenConnectionUUID(checkInPacket, QUuid());
+
+        socket.writeDatagram(checkInPacket, _domainServerSockAddr.getAddress(), _domainServerSockAddr.getPort());
+    }
+}
+
+void DomainServerLoadTests::readDomainLists(int msecs) {
+    QUdpSocket& socket = NodeList::getInstance()->getNodeSocket();
+    QByteArray packet;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    while (timer.elapsed() < msecs) {
+        if (!socket.hasPendingDatagrams() && !socket.waitForReadyRead(msecs - (int) timer.elapsed())) {
+            continue;
+        }
+
+        while (socket.hasPendingDatagrams()) {
+            packet.resize(socket.pendingDatagramSize());
+            socket.readDatagram(packet.data(), packet.size());
+
+            if (packetTypeForPacket(packet) != PacketTypeDomainList) {
+                continue;
+            }
+
+            _packetsReceived++;
+            _bytesReceived += packet.size();
+
+            QDataStream packetStream(packet);
+            packetStream.skipRawData(numBytesForPacketHeader(packet));
+
+            QUuid sessionUUID;
+            DomainListType_t listType;
+            quint32 baseVersion, listVersion;
+            quint16 packetIndex, numPackets;
+            packetStream >> sessionUUID >> listType >> baseVersion >> listVersion >> packetIndex >> numPackets;
+
+            if (_droppedNodes.contains(sessionUUID)) {
+                // this is for a node we've since stopped checking in for
+                continue;
+            }
+
+            if (listType == DomainListType::Full) {
+                _fullListPackets++;
+            } else {
+                _deltaListPackets++;
+            }
+
+            while (!packetStream.atEnd()) {
+                DomainListRecordType_t recordType;
+                QUuid nodeUUID, connectionSecret;
+                packetStream >> recordType;
+
+                if (recordType == DomainListRecordType::Removal) {
+                    packetStream >> nodeUUID;
+                    _removalRecordsReceived++;
+                } else {
+                    qint8 nodeType;
+                    HifiSockAddr publicSockAddr, localSockAddr;
+                    packetStream >> nodeType >> nodeUUID >> publicSockAddr >> localSockAddr >> connectionSecret;
+                    _nodeRecordsReceived++;
+                }
+            }
+
+            // the first packet for a session we haven't seen answers one of our connect requests, and the list is only
+            // acknowledged once every packet of it is in, just like NodeList does
+            SimulatedNode& node = _nodes[sessionUUID];
+            if (listVersion != node.pendingListVersion || node.pendingListPackets.size() != numPackets) {
+                node.pendingListVersion = listVersion;
+                node.pendingListPackets.fill(false, numPackets);
+            }
+            if (packetIndex < numPackets) {
+                node.pendingListPackets.setBit(packetIndex);
+            }
+            if (node.pendingListPackets.count(true) == numPackets
+                && (listType == DomainListType::Full || baseVersion == node.listVersion)) {
+                node.listVersion = listVersion;
+            }
+        }
+    }
+}
+
+bool DomainServerLoadTests::run() {
+    qDebug() << "Connecting" << _numNodes << "simulated nodes to the domain-server at" << _domainServerSockAddr;
+
+    // connect in bursts so that the full lists coming back don't overrun our receive buffer
+    const int CONNECT_BURST_SIZE = 50;
+    const int CONNECT_BURST_WAIT_MSECS = 100;
+    for (int i = 0; i < _numNodes; i += CONNECT_BURST_SIZE) {
+        sendConnectRequests(qMin(CONNECT_BURST_SIZE, _numNodes - i));
+        readDomainLists(CONNECT_BURST_WAIT_MSECS);
+    }
+
+    qDebug() << _nodes.size() << "nodes connected," << _bytesReceived << "bytes of DomainList received while connecting";
+    qDebug();
+
+    if (_nodes.isEmpty()) {
+        qDebug() << "The domain-server never answered, is there one running?";
+        return true;
+    }
+
+    // have every node check in once a second, and replace a few of them each time so that there is something to send
+    const int NUM_CHECK_IN_ROUNDS = 10;
+    const int NODES_REPLACED_PER_ROUND = 10;
+    const int CHECK_IN_INTERVAL_MSECS = DOMAIN_SERVER_CHECK_IN_USECS / USECS_PER_MSEC;
+
+    for (int round = 0; round < NUM_CHECK_IN_ROUNDS; round++) {
+        _packetsReceived = _bytesReceived = _fullListPackets = _deltaListPackets = 0;
+        _nodeRecordsReceived = _removalRecordsReceived = 0;
+
+        // the dropped nodes just stop checking in, the domain-server will time them out
+        for (int i = 0; i < NODES_REPLACED_PER_ROUND && !_nodes.isEmpty(); i++) {
+            _droppedNodes.insert(_nodes.begin().key());
+            _nodes.erase(_nodes.begin());
+        }
+
+        sendCheckIns();
+        sendConnectRequests(NODES_REPLACED_PER_ROUND);
+        readDomainLists(CHECK_IN_INTERVAL_MSECS);
+
+        qDebug() << "Round" << round << "-" << _nodes.size() << "nodes checked in," << _packetsReceived << "packets /"
+            << _bytesReceived << "bytes back (" << _fullListPackets << "full," << _deltaListPackets << "delta ),"
+            << _nodeRecordsReceived << "node records," << _removalRecordsReceived << "removals";
+    }
+
+    return false;
+}
@@ -0,0 +1,67 @@
+//
+//  DomainServerLoadTests.h
+//  tests/networking/src
+//
+//  Created by Stephen Birarda on 5/19/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_DomainServerLoadTests_h
+#define hifi_DomainServerLoadTests_h
+
+#include <QtCore/QBitArray>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QUuid>
+
+#include <HifiSockAddr.h>
+
+/// A node the load generator is checking in on behalf of.
+class SimulatedNode {
+public:
+    SimulatedNode() : listVersion(0), pendingListVersion(0) { }
+
+    quint32 listVersion;
+    quint32 pendingListVersion;
+    QBitArray pendingListPackets;
+};
+
+/// Simulates a crowd of agents checking in with a running domain-server and reports what it costs.
+class DomainServerLoadTests : public QCoreApplication {
+    Q_OBJECT
+
+public:
+
+    DomainServerLoadTests(int& argc, char** argv);
+
+    /// Connects the simulated nodes, then has them check in once a second while some of them come and go.
+    /// \return true if the domain-server never answered.
+    bool run();
+
+private:
+
+    void sendConnectRequests(int numRequests);
+    void sendCheckIns();
+
+    /// Reads DomainList replies until the deadline passes.
+    void readDomainLists(int msecs);
+
+    HifiSockAddr _domainServerSockAddr;
+    int _numNodes;
+
+    QHash<QUuid, SimulatedNode> _nodes;
+    QSet<QUuid> _droppedNodes;
+
+    int _packetsReceived;
+    int _bytesReceived;
+    int _fullListPackets;
+    int _deltaListPackets;
+    int _nodeRecordsReceived;
+    int _removalRecordsReceived;
+};
+
+#endif // hifi_DomainServerLoadTests_h
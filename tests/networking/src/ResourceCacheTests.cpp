@@ -0,0 +1,473 @@
+//
+//  ResourceCacheTests.cpp
+//  tests/networking/src
+//
+//  Created by Andrzej Kapolka on 5/24/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <iostream>
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QPointer>
+#include <QtCore/QTemporaryDir>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+
+#include <HTTPConnection.h>
+#include <HTTPManager.h>
+#include <ResourceCache.h>
+#include <ResourceDiskCache.h>
+#include <SharedUtil.h>
+
+#include "ResourceCacheTests.h"
+
+const int NUM_TEST_RESOURCES = 50;
+const int TEST_RESOURCE_SIZE = 64 * 1024;
+const int LOAD_TIMEOUT_MSECS = 10000;
+
+static QByteArray getResourceBody(int index) {
+    QByteArray body(TEST_RESOURCE_SIZE, 0);
+    for (int i = 0; i < body.size(); i++) {
+        body[i] = (char)((i * 31 + index * 17) ^ (i >> 8));
+    }
+    return body;
+}
+
+/// Serves /resource/N and /duplicate/N (the same body under a second name) with an ETag, marked as stale right away so
+/// that every later request for them has to be revalidated.
+class TestResourceServer : public HTTPRequestHandler {
+public:
+    
+    TestResourceServer() : bytesServed(0), fullResponses(0), notModifiedResponses(0) { }
+    
+    virtual bool handleHTTPRequest(HTTPConnection* connection, const QUrl& url) {
+        QStringList path = url.path().split('/', QString::SkipEmptyParts);
+        if (path.size() != 2 || !(path.at(0) == "resource" || path.at(0) == "duplicate")) {
+            return false;
+        }
+        int index = path.at(1).toInt();
+        QByteArray etag = "\"" + QByteArray::number(index) + "\"";
+        
+        Headers headers;
+        headers.insert("ETag", etag);
+        headers.insert("Cache-Control", "max-age=0");
+        
+        if (connection->requestHeaders().value("If-None-Match") == etag) {
+            notModifiedResponses++;
+            connection->respond("304 Not Modified", QByteArray(), HTTPConnection::DefaultContentType, headers);
+            return true;
+        }
+        QByteArray body = getResourceBody(index);
+        bytesServed += body.size();
+        fullResponses++;
+        connection->respond(HTTPConnection::StatusCode200, body, "application/octet-stream", headers);
+        return true;
+    }
+    
+    qint64 bytesServed;
+    int fullResponses;
+    int notModifiedResponses;
+};
+
+class TestResource : public Resource {
+public:
+    
+    TestResource(const QUrl& url) : Resource(url) { }
+    
+    QByteArray data;
+    
+protected:
+    
+    virtual void downloadFinished(QNetworkReply* reply) {
+        data = reply->readAll();
+        reply->deleteLater();
+        finishedLoading(true);
+    }
+};
+
+class TestResourceCache : public ResourceCache {
+public:
+    
+    QSharedPointer<TestResource> getTestResource(const QUrl& url) {
+        return getResource(url).staticCast<TestResource>();
+    }
+    
+protected:
+    
+    virtual QSharedPointer<Resource> createResource(const QUrl& url,
+            const QSharedPointer<Resource>& fallback, bool delayLoad, const void* extra) {
+        return QSharedPointer<Resource>(new TestResource(url), &Resource::allReferencesCleared);
+    }
+};
+
+class TestNetworkAccessManager;
+
+/// A reply that finishes when told to, without touching the network.
+class TestReply : public QNetworkReply {
+public:
+    
+    TestReply(TestNetworkAccessManager* manager, const QNetworkRequest& request, bool finishImmediately);
+    
+    void finish();
+    
+    virtual void abort();
+    
+protected:
+    
+    virtual qint64 readData(char* data, qint64 maxSize) { return -1; }
+    
+private:
+    
+    TestNetworkAccessManager* _manager;
+};
+
+/// Records the requests made through it, answering them with TestReplies that either finish as soon as control returns
+/// to the event loop or wait to be finished by the test.
+class TestNetworkAccessManager : public QNetworkAccessManager {
+public:
+    
+    TestNetworkAccessManager(bool finishImmediately) : _finishImmediately(finishImmediately) { }
+    
+    /// Finishes every reply that's still outstanding.
+    void finishOutstanding() {
+        QList<QPointer<TestReply> > outstanding = _outstanding;
+        _outstanding.clear();
+        foreach (const QPointer<TestReply>& reply, outstanding) {
+            if (reply) {
+                reply->finish();
+            }
+        }
+    }
+    
+    QList<QUrl> requested;
+    QList<QUrl> aborted;
+    
+protected:
+    
+    virtual QNetworkReply* createRequest(Operation op, const QNetworkRequest& request, QIODevice* outgoingData) {
+        requested.append(request.url());
+        TestReply* reply = new TestReply(this, request, _finishImmediately);
+        if (!_finishImmediately) {
+            _outstanding.append(reply);
+        }
+        return reply;
+    }
+    
+private:
+    
+    bool _finishImmediately;
+    QList<QPointer<TestReply> > _outstanding;
+};
+
+TestReply::TestReply(TestNetworkAccessManager* manager, const QNetworkRequest& request, bool finishImmediately) :
+    QNetworkReply(manager),
+    _manager(manager) {
+    
+    setRequest(request);
+    setUrl(request.url());
+    setOperation(QNetworkAccessManager::GetOperation);
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    
+    if (finishImmediately) {
+        setFinished(true);
+        QMetaObject::invokeMethod(this, "downloadProgress", Qt::QueuedConnection, Q_ARG(qint64, 0), Q_ARG(qint64, 0));
+    }
+}
+
+void TestReply::finish() {
+    setFinished(true);
+    emit downloadProgress(0, 0);
+}
+
+void TestReply::abort() {
+    _manager->aborted.append(url());
+}
+
+static QNetworkCacheMetaData getTestMetaData(const QUrl& url) {
+    QNetworkCacheMetaData metaData;
+    metaData.setUrl(url);
+    metaData.setSaveToDisk(true);
+    metaData.setLastModified(QDateTime::currentDateTime());
+    return metaData;
+}
+
+static void insertTestBody(ResourceDiskCache& cache, const QUrl& url, const QByteArray& body) {
+    QIODevice* device = cache.prepare(getTestMetaData(url));
+    if (!device) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: disk cache wouldn't take " << qPrintable(url.toString())
+            << std::endl;
+        return;
+    }
+    device->write(body);
+    cache.insert(device);
+}
+
+void ResourceCacheTests::diskCacheEvictsLeastRecentlyUsed() {
+    QTemporaryDir directory;
+    const int BODIES_THAT_FIT = 4;
+    QUrl first("http://test/0"), second("http://test/1");
+    {
+        ResourceDiskCache cache(directory.path(), BODIES_THAT_FIT * TEST_RESOURCE_SIZE);
+        insertTestBody(cache, first, getResourceBody(0));
+        insertTestBody(cache, second, getResourceBody(1));
+        for (int i = 2; i < BODIES_THAT_FIT; i++) {
+            insertTestBody(cache, QUrl("http://test/" + QString::number(i)), getResourceBody(i));
+        }
+        
+        // the same body under another name shouldn't take up any more room
+        insertTestBody(cache, QUrl("http://test/copy"), getResourceBody(0));
+        if (cache.getContentCount() != BODIES_THAT_FIT || cache.cacheSize() != BODIES_THAT_FIT * TEST_RESOURCE_SIZE) {
+            std::cout << __FILE__ << ":" << __LINE__ << " ERROR: expected " << BODIES_THAT_FIT << " bodies stored, got "
+                << cache.getContentCount() << " taking " << cache.cacheSize() << " bytes" << std::endl;
+        }
+        
+        // reading the first makes the second the oldest, so it's the one to go
+        delete cache.data(first);
+        insertTestBody(cache, QUrl("http://test/new"), getResourceBody(BODIES_THAT_FIT));
+        if (!cache.metaData(first).isValid() || cache.metaData(second).isValid()) {
+            std::cout << __FILE__ << ":" << __LINE__ << " ERROR: expected the least recently used body to be evicted"
+                << std::endl;
+        }
+        if (cache.cacheSize() > cache.getMaximumCacheSize()) {
+            std::cout << __FILE__ << ":" << __LINE__ << " ERROR: cache holds " << cache.cacheSize()
+                << " bytes, more than its maximum of " << cache.getMaximumCacheSize() << std::endl;
+        }
+    }
+    
+    // what was there should still be there after a restart
+    ResourceDiskCache cache(directory.path(), BODIES_THAT_FIT * TEST_RESOURCE_SIZE);
+    QIODevice* device = cache.data(first);
+    if (!device || device->readAll() != getResourceBody(0)) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: cached body didn't survive a restart" << std::endl;
+    }
+    delete device;
+    if (cache.getContentCount() != BODIES_THAT_FIT) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: expected " << BODIES_THAT_FIT
+            << " bodies after a restart, got " << cache.getContentCount() << std::endl;
+    }
+}
+
+class SessionResults {
+public:
+    int loaded;
+    qint64 msecsToLoaded;
+    qint64 bytesServed;
+    int fullResponses;
+    int notModifiedResponses;
+    int contentCount;
+};
+
+/// Loads every test resource with a new network access manager and resource cache, as a new run of the interface would.
+static SessionResults loadResources(TestResourceServer& server, const QUrl& baseUrl, const QString& cacheDirectory) {
+    qint64 bytesServedBefore = server.bytesServed;
+    int fullResponsesBefore = server.fullResponses;
+    int notModifiedResponsesBefore = server.notModifiedResponses;
+    
+    QNetworkAccessManager manager;
+    ResourceDiskCache* diskCache = new ResourceDiskCache(cacheDirectory);
+    manager.setCache(diskCache);
+    ResourceCache::setNetworkAccessManager(&manager);
+    
+    SessionResults results;
+    {
+        TestResourceCache cache;
+        QElapsedTimer timer;
+        timer.start();
+        
+        QList<QSharedPointer<TestResource> > resources;
+        for (int i = 0; i < NUM_TEST_RESOURCES; i++) {
+            resources.append(cache.getTestResource(baseUrl.resolved(QUrl("resource/" + QString::number(i)))));
+            resources.append(cache.getTestResource(baseUrl.resolved(QUrl("duplicate/" + QString::number(i)))));
+        }
+        do {
+            QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+            results.loaded = 0;
+            foreach (const QSharedPointer<TestResource>& resource, resources) {
+                if (resource->isLoaded() && resource->data.size() == TEST_RESOURCE_SIZE) {
+                    results.loaded++;
+                }
+            }
+        } while (results.loaded < resources.size() && timer.elapsed() < LOAD_TIMEOUT_MSECS);
+        
+        results.msecsToLoaded = timer.elapsed();
+    }
+    results.bytesServed = server.bytesServed - bytesServedBefore;
+    results.fullResponses = server.fullResponses - fullResponsesBefore;
+    results.notModifiedResponses = server.notModifiedResponses - notModifiedResponsesBefore;
+    results.contentCount = diskCache->getContentCount();
+    
+    ResourceCache::setNetworkAccessManager(NULL);
+    return results;
+}
+
+static void printSession(const char* name, const SessionResults& results) {
+    std::cout << "    " << name << ": " << results.loaded << " loaded in " << results.msecsToLoaded << " ms, "
+        << results.bytesServed << " bytes transferred, " << results.fullResponses << " full responses, "
+        << results.notModifiedResponses << " not modified" << std::endl;
+}
+
+void ResourceCacheTests::secondSessionRevalidatesFromDisk() {
+    TestResourceServer server;
+    HTTPManager httpManager(0, QString(), &server);
+    if (!httpManager.isListening()) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: couldn't start the loopback server" << std::endl;
+        return;
+    }
+    QUrl baseUrl(QString("http://127.0.0.1:%1/").arg(httpManager.serverPort()));
+    QTemporaryDir cacheDirectory;
+    
+    SessionResults first = loadResources(server, baseUrl, cacheDirectory.path());
+    SessionResults second = loadResources(server, baseUrl, cacheDirectory.path());
+    
+    std::cout << "Loading " << NUM_TEST_RESOURCES * 2 << " resources of " << TEST_RESOURCE_SIZE
+        << " bytes through the disk cache:" << std::endl;
+    printSession("first session", first);
+    printSession("second session", second);
+    
+    const int EXPECTED_LOADED = NUM_TEST_RESOURCES * 2;
+    if (first.loaded != EXPECTED_LOADED || second.loaded != EXPECTED_LOADED) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: expected " << EXPECTED_LOADED << " resources loaded, got "
+            << first.loaded << " and " << second.loaded << std::endl;
+    }
+    if (first.contentCount != NUM_TEST_RESOURCES) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: expected the duplicates to share bodies, got "
+            << first.contentCount << " bodies for " << NUM_TEST_RESOURCES << std::endl;
+    }
+    if (second.fullResponses != 0 || second.notModifiedResponses != EXPECTED_LOADED) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: expected every resource to be revalidated in the second "
+            "session" << std::endl;
+    }
+}
+
+static bool checkRequested(const TestNetworkAccessManager& manager, const QStringList& expected) {
+    QStringList requested;
+    foreach (const QUrl& url, manager.requested) {
+        requested.append(url.path());
+    }
+    if (requested != expected) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: expected requests " << qPrintable(expected.join(" "))
+            << ", got " << qPrintable(requested.join(" ")) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void ResourceCacheTests::higherPriorityRequestsGoFirst() {
+    int requestLimit = ResourceCache::getRequestLimit();
+    ResourceCache::setRequestLimit(1);
+    TestNetworkAccessManager manager(false);
+    ResourceCache::setNetworkAccessManager(&manager);
+    {
+        QObject owner;
+        TestResourceCache cache;
+        QSharedPointer<TestResource> first = cache.getTestResource(QUrl("http://test/first"));
+        first->setLoadPriority(&owner, 0.0f);
+        
+        // these all rank below the one in flight, so they wait for it
+        QSharedPointer<TestResource> low = cache.getTestResource(QUrl("http://test/low"));
+        low->setLoadPriority(&owner, -3.0f);
+        QSharedPointer<TestResource> high = cache.getTestResource(QUrl("http://test/high"));
+        high->setLoadPriority(&owner, -1.0f);
+        QSharedPointer<TestResource> middle = cache.getTestResource(QUrl("http://test/middle"));
+        middle->setLoadPriority(&owner, -2.0f);
+        
+        // requests to another host have their own limit
+        QSharedPointer<TestResource> other = cache.getTestResource(QUrl("http://other/other"));
+        
+        checkRequested(manager, QStringList() << "/first" << "/other");
+        manager.finishOutstanding();
+        checkRequested(manager, QStringList() << "/first" << "/other" << "/high");
+        manager.finishOutstanding();
+        manager.finishOutstanding();
+        checkRequested(manager, QStringList() << "/first" << "/other" << "/high" << "/middle" << "/low");
+        
+        // an urgent request takes the place of the low priority one, which goes back in line behind it
+        QSharedPointer<TestResource> urgent = cache.getTestResource(QUrl("http://test/urgent"));
+        urgent->setLoadPriority(&owner, 1.0f);
+        QSharedPointer<TestResource> last = cache.getTestResource(QUrl("http://test/last"));
+        if (manager.aborted != QList<QUrl>() << QUrl("http://test/low")) {
+            std::cout << __FILE__ << ":" << __LINE__ << " ERROR: expected the low priority request to be cancelled"
+                << std::endl;
+        }
+        manager.finishOutstanding();
+        checkRequested(manager, QStringList() << "/first" << "/other" << "/high" << "/middle" << "/low" << "/urgent"
+            << "/low");
+        manager.finishOutstanding();
+        manager.finishOutstanding();
+        
+        if (!(low->isLoaded() && urgent->isLoaded() && last->isLoaded()) || ResourceCache::getPendingRequestCount() != 0) {
+            std::cout << __FILE__ << ":" << __LINE__ << " ERROR: expected every request to have completed" << std::endl;
+        }
+    }
+    ResourceCache::setNetworkAccessManager(NULL);
+    ResourceCache::setRequestLimit(requestLimit);
+}
+
+void ResourceCacheTests::benchmarkRequestScheduling() {
+    const int NUM_RESOURCES = 10000;
+    const int NUM_HOSTS = 10;
+    const int REPRIORITIZED_PER_FRAME = 1000;
+    const int APPLICATION_REQUEST_LIMIT = 3;
+    
+    int requestLimit = ResourceCache::getRequestLimit();
+    ResourceCache::setRequestLimit(APPLICATION_REQUEST_LIMIT);
+    TestNetworkAccessManager manager(true);
+    ResourceCache::setNetworkAccessManager(&manager);
+    {
+        QObject owner;
+        TestResourceCache cache;
+        QElapsedTimer timer;
+        timer.start();
+        
+        QVector<QSharedPointer<TestResource> > resources;
+        for (int i = 0; i < NUM_RESOURCES; i++) {
+            resources.append(cache.getTestResource(QUrl(QString("http://host%1/%2").arg(i % NUM_HOSTS).arg(i))));
+            resources.last()->setLoadPriority(&owner, randFloat());
+        }
+        qint64 queuedNsecs = timer.nsecsElapsed();
+        
+        // every frame, the owners move and change the priorities of some of what's waiting
+        int frames = 0;
+        int loaded;
+        do {
+            for (int i = 0; i < REPRIORITIZED_PER_FRAME; i++) {
+                resources.at(randIntInRange(0, NUM_RESOURCES - 1))->setLoadPriority(&owner, randFloat());
+            }
+            QCoreApplication::processEvents();
+            frames++;
+            
+            loaded = 0;
+            foreach (const QSharedPointer<TestResource>& resource, resources) {
+                if (resource->isLoaded()) {
+                    loaded++;
+                }
+            }
+        } while (loaded < NUM_RESOURCES && timer.elapsed() < LOAD_TIMEOUT_MSECS * 6);
+        
+        qint64 elapsedNsecs = timer.nsecsElapsed();
+        std::cout << "Scheduling " << NUM_RESOURCES << " requests over " << NUM_HOSTS << " hosts: queued in "
+            << queuedNsecs / 1000000.0 << " ms, " << loaded << " completed after " << frames << " frames in "
+            << elapsedNsecs / 1000000.0 << " ms (" << (double)manager.requested.size() * 1.0e9 / elapsedNsecs
+            << " requests per second, " << manager.aborted.size() << " cancelled)" << std::endl;
+        
+        if (loaded < NUM_RESOURCES) {
+            std::cout << __FILE__ << ":" << __LINE__ << " ERROR: only " << loaded << " of " << NUM_RESOURCES
+                << " requests completed" << std::endl;
+        }
+    }
+    ResourceCache::setNetworkAccessManager(NULL);
+    ResourceCache::setRequestLimit(requestLimit);
+}
+
+void ResourceCacheTests::runAllTests() {
+    diskCacheEvictsLeastRecentlyUsed();
+    secondSessionRevalidatesFromDisk();
+    higherPriorityRequestsGoFirst();
+    benchmarkRequestScheduling();
+}
@@ -0,0 +1,34 @@
+//
+//  ResourceCacheTests.h
+//  tests/networking/src
+//
+//  Created by Andrzej Kapolka on 5/24/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_ResourceCacheTests_h
+#define hifi_ResourceCacheTests_h
+
+namespace ResourceCacheTests {
+
+    /// Fills a small disk cache past its limit and checks that what was used least recently goes first, and that the
+    /// index survives a restart.
+    void diskCacheEvictsLeastRecentlyUsed();
+
+    /// Loads a set of resources from a loopback server in two sessions sharing a disk cache, and reports the bytes
+    /// transferred and the time until everything was loaded in each.
+    void secondSessionRevalidatesFromDisk();
+
+    /// Checks that waiting requests start in order of priority, and that an urgent one displaces one in flight.
+    void higherPriorityRequestsGoFirst();
+
+    /// Reports the time taken to get through a queue of 10000 requests whose priorities keep changing.
+    void benchmarkRequestScheduling();
+
+    void runAllTests();
+}
+
+#endif // hifi_ResourceCacheTests_h
@@ -0,0 +1,19 @@
+//
+//  main.cpp
+//  tests/networking/src
+//
+//  Created by Stephen Birarda on 5/19/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include "DomainServerLoadTests.h"
+#include "ResourceCacheTests.h"
+
+int main(int argc, char** argv) {
+    DomainServerLoadTests loadTests(argc, argv);
+    ResourceCacheTests::runAllTests();
+    return loadTests.run();
+}
@@ -0,0 +1,100 @@
+//
+//  ParticleCollisionSystemTests.cpp
+//  tests/particles/src
+//
+//  Created by Brad Hefta-Gaub on 5/22/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+
+#include <NodeList.h>
+#include <OctreeConstants.h>
+#include <ParticleCollisionSystem.h>
+#include <ParticleEditPacketSender.h>
+#include <ParticleTree.h>
+#include <SharedUtil.h>
+
+#include "ParticleCollisionSystemTests.h"
+
+/// fills the tree with particles crowded enough into the middle of it that a good number of them touch
+static void addCrowdedParticles(ParticleTree& tree, int numParticles) {
+    // keep the density about the same no matter how many particles there are
+    const float PARTICLE_RADIUS = 0.5f;
+    const float PARTICLES_PER_CUBIC_METER = 0.05f;
+    float side = powf(numParticles / PARTICLES_PER_CUBIC_METER, 1.0f / 3.0f);
+    glm::vec3 corner(TREE_SCALE * 0.5f - side * 0.5f);
+
+    for (int i = 0; i < numParticles; i++) {
+        ParticleProperties properties;
+        properties.setPosition(corner + glm::vec3(randFloat(), randFloat(), randFloat()) * side);
+        properties.setVelocity(glm::vec3(randFloatInRange(-1.0f, 1.0f), randFloatInRange(-1.0f, 1.0f),
+            randFloatInRange(-1.0f, 1.0f)));
+        properties.setRadius(PARTICLE_RADIUS);
+        properties.setLifetime(1000.0f);
+        tree.addParticle(ParticleID(NEW_PARTICLE, i, false), properties);
+    }
+}
+
+void ParticleCollisionSystemTests::broadPhaseFindsTouchingPairs() {
+    const int NUM_PARTICLES = 500;
+    ParticleTree tree;
+    addCrowdedParticles(tree, NUM_PARTICLES);
+
+    QVector<const Particle*> particles;
+    tree.findParticles(glm::vec3(0.5f), 1.0f, particles);
+
+    int touchingPairs = 0;
+    for (int i = 0; i < particles.size(); i++) {
+        for (int j = i + 1; j < particles.size(); j++) {
+            float totalRadius = particles[i]->getRadius() + particles[j]->getRadius();
+            if (glm::distance(particles[i]->getPosition(), particles[j]->getPosition()) < totalRadius) {
+                touchingPairs++;
+            }
+        }
+    }
+
+    // without a packet sender, voxels or avatars the system only resolves the particles against each other
+    ParticleCollisionSystem collisionSystem(NULL, &tree);
+    collisionSystem.update();
+
+    // bounding boxes overlap whenever the spheres do, so there can be more candidates than touching pairs but never fewer
+    if (collisionSystem.getCandidateParticlePairCount() < touchingPairs) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: the broad phase yielded "
+            << collisionSystem.getCandidateParticlePairCount() << " pairs but " << touchingPairs << " pairs touch"
+            << std::endl;
+    }
+}
+
+void ParticleCollisionSystemTests::benchmarkCollisionSystem() {
+    NodeList::createInstance(NodeType::Agent);
+    ParticleEditPacketSender packetSender;
+
+    const int NUM_PARTICLE_COUNTS = 3;
+    const int PARTICLE_COUNTS[NUM_PARTICLE_COUNTS] = { 1000, 10000, 50000 };
+    const int NUM_FRAMES = 20;
+
+    for (int i = 0; i < NUM_PARTICLE_COUNTS; i++) {
+        ParticleTree tree;
+        addCrowdedParticles(tree, PARTICLE_COUNTS[i]);
+
+        ParticleCollisionSystem collisionSystem(&packetSender, &tree);
+        for (int frame = 0; frame < NUM_FRAMES; frame++) {
+            collisionSystem.update();
+        }
+
+        std::cout << PARTICLE_COUNTS[i] << " particles: collision system " << collisionSystem.getAverageUpdateTime()
+            << " usecs/frame, " << collisionSystem.getCandidateParticlePairCount() << " candidate pairs in the last frame"
+            << std::endl;
+    }
+}
+
+void ParticleCollisionSystemTests::runAllTests() {
+    broadPhaseFindsTouchingPairs();
+    benchmarkCollisionSystem();
+}
@@ -0,0 +1,26 @@
+//
+//  ParticleCollisionSystemTests.h
+//  tests/particles/src
+//
+//  Created by Brad Hefta-Gaub on 5/22/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_ParticleCollisionSystemTests_h
+#define hifi_ParticleCollisionSystemTests_h
+
+namespace ParticleCollisionSystemTests {
+
+    /// checks that the broad phase yields every pair of particles that actually touch
+    void broadPhaseFindsTouchingPairs();
+
+    /// times the collision system at 1k, 10k and 50k particles
+    void benchmarkCollisionSystem();
+
+    void runAllTests();
+}
+
+#endif // hifi_ParticleCollisionSystemTests_h
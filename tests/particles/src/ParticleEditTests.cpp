@@ -0,0 +1,182 @@
+//
+//  ParticleEditTests.cpp
+//  tests/particles/src
+//
+//  Created by Brad Hefta-Gaub on 5/23/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+
+#include <NodeList.h>
+#include <OctreeConstants.h>
+#include <ParticleEditPacketSender.h>
+#include <ParticleTree.h>
+#include <SharedUtil.h>
+
+#include "ParticleEditTests.h"
+
+/// stores a particle with a known id, last edited a while ago so that any edit made now is newer
+static void storeEditableParticle(ParticleTree& tree, uint32_t id, const glm::vec3& position) {
+    ParticleProperties properties;
+    properties.setPosition(position);
+    properties.setRadius(0.5f);
+    properties.setLifetime(1000.0f);
+    properties.setScript("Particle.setShouldDie(false);");
+
+    Particle particle(ParticleID(id), properties);
+    particle.setLastEdited(usecTimestampNow() - USECS_PER_SECOND);
+    tree.storeParticle(particle);
+}
+
+static int encodeEdit(uint32_t id, const ParticleProperties& properties, unsigned char* buffer) {
+    int size = 0;
+    Particle::encodeParticleEditMessageDetails(PacketTypeParticleAddOrEdit, ParticleID(id), properties, buffer,
+        MAX_PACKET_SIZE, size);
+    return size;
+}
+
+void ParticleEditTests::editAppliesInPlace() {
+    const uint32_t PARTICLE_ID = 42;
+    ParticleTree tree;
+    storeEditableParticle(tree, PARTICLE_ID, glm::vec3(TREE_SCALE * 0.5f));
+    const Particle* particle = tree.findParticleByID(PARTICLE_ID);
+    float ageBefore = particle->getAge();
+
+    glm::vec3 position(1234.5678f, 4321.1234f, 8765.4321f);
+    glm::vec3 velocity(-3.25f, 0.001f, 17.5f);
+    ParticleProperties properties;
+    properties.setPosition(position);
+    properties.setVelocity(velocity);
+
+    unsigned char buffer[MAX_PACKET_SIZE];
+    int size = encodeEdit(PARTICLE_ID, properties, buffer);
+    int processedBytes = tree.processEditPacketData(PacketTypeParticleAddOrEdit, NULL, 0, buffer, size,
+        SharedNodePointer());
+    if (processedBytes != size) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: processed " << processedBytes << " of the " << size
+            << " bytes of the edit" << std::endl;
+    }
+
+    // the particle is edited where it is, so the pointer we looked up before still finds it
+    const float POSITION_TOLERANCE = 2.0f / QUANTIZED_POSITION_SCALE;
+    glm::vec3 positionError = glm::abs(particle->getPosition() - position / (float)TREE_SCALE);
+    if (glm::max(positionError.x, glm::max(positionError.y, positionError.z)) > POSITION_TOLERANCE) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: position is off by " << positionError.x << ","
+            << positionError.y << "," << positionError.z << std::endl;
+    }
+    const float VELOCITY_TOLERANCE = 2.0f * glm::abs(velocity.z) / QUANTIZED_VELOCITY_SCALE;
+    glm::vec3 velocityError = glm::abs(particle->getVelocity() * (float)TREE_SCALE - velocity);
+    if (glm::max(velocityError.x, glm::max(velocityError.y, velocityError.z)) > VELOCITY_TOLERANCE) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: velocity is off by " << velocityError.x << ","
+            << velocityError.y << "," << velocityError.z << std::endl;
+    }
+    if (particle->getScript().isEmpty() || particle->getAge() < ageBefore) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: the edit changed properties it didn't include" << std::endl;
+    }
+
+    // an edit made before the last one applied is read past, but not applied
+    glm::vec3 editedPosition = particle->getPosition();
+    ParticleProperties staleProperties;
+    staleProperties.setPosition(glm::vec3(TREE_SCALE * 0.25f));
+    size = encodeEdit(PARTICLE_ID, staleProperties, buffer);
+    const int STALE_EDIT_AGE = 2 * USECS_PER_SECOND;
+    Particle::adjustEditPacketForClockSkew(buffer, size, -STALE_EDIT_AGE);
+    processedBytes = tree.processEditPacketData(PacketTypeParticleAddOrEdit, NULL, 0, buffer, size, SharedNodePointer());
+    if (processedBytes != size || particle->getPosition() != editedPosition
+            || tree.getStaleParticleEditCount() != 1) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: a stale edit was applied" << std::endl;
+    }
+}
+
+void ParticleEditTests::editsOfOneParticleCoalesce() {
+    ParticleProperties merged;
+    merged.setPosition(glm::vec3(1.0f));
+    ParticleProperties newer;
+    newer.setVelocity(glm::vec3(2.0f));
+    newer.setPosition(glm::vec3(3.0f));
+    merged.merge(newer);
+    if (merged.getChangedBits() != (CONTAINS_POSITION | CONTAINS_VELOCITY) || merged.getPosition() != glm::vec3(3.0f)
+            || merged.getVelocity() != glm::vec3(2.0f)) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: merged edit has changed bits " << merged.getChangedBits()
+            << std::endl;
+    }
+
+    NodeList::createInstance(NodeType::Agent);
+    ParticleEditPacketSender packetSender;
+
+    const int EDITS_PER_PARTICLE = 10;
+    for (int i = 0; i < EDITS_PER_PARTICLE; i++) {
+        ParticleProperties properties;
+        properties.setPosition(glm::vec3(i));
+        packetSender.queueParticleEditMessage(PacketTypeParticleAddOrEdit, ParticleID(42), properties);
+        packetSender.queueParticleEditMessage(PacketTypeParticleAddOrEdit, ParticleID(43), properties);
+    }
+    packetSender.releaseQueuedMessages();
+
+    if (packetSender.getSentEditCount() != 2 || packetSender.getCoalescedEditCount() != 2 * (EDITS_PER_PARTICLE - 1)) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: sent " << packetSender.getSentEditCount() << " edits, "
+            << packetSender.getCoalescedEditCount() << " coalesced" << std::endl;
+    }
+}
+
+void ParticleEditTests::benchmarkEdits() {
+    unsigned char buffer[MAX_PACKET_SIZE];
+
+    // what the collision system sends, compared to an edit of every property of a particle with a script and a model
+    ParticleProperties movedProperties;
+    movedProperties.setPosition(glm::vec3(TREE_SCALE * 0.5f));
+    movedProperties.setVelocity(glm::vec3(1.0f, -2.0f, 3.0f));
+    int movedSize = encodeEdit(1, movedProperties, buffer);
+
+    ParticleProperties fullProperties = movedProperties;
+    fullProperties.setRadius(0.5f);
+    fullProperties.setColor(xColor());
+    fullProperties.setGravity(glm::vec3(0.0f, -9.8f, 0.0f));
+    fullProperties.setDamping(DEFAULT_DAMPING);
+    fullProperties.setLifetime(DEFAULT_LIFETIME);
+    fullProperties.setInHand(false);
+    fullProperties.setShouldDie(false);
+    fullProperties.setScript("function collisionWithParticle(other) { Particle.setShouldDie(true); }");
+    fullProperties.setModelURL("http://highfidelity-public.s3-us-west-1.amazonaws.com/meshes/beachball.fst");
+    fullProperties.setModelScale(DEFAULT_MODEL_SCALE);
+    fullProperties.setModelTranslation(DEFAULT_MODEL_TRANSLATION);
+    fullProperties.setModelRotation(glm::quat());
+    int fullSize = encodeEdit(1, fullProperties, buffer);
+
+    std::cout << "position and velocity edit: " << movedSize << " bytes, edit of every property: " << fullSize
+        << " bytes" << std::endl;
+
+    // edit particles of a populated tree at random
+    const int NUM_PARTICLES = 10000;
+    const int NUM_EDITS = 100000;
+    ParticleTree tree;
+    for (int i = 0; i < NUM_PARTICLES; i++) {
+        storeEditableParticle(tree, i, glm::vec3(randFloat(), randFloat(), randFloat()) * (float)TREE_SCALE);
+    }
+
+    quint64 start = usecTimestampNow();
+    for (int i = 0; i < NUM_EDITS; i++) {
+        ParticleProperties properties;
+        properties.setPosition(glm::vec3(randFloat(), randFloat(), randFloat()) * (float)TREE_SCALE);
+        properties.setVelocity(glm::vec3(randFloatInRange(-1.0f, 1.0f), 0.0f, randFloatInRange(-1.0f, 1.0f)));
+        int size = encodeEdit(randIntInRange(0, NUM_PARTICLES - 1), properties, buffer);
+        tree.processEditPacketData(PacketTypeParticleAddOrEdit, NULL, 0, buffer, size, SharedNodePointer());
+    }
+    quint64 elapsed = usecTimestampNow() - start;
+
+    std::cout << NUM_EDITS << " edits of " << NUM_PARTICLES << " particles: "
+        << (float)NUM_EDITS * USECS_PER_SECOND / elapsed << " edits/second, "
+        << tree.getAverageBytesPerParticleEdit() << " bytes/edit" << std::endl;
+}
+
+void ParticleEditTests::runAllTests() {
+    editAppliesInPlace();
+    editsOfOneParticleCoalesce();
+    benchmarkEdits();
+}
@@ -0,0 +1,29 @@
+//
+//  ParticleEditTests.h
+//  tests/particles/src
+//
+//  Created by Brad Hefta-Gaub on 5/23/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_ParticleEditTests_h
+#define hifi_ParticleEditTests_h
+
+namespace ParticleEditTests {
+
+    /// checks that a quantized edit lands in the particle in the tree, and that an older edit doesn't
+    void editAppliesInPlace();
+
+    /// checks that repeated edits of one particle go out as one edit carrying all of their changes
+    void editsOfOneParticleCoalesce();
+
+    /// compares the size of a position and velocity edit with that of a full one, and times applying edits to a tree
+    void benchmarkEdits();
+
+    void runAllTests();
+}
+
+#endif // hifi_ParticleEditTests_h
@@ -0,0 +1,189 @@
+//
+//  ParticleSimulationTests.cpp
+//  tests/particles/src
+//
+//  Created by Brad Hefta-Gaub on 5/21/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+
+#include <AABox.h>
+#include <OctreeConstants.h>
+#include <Particle.h>
+#include <ParticleSimulation.h>
+#include <ParticleTree.h>
+#include <SharedUtil.h>
+
+#include "ParticleSimulationTests.h"
+
+const int NUM_BENCHMARK_PARTICLES = 100000;
+const quint64 SIMULATION_STEP_USECS = USECS_PER_SECOND / 60;
+
+static Particle randomParticle(quint64 lastUpdated) {
+    Particle particle;
+    particle.setPosition(glm::vec3(randFloat(), randFloatInRange(-0.01f, 1.0f), randFloat()));
+    particle.setVelocity(glm::vec3(randFloatInRange(-0.1f, 0.1f), randFloatInRange(-0.1f, 0.1f), randFloatInRange(-0.1f, 0.1f)));
+    particle.setGravity(glm::vec3(0.0f, randFloatInRange(-0.01f, 0.0f), 0.0f));
+    particle.setDamping(randFloatInRange(0.0f, 1.0f));
+    particle.setInHand(randFloat() < 0.1f);
+    particle.setLastUpdated(lastUpdated);
+    return particle;
+}
+
+void ParticleSimulationTests::simulationMatchesParticleUpdate() {
+    // an odd count, so that both the four-wide and the one-at-a-time paths get used
+    const int NUM_PARTICLES = 103;
+    quint64 now = usecTimestampNow();
+    AABox universe(glm::vec3(0.0f), 1.0f);
+
+    QVector<Particle> simulated;
+    for (int i = 0; i < NUM_PARTICLES; i++) {
+        simulated.append(randomParticle(now - SIMULATION_STEP_USECS));
+    }
+    QVector<Particle> updated = simulated;
+
+    ParticleSimulation simulation;
+    for (int i = 0; i < NUM_PARTICLES; i++) {
+        simulation.addParticle(&simulated[i], NULL, universe);
+    }
+    simulation.integrate(now);
+
+    for (int i = 0; i < NUM_PARTICLES; i++) {
+        simulation.commitParticle(i, now);
+        updated[i].update(now);
+
+        if (simulated[i].getPosition() != updated[i].getPosition()
+                || simulated[i].getVelocity() != updated[i].getVelocity()) {
+            std::cout << __FILE__ << ":" << __LINE__ << " ERROR: particle " << i
+                << " was integrated differently than Particle::update() would have" << std::endl;
+        }
+        if (simulated[i].getLastUpdated() != now) {
+            std::cout << __FILE__ << ":" << __LINE__ << " ERROR: particle " << i << " wasn't stamped with the update time"
+                << std::endl;
+        }
+        if (simulation.hasLeftElement(i) != !universe.contains(simulated[i].getPosition())) {
+            std::cout << __FILE__ << ":" << __LINE__ << " ERROR: particle " << i
+                << " disagrees with its element about whether it's still inside" << std::endl;
+        }
+    }
+}
+
+void ParticleSimulationTests::treeUpdateRebucketsParticles() {
+    ParticleTree tree;
+    glm::vec3 center(TREE_SCALE * 0.5f);
+
+    ParticleProperties longLived;
+    longLived.setPosition(center);
+    longLived.setLifetime(1000.0f);
+    tree.addParticle(ParticleID(NEW_PARTICLE, 1, false), longLived);
+
+    ParticleProperties expired;
+    expired.setPosition(center);
+    expired.setLifetime(0.0f);
+    tree.addParticle(ParticleID(NEW_PARTICLE, 2, false), expired);
+
+    // this one moves far enough to need a different element, but stays inside the tree
+    ParticleProperties moving;
+    moving.setPosition(center);
+    moving.setVelocity(glm::vec3(TREE_SCALE * 100.0f, 0.0f, 0.0f));
+    moving.setGravity(glm::vec3(0.0f));
+    moving.setDamping(0.0f);
+    moving.setLifetime(1000.0f);
+    tree.addParticle(ParticleID(NEW_PARTICLE, 3, false), moving);
+
+    tree.update();
+
+    QVector<const Particle*> remaining;
+    tree.findParticles(center / (float)TREE_SCALE, 0.5f, remaining);
+    if (remaining.size() != 2) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: expected 2 particles to survive the update but found "
+            << remaining.size() << std::endl;
+    }
+    if (!tree.hasAnyDeletedParticles()) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: the expired particle wasn't recorded as deleted" << std::endl;
+    }
+    foreach (const Particle* particle, remaining) {
+        if (particle->getCreatorTokenID() == 3 && particle->getPosition().x <= 0.5f) {
+            std::cout << __FILE__ << ":" << __LINE__ << " ERROR: the moving particle didn't move" << std::endl;
+        }
+    }
+}
+
+void ParticleSimulationTests::benchmarkSimulation() {
+    quint64 now = usecTimestampNow();
+    AABox universe(glm::vec3(0.0f), 1.0f);
+
+    QVector<Particle> particles;
+    particles.reserve(NUM_BENCHMARK_PARTICLES);
+    for (int i = 0; i < NUM_BENCHMARK_PARTICLES; i++) {
+        particles.append(randomParticle(now));
+    }
+    QVector<Particle> updatedParticles = particles;
+
+    const int NUM_STEPS = 100;
+
+    // the old way, one particle at a time through Particle::update()
+    quint64 start = usecTimestampNow();
+    quint64 stepTime = now;
+    for (int step = 0; step < NUM_STEPS; step++) {
+        stepTime += SIMULATION_STEP_USECS;
+        for (int i = 0; i < NUM_BENCHMARK_PARTICLES; i++) {
+            updatedParticles[i].update(stepTime);
+        }
+    }
+    quint64 particleUpdateUsecs = (usecTimestampNow() - start) / NUM_STEPS;
+
+    // the batched simulation, including copying the state in and back out
+    ParticleSimulation simulation;
+    quint64 integrateUsecs = 0;
+    start = usecTimestampNow();
+    stepTime = now;
+    for (int step = 0; step < NUM_STEPS; step++) {
+        stepTime += SIMULATION_STEP_USECS;
+        simulation.clear();
+        for (int i = 0; i < NUM_BENCHMARK_PARTICLES; i++) {
+            simulation.addParticle(&particles[i], NULL, universe);
+        }
+        quint64 integrateStart = usecTimestampNow();
+        simulation.integrate(stepTime);
+        integrateUsecs += usecTimestampNow() - integrateStart;
+        for (int i = 0; i < NUM_BENCHMARK_PARTICLES; i++) {
+            simulation.commitParticle(i, stepTime);
+        }
+    }
+    quint64 simulationUsecs = (usecTimestampNow() - start) / NUM_STEPS;
+    integrateUsecs /= NUM_STEPS;
+
+    std::cout << NUM_BENCHMARK_PARTICLES << " particles, average per step: Particle::update() " << particleUpdateUsecs
+        << " usecs, simulation " << simulationUsecs << " usecs (" << integrateUsecs << " usecs integrating)" << std::endl;
+
+    // and the whole tree update, which adds the scripts, the locking and the re-bucketing
+    ParticleTree tree;
+    for (int i = 0; i < NUM_BENCHMARK_PARTICLES; i++) {
+        ParticleProperties properties;
+        properties.setPosition(particles[i].getPosition() * (float)TREE_SCALE);
+        properties.setVelocity(particles[i].getVelocity() * (float)TREE_SCALE);
+        properties.setLifetime(1000.0f);
+        tree.addParticle(ParticleID(NEW_PARTICLE, i, false), properties);
+    }
+
+    const int NUM_TREE_UPDATES = 10;
+    start = usecTimestampNow();
+    for (int i = 0; i < NUM_TREE_UPDATES; i++) {
+        tree.update();
+    }
+    std::cout << NUM_BENCHMARK_PARTICLES << " particles, average ParticleTree::update() "
+        << (usecTimestampNow() - start) / NUM_TREE_UPDATES << " usecs" << std::endl;
+}
+
+void ParticleSimulationTests::runAllTests() {
+    simulationMatchesParticleUpdate();
+    treeUpdateRebucketsParticles();
+    benchmarkSimulation();
+}
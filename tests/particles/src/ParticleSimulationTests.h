@@ -0,0 +1,29 @@
+//
+//  ParticleSimulationTests.h
+//  tests/particles/src
+//
+//  Created by Brad Hefta-Gaub on 5/21/14.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_ParticleSimulationTests_h
+#define hifi_ParticleSimulationTests_h
+
+namespace ParticleSimulationTests {
+
+    /// checks the batched integration against Particle::update()
+    void simulationMatchesParticleUpdate();
+
+    /// checks that particles leaving their elements are moved and dead ones are removed
+    void treeUpdateRebucketsParticles();
+
+    /// times the integration and full tree updates of 100k particles
+    void benchmarkSimulation();
+
+    void runAllTests();
+}
+
+#endif // hifi_ParticleSimulationTests_h
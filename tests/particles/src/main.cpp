@@ -0,0 +1,20 @@
+//
+//  main.cpp
+//  tests/particles/src
+//
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include "ParticleCollisionSystemTests.h"
+#include "ParticleEditTests.h"
+#include "ParticleSimulationTests.h"
+
+int main(int argc, char** argv) {
+    ParticleSimulationTests::runAllTests();
+    ParticleCollisionSystemTests::runAllTests();
+    ParticleEditTests::runAllTests();
+    return 0;
+}
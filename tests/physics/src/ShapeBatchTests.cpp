@@ -0,0 +1,222 @@
+//
+//  ShapeBatchTests.cpp
+//  tests/physics/src
+//
+//  Created by Andrew Meadows on 05/23/2014.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include <CapsuleShape.h>
+#include <CollisionInfo.h>
+#include <ShapeBatch.h>
+#include <ShapeCollider.h>
+#include <SharedUtil.h>
+#include <SphereShape.h>
+
+#include "PhysicsTestUtil.h"
+#include "ShapeBatchTests.h"
+
+const int NUM_BATCHED_SHAPES = 256;
+const int NUM_COLLIDING_SHAPES = 64;
+const float SHAPE_REGION_SIZE = 10.f;
+const int MAX_TEST_COLLISIONS = NUM_BATCHED_SHAPES * NUM_COLLIDING_SHAPES;
+
+static const glm::vec3 origin(0.f);
+
+static glm::vec3 randVector(float scale) {
+    return glm::vec3(randFloatInRange(-scale, scale), randFloatInRange(-scale, scale), randFloatInRange(-scale, scale));
+}
+
+static glm::quat randRotation() {
+    glm::vec3 axis = randVector(1.f);
+    if (glm::length(axis) < EPSILON) {
+        axis = yAxis;
+    }
+    return glm::angleAxis(randFloatInRange(0.f, PI), glm::normalize(axis));
+}
+
+/// makes a mix of spheres and capsules, a few of them parallel so that capsuleCapsule()'s special case is covered
+static void makeRandomShapes(int numShapes, QVector<Shape*>& shapes) {
+    glm::quat sharedRotation = randRotation();
+    for (int i = 0; i < numShapes; ++i) {
+        glm::vec3 position = randVector(SHAPE_REGION_SIZE);
+        float radius = randFloatInRange(0.1f, 1.f);
+        if (randFloat() < 0.5f) {
+            shapes.push_back(new SphereShape(radius, position));
+        } else {
+            glm::quat rotation = (randFloat() < 0.25f) ? sharedRotation : randRotation();
+            shapes.push_back(new CapsuleShape(radius, randFloatInRange(0.1f, 2.f), position, rotation));
+        }
+    }
+}
+
+static void deleteShapes(QVector<Shape*>& shapes) {
+    for (int i = 0; i < shapes.size(); ++i) {
+        delete shapes[i];
+    }
+    shapes.clear();
+}
+
+static bool collisionsMatch(CollisionList& listA, CollisionList& listB) {
+    if (listA.size() != listB.size()) {
+        return false;
+    }
+    for (int i = 0; i < listA.size(); ++i) {
+        CollisionInfo* collisionA = listA.getCollision(i);
+        CollisionInfo* collisionB = listB.getCollision(i);
+        if (collisionA->_contactPoint != collisionB->_contactPoint
+                || collisionA->_penetration != collisionB->_penetration) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// collides every colliding shape with every batched shape through the pairwise methods
+static int collidePairwise(const QVector<Shape*>& colliding, const QVector<Shape*>& batched,
+        CollisionList& collisions, QVector<int>& touchedIndices) {
+    int numTouching = 0;
+    for (int i = 0; i < colliding.size(); ++i) {
+        for (int j = 0; j < batched.size(); ++j) {
+            if (ShapeCollider::collideShapes(colliding[i], batched[j], collisions)) {
+                touchedIndices.push_back(j);
+                ++numTouching;
+            }
+        }
+    }
+    return numTouching;
+}
+
+static void collideBatched(const QVector<Shape*>& colliding, const ShapeBatch& batch,
+        CollisionList& collisions, QVector<int>& touchedIndices) {
+    for (int i = 0; i < colliding.size(); ++i) {
+        ShapeCollider::collideShapeWithBatch(colliding[i], batch, collisions, &touchedIndices);
+    }
+}
+
+void ShapeBatchTests::batchedCollisionsMatchPairwise() {
+    QVector<Shape*> batched;
+    QVector<Shape*> colliding;
+    makeRandomShapes(NUM_BATCHED_SHAPES, batched);
+    makeRandomShapes(NUM_COLLIDING_SHAPES, colliding);
+
+    ShapeBatch batch;
+    for (int i = 0; i < batched.size(); ++i) {
+        batch.addShape(batched[i]);
+    }
+    if (batch.size() != batched.size()) {
+        std::cout << __FILE__ << ":" << __LINE__
+            << " ERROR: expected batch of " << batched.size() << " shapes but size is " << batch.size() << std::endl;
+    }
+
+    CollisionList pairwiseCollisions(MAX_TEST_COLLISIONS);
+    QVector<int> pairwiseTouched;
+    int numTouching = collidePairwise(colliding, batched, pairwiseCollisions, pairwiseTouched);
+
+    CollisionList batchedCollisions(MAX_TEST_COLLISIONS);
+    QVector<int> batchedTouched;
+    collideBatched(colliding, batch, batchedCollisions, batchedTouched);
+
+    if (numTouching == 0) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: expected some of the random shapes to touch" << std::endl;
+    }
+    if (!collisionsMatch(pairwiseCollisions, batchedCollisions)) {
+        std::cout << __FILE__ << ":" << __LINE__
+            << " ERROR: batched collisions differ from pairwise collisions, " << batchedCollisions.size()
+            << " vs " << pairwiseCollisions.size() << std::endl;
+    }
+    if (batchedTouched != pairwiseTouched) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: batched touched indices differ from pairwise" << std::endl;
+    }
+
+    deleteShapes(batched);
+    deleteShapes(colliding);
+}
+
+void ShapeBatchTests::batchFollowsMovedShapes() {
+    float radius = 1.f;
+    float halfHeight = 2.f;
+    SphereShape sphere(radius, origin);
+    CapsuleShape capsule(radius, halfHeight, glm::vec3(10.f, 0.f, 0.f), glm::quat());
+
+    ShapeBatch batch;
+    batch.addShape(&sphere);
+    batch.addShape(&capsule);
+
+    SphereShape probe(radius, glm::vec3(10.f, 0.5f * halfHeight, radius));
+    CollisionList collisions(16);
+    QVector<int> touchedIndices;
+
+    // the probe touches the capsule's side but not the sphere...
+    ShapeCollider::collideShapeWithBatch(&probe, batch, collisions, &touchedIndices);
+    if (touchedIndices.size() != 1 || touchedIndices[0] != 1) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: probe should touch only the capsule" << std::endl;
+    }
+
+    // ...until the shapes swap places
+    capsule.setPosition(origin);
+    sphere.setPosition(glm::vec3(10.f, 0.5f * halfHeight, 0.f));
+    batch.updateTransforms();
+    collisions.clear();
+    touchedIndices.clear();
+    ShapeCollider::collideShapeWithBatch(&probe, batch, collisions, &touchedIndices);
+    if (touchedIndices.size() != 1 || touchedIndices[0] != 0) {
+        std::cout << __FILE__ << ":" << __LINE__ << " ERROR: probe should touch only the sphere" << std::endl;
+    }
+}
+
+void ShapeBatchTests::benchmarkBatchedCollisions() {
+    QVector<Shape*> batched;
+    QVector<Shape*> colliding;
+    makeRandomShapes(NUM_BATCHED_SHAPES, batched);
+    makeRandomShapes(NUM_COLLIDING_SHAPES, colliding);
+
+    ShapeBatch batch;
+    for (int i = 0; i < batched.size(); ++i) {
+        batch.addShape(batched[i]);
+    }
+
+    const int NUM_ROUNDS = 100;
+    CollisionList collisions(MAX_TEST_COLLISIONS);
+    QVector<int> touchedIndices;
+    touchedIndices.reserve(MAX_TEST_COLLISIONS);
+
+    quint64 startTime = usecTimestampNow();
+    for (int i = 0; i < NUM_ROUNDS; ++i) {
+        collisions.clear();
+        touchedIndices.resize(0);
+        collidePairwise(colliding, batched, collisions, touchedIndices);
+    }
+    quint64 pairwiseTime = qMax(usecTimestampNow() - startTime, (quint64)1);
+
+    startTime = usecTimestampNow();
+    for (int i = 0; i < NUM_ROUNDS; ++i) {
+        collisions.clear();
+        touchedIndices.resize(0);
+        collideBatched(colliding, batch, collisions, touchedIndices);
+    }
+    quint64 batchedTime = qMax(usecTimestampNow() - startTime, (quint64)1);
+
+    double numPairs = (double)NUM_ROUNDS * NUM_BATCHED_SHAPES * NUM_COLLIDING_SHAPES;
+    std::cout << "ShapeCollider: " << collisions.size() << " collisions among "
+        << NUM_COLLIDING_SHAPES << " x " << NUM_BATCHED_SHAPES << " shapes" << std::endl;
+    std::cout << "    pairwise " << (numPairs * USECS_PER_SECOND / pairwiseTime) << " pairs/sec" << std::endl;
+    std::cout << "    batched  " << (numPairs * USECS_PER_SECOND / batchedTime) << " pairs/sec" << std::endl;
+
+    deleteShapes(batched);
+    deleteShapes(colliding);
+}
+
+void ShapeBatchTests::runAllTests() {
+    batchedCollisionsMatchPairwise();
+    batchFollowsMovedShapes();
+    benchmarkBatchedCollisions();
+}
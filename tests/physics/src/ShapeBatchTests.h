@@ -0,0 +1,26 @@
+//
+//  ShapeBatchTests.h
+//  tests/physics/src
+//
+//  Created by Andrew Meadows on 05/23/2014.
+//  Copyright 2014 High Fidelity, Inc.
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#ifndef hifi_ShapeBatchTests_h
+#define hifi_ShapeBatchTests_h
+
+namespace ShapeBatchTests {
+
+    void batchedCollisionsMatchPairwise();
+    void batchFollowsMovedShapes();
+
+    /// Reports the pairs per second of the batched and pairwise narrow phases.
+    void benchmarkBatchedCollisions();
+
+    void runAllTests(); 
+}
+
+#endif // hifi_ShapeBatchTests_h